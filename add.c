@@ -2,6 +2,9 @@
 
 int add_main(int argc, char **argv)
 {
+    (void)argc;
+    (void)argv;
+
     // TODO: Implement 'add partition' functionality here for Linux
 
     return 1;  // success
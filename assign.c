@@ -2,6 +2,9 @@
 
 int assign_main(int argc, char **argv)
 {
+    (void)argc;
+    (void)argv;
+
     // TODO: Implement 'assign drive letter' or mount point logic for Linux here
 
     return 1;  // success
@@ -1,8 +1,74 @@
-#include <stdbool.h>
+/*
+ * PROJECT:         ReactOS DiskPart (Linux port)
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * FILE:            base/system/diskpart/attach.c
+ * PURPOSE:         Manages all the partitions of the OS in an interactive way.
+ */
 
-int attach_main(int argc, char **argv)
+#include "diskpart.h"
+
+#include <strings.h>
+
+/* FUNCTIONS ******************************************************************/
+
+/* attach vdisk [file=<path>] [readonly] [noerr] */
+BOOL
+attach_main(
+    int argc,
+    char **argv)
 {
-    // TODO: Implement 'attach' functionality for Linux (e.g., loop device attach)
+    VDISKENTRY VDiskEntry;
+    char *pszSuffix = NULL;
+    char *pszFile = NULL;
+    BOOL bReadOnly = FALSE;
+    int i;
+
+    if (argc < 2 || strcasecmp(argv[1], "vdisk") != 0)
+    {
+        printf("Usage: attach vdisk [file=<path>] [readonly]\n");
+        return TRUE;
+    }
+
+    for (i = 2; i < argc; i++)
+    {
+        if (HasPrefix(argv[i], "file=", &pszSuffix))
+        {
+            free(pszFile);
+            pszFile = DuplicateQuotedString(pszSuffix);
+        }
+        else if (strcasecmp(argv[i], "readonly") == 0)
+        {
+            bReadOnly = TRUE;
+        }
+        else if (strcasecmp(argv[i], "noerr") != 0)
+        {
+            printf("Invalid argument: %s\n", argv[i]);
+            free(pszFile);
+            return TRUE;
+        }
+    }
+
+    if (pszFile == NULL && CurrentVirtualDisk[0] == '\0')
+    {
+        printf("No virtual disk selected.\n");
+        CommandFailed = TRUE;
+        return TRUE;
+    }
+
+    if (!AttachVirtualDisk(pszFile ? pszFile : CurrentVirtualDisk, bReadOnly, &VDiskEntry))
+    {
+        printf("\nDiskPart failed to attach the virtual disk file.\n\n");
+        free(pszFile);
+        return TRUE;
+    }
+
+    snprintf(CurrentVirtualDisk, sizeof(CurrentVirtualDisk), "%s", VDiskEntry.FileName);
+
+    printf("\nDiskPart successfully attached the virtual disk file as %s", VDiskEntry.DeviceName);
+    printf(" (%lu-byte blocks, %s I/O).\n\n", (unsigned long)VDiskEntry.BlockSize,
+           VDiskEntry.DirectIo ? "direct" : "buffered");
+
+    free(pszFile);
 
-    return 1;  // success
+    return TRUE;
 }
@@ -2,6 +2,9 @@
 
 int attributes_main(int argc, char **argv)
 {
+    (void)argc;
+    (void)argv;
+
     // TODO: Implement 'attributes' command logic for Linux partitions (e.g., readonly flag)
 
     return 1;  // success
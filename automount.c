@@ -3,6 +3,9 @@
 
 int automount_main(int argc, char **argv)
 {
+    (void)argc;
+    (void)argv;
+
     printf("Automount\n");
     return 1;  // success
 }
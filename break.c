@@ -3,6 +3,9 @@
 
 int break_main(int argc, char **argv)
 {
+    (void)argc;
+    (void)argv;
+
     printf("\nTODO: Add code later since Win 7 Home Premium doesn't have this feature.\n");
     return 1; // success
 }
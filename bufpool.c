@@ -0,0 +1,218 @@
+/*
+ * PROJECT:         ReactOS DiskPart (Linux port)
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * FILE:            base/system/diskpart/bufpool.c
+ * PURPOSE:         Pool of page-aligned I/O buffers shared by the data paths,
+ *                  optionally backed by 2 MB huge pages.
+ */
+
+#include "diskpart.h"
+
+#include <sys/mman.h>
+
+#define IO_POOL_MAX_BUFFERS     64
+#define IO_POOL_MIN_SIZE        4096
+#define IO_POOL_HUGE_PAGE_SIZE  (2 * 1024 * 1024)
+#define IO_POOL_DEFAULT_LIMIT   (64 * 1024 * 1024)
+
+typedef struct _IO_BUFFER {
+    void *Address;
+    size_t Size;
+    BOOL InUse;
+} IO_BUFFER, *PIO_BUFFER;
+
+static IO_BUFFER PoolBuffers[IO_POOL_MAX_BUFFERS];
+static size_t PoolMappedBytes;
+static size_t PoolLimit;
+static BOOL PoolHugePages;
+static BOOL PoolConfigured;
+
+/* FUNCTIONS ******************************************************************/
+
+/*
+ * Sets the most memory the pool may keep mapped and whether buffers of 2 MB
+ * and up are backed by huge pages. Without a call the limit comes from
+ * DISKPART_IO_POOL_MB and huge pages from DISKPART_HUGEPAGES=1.
+ */
+void
+ConfigureIoBufferPool(
+    size_t Limit,
+    BOOL HugePages)
+{
+    PoolLimit = (Limit != 0) ? Limit : IO_POOL_DEFAULT_LIMIT;
+    PoolHugePages = HugePages;
+    PoolConfigured = TRUE;
+}
+
+
+static
+void
+ConfigureFromEnvironment(void)
+{
+    const char *Value;
+    size_t Limit = 0;
+
+    Value = getenv("DISKPART_IO_POOL_MB");
+    if (Value != NULL)
+        Limit = (size_t)strtoull(Value, NULL, 10) * 1024 * 1024;
+
+    Value = getenv("DISKPART_HUGEPAGES");
+
+    ConfigureIoBufferPool(Limit, Value != NULL && strcmp(Value, "1") == 0);
+}
+
+
+/* Buffers come in power-of-two sizes so that they can be reused across calls */
+static
+size_t
+GetBufferClassSize(
+    size_t Size)
+{
+    size_t ClassSize = IO_POOL_MIN_SIZE;
+
+    while (ClassSize < Size)
+        ClassSize <<= 1;
+
+    return ClassSize;
+}
+
+
+static
+void
+UnmapBuffer(
+    PIO_BUFFER Buffer)
+{
+    munmap(Buffer->Address, Buffer->Size);
+    PoolMappedBytes -= Buffer->Size;
+    memset(Buffer, 0, sizeof(*Buffer));
+}
+
+
+/* Unmaps idle buffers until Size more bytes fit under the limit */
+static
+BOOL
+MakeRoom(
+    size_t Size)
+{
+    int i;
+
+    for (i = 0; i < IO_POOL_MAX_BUFFERS && PoolMappedBytes + Size > PoolLimit; i++)
+    {
+        if (PoolBuffers[i].Address != NULL && !PoolBuffers[i].InUse)
+            UnmapBuffer(&PoolBuffers[i]);
+    }
+
+    return PoolMappedBytes + Size <= PoolLimit;
+}
+
+
+static
+void *
+MapBuffer(
+    size_t Size)
+{
+    void *Address = MAP_FAILED;
+
+    /* Populated up front: the page faults are paid once, not in the I/O loop */
+    if (PoolHugePages && Size >= IO_POOL_HUGE_PAGE_SIZE)
+    {
+        Address = mmap(NULL, Size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE | MAP_HUGETLB, -1, 0);
+    }
+
+    if (Address == MAP_FAILED)
+    {
+        Address = mmap(NULL, Size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+        if (Address == MAP_FAILED)
+            return NULL;
+
+        /* No reserved huge pages; transparent ones are the next best thing */
+        if (PoolHugePages && Size >= IO_POOL_HUGE_PAGE_SIZE)
+            madvise(Address, Size, MADV_HUGEPAGE);
+    }
+
+    return Address;
+}
+
+
+/*
+ * Checks out a page-aligned buffer of at least Size bytes, suitable for
+ * O_DIRECT. The contents are undefined. Returns NULL if the pool limit
+ * does not allow it.
+ */
+void *
+AcquireIoBuffer(
+    size_t Size)
+{
+    size_t ClassSize = GetBufferClassSize(Size);
+    PIO_BUFFER Slot = NULL;
+    int i;
+
+    if (!PoolConfigured)
+        ConfigureFromEnvironment();
+
+    for (i = 0; i < IO_POOL_MAX_BUFFERS; i++)
+    {
+        if (PoolBuffers[i].Address == NULL)
+        {
+            if (Slot == NULL)
+                Slot = &PoolBuffers[i];
+        }
+        else if (!PoolBuffers[i].InUse && PoolBuffers[i].Size == ClassSize)
+        {
+            PoolBuffers[i].InUse = TRUE;
+            return PoolBuffers[i].Address;
+        }
+    }
+
+    if (!MakeRoom(ClassSize))
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    /* MakeRoom may have freed a slot */
+    for (i = 0; Slot == NULL && i < IO_POOL_MAX_BUFFERS; i++)
+    {
+        if (PoolBuffers[i].Address == NULL)
+            Slot = &PoolBuffers[i];
+    }
+
+    if (Slot == NULL)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    Slot->Address = MapBuffer(ClassSize);
+    if (Slot->Address == NULL)
+        return NULL;
+
+    Slot->Size = ClassSize;
+    Slot->InUse = TRUE;
+    PoolMappedBytes += ClassSize;
+
+    return Slot->Address;
+}
+
+
+/* Returns a buffer to the pool; it stays mapped for the next caller */
+void
+ReleaseIoBuffer(
+    void *Address)
+{
+    int i;
+
+    if (Address == NULL)
+        return;
+
+    for (i = 0; i < IO_POOL_MAX_BUFFERS; i++)
+    {
+        if (PoolBuffers[i].Address == Address)
+        {
+            PoolBuffers[i].InUse = FALSE;
+            return;
+        }
+    }
+}
@@ -1,123 +1,398 @@
-#include <stdio.h>
-#include <stdlib.h>
-#include <stdbool.h>
+/*
+ * PROJECT:         ReactOS DiskPart (Linux port)
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * FILE:            base/system/diskpart/clean.c
+ * PURPOSE:         Removes the partition information from the selected disk,
+ *                  or zeroes the whole disk with "clean all".
+ */
+
+#define _GNU_SOURCE
+#include "diskpart.h"
+
+#include <strings.h>
 #include <fcntl.h>
 #include <unistd.h>
-#include <string.h>
-#include <errno.h>
-#include <sys/stat.h>
-#include <sys/types.h>
-
-#define BUFFER_SIZE (1024 * 1024) // 1 MB
-
-typedef struct Disk {
-    const char *device_path;
-    off_t size_bytes;
-    unsigned int sector_size;
-} Disk;
-
-// Global current disk pointer (should be initialized before calling clean_main)
-Disk *CurrentDisk = NULL;
-
-// Helper: get device size
-off_t get_device_size(const char *device_path) {
-    int fd = open(device_path, O_RDONLY);
-    if (fd < 0) return -1;
-    off_t size = lseek(fd, 0, SEEK_END);
-    close(fd);
-    return size;
-}
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <linux/blkzoned.h>
+
+#define CLEAN_WIPE_SIZE  (1024 * 1024)
+#define CLEAN_CHUNK_SIZE (8 * 1024 * 1024)
+
+/* Zones per BLKREPORTZONE call, and the most zones one BLKRESETZONE covers */
+#define CLEAN_ZONE_REPORT_COUNT 256
+#define CLEAN_ZONE_BATCH        64
+#define CLEAN_MAX_JOBS          16
+
+typedef struct _ZONE_RESET_QUEUE {
+    int fd;
+    struct blk_zone_range *Ranges;
+    ULONG Count;
+    ULONG Allocated;
+    ULONG Next;
+    BOOL Failed;
+} ZONE_RESET_QUEUE, *PZONE_RESET_QUEUE;
+
+/* FUNCTIONS ******************************************************************/
+
+static
+BOOL
+ZeroDiskRange(
+    int fd,
+    ULONGLONG Offset,
+    ULONGLONG Length,
+    const UCHAR *Zero,
+    size_t ZeroSize)
+{
+    size_t Chunk;
+    ssize_t Result;
+
+    while (Length > 0)
+    {
+        Chunk = (Length > ZeroSize) ? ZeroSize : (size_t)Length;
 
-int clean_main(int argc, char **argv) {
-    bool wipe_all = false;
+        Result = pwrite(fd, Zero, Chunk, (off_t)Offset);
+        if (Result < 0 && errno == EINTR)
+            continue;
+        if (Result <= 0)
+        {
+            printf("Failed to write zeros at offset %llu: %s\n",
+                   (unsigned long long)Offset, Result < 0 ? strerror(errno) : "short write");
+            return FALSE;
+        }
 
-    if (CurrentDisk == NULL) {
-        fprintf(stderr, "No disk selected. Please select a disk first.\n");
-        return 1;
+        Offset += Result;
+        Length -= Result;
     }
 
-    // Protect boot disk example: on Linux, usually device names or root disk detection can be used
-    // For simplicity, we skip this check here
+    return TRUE;
+}
 
-    // Parse arguments for "all"
-    for (int i = 1; i < argc; i++) {
-        if (strcmp(argv[i], "all") == 0) {
-            wipe_all = true;
-            break;
+
+/* Queues a zone for reset, merging it into the previous batch where possible */
+static
+BOOL
+QueueZoneReset(
+    PZONE_RESET_QUEUE Queue,
+    const struct blk_zone *Zone)
+{
+    struct blk_zone_range *Last;
+    struct blk_zone_range *Ranges;
+    ULONG Allocated;
+
+    if (Queue->Count > 0)
+    {
+        Last = &Queue->Ranges[Queue->Count - 1];
+        if (Last->sector + Last->nr_sectors == Zone->start &&
+            Last->nr_sectors < Zone->len * CLEAN_ZONE_BATCH)
+        {
+            Last->nr_sectors += Zone->len;
+            return TRUE;
         }
     }
 
-    int fd = open(CurrentDisk->device_path, O_WRONLY);
-    if (fd < 0) {
-        fprintf(stderr, "Failed to open device %s: %s\n", CurrentDisk->device_path, strerror(errno));
-        return 1;
+    if (Queue->Count == Queue->Allocated)
+    {
+        Allocated = (Queue->Allocated != 0) ? Queue->Allocated * 2 : 64;
+        Ranges = realloc(Queue->Ranges, Allocated * sizeof(*Ranges));
+        if (Ranges == NULL)
+            return FALSE;
+
+        Queue->Ranges = Ranges;
+        Queue->Allocated = Allocated;
     }
 
-    // Allocate 1MB zero buffer
-    char *zero_buf = calloc(1, BUFFER_SIZE);
-    if (!zero_buf) {
-        fprintf(stderr, "Failed to allocate memory for zero buffer.\n");
-        close(fd);
-        return 1;
+    Queue->Ranges[Queue->Count].sector = Zone->start;
+    Queue->Ranges[Queue->Count].nr_sectors = Zone->len;
+    Queue->Count++;
+
+    return TRUE;
+}
+
+
+/*
+ * Walks the zones overlapping a byte range. Sequential zones that hold data
+ * are queued for reset, since they cannot be overwritten in place;
+ * conventional zones are zeroed like an ordinary disk.
+ */
+static
+BOOL
+CleanZoneRange(
+    int fd,
+    ULONGLONG Offset,
+    ULONGLONG Length,
+    PZONE_RESET_QUEUE Queue,
+    const UCHAR *Zero,
+    size_t ZeroSize)
+{
+    struct blk_zone_report *Report;
+    struct blk_zone *Zone;
+    ULONGLONG Sector = Offset / 512;
+    ULONGLONG EndSector = (Offset + Length) / 512;
+    ULONGLONG Start, End;
+    BOOL Success = TRUE;
+    ULONG i;
+
+    Report = AcquireIoBuffer(sizeof(*Report) + CLEAN_ZONE_REPORT_COUNT * sizeof(struct blk_zone));
+    if (Report == NULL)
+    {
+        printf("Out of memory.\n");
+        return FALSE;
     }
 
-    off_t total_size = CurrentDisk->size_bytes;
-    if (total_size <= 0) {
-        // Try to get device size if not known
-        total_size = get_device_size(CurrentDisk->device_path);
-        if (total_size <= 0) {
-            fprintf(stderr, "Failed to determine device size.\n");
-            free(zero_buf);
-            close(fd);
-            return 1;
+    while (Success && Sector < EndSector)
+    {
+        memset(Report, 0, sizeof(*Report));
+        Report->sector = Sector;
+        Report->nr_zones = CLEAN_ZONE_REPORT_COUNT;
+
+        if (ioctl(fd, BLKREPORTZONE, Report) < 0)
+        {
+            printf("Failed to report zones: %s\n", strerror(errno));
+            Success = FALSE;
+            break;
         }
-    }
+        if (Report->nr_zones == 0)
+            break;
 
-    if (wipe_all) {
-        off_t written = 0;
-        while (written < total_size) {
-            ssize_t to_write = BUFFER_SIZE;
-            if (total_size - written < BUFFER_SIZE) {
-                to_write = total_size - written;
+        for (i = 0; Success && i < Report->nr_zones; i++)
+        {
+            Zone = &Report->zones[i];
+            if (Zone->start >= EndSector)
+                break;
+
+            if (Zone->type == BLK_ZONE_TYPE_CONVENTIONAL)
+            {
+                Start = (Zone->start > Offset / 512) ? Zone->start * 512 : Offset;
+                End = (Zone->start + Zone->len < EndSector) ? (Zone->start + Zone->len) * 512 : Offset + Length;
+                Success = ZeroDiskRange(fd, Start, End - Start, Zero, ZeroSize);
             }
-            ssize_t res = write(fd, zero_buf, to_write);
-            if (res < 0) {
-                fprintf(stderr, "Failed to write zeros at offset %lld: %s\n",
-                        (long long)written, strerror(errno));
-                free(zero_buf);
-                close(fd);
-                return 1;
+            else if (Zone->cond != BLK_ZONE_COND_EMPTY &&
+                     Zone->cond != BLK_ZONE_COND_READONLY &&
+                     Zone->cond != BLK_ZONE_COND_OFFLINE)
+            {
+                if (!QueueZoneReset(Queue, Zone))
+                {
+                    printf("Out of memory.\n");
+                    Success = FALSE;
+                }
             }
-            written += res;
+
+            Sector = Zone->start + Zone->len;
         }
-    } else {
-        // Wipe first MB
-        if (write(fd, zero_buf, BUFFER_SIZE) != BUFFER_SIZE) {
-            fprintf(stderr, "Failed to write zeros to start of disk: %s\n", strerror(errno));
-            free(zero_buf);
-            close(fd);
-            return 1;
+    }
+
+    ReleaseIoBuffer(Report);
+
+    return Success;
+}
+
+
+static
+void *
+ZoneResetWorker(
+    void *Context)
+{
+    PZONE_RESET_QUEUE Queue = Context;
+    ULONG Index;
+
+    while ((Index = __sync_fetch_and_add(&Queue->Next, 1)) < Queue->Count)
+    {
+        if (ioctl(Queue->fd, BLKRESETZONE, &Queue->Ranges[Index]) < 0)
+        {
+            printf("Failed to reset zones at sector %llu: %s\n",
+                   (unsigned long long)Queue->Ranges[Index].sector, strerror(errno));
+            Queue->Failed = TRUE;
         }
+    }
+
+    return NULL;
+}
+
+
+/* Resets the queued zones, Jobs batches at a time */
+static
+BOOL
+ResetQueuedZones(
+    PZONE_RESET_QUEUE Queue,
+    ULONG Jobs)
+{
+    pthread_t Threads[CLEAN_MAX_JOBS];
+    ULONG Started = 0;
+
+    if (Jobs > Queue->Count)
+        Jobs = Queue->Count;
 
-        // Wipe last MB
-        if (lseek(fd, total_size - BUFFER_SIZE, SEEK_SET) < 0) {
-            fprintf(stderr, "Failed to seek to end of disk: %s\n", strerror(errno));
-            free(zero_buf);
-            close(fd);
-            return 1;
+    /* The calling thread is one of the jobs */
+    while (Started + 1 < Jobs &&
+           pthread_create(&Threads[Started], NULL, ZoneResetWorker, Queue) == 0)
+    {
+        Started++;
+    }
+
+    ZoneResetWorker(Queue);
+
+    while (Started > 0)
+        pthread_join(Threads[--Started], NULL);
+
+    return !Queue->Failed;
+}
+
+
+/*
+ * Wipes the partition tables at both ends of the disk, or zeroes all of it.
+ * The partition lists of the disk are emptied to match.
+ */
+BOOL
+CleanDisk(
+    PDISKENTRY DiskEntry,
+    BOOL All,
+    ULONG Jobs)
+{
+    ULONGLONG DiskSize, WipeSize;
+    PARTITION_NODE_WAIT Wait;
+    DISK_TOPOLOGY Topology;
+    ZONE_RESET_QUEUE Queue;
+    size_t ZeroSize;
+    UCHAR *Zero;
+    BOOL Zoned;
+    BOOL Success;
+    int fd;
+
+    if (Jobs == 0)
+        Jobs = 1;
+    if (Jobs > CLEAN_MAX_JOBS)
+        Jobs = CLEAN_MAX_JOBS;
+
+    DiskSize = DiskEntry->SectorCount * DiskEntry->BytesPerSector;
+    ZeroSize = All ? CLEAN_CHUNK_SIZE : CLEAN_WIPE_SIZE;
+
+    if (!LockDisk(DiskEntry, TRUE))
+        return FALSE;
+
+    BeginPartitionNodeWait(&Wait);
+
+    Zero = AcquireIoBuffer(ZeroSize);
+    if (Zero == NULL)
+    {
+        printf("Out of memory.\n");
+        UnlockDisk(DiskEntry);
+        EndPartitionNodeWait(&Wait);
+        return FALSE;
+    }
+    memset(Zero, 0, ZeroSize);
+
+    /* The pool buffers are aligned, so bypass the page cache where we can */
+    fd = open(DiskEntry->DeviceName, O_WRONLY | O_DIRECT | O_CLOEXEC);
+    if (fd < 0)
+        fd = OpenDiskDevice(DiskEntry, O_WRONLY);
+    if (fd < 0)
+    {
+        ReleaseIoBuffer(Zero);
+        UnlockDisk(DiskEntry);
+        EndPartitionNodeWait(&Wait);
+        return FALSE;
+    }
+
+    /* Sequential zones are reset rather than written, which they may not allow */
+    Zoned = GetDiskTopology(DiskEntry->DeviceName, &Topology) &&
+            Topology.ZoneModel != ZONE_MODEL_NONE;
+
+    memset(&Queue, 0, sizeof(Queue));
+    Queue.fd = fd;
+
+    /* MBR and primary GPT at the start, backup GPT at the end */
+    WipeSize = (DiskSize < CLEAN_WIPE_SIZE) ? DiskSize : CLEAN_WIPE_SIZE;
+
+    if (Zoned)
+    {
+        if (All)
+        {
+            Success = CleanZoneRange(fd, 0, DiskSize, &Queue, Zero, ZeroSize);
         }
-        if (write(fd, zero_buf, BUFFER_SIZE) != BUFFER_SIZE) {
-            fprintf(stderr, "Failed to write zeros to end of disk: %s\n", strerror(errno));
-            free(zero_buf);
-            close(fd);
-            return 1;
+        else
+        {
+            Success = CleanZoneRange(fd, 0, WipeSize, &Queue, Zero, ZeroSize) &&
+                      CleanZoneRange(fd, DiskSize - WipeSize, WipeSize, &Queue, Zero, ZeroSize);
         }
+
+        if (Success)
+            Success = ResetQueuedZones(&Queue, Jobs);
+
+        free(Queue.Ranges);
+    }
+    else if (All)
+    {
+        Success = ZeroDiskRange(fd, 0, DiskSize, Zero, ZeroSize);
+    }
+    else
+    {
+        Success = ZeroDiskRange(fd, 0, WipeSize, Zero, ZeroSize) &&
+                  ZeroDiskRange(fd, DiskSize - WipeSize, WipeSize, Zero, ZeroSize);
     }
 
-    printf("Disk cleaned successfully.\n");
+    if (Success && fsync(fd) < 0)
+        Success = FALSE;
 
-    free(zero_buf);
     close(fd);
-    return 0;
+    ReleaseIoBuffer(Zero);
+
+    if (Success)
+    {
+        ClearPartitionList(DiskEntry);
+        RememberPartitionTable(DiskEntry);
+        if (!SyncKernelPartitions(DiskEntry, &Wait))
+            printf("The kernel partition table could not be updated; rescan the disk.\n");
+    }
+
+    UnlockDisk(DiskEntry);
+    EndPartitionNodeWait(&Wait);
+
+    return Success;
 }
 
+
+BOOL
+clean_main(
+    int argc,
+    char **argv)
+{
+    BOOL All = FALSE;
+    ULONG Jobs = 1;
+    int i;
+
+    if (CurrentDisk == NULL)
+    {
+        printf("No disk selected.\n");
+        CommandFailed = TRUE;
+        return TRUE;
+    }
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcasecmp(argv[i], "all") == 0)
+        {
+            All = TRUE;
+        }
+        else if (strncasecmp(argv[i], "jobs=", 5) == 0 && IsDecString(argv[i] + 5))
+        {
+            Jobs = strtoul(argv[i] + 5, NULL, 10);
+        }
+        else
+        {
+            printf("Usage: clean [all] [jobs=<n>]\n");
+            CommandFailed = TRUE;
+            return TRUE;
+        }
+    }
+
+    if (CleanDisk(CurrentDisk, All, Jobs))
+        printf("\nDiskPart succeeded in cleaning the disk.\n");
+    else
+    {
+        printf("\nDiskPart failed to clean the disk.\n");
+        CommandFailed = TRUE;
+    }
+
+    return TRUE;
+}
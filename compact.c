@@ -1,8 +1,478 @@
-#include <stdbool.h>
+/*
+ * PROJECT:         ReactOS DiskPart (Linux port)
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * FILE:            base/system/diskpart/compact.c
+ * PURPOSE:         Manages all the partitions of the OS in an interactive way.
+ */
 
-int compact_main(int argc, char **argv)
+#define _GNU_SOURCE
+#include "diskpart.h"
+
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <linux/falloc.h>
+
+#define COMPACT_CHUNK_SIZE  (8 * 1024 * 1024)
+#define COMPACT_ALIGNMENT   4096
+#define MAX_IMAGE_PARTITIONS 128
+
+typedef struct _COMPACT_CONTEXT {
+    int fd;                     /* Buffered, used for punching */
+    int DirectFd;               /* O_DIRECT for the zero scan, or -1 */
+    ULONG HoleSize;             /* Allocation unit of the host filesystem */
+    ULONGLONG FileSize;
+    ULONGLONG PartitionBase;    /* Byte offset of the partition being walked */
+    ULONGLONG Punched;
+    BOOL Failed;
+} COMPACT_CONTEXT, *PCOMPACT_CONTEXT;
+
+/* FUNCTIONS ******************************************************************/
+
+/*
+ * Deallocates [Offset, Offset + Length) of the image, shrunk to whole
+ * allocation units of the host filesystem. The file size is kept.
+ */
+static
+void
+PunchRange(
+    PCOMPACT_CONTEXT Compact,
+    ULONGLONG Offset,
+    ULONGLONG Length)
+{
+    ULONGLONG Start, End;
+
+    Start = (Offset + Compact->HoleSize - 1) / Compact->HoleSize * Compact->HoleSize;
+    End = AlignDown(Offset + Length, Compact->HoleSize);
+    if (End > Compact->FileSize)
+        End = Compact->FileSize;
+    if (Compact->Failed || End <= Start)
+        return;
+
+    if (fallocate(Compact->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                  (off_t)Start, (off_t)(End - Start)) != 0)
+    {
+        perror("fallocate FALLOC_FL_PUNCH_HOLE");
+        Compact->Failed = TRUE;
+        return;
+    }
+
+    Compact->Punched += End - Start;
+}
+
+
+static
+void
+PunchFreeRange(
+    void *Context,
+    ULONGLONG Offset,
+    ULONGLONG Length)
+{
+    PCOMPACT_CONTEXT Compact = Context;
+
+    PunchRange(Compact, Compact->PartitionBase + Offset, Length);
+}
+
+
+/* OR-folds the block 256 bits at a time; Length is a multiple of 32 */
+static
+BOOL
+IsZeroBlock(
+    const UCHAR *Block,
+    size_t Length)
+{
+    ULONGLONG Words[4];
+    size_t i;
+
+    for (i = 0; i < Length; i += 32)
+    {
+        memcpy(Words, Block + i, sizeof(Words));
+        if ((Words[0] | Words[1] | Words[2] | Words[3]) != 0)
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+/*
+ * Reads only the allocated extents of the image (SEEK_DATA/SEEK_HOLE) and
+ * punches every allocation unit that holds nothing but zeros.
+ */
+static
+BOOL
+PunchZeroBlocks(
+    PCOMPACT_CONTEXT Compact)
+{
+    ULONGLONG Data, Hole, Offset, RunStart = 0;
+    size_t Length, i;
+    ssize_t Result;
+    BOOL InRun = FALSE;
+    UCHAR *Buffer;
+    int fd;
+
+    Buffer = AcquireIoBuffer(COMPACT_CHUNK_SIZE);
+    if (Buffer == NULL)
+        return FALSE;
+
+    posix_fadvise(Compact->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    for (Data = 0; Data < Compact->FileSize && !Compact->Failed; Data = Hole)
+    {
+        Data = (ULONGLONG)lseek(Compact->fd, (off_t)Data, SEEK_DATA);
+        if ((off_t)Data < 0)
+            break;      /* ENXIO: only holes left */
+
+        Hole = (ULONGLONG)lseek(Compact->fd, (off_t)Data, SEEK_HOLE);
+        if ((off_t)Hole < 0)
+            Hole = Compact->FileSize;
+
+        for (Offset = Data; Offset < Hole && !Compact->Failed; Offset += Length)
+        {
+            Length = (Hole - Offset > COMPACT_CHUNK_SIZE) ? COMPACT_CHUNK_SIZE : (size_t)(Hole - Offset);
+
+            /* Unaligned tails go through the page cache */
+            fd = (Compact->DirectFd >= 0 && (Offset % COMPACT_ALIGNMENT) == 0 &&
+                  (Length % COMPACT_ALIGNMENT) == 0) ? Compact->DirectFd : Compact->fd;
+
+            Result = pread(fd, Buffer, Length, (off_t)Offset);
+            if (Result != (ssize_t)Length)
+            {
+                perror("Failed to read the image");
+                ReleaseIoBuffer(Buffer);
+                return FALSE;
+            }
+
+            for (i = 0; i + Compact->HoleSize <= Length; i += Compact->HoleSize)
+            {
+                if (IsZeroBlock(Buffer + i, Compact->HoleSize))
+                {
+                    if (!InRun)
+                        RunStart = Offset + i;
+                    InRun = TRUE;
+                }
+                else if (InRun)
+                {
+                    PunchRange(Compact, RunStart, Offset + i - RunStart);
+                    InRun = FALSE;
+                }
+            }
+        }
+
+        if (InRun)
+        {
+            PunchRange(Compact, RunStart, Hole - RunStart);
+            InRun = FALSE;
+        }
+    }
+
+    ReleaseIoBuffer(Buffer);
+
+    return !Compact->Failed;
+}
+
+
+static
+int
+CompareByStart(
+    const void *A,
+    const void *B)
+{
+    const PARTENTRY *First = A, *Second = B;
+
+    return (First->StartSector < Second->StartSector) ? -1 : (First->StartSector > Second->StartSector);
+}
+
+
+/*
+ * Reads the partition table of the image into Table. An extended partition
+ * is kept as one entry, so its logical drives are left as they are.
+ * Returns the number of partitions and in *EndSector the first sector past
+ * the usable area (the backup GPT is behind it).
+ */
+static
+int
+ReadImagePartitions(
+    PDISKENTRY DiskEntry,
+    PPARTENTRY Table,
+    int MaxCount,
+    ULONGLONG *EndSector)
+{
+    UCHAR Sector[4096 * 2];
+    PMASTER_BOOT_RECORD Mbr = (PMASTER_BOOT_RECORD)Sector;
+    PEFI_PARTITION_HEADER Header;
+    PEFI_PARTITION_ENTRY Entry;
+    UCHAR *Entries;
+    ULONG EntrySize, EntryCount;
+    ULONGLONG First, Last;
+    size_t ArraySize;
+    int fd, Count = 0, i;
+
+    *EndSector = DiskEntry->SectorCount;
+
+    fd = OpenDiskDevice(DiskEntry, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    if (pread(fd, Sector, sizeof(Sector), 0) != (ssize_t)sizeof(Sector) ||
+        MbrGetMasterBootRecordMagic(Mbr) != MBR_SIGNATURE)
+    {
+        close(fd);
+        return 0;
+    }
+
+    /* The GPT header sits in LBA 1 of whatever sector size the image uses */
+    Header = (PEFI_PARTITION_HEADER)(Sector + 512);
+    if (GptHeaderGetSignature(Header) != EFI_PT_SIGNATURE &&
+        GptHeaderGetSignature((PEFI_PARTITION_HEADER)(Sector + 4096)) == EFI_PT_SIGNATURE)
+    {
+        Header = (PEFI_PARTITION_HEADER)(Sector + 4096);
+        DiskEntry->BytesPerSector = 4096;
+        DiskEntry->SectorCount /= 8;
+        *EndSector = DiskEntry->SectorCount;
+    }
+
+    if (Mbr->PartitionTable[0].PartitionType == PARTITION_GPT &&
+        GptHeaderGetSignature(Header) == EFI_PT_SIGNATURE)
+    {
+        EntrySize = GptHeaderGetSizeOfPartitionEntry(Header);
+        EntryCount = GptHeaderGetNumberOfEntries(Header);
+        ArraySize = (size_t)EntryCount * EntrySize;
+        Entries = (EntrySize >= sizeof(EFI_PARTITION_ENTRY) && ArraySize <= 1024 * 1024)
+                      ? malloc(ArraySize) : NULL;
+
+        if (Entries != NULL &&
+            pread(fd, Entries, ArraySize,
+                  (off_t)(GptHeaderGetPartitionEntryLBA(Header) * DiskEntry->BytesPerSector)) == (ssize_t)ArraySize &&
+            GptCrc32(Entries, ArraySize) == GptHeaderGetPartitionEntryCRC32(Header))
+        {
+            *EndSector = GptHeaderGetLastUsableLBA(Header) + 1;
+
+            for (i = 0; i < (int)EntryCount && Count < MaxCount; i++)
+            {
+                Entry = (PEFI_PARTITION_ENTRY)(Entries + (size_t)i * EntrySize);
+                First = GptEntryGetStartingLBA(Entry);
+                Last = GptEntryGetEndingLBA(Entry);
+                if (!GptEntryIsUsed(Entry) || Last < First)
+                    continue;
+
+                memset(&Table[Count], 0, sizeof(PARTENTRY));
+                Table[Count].DiskEntry = DiskEntry;
+                Table[Count].StartSector = First;
+                Table[Count].SectorCount = Last - First + 1;
+                Table[Count].IsPartitioned = TRUE;
+                Count++;
+            }
+        }
+        else
+        {
+            Count = -1;
+        }
+
+        free(Entries);
+    }
+    else
+    {
+        for (i = 0; i < 4 && Count < MaxCount; i++)
+        {
+            if (Mbr->PartitionTable[i].PartitionType == PARTITION_ENTRY_UNUSED ||
+                MbrEntryGetSectorCount(&Mbr->PartitionTable[i]) == 0)
+                continue;
+
+            memset(&Table[Count], 0, sizeof(PARTENTRY));
+            Table[Count].DiskEntry = DiskEntry;
+            Table[Count].StartSector = MbrEntryGetStartingLba(&Mbr->PartitionTable[i]);
+            Table[Count].SectorCount = MbrEntryGetSectorCount(&Mbr->PartitionTable[i]);
+            Table[Count].PartitionType = Mbr->PartitionTable[i].PartitionType;
+            Table[Count].IsPartitioned = TRUE;
+            Count++;
+        }
+    }
+
+    close(fd);
+
+    if (Count > 0)
+        qsort(Table, Count, sizeof(PARTENTRY), CompareByStart);
+
+    return Count;
+}
+
+
+/*
+ * Releases the blocks of an image that cannot hold data: the gaps between
+ * partitions, the free blocks of the filesystems we can read, and finally
+ * every block that is all zeros.
+ */
+static
+BOOL
+CompactImage(
+    const char *FileName)
 {
-    // TODO: Implement 'compact' functionality for Linux partitions if needed
+    COMPACT_CONTEXT Compact;
+    DISKENTRY DiskEntry;
+    PARTENTRY *Table = NULL;
+    PARTENTRY Whole;
+    struct stat StatBuffer;
+    ULONGLONG Before, EndSector, GapStart;
+    int Count, i;
+    BOOL Success = FALSE;
+
+    memset(&Compact, 0, sizeof(Compact));
+    Compact.DirectFd = -1;
+
+    Compact.fd = open(FileName, O_RDWR | O_CLOEXEC);
+    if (Compact.fd < 0 || fstat(Compact.fd, &StatBuffer) < 0 || !S_ISREG(StatBuffer.st_mode))
+    {
+        printf("\nThe virtual disk file could not be opened.\n\n");
+        goto done;
+    }
+
+    Compact.DirectFd = open(FileName, O_RDONLY | O_DIRECT | O_CLOEXEC);
+    Compact.FileSize = (ULONGLONG)StatBuffer.st_size;
+    Compact.HoleSize = (StatBuffer.st_blksize >= 512 && StatBuffer.st_blksize <= 1048576)
+                           ? (ULONG)StatBuffer.st_blksize : COMPACT_ALIGNMENT;
+    Before = (ULONGLONG)StatBuffer.st_blocks * 512;
+
+    /* The image is walked with the partition and filesystem readers */
+    memset(&DiskEntry, 0, sizeof(DiskEntry));
+    snprintf(DiskEntry.DeviceName, sizeof(DiskEntry.DeviceName), "%s", FileName);
+    DiskEntry.BytesPerSector = 512;
+    DiskEntry.SectorCount = Compact.FileSize / 512;
+    InitializeListHead(&DiskEntry.PrimaryPartListHead);
+    InitializeListHead(&DiskEntry.LogicalPartListHead);
+
+    memset(&Whole, 0, sizeof(Whole));
+    Whole.DiskEntry = &DiskEntry;
+    Whole.SectorCount = DiskEntry.SectorCount;
+    Whole.IsPartitioned = TRUE;
+
+    /* A bare filesystem without a partition table */
+    if (EnumerateFileSystemFreeRanges(&Whole, PunchFreeRange, &Compact))
+    {
+        printf("Released the free blocks of the filesystem.\n");
+    }
+    else
+    {
+        Table = calloc(MAX_IMAGE_PARTITIONS, sizeof(PARTENTRY));
+        if (Table == NULL)
+            goto done;
+
+        Count = ReadImagePartitions(&DiskEntry, Table, MAX_IMAGE_PARTITIONS, &EndSector);
+        if (Count < 0)
+        {
+            printf("The partition table of the image is damaged; only zero blocks are released.\n");
+            Count = 0;
+        }
+
+        /* Space in front of the first partition may hold a boot loader */
+        GapStart = (Count > 0) ? Table[0].StartSector : EndSector;
+
+        for (i = 0; i < Count && !Compact.Failed; i++)
+        {
+            if (Table[i].StartSector > GapStart)
+                PunchRange(&Compact, GapStart * DiskEntry.BytesPerSector,
+                           (Table[i].StartSector - GapStart) * DiskEntry.BytesPerSector);
+
+            if (Table[i].StartSector + Table[i].SectorCount > GapStart)
+                GapStart = Table[i].StartSector + Table[i].SectorCount;
+
+            if (IsContainerPartition(Table[i].PartitionType))
+                continue;
+
+            Compact.PartitionBase = Table[i].StartSector * DiskEntry.BytesPerSector;
+            if (EnumerateFileSystemFreeRanges(&Table[i], PunchFreeRange, &Compact))
+                printf("Released the free blocks of partition %d.\n", i + 1);
+        }
+
+        if (Count > 0 && EndSector > GapStart)
+            PunchRange(&Compact, GapStart * DiskEntry.BytesPerSector,
+                       (EndSector - GapStart) * DiskEntry.BytesPerSector);
+    }
+
+    Compact.PartitionBase = 0;
+
+    if (Compact.Failed || !PunchZeroBlocks(&Compact))
+        goto done;
+
+    if (fsync(Compact.fd) != 0 || fstat(Compact.fd, &StatBuffer) != 0)
+    {
+        perror("fsync");
+        goto done;
+    }
+
+    printf("\nDiskPart successfully compacted the virtual disk file.\n");
+    printf("Allocated size went from %llu MB to %llu MB.\n\n",
+           (unsigned long long)(Before / 1048576ULL),
+           (unsigned long long)((ULONGLONG)StatBuffer.st_blocks * 512 / 1048576ULL));
+
+    Success = TRUE;
+
+done:
+    free(Table);
+    if (Compact.DirectFd >= 0)
+        close(Compact.DirectFd);
+    if (Compact.fd >= 0)
+        close(Compact.fd);
+
+    return Success;
+}
+
+
+/* compact vdisk [file=<path>] [noerr] */
+BOOL
+compact_main(
+    int argc,
+    char **argv)
+{
+    VDISKENTRY VDiskEntry;
+    char *pszSuffix = NULL;
+    char *pszFile = NULL;
+    const char *FileName;
+    int i;
+
+    if (argc < 2 || strcasecmp(argv[1], "vdisk") != 0)
+    {
+        printf("Usage: compact vdisk [file=<path>]\n");
+        return TRUE;
+    }
+
+    for (i = 2; i < argc; i++)
+    {
+        if (HasPrefix(argv[i], "file=", &pszSuffix))
+        {
+            free(pszFile);
+            pszFile = DuplicateQuotedString(pszSuffix);
+        }
+        else if (strcasecmp(argv[i], "noerr") != 0)
+        {
+            printf("Invalid argument: %s\n", argv[i]);
+            free(pszFile);
+            return TRUE;
+        }
+    }
+
+    FileName = pszFile ? pszFile : CurrentVirtualDisk;
+    if (FileName[0] == '\0')
+    {
+        printf("No virtual disk selected.\n");
+        CommandFailed = TRUE;
+        return TRUE;
+    }
+
+    /* A writer could fill a block between our read and the punch */
+    if (FindAttachedVirtualDisk(FileName, &VDiskEntry) && !VDiskEntry.ReadOnly)
+    {
+        printf("\nThe virtual disk is attached read-write as %s.\n", VDiskEntry.DeviceName);
+        printf("Detach it or attach it read-only before compacting.\n\n");
+        free(pszFile);
+        return TRUE;
+    }
+
+    if (!CompactImage(FileName))
+        printf("\nDiskPart failed to compact the virtual disk file.\n\n");
+
+    free(pszFile);
 
-    return 0;  // failure / not implemented
+    return TRUE;
 }
@@ -1,8 +1,455 @@
-#include <stdbool.h>
+/*
+ * PROJECT:         ReactOS DiskPart (Linux port)
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * FILE:            base/system/diskpart/convert.c
+ * PURPOSE:         Converts a disk between the MBR and GPT partition styles
+ *                  in place, without moving any partition data.
+ */
 
-int convert_main(int argc, char **argv)
+#include "diskpart.h"
+
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+/* FUNCTIONS ******************************************************************/
+
+static
+BOOL
+IsDataPartition(
+    PPARTENTRY PartEntry)
+{
+    return PartEntry->IsPartitioned &&
+           !IsContainerPartition(PartEntry->PartitionType);
+}
+
+
+/*
+ * Collects every data partition of the disk, primary and logical, sorted by
+ * start sector. Returns the number of partitions or -1 if there are more than
+ * MaxCount of them.
+ */
+static
+int
+CollectPartitions(
+    PDISKENTRY DiskEntry,
+    PPARTENTRY *Table,
+    int MaxCount)
+{
+    ListEntry *Heads[2] = { &DiskEntry->PrimaryPartListHead, &DiskEntry->LogicalPartListHead };
+    ListEntry *Entry;
+    PPARTENTRY PartEntry;
+    int Count = 0;
+    int i, j;
+
+    for (i = 0; i < 2; i++)
+    {
+        for (Entry = Heads[i]->Flink; Entry != Heads[i]; Entry = Entry->Flink)
+        {
+            PartEntry = CONTAINING_RECORD(Entry, PARTENTRY, ListEntry);
+            if (!IsDataPartition(PartEntry))
+                continue;
+
+            if (Count == MaxCount)
+                return -1;
+
+            /* Insertion sort, the lists are short and almost always sorted */
+            for (j = Count; j > 0 && Table[j - 1]->StartSector > PartEntry->StartSector; j--)
+                Table[j] = Table[j - 1];
+            Table[j] = PartEntry;
+            Count++;
+        }
+    }
+
+    return Count;
+}
+
+
+static
+BOOL
+CheckOverlaps(
+    PPARTENTRY *Table,
+    int Count)
+{
+    int i;
+
+    for (i = 0; i < Count; i++)
+    {
+        if (Table[i]->SectorCount == 0)
+        {
+            printf("Partition %lu is empty.\n", (unsigned long)Table[i]->PartitionNumber);
+            return FALSE;
+        }
+
+        if (i > 0 &&
+            Table[i - 1]->StartSector + Table[i - 1]->SectorCount > Table[i]->StartSector)
+        {
+            printf("Partitions %lu and %lu overlap.\n",
+                   (unsigned long)Table[i - 1]->PartitionNumber,
+                   (unsigned long)Table[i]->PartitionNumber);
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+
+/*
+ * Rebuilds the in-memory partition lists after a conversion. Container
+ * entries are dropped, Table[0..Count-1] are (re)inserted as either primary
+ * or logical partitions and the free space entries are made anew for the
+ * new style by RebuildFreeSpaceEntries.
+ */
+static
+void
+RebuildPartitionLists(
+    PDISKENTRY DiskEntry,
+    PPARTENTRY *Table,
+    int Count,
+    int PrimaryCount,
+    PPARTENTRY ExtendedEntry)
+{
+    ListEntry *Heads[2] = { &DiskEntry->PrimaryPartListHead, &DiskEntry->LogicalPartListHead };
+    ListEntry *Entry, *Next;
+    PPARTENTRY PartEntry;
+    int i;
+
+    for (i = 0; i < 2; i++)
+    {
+        for (Entry = Heads[i]->Flink; Entry != Heads[i]; Entry = Next)
+        {
+            Next = Entry->Flink;
+            PartEntry = CONTAINING_RECORD(Entry, PARTENTRY, ListEntry);
+            RemoveEntryList(Entry);
+
+            if (!PartEntry->IsPartitioned || IsContainerPartition(PartEntry->PartitionType))
+            {
+                if (CurrentPartition == PartEntry)
+                    CurrentPartition = NULL;
+                free(PartEntry);
+            }
+        }
+    }
+
+    DiskEntry->ExtendedPartition = ExtendedEntry;
+    if (ExtendedEntry != NULL)
+        Table[Count] = ExtendedEntry;
+
+    for (i = 0; i < Count + (ExtendedEntry != NULL); i++)
+    {
+        PartEntry = Table[i];
+        PartEntry->LogicalPartition = (i >= PrimaryCount && i < Count);
+        InsertTailList(PartEntry->LogicalPartition ? Heads[1] : Heads[0], &PartEntry->ListEntry);
+    }
+}
+
+
+/*
+ * The partitions keep their sectors; the table is written by the same
+ * WriteGptTable that writes every other change to a GPT disk.
+ */
+static
+BOOL
+ConvertToGpt(
+    PDISKENTRY DiskEntry,
+    PPARTITION_NODE_WAIT Wait)
+{
+    PPARTENTRY Table[EFI_PT_ENTRY_COUNT + 1];
+    PPARTENTRY Slots[EFI_PT_ENTRY_COUNT];
+    int Count, i;
+    int fd;
+
+    if (DiskEntry->PartitionStyle == PARTITION_STYLE_GPT)
+    {
+        printf("The selected disk is already a GPT disk.\n");
+        return FALSE;
+    }
+
+    Count = CollectPartitions(DiskEntry, Table, EFI_PT_ENTRY_COUNT);
+    if (Count < 0)
+    {
+        printf("The disk has more than %d partitions.\n", EFI_PT_ENTRY_COUNT);
+        return FALSE;
+    }
+
+    if (!CheckOverlaps(Table, Count))
+        return FALSE;
+
+    /* Fresh GUIDs for the disk and every partition, types follow the MBR ids */
+    memset(Slots, 0, sizeof(Slots));
+    for (i = 0; i < Count; i++)
+    {
+        memset(&Table[i]->PartitionTypeGuid, 0, sizeof(GUID));
+        memset(&Table[i]->PartitionGuid, 0, sizeof(GUID));
+        Slots[i] = Table[i];
+    }
+    memset(&DiskEntry->DiskGuid, 0, sizeof(GUID));
+
+    fd = OpenDiskDevice(DiskEntry, O_RDWR);
+    if (fd < 0)
+        return FALSE;
+
+    if (!WriteGptTable(DiskEntry, fd, Slots))
+    {
+        close(fd);
+        return FALSE;
+    }
+
+    close(fd);
+
+    RebuildPartitionLists(DiskEntry, Table, Count, Count, NULL);
+
+    if (!SyncKernelPartitions(DiskEntry, Wait))
+        printf("The kernel partition table could not be updated; rescan the disk.\n");
+
+    DiskEntry->PartitionStyle = PARTITION_STYLE_GPT;
+    DiskEntry->NoMbr = FALSE;
+    DiskEntry->Dirty = FALSE;
+
+    if (!RebuildFreeSpaceEntries(DiskEntry))
+        printf("Out of memory; rescan the disk to see its free space.\n");
+
+    return TRUE;
+}
+
+
+static
+UCHAR
+GetMbrType(
+    PPARTENTRY PartEntry)
 {
-    // TODO: Implement 'convert' functionality (e.g., MBR <-> GPT) on Linux
+    UCHAR Type = MbrTypeFromGptType(&PartEntry->PartitionTypeGuid);
+
+    /* "Basic data" covers FAT and NTFS; FAT volumes keep their own id */
+    if (Type == 0x07 && strncmp(PartEntry->FileSystemName, "FAT", 3) == 0)
+        Type = 0x0C;
+
+    return Type;
+}
+
+
+static
+void
+SwapPartitionTypes(
+    PPARTENTRY *Table,
+    UCHAR *Types,
+    int Count)
+{
+    UCHAR Type;
+    int i;
+
+    for (i = 0; i < Count; i++)
+    {
+        Type = Table[i]->PartitionType;
+        Table[i]->PartitionType = Types[i];
+        Types[i] = Type;
+    }
+}
+
+
+static
+BOOL
+ConvertToMbr(
+    PDISKENTRY DiskEntry,
+    PPARTITION_NODE_WAIT Wait)
+{
+    PPARTENTRY Table[EFI_PT_ENTRY_COUNT + 1];
+    PPARTENTRY Slots[MBR_PARTITION_COUNT];
+    PPARTENTRY ExtendedEntry = NULL;
+    UCHAR Types[EFI_PT_ENTRY_COUNT];
+    ULONG BytesPerSector = DiskEntry->BytesPerSector;
+    ULONGLONG ExtStart, ExtEnd, PrevEnd;
+    UCHAR *Zero = NULL;
+    int Count, PrimaryCount, i;
+    int fd = -1;
+    BOOL Success = FALSE;
+
+    if (DiskEntry->PartitionStyle == PARTITION_STYLE_MBR)
+    {
+        printf("The selected disk is already an MBR disk.\n");
+        return FALSE;
+    }
+
+    Count = CollectPartitions(DiskEntry, Table, EFI_PT_ENTRY_COUNT);
+    if (Count < 0)
+    {
+        printf("The disk has more than %d partitions.\n", EFI_PT_ENTRY_COUNT);
+        return FALSE;
+    }
+
+    if (!CheckOverlaps(Table, Count))
+        return FALSE;
+
+    /* Up to four primaries, otherwise three primaries plus an EBR chain */
+    PrimaryCount = (Count <= MBR_PARTITION_COUNT) ? Count : MBR_PARTITION_COUNT - 1;
+
+    PrevEnd = 0;
+    for (i = 0; i < Count; i++)
+    {
+        if (i >= PrimaryCount && Table[i]->StartSector - 1 <= PrevEnd)
+        {
+            printf("There is no free sector for the EBR in front of partition %lu.\n",
+                   (unsigned long)Table[i]->PartitionNumber);
+            return FALSE;
+        }
+        PrevEnd = Table[i]->StartSector + Table[i]->SectorCount - 1;
+    }
+
+    memset(Slots, 0, sizeof(Slots));
+    for (i = 0; i < PrimaryCount; i++)
+        Slots[i] = Table[i];
+
+    if (Count > PrimaryCount)
+    {
+        ExtStart = Table[PrimaryCount]->StartSector - 1;
+        ExtEnd = Table[Count - 1]->StartSector + Table[Count - 1]->SectorCount - 1;
+
+        ExtendedEntry = calloc(1, sizeof(PARTENTRY));
+        if (ExtendedEntry == NULL)
+        {
+            printf("Out of memory.\n");
+            return FALSE;
+        }
+        ExtendedEntry->DiskEntry = DiskEntry;
+        ExtendedEntry->StartSector = ExtStart;
+        ExtendedEntry->SectorCount = ExtEnd - ExtStart + 1;
+        ExtendedEntry->PartitionType = PARTITION_XINT13_EXTENDED;
+        ExtendedEntry->IsPartitioned = TRUE;
+        ExtendedEntry->FormatState = Unformatted;
+        Slots[PrimaryCount] = ExtendedEntry;
+    }
+
+    /* The MBR ids stay in a scratch copy until the table is on the disk */
+    for (i = 0; i < Count; i++)
+        Types[i] = GetMbrType(Table[i]);
+
+    Zero = calloc(1, BytesPerSector);
+    if (Zero == NULL)
+    {
+        printf("Out of memory.\n");
+        goto done;
+    }
+
+    fd = OpenDiskDevice(DiskEntry, O_RDWR);
+    if (fd < 0)
+        goto done;
+
+    /*
+     * Backup GPT header first, so that a half-done conversion is detected as
+     * broken GPT, then the MBR and its EBR chain, then the primary header.
+     */
+    if (!WriteDiskSectors(fd, DiskEntry, DiskEntry->SectorCount - 1, 1, Zero) ||
+        fsync(fd) < 0)
+    {
+        printf("Failed to write the MBR.\n");
+        goto done;
+    }
+
+    /* WriteMbrTable takes the ids from the entries; put the old ones back if it fails */
+    SwapPartitionTypes(Table, Types, Count);
+    if (!WriteMbrTable(DiskEntry, fd, Slots, &Table[PrimaryCount], Count - PrimaryCount))
+    {
+        SwapPartitionTypes(Table, Types, Count);
+        goto done;
+    }
+
+    if (!WriteDiskSectors(fd, DiskEntry, 1, 1, Zero) ||
+        fsync(fd) < 0)
+    {
+        printf("Failed to wipe the GPT header.\n");
+        goto done;
+    }
+
+    for (i = 0; i < Count; i++)
+    {
+        memset(&Table[i]->PartitionGuid, 0, sizeof(GUID));
+        memset(&Table[i]->PartitionTypeGuid, 0, sizeof(GUID));
+    }
+
+    RebuildPartitionLists(DiskEntry, Table, Count, PrimaryCount, ExtendedEntry);
+    ExtendedEntry = NULL;
+
+    if (!SyncKernelPartitions(DiskEntry, Wait))
+        printf("The kernel partition table could not be updated; rescan the disk.\n");
+
+    DiskEntry->PartitionStyle = PARTITION_STYLE_MBR;
+    memset(&DiskEntry->DiskGuid, 0, sizeof(GUID));
+    DiskEntry->Dirty = FALSE;
+
+    if (!RebuildFreeSpaceEntries(DiskEntry))
+        printf("Out of memory; rescan the disk to see its free space.\n");
+
+    Success = TRUE;
+
+done:
+    if (fd >= 0)
+        close(fd);
+    free(ExtendedEntry);
+    free(Zero);
+
+    return Success;
+}
+
+
+BOOL
+convert_main(
+    int argc,
+    char **argv)
+{
+    PARTITION_NODE_WAIT Wait;
+    BOOL Success;
+
+    if (CurrentDisk == NULL)
+    {
+        printf("No disk selected.\n");
+        CommandFailed = TRUE;
+        return TRUE;
+    }
+
+    if (argc < 2)
+    {
+        printf("Usage: convert gpt | convert mbr\n");
+        CommandFailed = TRUE;
+        return TRUE;
+    }
+
+    if (strcasecmp(argv[1], "gpt") != 0 && strcasecmp(argv[1], "mbr") != 0)
+    {
+        printf("Unsupported conversion: %s\n", argv[1]);
+        CommandFailed = TRUE;
+        return TRUE;
+    }
+
+    if (!LockDisk(CurrentDisk, TRUE))
+    {
+        printf("\nDiskPart failed to convert the selected disk.\n");
+        CommandFailed = TRUE;
+        return TRUE;
+    }
+
+    /* Renumbered partitions get new nodes */
+    BeginPartitionNodeWait(&Wait);
+
+    if (strcasecmp(argv[1], "gpt") == 0)
+        Success = ConvertToGpt(CurrentDisk, &Wait);
+    else
+        Success = ConvertToMbr(CurrentDisk, &Wait);
+
+    if (Success)
+        RememberPartitionTable(CurrentDisk);
+
+    UnlockDisk(CurrentDisk);
+    EndPartitionNodeWait(&Wait);
+
+    if (Success)
+        printf("\nDiskPart successfully converted the selected disk to the %s format.\n",
+               (CurrentDisk->PartitionStyle == PARTITION_STYLE_GPT) ? "GPT" : "MBR");
+    else
+    {
+        printf("\nDiskPart failed to convert the selected disk.\n");
+        CommandFailed = TRUE;
+    }
 
-    return 1;  // success (stub)
+    return TRUE;
 }
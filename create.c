@@ -1,155 +1,231 @@
+#include "diskpart.h"
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <parted/parted.h>
+#include <strings.h>
 
 // Parse size string like "size=100" (MB)
 static unsigned long long parse_size_mb(const char *arg) {
-    if (strncmp(arg, "size=", 5) == 0) {
+    if (strncasecmp(arg, "size=", 5) == 0) {
         return strtoull(arg + 5, NULL, 10);
     }
     return 0;
 }
 
+// Parse align=<KB>, the boundary the partition must start on
+static unsigned long long parse_align_kb(const char *arg) {
+    if (strncasecmp(arg, "align=", 6) == 0) {
+        return strtoull(arg + 6, NULL, 10);
+    }
+    return 0;
+}
+
 // Parse id= hex partition type code (for MBR)
 static unsigned int parse_id(const char *arg) {
-    if (strncmp(arg, "id=", 3) == 0) {
+    if (strncasecmp(arg, "id=", 3) == 0) {
         return (unsigned int)strtoul(arg + 3, NULL, 16);
     }
     return 0x0;
 }
 
-static void usage(const char *progname) {
-    printf("Usage: %s <device> <type> [options]\n", progname);
-    printf("  <device> : e.g. /dev/sda\n");
-    printf("  <type>   : primary | extended | logical\n");
+static void usage(const char *type) {
+    printf("Usage: create partition %s [options]\n", type);
     printf("  options  : size=<MB> id=<hex partition id> (id only for MBR)\n");
+    printf("             align=<KB> (default: derived from the device I/O topology)\n");
 }
 
-// Convert MB to sectors (assume 512 bytes per sector)
-static PedSector size_mb_to_sectors(unsigned long long mb) {
-    return (PedSector)(mb * 1024 * 1024 / 512);
+// Trims a free extent of the disk to aligned boundaries. Logical drives
+// need the sector in front of them for their EBR.
+static BOOL align_extent(const DISK_TOPOLOGY *topology, unsigned long long alignment,
+                         ULONG sector_size, int logical, PFREE_EXTENT extent) {
+    ULONGLONG first = extent->StartSector + (logical ? 1 : 0);
+    ULONGLONG start = AlignPartitionStart(topology, alignment, first * sector_size) / sector_size;
+    ULONGLONG end = AlignPartitionEnd(topology, (extent->StartSector + extent->SectorCount) * sector_size) / sector_size;
+    if (end <= start)
+        return FALSE;
+
+    extent->StartSector = start;
+    extent->SectorCount = end - start;
+    return TRUE;
 }
 
-int main(int argc, char **argv) {
-    if (argc < 3) {
-        usage(argv[0]);
-        return 1;
-    }
-
-    const char *device_path = argv[1];
-    const char *part_type_str = argv[2];
+// create partition primary|extended|logical [size=<MB>] [id=<hex>] [align=<KB>]
+static BOOL create_partition(int argc, char **argv, const char *part_type_str, UCHAR default_id) {
     unsigned long long size_mb = 0;
-    unsigned int part_id = 0x0;  // default for MBR
+    unsigned int part_id = 0x0;
+    unsigned long long align_kb = 0;
+    int logical = strcmp(part_type_str, "logical") == 0;
+    int extended = strcmp(part_type_str, "extended") == 0;
+
+    if (CurrentDisk == NULL) {
+        printf("No disk selected.\n");
+        CommandFailed = TRUE;
+        return TRUE;
+    }
 
     // Parse options
     for (int i = 3; i < argc; i++) {
-        if (strncmp(argv[i], "size=", 5) == 0) {
+        if (strncasecmp(argv[i], "size=", 5) == 0) {
             size_mb = parse_size_mb(argv[i]);
-        } else if (strncmp(argv[i], "id=", 3) == 0) {
+        } else if (strncasecmp(argv[i], "id=", 3) == 0) {
             part_id = parse_id(argv[i]);
+        } else if (strncasecmp(argv[i], "align=", 6) == 0) {
+            align_kb = parse_align_kb(argv[i]);
+            if (align_kb == 0) {
+                fprintf(stderr, "Invalid alignment: %s\n", argv[i]);
+                CommandFailed = TRUE;
+                return TRUE;
+            }
         } else {
             fprintf(stderr, "Unknown option: %s\n", argv[i]);
-            usage(argv[0]);
-            return 1;
+            usage(part_type_str);
+            CommandFailed = TRUE;
+            return TRUE;
         }
     }
 
-    PedDevice *dev = ped_device_get(device_path);
-    if (!dev) {
-        fprintf(stderr, "Failed to open device %s\n", device_path);
-        return 1;
+    if (CurrentDisk->PartitionStyle == PARTITION_STYLE_RAW) {
+        fprintf(stderr, "The disk has no partition table; convert it to MBR or GPT first\n");
+        CommandFailed = TRUE;
+        return TRUE;
+    }
+    if ((logical || extended) && CurrentDisk->PartitionStyle != PARTITION_STYLE_MBR) {
+        fprintf(stderr, "Extended partitions and logical drives only exist on MBR disks\n");
+        CommandFailed = TRUE;
+        return TRUE;
+    }
+    if (logical && CurrentDisk->ExtendedPartition == NULL) {
+        fprintf(stderr, "Create an extended partition for the logical drive first\n");
+        CommandFailed = TRUE;
+        return TRUE;
+    }
+    if (part_id > 0xFF || (part_id != 0 && extended != IsContainerPartition(part_id))) {
+        fprintf(stderr, "Invalid partition id: %x\n", part_id);
+        CommandFailed = TRUE;
+        return TRUE;
     }
 
-    if (!ped_device_open(dev)) {
-        fprintf(stderr, "Failed to open device %s\n", device_path);
-        ped_device_destroy(dev);
-        return 1;
+    // Start on a boundary that suits the device: physical block, RAID
+    // stripe, zone. Image files have no topology, use the label's sectors.
+    DISK_TOPOLOGY topology;
+    if (!GetDiskTopology(CurrentDisk->DeviceName, &topology)) {
+        memset(&topology, 0, sizeof(topology));
+        topology.LogicalBlockSize = CurrentDisk->BytesPerSector;
+        topology.PhysicalBlockSize = CurrentDisk->BytesPerSector;
     }
 
-    PedDisk *disk = ped_disk_new(dev);
-    if (!disk) {
-        fprintf(stderr, "Failed to read disk label on %s\n", device_path);
-        ped_device_close(dev);
-        ped_device_destroy(dev);
-        return 1;
+    ULONG sector_size = CurrentDisk->BytesPerSector;
+    unsigned long long alignment = align_kb ? align_kb * 1024 : GetPartitionAlignment(&topology);
+    if (topology.ZoneModel != ZONE_MODEL_NONE && topology.ZoneSize != 0 &&
+        alignment % topology.ZoneSize != 0) {
+        fprintf(stderr, "The alignment must be a multiple of the %llu KB zone size\n",
+                (unsigned long long)topology.ZoneSize / 1024);
+        CommandFailed = TRUE;
+        return TRUE;
+    }
+    if (alignment % sector_size != 0) {
+        fprintf(stderr, "The alignment must be a multiple of the %lu byte sector size\n",
+                (unsigned long)sector_size);
+        CommandFailed = TRUE;
+        return TRUE;
     }
 
-    // Determine partition type enum
-    PedPartitionType part_type = NULL;
-    if (strcmp(part_type_str, "primary") == 0) {
-        part_type = ped_partition_type_get(disk, PED_PARTITION_PRIMARY);
-    } else if (strcmp(part_type_str, "extended") == 0) {
-        part_type = ped_partition_type_get(disk, PED_PARTITION_EXTENDED);
-    } else if (strcmp(part_type_str, "logical") == 0) {
-        part_type = ped_partition_type_get(disk, PED_PARTITION_LOGICAL);
+    // Place the partition in the smallest free extent of the disk that holds
+    // it, or the largest one when no size is given. The disk's extents are
+    // only aligned to its default grain, so one that the device alignment
+    // leaves too small sends the search on to the next bigger one.
+    PFREE_EXTENT_INDEX free_extents = logical ? &CurrentDisk->LogicalFreeExtents
+                                              : &CurrentDisk->PrimaryFreeExtents;
+    ULONGLONG size_sectors = size_mb * 1024 * 1024 / sector_size;
+    FREE_EXTENT extent;
+    BOOL found;
+    if (size_mb > 0) {
+        ULONGLONG wanted = size_sectors;
+        while ((found = FindFreeExtent(free_extents, FREE_EXTENT_BEST_FIT, wanted, &extent))) {
+            wanted = extent.SectorCount + 1;
+            if (align_extent(&topology, alignment, sector_size, logical, &extent) &&
+                extent.SectorCount >= size_sectors)
+                break;
+        }
     } else {
-        fprintf(stderr, "Unknown partition type: %s\n", part_type_str);
-        ped_disk_destroy(disk);
-        ped_device_close(dev);
-        ped_device_destroy(dev);
-        return 1;
+        found = FindFreeExtent(free_extents, FREE_EXTENT_LARGEST, 1, &extent) &&
+                align_extent(&topology, alignment, sector_size, logical, &extent);
     }
 
-    // Find free space on disk
-    PedGeometry *geom = ped_disk_get_free_space(disk);
-    if (!geom) {
-        fprintf(stderr, "No free space available on %s\n", device_path);
-        ped_disk_destroy(disk);
-        ped_device_close(dev);
-        ped_device_destroy(dev);
-        return 1;
+    if (!found) {
+        if (size_mb > 0)
+            fprintf(stderr, "Not enough free space for requested size %llu MB\n", size_mb);
+        else
+            fprintf(stderr, "No aligned free space available on %s\n", CurrentDisk->DeviceName);
+        CommandFailed = TRUE;
+        return TRUE;
     }
 
-    PedSector start_sector = geom->start;
-    PedSector end_sector = geom->end;
-
-    // If size specified, adjust end sector accordingly
+    ULONGLONG start_sector = extent.StartSector;
+    ULONGLONG end_sector = extent.StartSector + extent.SectorCount - 1;
     if (size_mb > 0) {
-        PedSector size_sectors = size_mb_to_sectors(size_mb);
-        if (start_sector + size_sectors - 1 > end_sector) {
-            fprintf(stderr, "Not enough free space for requested size %llu MB\n", size_mb);
-            ped_disk_destroy(disk);
-            ped_device_close(dev);
-            ped_device_destroy(dev);
-            return 1;
-        }
         end_sector = start_sector + size_sectors - 1;
     }
 
-    PedPartition *new_part = ped_partition_new(disk, part_type, part_id, start_sector, end_sector);
-    if (!new_part) {
-        fprintf(stderr, "Failed to create new partition\n");
-        ped_disk_destroy(disk);
-        ped_device_close(dev);
-        ped_device_destroy(dev);
-        return 1;
+    // Zoned devices: the partition must end on a zone boundary too
+    end_sector = AlignPartitionEnd(&topology, (end_sector + 1) * sector_size) / sector_size;
+    if (end_sector <= start_sector) {
+        fprintf(stderr, "The partition must hold at least one %llu KB zone\n",
+                (unsigned long long)topology.ZoneSize / 1024);
+        CommandFailed = TRUE;
+        return TRUE;
+    }
+    end_sector--;
+
+    // Hold the disk from the list change to the kernel update, so nobody
+    // else writes a table between them
+    if (!LockDisk(CurrentDisk, TRUE)) {
+        fprintf(stderr, "Failed to lock %s\n", CurrentDisk->DeviceName);
+        CommandFailed = TRUE;
+        return TRUE;
     }
 
-    if (!ped_disk_add_partition(disk, new_part, ped_constraint_any(dev))) {
-        fprintf(stderr, "Failed to add partition to disk\n");
-        ped_partition_destroy(new_part);
-        ped_disk_destroy(disk);
-        ped_device_close(dev);
-        ped_device_destroy(dev);
-        return 1;
+    PPARTENTRY new_part = CreatePartitionEntry(CurrentDisk, start_sector, end_sector - start_sector + 1,
+                                               part_id ? (UCHAR)part_id : default_id);
+    if (new_part == NULL) {
+        UnlockDisk(CurrentDisk);
+        fprintf(stderr, "Failed to create new partition\n");
+        CommandFailed = TRUE;
+        return TRUE;
     }
 
-    if (!ped_disk_commit_to_dev(disk)) {
+    // Writes the table, registers the partition with the kernel and waits
+    // for its node, so a format run right after this finds it in place
+    if (!NT_SUCCESS(WritePartitions(CurrentDisk))) {
+        DeletePartitionEntry(new_part);
+        CurrentDisk->Dirty = FALSE;
+        UnlockDisk(CurrentDisk);
         fprintf(stderr, "Failed to write partition table to disk\n");
-        ped_partition_destroy(new_part);
-        ped_disk_destroy(disk);
-        ped_device_close(dev);
-        ped_device_destroy(dev);
-        return 1;
+        CommandFailed = TRUE;
+        return TRUE;
     }
 
-    printf("Partition created successfully: %s %s size %llu MB\n", device_path, part_type_str, size_mb);
+    UnlockDisk(CurrentDisk);
 
-    ped_disk_destroy(disk);
-    ped_device_close(dev);
-    ped_device_destroy(dev);
+    CurrentPartition = new_part;
 
-    return 0;
+    char device_name[MAX_PATH];
+    GetPartitionDeviceName(new_part, device_name, sizeof(device_name));
+    printf("Partition created successfully: %s %s size %llu MB\n", device_name, part_type_str,
+           (unsigned long long)(new_part->SectorCount * sector_size / (1024 * 1024)));
+
+    return TRUE;
+}
+
+BOOL CreatePrimaryPartition(int argc, char **argv) {
+    return create_partition(argc, argv, "primary", 0x83);
 }
 
+BOOL CreateExtendedPartition(int argc, char **argv) {
+    return create_partition(argc, argv, "extended", PARTITION_XINT13_EXTENDED);
+}
+
+BOOL CreateLogicalPartition(int argc, char **argv) {
+    return create_partition(argc, argv, "logical", 0x83);
+}
@@ -0,0 +1,575 @@
+/*
+ * PROJECT:         ReactOS DiskPart (Linux port)
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * FILE:            base/system/diskpart/daemon.c
+ * PURPOSE:         Daemon mode: keeps the disk and volume lists in memory,
+ *                  rescans them on block uevents and runs the commands of
+ *                  local clients that connect to a Unix socket.
+ */
+
+/*
+ * Protocol: a client sends interpreter commands, one per line, for example
+ * "select disk 1" or "list partition format=json". Each one is answered by
+ * a header line "<status> <length>" followed by <length> bytes of output.
+ * The status is "ok", "failed" if the command reported an error, or "bye"
+ * after "exit", when the daemon closes the connection. The output holds
+ * what the command wrote to both stdout and stderr. Each client has its own selection of disk, partition,
+ * volume and virtual disk; commands run one at a time.
+ */
+
+#define _GNU_SOURCE
+#include "diskpart.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#define DAEMON_DEFAULT_SOCKET   "/run/ldiskpart.sock"
+#define DAEMON_MAX_CLIENTS      64
+#define DAEMON_RESCAN_DELAY     100     /* ms of quiet after the last uevent */
+#define DAEMON_SEND_TIMEOUT     5       /* seconds */
+
+/*
+ * What a client has selected. Disk and volume numbers are positions in the
+ * lists and change when a rescan finds a disk added or gone, so the
+ * selection is kept by device node and, for a partition, by its start and
+ * GUID.
+ */
+typedef struct _SELECTION_CONTEXT {
+    BOOL DiskSelected;
+    char DiskName[MAX_PATH];
+    dev_t DiskDevice;
+    BOOL PartitionSelected;
+    ULONGLONG PartitionStart;
+    GUID PartitionGuid;
+    BOOL VolumeSelected;
+    char VolumeName[MAX_PATH];
+    char VirtualDisk[MAX_PATH];
+} SELECTION_CONTEXT, *PSELECTION_CONTEXT;
+
+typedef struct _DAEMON_CLIENT {
+    int Socket;
+    size_t Length;
+    char Request[MAX_STRING_SIZE];
+    SELECTION_CONTEXT Selection;
+} DAEMON_CLIENT, *PDAEMON_CLIENT;
+
+static DAEMON_CLIENT Clients[DAEMON_MAX_CLIENTS];
+static ULONG ClientCount;
+static int OutputFile = -1;     /* The output of a command goes here */
+static int SavedStdout = -1;
+static int SavedStderr = -1;
+static BOOL RescanPending;
+static volatile sig_atomic_t DaemonStopping;
+
+/* FUNCTIONS ******************************************************************/
+
+static
+void
+StopDaemon(
+    int Signal)
+{
+    (void)Signal;
+    DaemonStopping = 1;
+}
+
+
+/* The device number of a disk's node, 0 if it is gone */
+static
+dev_t
+GetDiskDevice(
+    const char *DeviceName)
+{
+    struct stat StatBuffer;
+
+    if (stat(DeviceName, &StatBuffer) < 0 || !S_ISBLK(StatBuffer.st_mode))
+        return 0;
+
+    return StatBuffer.st_rdev;
+}
+
+
+static
+PPARTENTRY
+FindSelectedPartition(
+    ListEntry *ListHead,
+    const SELECTION_CONTEXT *Selection)
+{
+    ListEntry *Entry;
+    PPARTENTRY PartEntry;
+
+    for (Entry = ListHead->Flink; Entry != ListHead; Entry = Entry->Flink)
+    {
+        PartEntry = CONTAINING_RECORD(Entry, PARTENTRY, ListEntry);
+        if (PartEntry->IsPartitioned && PartEntry->StartSector == Selection->PartitionStart &&
+            memcmp(&PartEntry->PartitionGuid, &Selection->PartitionGuid, sizeof(GUID)) == 0)
+            return PartEntry;
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Makes the client's selection current. Whatever no longer exists, e.g. a
+ * disk that was unplugged, is dropped from the selection, and the client is
+ * told so in the reply to the command.
+ */
+static
+void
+RestoreSelection(
+    PSELECTION_CONTEXT Selection)
+{
+    ListEntry *Entry;
+    PDISKENTRY DiskEntry;
+    PVOLENTRY VolumeEntry;
+
+    CurrentDisk = NULL;
+    CurrentPartition = NULL;
+    CurrentVolume = NULL;
+
+    for (Entry = DiskListHead.Flink; Selection->DiskSelected && Entry != &DiskListHead; Entry = Entry->Flink)
+    {
+        DiskEntry = CONTAINING_RECORD(Entry, DISKENTRY, ListEntry);
+        if (strcmp(DiskEntry->DeviceName, Selection->DiskName) == 0 &&
+            GetDiskDevice(DiskEntry->DeviceName) == Selection->DiskDevice)
+        {
+            CurrentDisk = DiskEntry;
+            break;
+        }
+    }
+
+    if (CurrentDisk != NULL && Selection->PartitionSelected)
+    {
+        CurrentPartition = FindSelectedPartition(&CurrentDisk->PrimaryPartListHead, Selection);
+        if (CurrentPartition == NULL)
+            CurrentPartition = FindSelectedPartition(&CurrentDisk->LogicalPartListHead, Selection);
+    }
+
+    for (Entry = VolumeListHead.Flink; Selection->VolumeSelected && Entry != &VolumeListHead; Entry = Entry->Flink)
+    {
+        VolumeEntry = CONTAINING_RECORD(Entry, VOLENTRY, ListEntry);
+        if (strcmp(VolumeEntry->DeviceName, Selection->VolumeName) == 0)
+        {
+            CurrentVolume = VolumeEntry;
+            break;
+        }
+    }
+
+    if (Selection->DiskSelected && CurrentDisk == NULL)
+    {
+        printf("The selected disk %s is gone; no disk is selected.\n", Selection->DiskName);
+        Selection->DiskSelected = FALSE;
+        Selection->PartitionSelected = FALSE;
+    }
+    else if (Selection->PartitionSelected && CurrentPartition == NULL)
+    {
+        printf("The selected partition is gone; no partition is selected.\n");
+        Selection->PartitionSelected = FALSE;
+    }
+
+    if (Selection->VolumeSelected && CurrentVolume == NULL)
+    {
+        printf("The selected volume %s is gone; no volume is selected.\n", Selection->VolumeName);
+        Selection->VolumeSelected = FALSE;
+    }
+
+    memcpy(CurrentVirtualDisk, Selection->VirtualDisk, sizeof(CurrentVirtualDisk));
+}
+
+
+static
+void
+SaveSelection(
+    PSELECTION_CONTEXT Selection)
+{
+    memset(Selection, 0, sizeof(*Selection));
+
+    if (CurrentDisk != NULL)
+    {
+        Selection->DiskSelected = TRUE;
+        snprintf(Selection->DiskName, sizeof(Selection->DiskName), "%s", CurrentDisk->DeviceName);
+        Selection->DiskDevice = GetDiskDevice(CurrentDisk->DeviceName);
+    }
+
+    if (CurrentPartition != NULL)
+    {
+        Selection->PartitionSelected = TRUE;
+        Selection->PartitionStart = CurrentPartition->StartSector;
+        Selection->PartitionGuid = CurrentPartition->PartitionGuid;
+    }
+
+    if (CurrentVolume != NULL)
+    {
+        Selection->VolumeSelected = TRUE;
+        snprintf(Selection->VolumeName, sizeof(Selection->VolumeName), "%s", CurrentVolume->DeviceName);
+    }
+
+    memcpy(Selection->VirtualDisk, CurrentVirtualDisk, sizeof(Selection->VirtualDisk));
+}
+
+
+static
+void
+RescanDisks(void)
+{
+    CurrentDisk = NULL;
+    CurrentPartition = NULL;
+    CurrentVolume = NULL;
+
+    DestroyVolumeList();
+    DestroyPartitionList();
+    CreatePartitionList();
+    CreateVolumeList();
+
+    RescanPending = FALSE;
+}
+
+
+static
+int
+OpenListenSocket(
+    const char *SocketPath)
+{
+    struct sockaddr_un Address;
+    struct stat StatBuffer;
+    mode_t OldMask;
+    int fd;
+
+    if (strlen(SocketPath) >= sizeof(Address.sun_path))
+    {
+        printf("The socket path is too long: %s\n", SocketPath);
+        return -1;
+    }
+
+    memset(&Address, 0, sizeof(Address));
+    Address.sun_family = AF_UNIX;
+    strcpy(Address.sun_path, SocketPath);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd < 0)
+        return -1;
+
+    /* A socket left over by a daemon that died is replaced, a live one is not */
+    if (lstat(SocketPath, &StatBuffer) == 0 && S_ISSOCK(StatBuffer.st_mode))
+    {
+        if (connect(fd, (struct sockaddr *)&Address, sizeof(Address)) == 0 || errno == EAGAIN)
+        {
+            printf("Another daemon is already listening on %s.\n", SocketPath);
+            close(fd);
+            return -1;
+        }
+
+        close(fd);
+        unlink(SocketPath);
+
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+        if (fd < 0)
+            return -1;
+    }
+
+    /* Only the owner may send commands that can wipe disks */
+    OldMask = umask(077);
+    if (bind(fd, (struct sockaddr *)&Address, sizeof(Address)) < 0)
+    {
+        umask(OldMask);
+        printf("Cannot listen on %s: %s\n", SocketPath, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    umask(OldMask);
+
+    if (listen(fd, SOMAXCONN) < 0)
+    {
+        close(fd);
+        unlink(SocketPath);
+        return -1;
+    }
+
+    return fd;
+}
+
+
+static
+void
+AcceptClient(
+    int ListenSocket)
+{
+    struct timeval Timeout = { DAEMON_SEND_TIMEOUT, 0 };
+    struct ucred Credentials;
+    socklen_t Length;
+    PDAEMON_CLIENT Client;
+    int fd;
+
+    while ((fd = accept4(ListenSocket, NULL, NULL, SOCK_CLOEXEC)) >= 0)
+    {
+        Length = sizeof(Credentials);
+        if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &Credentials, &Length) < 0 ||
+            (Credentials.uid != 0 && Credentials.uid != geteuid()) ||
+            ClientCount == DAEMON_MAX_CLIENTS)
+        {
+            close(fd);
+            continue;
+        }
+
+        /* A client that does not read its replies must not stall the others */
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &Timeout, sizeof(Timeout));
+
+        Client = &Clients[ClientCount++];
+        memset(Client, 0, sizeof(*Client));
+        Client->Socket = fd;
+    }
+}
+
+
+static
+void
+CloseClient(
+    ULONG Index)
+{
+    close(Clients[Index].Socket);
+
+    ClientCount--;
+    if (Index != ClientCount)
+        Clients[Index] = Clients[ClientCount];
+}
+
+
+/* Sends the header and then the command's output, straight from the file */
+static
+BOOL
+SendReply(
+    PDAEMON_CLIENT Client,
+    const char *Status,
+    off_t Length)
+{
+    char Header[64];
+    off_t Offset = 0;
+    ssize_t Result;
+    int HeaderLength;
+
+    HeaderLength = snprintf(Header, sizeof(Header), "%s %llu\n", Status, (unsigned long long)Length);
+    if (send(Client->Socket, Header, (size_t)HeaderLength, MSG_NOSIGNAL) != HeaderLength)
+        return FALSE;
+
+    while (Offset < Length)
+    {
+        Result = sendfile(Client->Socket, OutputFile, &Offset, (size_t)(Length - Offset));
+        if (Result < 0 && errno == EINTR)
+            continue;
+        if (Result <= 0)
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+/* Runs one command in the client's selection; FALSE closes the connection */
+static
+BOOL
+RunClientCommand(
+    PDAEMON_CLIENT Client,
+    char *Line)
+{
+    const char *Status;
+    BOOL Continue;
+    off_t Length;
+
+    if (RescanPending)
+        RescanDisks();
+
+    if (ftruncate(OutputFile, 0) < 0 || lseek(OutputFile, 0, SEEK_SET) < 0)
+        return FALSE;
+
+    /* Whatever the command prints, with printf or write(), to stdout or stderr, is the reply */
+    fflush(stdout);
+    fflush(stderr);
+    dup2(OutputFile, STDOUT_FILENO);
+    dup2(OutputFile, STDERR_FILENO);
+
+    RestoreSelection(&Client->Selection);
+
+    Continue = InterpretScript(Line);
+
+    fflush(stdout);
+    fflush(stderr);
+    dup2(SavedStdout, STDOUT_FILENO);
+    dup2(SavedStderr, STDERR_FILENO);
+
+    SaveSelection(&Client->Selection);
+
+    Length = lseek(OutputFile, 0, SEEK_CUR);
+    if (Length < 0)
+        return FALSE;
+
+    if (!Continue)
+        Status = "bye";
+    else if (CommandFailed)
+        Status = "failed";
+    else
+        Status = "ok";
+
+    return SendReply(Client, Status, Length) && Continue;
+}
+
+
+static
+BOOL
+ReadClient(
+    PDAEMON_CLIENT Client)
+{
+    ssize_t Result;
+    char *Line, *End;
+    size_t Used;
+
+    Result = recv(Client->Socket, Client->Request + Client->Length,
+                  sizeof(Client->Request) - 1 - Client->Length, MSG_DONTWAIT);
+    if (Result < 0 && (errno == EAGAIN || errno == EINTR))
+        return TRUE;
+    if (Result <= 0)
+        return FALSE;
+
+    Client->Length += (size_t)Result;
+    Client->Request[Client->Length] = '\0';
+
+    Line = Client->Request;
+    while ((End = strchr(Line, '\n')) != NULL)
+    {
+        *End = '\0';
+        if (End > Line && End[-1] == '\r')
+            End[-1] = '\0';
+
+        if (!RunClientCommand(Client, Line))
+            return FALSE;
+
+        Line = End + 1;
+    }
+
+    /* Keep an incomplete line; one that fills the buffer is too long */
+    Used = (size_t)(Line - Client->Request);
+    Client->Length -= Used;
+    memmove(Client->Request, Line, Client->Length);
+
+    return (Client->Length < sizeof(Client->Request) - 1);
+}
+
+
+/*
+ * Serves commands on SocketPath (NULL for /run/ldiskpart.sock) until
+ * SIGTERM or SIGINT. The disk and volume lists must have been created.
+ */
+BOOL
+DaemonMain(
+    const char *SocketPath)
+{
+    struct pollfd PollFds[2 + DAEMON_MAX_CLIENTS];
+    struct sigaction Action;
+    UEVENT Event;
+    int ListenSocket, UeventSocket;
+    ULONG i, Polled;
+    int Count;
+
+    if (SocketPath == NULL)
+        SocketPath = DAEMON_DEFAULT_SOCKET;
+
+    OutputFile = memfd_create("ldiskpart-output", MFD_CLOEXEC);
+    SavedStdout = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+    SavedStderr = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 0);
+    if (OutputFile < 0 || SavedStdout < 0 || SavedStderr < 0)
+    {
+        printf("Cannot create the output file: %s\n", strerror(errno));
+        return FALSE;
+    }
+
+    ListenSocket = OpenListenSocket(SocketPath);
+    if (ListenSocket < 0)
+    {
+        close(OutputFile);
+        close(SavedStdout);
+        close(SavedStderr);
+        return FALSE;
+    }
+
+    UeventSocket = OpenUeventSocket(UEVENT_GROUP_KERNEL);
+    if (UeventSocket < 0)
+        printf("Cannot watch for device changes; use \"rescan\" to refresh.\n");
+
+    /* No SA_RESTART: a signal has to interrupt poll() */
+    memset(&Action, 0, sizeof(Action));
+    Action.sa_handler = StopDaemon;
+    sigemptyset(&Action.sa_mask);
+    sigaction(SIGTERM, &Action, NULL);
+    sigaction(SIGINT, &Action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("Listening on %s\n", SocketPath);
+    fflush(stdout);
+
+    while (!DaemonStopping)
+    {
+        PollFds[0].fd = ListenSocket;
+        PollFds[0].events = POLLIN;
+        PollFds[1].fd = UeventSocket;
+        PollFds[1].events = POLLIN;
+        for (i = 0; i < ClientCount; i++)
+        {
+            PollFds[2 + i].fd = Clients[i].Socket;
+            PollFds[2 + i].events = POLLIN;
+        }
+        Polled = ClientCount;
+
+        /* Rescan once the events of a change have all come in */
+        Count = poll(PollFds, 2 + Polled, RescanPending ? DAEMON_RESCAN_DELAY : -1);
+        if (Count < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        if (Count == 0)
+        {
+            RescanDisks();
+            continue;
+        }
+
+        if (PollFds[1].revents & POLLIN)
+        {
+            while (ReadUevent(UeventSocket, &Event))
+            {
+                if (IsBlockUevent(&Event))
+                    RescanPending = TRUE;
+            }
+        }
+
+        /* From the end, as closing a client moves the last one into its slot */
+        for (i = Polled; i-- > 0;)
+        {
+            if ((PollFds[2 + i].revents & (POLLIN | POLLHUP | POLLERR)) && !ReadClient(&Clients[i]))
+                CloseClient(i);
+        }
+
+        if (PollFds[0].revents & POLLIN)
+            AcceptClient(ListenSocket);
+    }
+
+    while (ClientCount > 0)
+        CloseClient(ClientCount - 1);
+
+    if (UeventSocket >= 0)
+        close(UeventSocket);
+    close(ListenSocket);
+    unlink(SocketPath);
+    close(OutputFile);
+    close(SavedStdout);
+    close(SavedStderr);
+
+    return TRUE;
+}
@@ -1,92 +1,81 @@
+#include "diskpart.h"
+
 #include <stdio.h>
 #include <stdlib.h>
-#include <fcntl.h>
-#include <unistd.h>
 #include <string.h>
-#include <sys/ioctl.h>
-#include <linux/fs.h>  // For BLKGETSIZE64
-
-#define MBR_SIZE 512
-#define PARTITION_TABLE_OFFSET 446
-#define PARTITION_ENTRY_SIZE 16
-#define MAX_PARTITIONS 4
-
-struct mbr_partition_entry {
-    unsigned char boot_flag;
-    unsigned char chs_start[3];
-    unsigned char type;
-    unsigned char chs_end[3];
-    unsigned int lba_start;
-    unsigned int num_sectors;
-} __attribute__((packed));
-
-struct mbr {
-    unsigned char boot_code[446];
-    struct mbr_partition_entry partitions[MAX_PARTITIONS];
-    unsigned short signature;
-} __attribute__((packed));
+#include <strings.h>
 
-int delete_partition(const char *device, int partition_index)
+// delete partition [override]
+BOOL DeletePartition(int argc, char **argv)
 {
-    if (partition_index < 1 || partition_index > MAX_PARTITIONS) {
-        fprintf(stderr, "Partition index must be between 1 and 4\n");
-        return -1;
+    PPARTENTRY PartEntry = CurrentPartition;
+    char MountPoint[MAX_PATH];
+    char DeviceName[MAX_PATH];
+    BOOL Override = FALSE;
+    int i;
+
+    for (i = 2; i < argc; i++) {
+        if (strcasecmp(argv[i], "override") == 0) {
+            Override = TRUE;
+        } else if (strcasecmp(argv[i], "noerr") != 0) {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            CommandFailed = TRUE;
+            return TRUE;
+        }
     }
 
-    int fd = open(device, O_RDWR);
-    if (fd < 0) {
-        perror("Open device");
-        return -1;
+    if (CurrentDisk == NULL) {
+        printf("No disk selected.\n");
+        CommandFailed = TRUE;
+        return TRUE;
     }
 
-    struct mbr mbr_data;
-
-    // Read MBR
-    ssize_t bytes_read = pread(fd, &mbr_data, MBR_SIZE, 0);
-    if (bytes_read != MBR_SIZE) {
-        perror("Read MBR");
-        close(fd);
-        return -1;
+    if (PartEntry == NULL) {
+        printf("No partition selected.\n");
+        CommandFailed = TRUE;
+        return TRUE;
     }
 
-    // Zero out the partition entry
-    memset(&mbr_data.partitions[partition_index -1], 0, sizeof(struct mbr_partition_entry));
-
-    // Write MBR back
-    ssize_t bytes_written = pwrite(fd, &mbr_data, MBR_SIZE, 0);
-    if (bytes_written != MBR_SIZE) {
-        perror("Write MBR");
-        close(fd);
-        return -1;
+    GetPartitionDeviceName(PartEntry, DeviceName, sizeof(DeviceName));
+
+    // A mounted file system would go on writing into free space
+    if (GetPartitionMountPoint(PartEntry, MountPoint, sizeof(MountPoint))) {
+        if (!Override) {
+            fprintf(stderr, "%s is mounted on %s; unmount it or use override\n", DeviceName, MountPoint);
+            CommandFailed = TRUE;
+            return TRUE;
+        }
+        if (!NT_SUCCESS(DismountVolume(PartEntry))) {
+            fprintf(stderr, "Failed to unmount %s\n", MountPoint);
+            CommandFailed = TRUE;
+            return TRUE;
+        }
     }
 
-    // Tell kernel to reread partition table
-    if (ioctl(fd, BLKRRPART) < 0) {
-        perror("ioctl BLKRRPART");
-        // Not fatal, just warn
+    // Hold the disk from the list change to the kernel update
+    if (!LockDisk(CurrentDisk, TRUE)) {
+        fprintf(stderr, "Failed to lock %s\n", CurrentDisk->DeviceName);
+        CommandFailed = TRUE;
+        return TRUE;
     }
 
-    close(fd);
-
-    printf("Partition %d deleted successfully on device %s\n", partition_index, device);
-    return 0;
-}
-
-int main(int argc, char **argv)
-{
-    if (argc < 3) {
-        fprintf(stderr, "Usage: %s <device> <partition_number>\n", argv[0]);
-        fprintf(stderr, "Example: %s /dev/sda 2\n", argv[0]);
-        return 1;
+    if (!DeletePartitionEntry(PartEntry)) {
+        UnlockDisk(CurrentDisk);
+        fprintf(stderr, "Failed to delete partition\n");
+        CommandFailed = TRUE;
+        return TRUE;
     }
 
-    const char *device = argv[1];
-    int partition_index = atoi(argv[2]);
-
-    if (delete_partition(device, partition_index) < 0) {
-        fprintf(stderr, "Failed to delete partition\n");
-        return 1;
+    // Drops just this partition from the kernel; the others stay online
+    if (!NT_SUCCESS(WritePartitions(CurrentDisk))) {
+        UnlockDisk(CurrentDisk);
+        fprintf(stderr, "Failed to write the partition table; rescan the disk\n");
+        CommandFailed = TRUE;
+        return TRUE;
     }
 
-    return 0;
+    UnlockDisk(CurrentDisk);
+
+    printf("Partition %s deleted successfully\n", DeviceName);
+    return TRUE;
 }
@@ -1,29 +1,62 @@
 /*
- * PROJECT:         Linux DiskPart-like tool (simplified)
- * LICENSE:         GPL - Adapted from ReactOS DiskPart detach.c
- * PURPOSE:         Detach disk or volume (stub implementation)
+ * PROJECT:         ReactOS DiskPart (Linux port)
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * FILE:            base/system/diskpart/detach.c
+ * PURPOSE:         Manages all the partitions of the OS in an interactive way.
  */
 
-#include <stdio.h>
-#include <stdbool.h>
+#include "diskpart.h"
 
-// Minimal typedef replacements for Linux compatibility
-typedef int BOOL;
-typedef int INT;
-typedef wchar_t* LPWSTR;
+#include <strings.h>
 
-#define TRUE 1
-#define FALSE 0
+/* FUNCTIONS ******************************************************************/
 
-BOOL detach_main(INT argc, LPWSTR *argv)
+/* detach vdisk [file=<path>] [noerr] */
+BOOL
+detach_main(
+    int argc,
+    char **argv)
 {
-    // In Linux, "detach" might correspond to unmounting or ejecting a disk.
-    // This is just a stub, you can add code to unmount or safely remove the disk here.
+    char *pszSuffix = NULL;
+    char *pszFile = NULL;
+    BOOL bSuccess;
+    int i;
 
-    printf("detach_main called with %d arguments\n", argc);
+    if (argc < 2 || strcasecmp(argv[1], "vdisk") != 0)
+    {
+        printf("Usage: detach vdisk [file=<path>]\n");
+        return TRUE;
+    }
 
-    // Example: You might use 'umount' system call or invoke system("umount /dev/sdX")
-    // For now, just return TRUE as placeholder.
+    for (i = 2; i < argc; i++)
+    {
+        if (HasPrefix(argv[i], "file=", &pszSuffix))
+        {
+            free(pszFile);
+            pszFile = DuplicateQuotedString(pszSuffix);
+        }
+        else if (strcasecmp(argv[i], "noerr") != 0)
+        {
+            printf("Invalid argument: %s\n", argv[i]);
+            free(pszFile);
+            return TRUE;
+        }
+    }
+
+    if (pszFile == NULL && CurrentVirtualDisk[0] == '\0')
+    {
+        printf("No virtual disk selected.\n");
+        CommandFailed = TRUE;
+        return TRUE;
+    }
+
+    bSuccess = DetachVirtualDisk(pszFile ? pszFile : CurrentVirtualDisk);
+    free(pszFile);
+
+    if (bSuccess)
+        printf("\nDiskPart successfully detached the virtual disk file.\n\n");
+    else
+        printf("\nDiskPart failed to detach the virtual disk file.\n\n");
 
     return TRUE;
 }
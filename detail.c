@@ -5,211 +5,190 @@
  * PURPOSE:         Show details about disks, partitions, and volumes
  */
 
-#include <stdio.h>
-#include <stdbool.h>
-#include <stdint.h>
-#include <string.h>
-
-// Dummy linked list struct
-typedef struct ListEntry {
-    struct ListEntry *next;
-    struct ListEntry *prev;
-} ListEntry;
-
-// Disk, Partition, Volume structures simplified
-typedef struct {
-    uint32_t DiskNumber;
-    uint64_t BytesPerSector;
-} DiskEntry;
-
-typedef struct {
-    uint64_t QuadPart;
-} LargeInteger;
-
-typedef struct {
-    uint32_t NumberOfDiskExtents;
-    struct {
-        uint32_t DiskNumber;
-        LargeInteger StartingOffset;
-        LargeInteger ExtentLength;
-    } *Extents;
-} Extents;
-
-typedef struct {
-    Extents *pExtents;
-    ListEntry ListEntry;
-} VolumeEntry;
-
-typedef struct {
-    uint32_t PartitionNumber;
-    uint32_t PartitionType;
-    bool BootIndicator;
-    LargeInteger StartSector;
-    LargeInteger SectorCount;
-    DiskEntry *DiskEntry;
-    ListEntry ListEntry;
-} PartEntry;
-
-// Global heads of lists (dummy initialization)
-ListEntry VolumeListHead = { &VolumeListHead, &VolumeListHead };
-ListEntry DiskListHead = { &DiskListHead, &DiskListHead };
+#include "diskpart.h"
 
-// Current selections (to simulate state)
-DiskEntry *CurrentDisk = NULL;
-PartEntry *CurrentPartition = NULL;
-VolumeEntry *CurrentVolume = NULL;
+/* GLOBALS ********************************************************************/
 
-// Helper macro for linked list traversal
-#define LIST_FOR_EACH(pos, head) \
-    for (pos = (head)->next; pos != (head); pos = pos->next)
+ListEntry VolumeListHead = { &VolumeListHead, &VolumeListHead };
+ListEntry DiskListHead = { &DiskListHead, &DiskListHead };
 
-// Dummy functions to simulate printing and linked list behavior
+PDISKENTRY CurrentDisk = NULL;
+PPARTENTRY CurrentPartition = NULL;
+PVOLENTRY CurrentVolume = NULL;
+
+static const OUTPUT_COLUMN DiskDetailColumns[] = {
+    { "Disk", "disk", FALSE },
+    { "Device", "device", FALSE },
+    { "Type", "type", FALSE },
+    { "Size in Bytes", "size", FALSE },
+    { "Path", "path", FALSE },
+    { "Target", "target", FALSE },
+    { "LUN ID", "lun", FALSE },
+    { "Disk ID", "id", FALSE },
+};
+
+static const OUTPUT_COLUMN PartitionDetailColumns[] = {
+    { "Partition", "partition", FALSE },
+    { "Type", "type", FALSE },
+    { "Active", "active", FALSE },
+    { "Offset in Bytes", "offset", FALSE },
+    { "Size in Bytes", "size", FALSE },
+};
+
+/* FUNCTIONS ******************************************************************/
+
+BOOL
+DetailDisk(
+    int argc,
+    char **argv)
+{
+    OUTPUT_BUFFER Output;
+    OUTPUT_TABLE Table;
+    PVOLUME_LINK Links;
+    ULONG Count, i;
+    ULONGLONG DiskSize;
+
+    if (CurrentDisk == NULL)
+    {
+        printf("No disk selected.\n");
+        CommandFailed = TRUE;
+        return TRUE;
+    }
 
-void PrintVolume(VolumeEntry *vol) {
-    printf("Volume info: %p\n", (void*)vol);
-}
+    InitializeOutputBuffer(&Output);
+    if (!ParseOutputArguments(&Output, argc, argv, 2))
+        return TRUE;
+
+    DiskSize = CurrentDisk->SectorCount * CurrentDisk->BytesPerSector;
+
+    OutputBeginDocument(&Output);
+    InitializeOutputRecord(&Table, &Output, "disk", DiskDetailColumns, ARRAYSIZE(DiskDetailColumns));
+    OutputTableValue(&Table, CurrentDisk->DiskNumber, "%lu", (unsigned long)CurrentDisk->DiskNumber);
+    OutputTableCell(&Table, "%s", CurrentDisk->DeviceName);
+    OutputTableCell(&Table, "%s", (CurrentDisk->PartitionStyle == PARTITION_STYLE_GPT) ? "GPT" :
+                    (CurrentDisk->PartitionStyle == PARTITION_STYLE_MBR) ? "MBR" : "RAW");
+    OutputTableValue(&Table, DiskSize, "%llu", (unsigned long long)DiskSize);
+    OutputTableValue(&Table, CurrentDisk->PathId, "%u", CurrentDisk->PathId);
+    OutputTableValue(&Table, CurrentDisk->TargetId, "%u", CurrentDisk->TargetId);
+    OutputTableValue(&Table, CurrentDisk->Lun, "%u", CurrentDisk->Lun);
+    if (CurrentDisk->PartitionStyle == PARTITION_STYLE_GPT)
+    {
+        OutputTableCell(&Table, "{%08X-%04X-%04X-%02X%02X-%02X%02X%02X%02X%02X%02X}",
+                        (unsigned int)CurrentDisk->DiskGuid.Data1,
+                        CurrentDisk->DiskGuid.Data2, CurrentDisk->DiskGuid.Data3,
+                        CurrentDisk->DiskGuid.Data4[0], CurrentDisk->DiskGuid.Data4[1],
+                        CurrentDisk->DiskGuid.Data4[2], CurrentDisk->DiskGuid.Data4[3],
+                        CurrentDisk->DiskGuid.Data4[4], CurrentDisk->DiskGuid.Data4[5],
+                        CurrentDisk->DiskGuid.Data4[6], CurrentDisk->DiskGuid.Data4[7]);
+    }
+    OutputTable(&Table, NULL);
 
-void PrintDisk(DiskEntry *disk) {
-    printf("Disk %u info\n", disk->DiskNumber);
-}
+    InitializeOutputTable(&Table, &Output, "volumes", VolumeColumns, VOLUME_COLUMN_COUNT);
+    Count = GetDiskVolumes(CurrentDisk, &Links);
+    for (i = 0; i < Count; i++)
+        PrintVolume(&Table, Links[i].VolumeEntry);
+    OutputTable(&Table, "There are no volumes.");
+    OutputEndDocument(&Output);
 
-bool IsDiskInVolume(VolumeEntry *vol, DiskEntry *disk) {
-    if (!vol || !vol->pExtents || !disk)
-        return false;
+    FlushOutputBuffer(&Output);
+    FreeOutputBuffer(&Output);
 
-    for (uint32_t i = 0; i < vol->pExtents->NumberOfDiskExtents; i++) {
-        if (vol->pExtents->Extents[i].DiskNumber == disk->DiskNumber)
-            return true;
-    }
-    return false;
+    return TRUE;
 }
 
-bool IsPartitionInVolume(VolumeEntry *vol, PartEntry *part) {
-    if (!vol || !vol->pExtents || !part || !part->DiskEntry)
-        return false;
 
-    for (uint32_t i = 0; i < vol->pExtents->NumberOfDiskExtents; i++) {
-        if (vol->pExtents->Extents[i].DiskNumber == part->DiskEntry->DiskNumber) {
-            if (vol->pExtents->Extents[i].StartingOffset.QuadPart == part->StartSector.QuadPart * part->DiskEntry->BytesPerSector &&
-                vol->pExtents->Extents[i].ExtentLength.QuadPart == part->SectorCount.QuadPart * part->DiskEntry->BytesPerSector)
-                return true;
-        }
+BOOL
+DetailPartition(
+    int argc,
+    char **argv)
+{
+    OUTPUT_BUFFER Output;
+    OUTPUT_TABLE Table;
+    PVOLUME_LINK Links;
+    ULONG Count, i;
+    ULONGLONG Offset, Size;
+
+    if (CurrentDisk == NULL)
+    {
+        printf("No disk selected.\n");
+        CommandFailed = TRUE;
+        return TRUE;
     }
-    return false;
-}
 
-// DetailDisk equivalent
-int DetailDisk(int argc, char **argv) {
-    if (argc > 2) {
-        fprintf(stderr, "Invalid arguments\n");
-        return 1;
-    }
-    if (!CurrentDisk) {
-        printf("No disk selected\n");
-        return 1;
+    if (CurrentPartition == NULL)
+    {
+        printf("No partition selected.\n");
+        CommandFailed = TRUE;
+        return TRUE;
     }
 
-    printf("\nDisk Signature: %u\n", CurrentDisk->DiskNumber);  // Replace with real sig
-    printf("PathId: N/A\n");    // No equivalent in Linux example
-    printf("TargetId: N/A\n");
-    printf("Lun: N/A\n");
-
-    ListEntry *entry;
-    bool printedHeader = false;
-
-    LIST_FOR_EACH(entry, &VolumeListHead) {
-        VolumeEntry *vol = (VolumeEntry *)((char *)entry - offsetof(VolumeEntry, ListEntry));
-        if (IsDiskInVolume(vol, CurrentDisk)) {
-            if (!printedHeader) {
-                printf("\nVolumes:\n");
-                printedHeader = true;
-            }
-            PrintVolume(vol);
-        }
-    }
-
-    printf("\n");
-    return 0;
+    InitializeOutputBuffer(&Output);
+    if (!ParseOutputArguments(&Output, argc, argv, 2))
+        return TRUE;
+
+    Offset = CurrentPartition->StartSector * CurrentDisk->BytesPerSector;
+    Size = CurrentPartition->SectorCount * CurrentDisk->BytesPerSector;
+
+    OutputBeginDocument(&Output);
+    InitializeOutputRecord(&Table, &Output, "partition", PartitionDetailColumns,
+                           ARRAYSIZE(PartitionDetailColumns));
+    OutputTableValue(&Table, CurrentPartition->PartitionNumber, "%lu",
+                     (unsigned long)CurrentPartition->PartitionNumber);
+    OutputTableCell(&Table, "%02X", CurrentPartition->PartitionType);
+    OutputTableBoolean(&Table, CurrentPartition->BootIndicator);
+    OutputTableValue(&Table, Offset, "%llu", (unsigned long long)Offset);
+    OutputTableValue(&Table, Size, "%llu", (unsigned long long)Size);
+    OutputTable(&Table, NULL);
+
+    InitializeOutputTable(&Table, &Output, "volumes", VolumeColumns, VOLUME_COLUMN_COUNT);
+    Count = GetPartitionVolumes(CurrentPartition, &Links);
+    for (i = 0; i < Count; i++)
+        PrintVolume(&Table, Links[i].VolumeEntry);
+    OutputTable(&Table, "There is no volume associated with this partition.");
+    OutputEndDocument(&Output);
+
+    FlushOutputBuffer(&Output);
+    FreeOutputBuffer(&Output);
+
+    return TRUE;
 }
 
-// DetailPartition equivalent
-int DetailPartition(int argc, char **argv) {
-    if (argc > 2) {
-        fprintf(stderr, "Invalid arguments\n");
-        return 1;
-    }
-    if (!CurrentDisk) {
-        printf("No disk selected\n");
-        return 1;
-    }
-    if (!CurrentPartition) {
-        printf("No partition selected\n");
-        return 1;
-    }
 
-    uint64_t partOffset = CurrentPartition->StartSector.QuadPart * CurrentDisk->BytesPerSector;
-
-    printf("\nPartition Number: %u\n", CurrentPartition->PartitionNumber);
-    printf("Partition Type: %u\n", CurrentPartition->PartitionType);
-    printf("Hidden: N/A\n");
-    printf("Active: %s\n", CurrentPartition->BootIndicator ? "Yes" : "No");
-    printf("Offset: %lu\n", partOffset);
-
-    ListEntry *entry;
-    bool volumeFound = false;
-    bool printedHeader = false;
-
-    LIST_FOR_EACH(entry, &VolumeListHead) {
-        VolumeEntry *vol = (VolumeEntry *)((char *)entry - offsetof(VolumeEntry, ListEntry));
-        if (IsPartitionInVolume(vol, CurrentPartition)) {
-            if (!printedHeader) {
-                printf("\nVolumes:\n");
-                printedHeader = true;
-            }
-            PrintVolume(vol);
-            volumeFound = true;
-        }
+BOOL
+DetailVolume(
+    int argc,
+    char **argv)
+{
+    OUTPUT_BUFFER Output;
+    OUTPUT_TABLE Table;
+    PVOLUME_LINK Links;
+    ULONG Count, i;
+
+    if (CurrentVolume == NULL)
+    {
+        printf("No volume selected.\n");
+        CommandFailed = TRUE;
+        return TRUE;
     }
 
-    if (!volumeFound)
-        printf("No volume found\n");
+    InitializeOutputBuffer(&Output);
+    if (!ParseOutputArguments(&Output, argc, argv, 2))
+        return TRUE;
 
-    printf("\n");
-    return 0;
-}
+    OutputBeginDocument(&Output);
+    InitializeOutputRecord(&Table, &Output, "volume", VolumeColumns, VOLUME_COLUMN_COUNT);
+    PrintVolume(&Table, CurrentVolume);
+    OutputTable(&Table, NULL);
 
-// DetailVolume equivalent
-int DetailVolume(int argc, char **argv) {
-    if (argc > 2) {
-        fprintf(stderr, "Invalid arguments\n");
-        return 1;
-    }
+    InitializeOutputTable(&Table, &Output, "disks", DiskColumns, DISK_COLUMN_COUNT);
+    Count = GetVolumeDisks(CurrentVolume, &Links);
+    for (i = 0; i < Count; i++)
+        PrintDisk(&Table, Links[i].DiskEntry);
+    OutputTable(&Table, "There are no disks attached to this volume.");
+    OutputEndDocument(&Output);
 
-    if (!CurrentVolume) {
-        printf("No volume selected\n");
-        return 1;
-    }
-
-    ListEntry *entry;
-    bool diskFound = false;
-    bool printedHeader = false;
-
-    LIST_FOR_EACH(entry, &DiskListHead) {
-        DiskEntry *disk = (DiskEntry *)((char *)entry - offsetof(DiskEntry, ListEntry));
-        if (IsDiskInVolume(CurrentVolume, disk)) {
-            if (!printedHeader) {
-                printf("\nDisks:\n");
-                printedHeader = true;
-            }
-            PrintDisk(disk);
-            diskFound = true;
-        }
-    }
+    FlushOutputBuffer(&Output);
+    FreeOutputBuffer(&Output);
 
-    if (!diskFound)
-        printf("No disks found\n");
-
-    printf("\n");
-    return 0;
+    return TRUE;
 }
-
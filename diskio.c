@@ -0,0 +1,127 @@
+/*
+ * PROJECT:         ReactOS DiskPart (Linux port)
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * FILE:            base/system/diskpart/diskio.c
+ * PURPOSE:         Raw sector access to the block devices behind DISKENTRYs.
+ */
+
+#include "diskpart.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+/* FUNCTIONS ******************************************************************/
+
+int
+OpenDiskDevice(
+    PDISKENTRY DiskEntry,
+    int Flags)
+{
+    int fd;
+
+    if (DiskEntry == NULL || DiskEntry->DeviceName[0] == '\0')
+    {
+        errno = ENODEV;
+        return -1;
+    }
+
+    fd = open(DiskEntry->DeviceName, Flags | O_CLOEXEC);
+    if (fd < 0)
+        fprintf(stderr, "Failed to open %s: %s\n", DiskEntry->DeviceName, strerror(errno));
+
+    return fd;
+}
+
+
+BOOL
+ReadDiskSectors(
+    int fd,
+    PDISKENTRY DiskEntry,
+    ULONGLONG Lba,
+    ULONG Count,
+    void *Buffer)
+{
+    size_t Length = (size_t)Count * DiskEntry->BytesPerSector;
+    off_t Offset = (off_t)(Lba * DiskEntry->BytesPerSector);
+    size_t Done = 0;
+    ssize_t Result;
+
+    while (Done < Length)
+    {
+        Result = pread(fd, (char *)Buffer + Done, Length - Done, Offset + Done);
+        if (Result < 0 && errno == EINTR)
+            continue;
+        if (Result <= 0)
+        {
+            fprintf(stderr, "Failed to read sector %llu: %s\n",
+                    (unsigned long long)Lba, Result < 0 ? strerror(errno) : "short read");
+            return FALSE;
+        }
+        Done += Result;
+    }
+
+    return TRUE;
+}
+
+
+BOOL
+WriteDiskSectors(
+    int fd,
+    PDISKENTRY DiskEntry,
+    ULONGLONG Lba,
+    ULONG Count,
+    const void *Buffer)
+{
+    size_t Length = (size_t)Count * DiskEntry->BytesPerSector;
+    off_t Offset = (off_t)(Lba * DiskEntry->BytesPerSector);
+    size_t Done = 0;
+    ssize_t Result;
+
+    while (Done < Length)
+    {
+        Result = pwrite(fd, (const char *)Buffer + Done, Length - Done, Offset + Done);
+        if (Result < 0 && errno == EINTR)
+            continue;
+        if (Result <= 0)
+        {
+            fprintf(stderr, "Failed to write sector %llu: %s\n",
+                    (unsigned long long)Lba, Result < 0 ? strerror(errno) : "short write");
+            return FALSE;
+        }
+        Done += Result;
+    }
+
+    return TRUE;
+}
+
+
+BOOL
+ReadPartitionBytes(
+    int fd,
+    PPARTENTRY PartEntry,
+    ULONGLONG Offset,
+    size_t Length,
+    void *Buffer)
+{
+    off_t Base = (off_t)(PartEntry->StartSector * PartEntry->DiskEntry->BytesPerSector);
+    size_t Done = 0;
+    ssize_t Result;
+
+    if (Offset + Length > PartEntry->SectorCount * PartEntry->DiskEntry->BytesPerSector)
+    {
+        errno = EINVAL;
+        return FALSE;
+    }
+
+    while (Done < Length)
+    {
+        Result = pread(fd, (char *)Buffer + Done, Length - Done, Base + Offset + Done);
+        if (Result < 0 && errno == EINTR)
+            continue;
+        if (Result <= 0)
+            return FALSE;
+        Done += Result;
+    }
+
+    return TRUE;
+}
@@ -0,0 +1,282 @@
+/*
+ * PROJECT:         ReactOS DiskPart (Linux port)
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * FILE:            base/system/diskpart/disklock.c
+ * PURPOSE:         Advisory locks on whole-disk block devices.
+ */
+
+#include "diskpart.h"
+
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+/*
+ * Same convention as udev and systemd-repart: a BSD lock on the device
+ * node of the whole disk. Readers of the partition table take it shared,
+ * writers exclusive, and udev does not probe a disk while it is held
+ * exclusively.
+ */
+
+#define LOCK_RETRY_MIN_MS   10
+#define LOCK_RETRY_MAX_MS   500
+
+/* How long to wait for another process; -t on the command line */
+ULONG DiskLockTimeout = 10;
+
+/* FUNCTIONS ******************************************************************/
+
+static
+ULONGLONG
+GetMonotonicMilliseconds(void)
+{
+    struct timespec Now;
+
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return (ULONGLONG)Now.tv_sec * 1000 + Now.tv_nsec / 1000000;
+}
+
+
+/*
+ * Looks the lock on the device node up in /proc/locks to name the process
+ * holding it. Returns 0 if it cannot be told.
+ */
+static
+pid_t
+FindLockHolder(
+    int fd)
+{
+    char Line[256];
+    char Kind[16];
+    unsigned int Major, Minor;
+    unsigned long long Inode;
+    struct stat Stat;
+    FILE *File;
+    int Pid;
+    pid_t Holder = 0;
+
+    if (fstat(fd, &Stat) < 0)
+        return 0;
+
+    File = fopen("/proc/locks", "r");
+    if (File == NULL)
+        return 0;
+
+    /* 1: FLOCK  ADVISORY  WRITE 1234 00:05:321 0 EOF */
+    while (fgets(Line, sizeof(Line), File) != NULL)
+    {
+        if (strstr(Line, "->") != NULL)
+            continue;   /* A waiter, not the holder */
+
+        if (sscanf(Line, "%*s %15s %*s %*s %d %x:%x:%llu", Kind, &Pid, &Major, &Minor, &Inode) != 5)
+            continue;
+
+        if (strcmp(Kind, "FLOCK") == 0 && Pid != getpid() &&
+            makedev(Major, Minor) == Stat.st_dev && Inode == (unsigned long long)Stat.st_ino)
+        {
+            Holder = Pid;
+            break;
+        }
+    }
+
+    fclose(File);
+    return Holder;
+}
+
+
+static
+void
+ReportLockHolder(
+    PDISKENTRY DiskEntry,
+    int fd)
+{
+    char Path[64];
+    char Name[64] = "";
+    FILE *File;
+    pid_t Holder;
+
+    Holder = FindLockHolder(fd);
+    if (Holder == 0)
+    {
+        printf("Disk %lu (%s) is in use by another process.\n",
+               (unsigned long)DiskEntry->DiskNumber, DiskEntry->DeviceName);
+        return;
+    }
+
+    snprintf(Path, sizeof(Path), "/proc/%d/comm", (int)Holder);
+    File = fopen(Path, "r");
+    if (File != NULL)
+    {
+        if (fgets(Name, sizeof(Name), File) != NULL)
+            Name[strcspn(Name, "\n")] = '\0';
+        fclose(File);
+    }
+
+    printf("Disk %lu (%s) is in use by %s (pid %d).\n",
+           (unsigned long)DiskEntry->DiskNumber, DiskEntry->DeviceName,
+           Name[0] != '\0' ? Name : "another process", (int)Holder);
+}
+
+
+/*
+ * Takes the shared lock back after a failed upgrade, which flock() drops
+ * before it tries for the exclusive one. Another process may have got in
+ * between; if it still holds the disk after the timeout, the lock is lost
+ * and the nested holders are told by LockDisk failing.
+ */
+static
+BOOL
+RestoreSharedLock(
+    PDISKENTRY DiskEntry,
+    int fd)
+{
+    ULONGLONG Deadline = GetMonotonicMilliseconds() + (ULONGLONG)DiskLockTimeout * 1000;
+    ULONG Delay = LOCK_RETRY_MIN_MS;
+
+    while (flock(fd, LOCK_SH | LOCK_NB) < 0)
+    {
+        if (errno == EINTR)
+            continue;
+
+        if (errno != EWOULDBLOCK || GetMonotonicMilliseconds() >= Deadline)
+        {
+            printf("Lost the lock of disk %lu (%s); another process may change it.\n",
+                   (unsigned long)DiskEntry->DiskNumber, DiskEntry->DeviceName);
+            close(fd);
+            DiskEntry->LockFd = -1;
+            DiskEntry->LockLost = TRUE;
+            return FALSE;
+        }
+
+        usleep(Delay * 1000);
+        if (Delay < LOCK_RETRY_MAX_MS)
+            Delay *= 2;
+    }
+
+    return TRUE;
+}
+
+
+/*
+ * Takes the lock of the disk, waiting up to DiskLockTimeout seconds for a
+ * conflicting holder. Locks nest: each successful call needs an UnlockDisk,
+ * and an exclusive request while holding it shared upgrades the lock until
+ * the last UnlockDisk.
+ */
+BOOL
+LockDisk(
+    PDISKENTRY DiskEntry,
+    BOOL Exclusive)
+{
+    ULONGLONG Deadline;
+    ULONG Delay = LOCK_RETRY_MIN_MS;
+    BOOL Reported = FALSE;
+    int Operation = Exclusive ? LOCK_EX : LOCK_SH;
+    int Error;
+    int fd;
+
+    if (DiskEntry->LockLost)
+    {
+        printf("The lock of disk %lu was lost; release it before locking again.\n",
+               (unsigned long)DiskEntry->DiskNumber);
+        errno = EBUSY;
+        return FALSE;
+    }
+
+    /* Nested, or without a descriptor to lock (see below) */
+    if (DiskEntry->LockDepth > 0 &&
+        (DiskEntry->LockExclusive || !Exclusive || DiskEntry->LockFd < 0))
+    {
+        DiskEntry->LockDepth++;
+        return TRUE;
+    }
+
+    if (DiskEntry->LockDepth > 0)
+    {
+        fd = DiskEntry->LockFd;
+    }
+    else
+    {
+        fd = open(DiskEntry->DeviceName, O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+        if (fd < 0)
+        {
+            /* Nothing to lock, e.g. without access to the node; do not stand in the way */
+            DiskEntry->LockFd = -1;
+            DiskEntry->LockExclusive = Exclusive;
+            DiskEntry->LockDepth = 1;
+            return TRUE;
+        }
+    }
+
+    Deadline = GetMonotonicMilliseconds() + (ULONGLONG)DiskLockTimeout * 1000;
+
+    while (flock(fd, Operation | LOCK_NB) < 0)
+    {
+        if (errno == EINTR)
+            continue;
+
+        Error = errno;
+        if (Error != EWOULDBLOCK || GetMonotonicMilliseconds() >= Deadline)
+        {
+            if (Error == EWOULDBLOCK)
+            {
+                if (!Reported)
+                    ReportLockHolder(DiskEntry, fd);
+                printf("Gave up waiting for disk %lu after %lu seconds.\n",
+                       (unsigned long)DiskEntry->DiskNumber, (unsigned long)DiskLockTimeout);
+            }
+            else
+            {
+                printf("Failed to lock %s: %s\n", DiskEntry->DeviceName, strerror(Error));
+            }
+
+            /* A failed conversion has already dropped the shared lock */
+            if (DiskEntry->LockDepth == 0)
+                close(fd);
+            else
+                RestoreSharedLock(DiskEntry, fd);
+            errno = (Error == EWOULDBLOCK) ? EBUSY : Error;
+            return FALSE;
+        }
+
+        if (!Reported)
+        {
+            ReportLockHolder(DiskEntry, fd);
+            printf("Waiting up to %lu seconds for it...\n", (unsigned long)DiskLockTimeout);
+            Reported = TRUE;
+        }
+
+        usleep(Delay * 1000);
+        if (Delay < LOCK_RETRY_MAX_MS)
+            Delay *= 2;
+    }
+
+    DiskEntry->LockFd = fd;
+    DiskEntry->LockExclusive = Exclusive;
+    DiskEntry->LockDepth++;
+
+    return TRUE;
+}
+
+
+void
+UnlockDisk(
+    PDISKENTRY DiskEntry)
+{
+    if (DiskEntry->LockDepth == 0)
+        return;
+
+    if (--DiskEntry->LockDepth > 0)
+        return;
+
+    /* Closing the descriptor drops the lock */
+    if (DiskEntry->LockFd >= 0)
+        close(DiskEntry->LockFd);
+
+    DiskEntry->LockFd = -1;
+    DiskEntry->LockExclusive = FALSE;
+    DiskEntry->LockLost = FALSE;
+}
@@ -5,16 +5,13 @@
  * PURPOSE:         Manage partitions in an interactive way (Linux port)
  */
 
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <unistd.h>
-#include <ctype.h>
+#include "diskpart.h"
+#include "ldiskpart.h"
 
-#define MAX_STRING_SIZE 256
+#include <strings.h>
+#include <unistd.h>
 
-// Dummy implementations for missing functions and strings cuz am lazy
-void ShowHeader(void)
+static void ShowHeader(void)
 {
     char hostname[MAX_STRING_SIZE] = {0};
     if (gethostname(hostname, sizeof(hostname)) != 0)
@@ -26,53 +23,7 @@ void ShowHeader(void)
     printf("Current Computer: %s\n\n", hostname);
 }
 
-int InterpretScript(const char *line)
-{
-    // TODO: Implement script interpretation here
-    printf("Interpreting: %s", line);
-    return 1; // success
-}
-
-void InterpretMain(void)
-{
-    // TODO: Implement interactive interpreter here (maybe)
-    printf("Starting interactive mode...\n");
-    // Placeholder loop (implement real CLI parser)
-    char line[256];
-    while (1)
-    {
-        printf("> ");
-        if (!fgets(line, sizeof(line), stdin))
-            break;
-        if (strncmp(line, "exit", 4) == 0)
-            break;
-        InterpretScript(line);
-    }
-}
-
-void CreatePartitionList(void)
-{
-    // TODO: implement disk/partition enumeration on Linux
-    printf("Initializing partition list...\n");
-}
-
-void DestroyPartitionList(void)
-{
-    // Cleanup
-}
-
-void CreateVolumeList(void)
-{
-    // TODO: implement volume list initialization on Linux
-    printf("Initializing volume list...\n");
-}
-
-void DestroyVolumeList(void)
-{
-    // Cleanup
-}
-
-int RunScript(const char *filename)
+static int RunScript(const char *filename)
 {
     FILE *script = fopen(filename, "r");
     if (!script)
@@ -84,7 +35,7 @@ int RunScript(const char *filename)
     char tmp_string[MAX_STRING_SIZE];
     while (fgets(tmp_string, sizeof(tmp_string), script))
     {
-        if (!InterpretScript(tmp_string))
+        if (!LdpRunCommand(tmp_string))
         {
             fclose(script);
             return 0;
@@ -95,19 +46,40 @@ int RunScript(const char *filename)
     return 1; // success
 }
 
+static void RunInteractive(void)
+{
+    char input_line[MAX_STRING_SIZE];
+
+    do
+    {
+        // Linux-friendly prompt
+        printf("diskpart> ");
+        fflush(stdout);
+
+        if (!fgets(input_line, sizeof(input_line), stdin))
+        {
+            printf("\n");
+            break; // EOF or error
+        }
+    } while (LdpRunCommand(input_line));
+}
+
 int main(int argc, char *argv[])
 {
     const char *script = NULL;
-    int timeout = 0;
+    const char *socket_path = NULL;
+    int daemon = 0;
+    int timeout;
     int result = EXIT_SUCCESS;
 
-    CreatePartitionList();
-    CreateVolumeList();
-
     if (argc < 2)
     {
+        if (LdpInitialize() != LDP_SUCCESS)
+            fprintf(stderr, "Warning: The disks could not be enumerated\n");
+        fputs(LdpGetLastErrorMessage(), stderr);
+
         ShowHeader();
-        InterpretMain();
+        RunInteractive();
     }
     else
     {
@@ -121,7 +93,11 @@ int main(int argc, char *argv[])
                 {
                     printf("Usage:\n");
                     printf("  -s <script>    Run script file\n");
-                    printf("  -t <seconds>   Timeout before running script\n");
+                    printf("  -t <seconds>   How long to wait for a disk another instance is using\n");
+                    printf("  --output <text|json|csv>\n");
+                    printf("                 Format of the list and detail commands\n");
+                    printf("  --daemon [socket]\n");
+                    printf("                 Serve commands on a Unix socket (/run/ldiskpart.sock)\n");
                     printf("  -?             Show this help\n");
                     result = EXIT_SUCCESS;
                     goto done;
@@ -146,8 +122,7 @@ int main(int argc, char *argv[])
                     {
                         index++;
                         timeout = atoi(argv[index]);
-                        if (timeout < 0)
-                            timeout = 0;
+                        LdpSetLockTimeout(timeout > 0 ? (uint32_t)timeout : 0);
                     }
                     else
                     {
@@ -156,6 +131,28 @@ int main(int argc, char *argv[])
                         goto done;
                     }
                 }
+                else if (strcasecmp(flag, "-daemon") == 0)
+                {
+                    daemon = 1;
+                    if (index + 1 < argc && argv[index + 1][0] != '-')
+                    {
+                        index++;
+                        socket_path = argv[index];
+                    }
+                }
+                else if (strcasecmp(flag, "-output") == 0)
+                {
+                    if (index + 1 < argc && LdpSetOutputFormat(argv[index + 1]) == LDP_SUCCESS)
+                    {
+                        index++;
+                    }
+                    else
+                    {
+                        fprintf(stderr, "Error: Expected text, json or csv after --output\n");
+                        result = EXIT_FAILURE;
+                        goto done;
+                    }
+                }
                 else
                 {
                     fprintf(stderr, "Error: Unknown flag '%s'\n", flag);
@@ -171,16 +168,21 @@ int main(int argc, char *argv[])
             }
         }
 
+        /* After the flags, so that -t already bounds the waits of the first scan */
+        if (LdpInitialize() != LDP_SUCCESS)
+            fprintf(stderr, "Warning: The disks could not be enumerated\n");
+        fputs(LdpGetLastErrorMessage(), stderr);
+
+        if (daemon)
+        {
+            result = (LdpServe(socket_path) == LDP_SUCCESS) ? EXIT_SUCCESS : EXIT_FAILURE;
+            goto done;
+        }
+
         ShowHeader();
 
         if (script != NULL)
         {
-            if (timeout > 0)
-            {
-                printf("Waiting for %d seconds before running script...\n", timeout);
-                sleep(timeout);
-            }
-
             if (!RunScript(script))
             {
                 result = EXIT_FAILURE;
@@ -198,8 +200,7 @@ int main(int argc, char *argv[])
     printf("Exiting DiskPart tool.\n");
 
 done:
-    DestroyVolumeList();
-    DestroyPartitionList();
+    LdpShutdown();
     return result;
 }
 
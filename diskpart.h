@@ -18,6 +18,11 @@
 #include <stdbool.h>
 #include <string.h>
 #include <errno.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "resource.h"
+#include "diskpart_msg.h"   /* Generated by tools/mkmsgcat */
 
 /* DEBUG STUB ****************************************************************/
 #define DPRINT(...) do {} while (0) // Replace with printf if needed
@@ -37,10 +42,15 @@ typedef int32_t  NTSTATUS;
 
 #define NT_SUCCESS(Status) ((NTSTATUS)(Status) >= 0)
 
+/* WritePartitions wrote the table, but the kernel still has the old one */
+#define STATUS_KERNEL_NOT_SYNCED ((NTSTATUS)1)
+
 #define MAX_STRING_SIZE 1024
 #define MAX_ARGS_COUNT  256
 #define MAX_PATH        260
 
+#define ARRAYSIZE(a) (sizeof(a) / sizeof((a)[0]))
+
 /* Doubly Linked List ********************************************************/
 
 typedef struct ListEntry {
@@ -69,6 +79,9 @@ static inline void RemoveEntryList(ListEntry *entry) {
     entry->Flink->Blink = entry->Blink;
 }
 
+#define CONTAINING_RECORD(address, type, field) \
+    ((type *)((char *)(address) - offsetof(type, field)))
+
 /* Simplified UNICODE_STRING *************************************************/
 
 typedef struct _UNICODE_STRING {
@@ -91,17 +104,56 @@ typedef enum _VOLUME_TYPE {
     VOLUME_TYPE_CDROM,
     VOLUME_TYPE_PARTITION,
     VOLUME_TYPE_REMOVABLE,
+    VOLUME_TYPE_SIMPLE,
+    VOLUME_TYPE_SPANNED,
+    VOLUME_TYPE_STRIPE,
+    VOLUME_TYPE_MIRROR,
+    VOLUME_TYPE_RAID5,
     VOLUME_TYPE_UNKNOWN
 } VOLUME_TYPE;
 
+typedef enum _PARTITION_STYLE {
+    PARTITION_STYLE_MBR,
+    PARTITION_STYLE_GPT,
+    PARTITION_STYLE_RAW
+} PARTITION_STYLE;
+
+typedef enum _ZONE_MODEL {
+    ZONE_MODEL_NONE,
+    ZONE_MODEL_HOST_AWARE,
+    ZONE_MODEL_HOST_MANAGED
+} ZONE_MODEL;
+
+typedef struct _GUID {
+    ULONG Data1;
+    USHORT Data2;
+    USHORT Data3;
+    UCHAR Data4[8];
+} GUID;
+
+/* ON-DISK STRUCTURES ********************************************************/
+
+#define PARTITION_ENTRY_UNUSED  0x00
+#define PARTITION_EXTENDED      0x05
+#define PARTITION_XINT13_EXTENDED 0x0F
+#define PARTITION_LINUX_EXTENDED 0x85
+#define PARTITION_GPT           0xEE
+
+#define IsContainerPartition(Type) \
+    (((Type) == PARTITION_EXTENDED) || \
+     ((Type) == PARTITION_XINT13_EXTENDED) || \
+     ((Type) == PARTITION_LINUX_EXTENDED))
+
+#include "ondisk.h"
+
 /* STRUCT DEFINITIONS ********************************************************/
 
-struct DiskEntry;
+struct _DISKENTRY;
 struct VolumeEntry;
 
 typedef struct _PARTENTRY {
     ListEntry ListEntry;
-    struct DiskEntry *DiskEntry;
+    struct _DISKENTRY *DiskEntry;
 
     ULONGLONG StartSector;
     ULONGLONG SectorCount;
@@ -123,9 +175,35 @@ typedef struct _PARTENTRY {
     BOOL AutoCreate;
     BOOL NeedsCheck;
 
+    GUID PartitionTypeGuid;
+    GUID PartitionGuid;
+
     void *FileSystem;
 } PARTENTRY, *PPARTENTRY;
 
+/* A run of unpartitioned sectors */
+typedef struct _FREE_EXTENT {
+    ULONGLONG StartSector;
+    ULONGLONG SectorCount;
+} FREE_EXTENT, *PFREE_EXTENT;
+
+typedef enum _FREE_EXTENT_FIT {
+    FREE_EXTENT_BEST_FIT,
+    FREE_EXTENT_FIRST_FIT,
+    FREE_EXTENT_LARGEST
+} FREE_EXTENT_FIT;
+
+/* Free extents of a disk, see freespace.c */
+typedef struct _FREE_EXTENT_NODE *PFREE_EXTENT_NODE;
+
+typedef struct _FREE_EXTENT_INDEX {
+    PFREE_EXTENT_NODE ByStart;
+    PFREE_EXTENT_NODE BySize;
+    ULONG Count;
+    ULONG Seed;
+    ULONGLONG TotalSectors;
+} FREE_EXTENT_INDEX, *PFREE_EXTENT_INDEX;
+
 typedef struct _DISK_LAYOUT_LINUX {
     ULONG Signature;
 } DISK_LAYOUT_LINUX, *PDISK_LAYOUT_LINUX;
@@ -133,6 +211,8 @@ typedef struct _DISK_LAYOUT_LINUX {
 typedef struct _DISKENTRY {
     ListEntry ListEntry;
 
+    char DeviceName[MAX_PATH];
+
     ULONGLONG Cylinders;
     ULONG TracksPerCylinder;
     ULONG SectorsPerTrack;
@@ -157,15 +237,43 @@ typedef struct _DISKENTRY {
 
     UNICODE_STRING DriverName;
 
+    PARTITION_STYLE PartitionStyle;
+    GUID DiskGuid;
+
     void *LayoutBuffer;
 
+    /* Of the partition table as last read or written, see RememberPartitionTable */
+    ULONG TableChecksum;
+
     PPARTENTRY ExtendedPartition;
 
     ListEntry PrimaryPartListHead;
     ListEntry LogicalPartListHead;
 
+    /* Mirror the free space entries of the two lists */
+    FREE_EXTENT_INDEX PrimaryFreeExtents;
+    FREE_EXTENT_INDEX LogicalFreeExtents;
+
+    /* Advisory lock on the device node, see disklock.c */
+    int LockFd;
+    ULONG LockDepth;
+    BOOL LockExclusive;
+    BOOL LockLost;
+
 } DISKENTRY, *PDISKENTRY;
 
+/* Where a volume lives: byte ranges on one or more disks */
+typedef struct _DISK_EXTENT {
+    ULONG DiskNumber;
+    ULONGLONG StartingOffset;
+    ULONGLONG ExtentLength;
+} DISK_EXTENT, *PDISK_EXTENT;
+
+typedef struct _VOLUME_DISK_EXTENTS {
+    ULONG NumberOfDiskExtents;
+    DISK_EXTENT Extents[1];
+} VOLUME_DISK_EXTENTS, *PVOLUME_DISK_EXTENTS;
+
 typedef struct _VOLENTRY {
     ListEntry ListEntry;
 
@@ -180,9 +288,121 @@ typedef struct _VOLENTRY {
     VOLUME_TYPE VolumeType;
     ULONGLONG Size;
 
-    void *pExtents;
+    PVOLUME_DISK_EXTENTS pExtents;
 } VOLENTRY, *PVOLENTRY;
 
+#define VOLUME_LINK_NO_PARTITION    ((ULONGLONG)-1)
+
+/* A volume with extents on a disk, see volindex.c */
+typedef struct _VOLUME_LINK {
+    ULONG DiskNumber;
+    ULONG VolumeNumber;
+    ULONGLONG PartitionOffset;      /* Byte offset of a partition the extents overlap */
+    PDISKENTRY DiskEntry;
+    PVOLENTRY VolumeEntry;
+} VOLUME_LINK, *PVOLUME_LINK;
+
+/* A loop device and the image file behind it */
+typedef struct _VDISKENTRY {
+    ULONG LoopNumber;
+    char DeviceName[MAX_PATH];
+    char FileName[MAX_PATH];
+    ULONGLONG Size;
+    ULONG BlockSize;
+    BOOL DirectIo;
+    BOOL ReadOnly;
+} VDISKENTRY, *PVDISKENTRY;
+
+/* I/O limits of a block device, in bytes, as sysfs reports them */
+typedef struct _DISK_TOPOLOGY {
+    ULONG LogicalBlockSize;
+    ULONG PhysicalBlockSize;
+    ULONG MinimumIoSize;
+    ULONG OptimalIoSize;
+    ULONG AlignmentOffset;
+    ULONGLONG ChunkSize;
+    ZONE_MODEL ZoneModel;
+    ULONGLONG ZoneSize;
+    ULONG ZoneCount;
+} DISK_TOPOLOGY, *PDISK_TOPOLOGY;
+
+typedef enum _OUTPUT_FORMAT {
+    OUTPUT_FORMAT_TEXT,
+    OUTPUT_FORMAT_JSON,
+    OUTPUT_FORMAT_CSV
+} OUTPUT_FORMAT;
+
+/* Output of a command, collected and then written with a single write() */
+typedef struct _OUTPUT_BUFFER {
+    char *Data;
+    size_t Length;
+    size_t Allocated;
+    BOOL Failed;
+    OUTPUT_FORMAT Format;
+    ULONG Sections;         /* Tables and records written so far */
+} OUTPUT_BUFFER, *POUTPUT_BUFFER;
+
+#define OUTPUT_MAX_COLUMNS 8
+
+typedef struct _OUTPUT_COLUMN {
+    const char *Title;      /* Heading in text output */
+    const char *Key;        /* Member or field name in JSON and CSV */
+    BOOL AlignRight;
+} OUTPUT_COLUMN;
+
+/*
+ * Rows of a list, or the fields of one object (a record). Text tables keep
+ * their cells until the end, as the column widths grow while cells are
+ * added; everything else streams straight into the output buffer.
+ */
+typedef struct _OUTPUT_TABLE {
+    POUTPUT_BUFFER Output;
+    const char *Name;
+    BOOL IsRecord;
+    const OUTPUT_COLUMN *Columns;
+    ULONG ColumnCount;
+    ULONG Widths[OUTPUT_MAX_COLUMNS];
+    OUTPUT_BUFFER Cells;
+    ULONG RowCount;
+    ULONG CellCount;
+} OUTPUT_TABLE, *POUTPUT_TABLE;
+
+#define UEVENT_BUFFER_SIZE 8192
+
+/* Netlink groups: the kernel's events, and udev's once its rules have run */
+#define UEVENT_GROUP_KERNEL 1
+#define UEVENT_GROUP_UDEV   2
+
+/* A kernel uevent; the strings point into Buffer and may be NULL */
+typedef struct _UEVENT {
+    char Buffer[UEVENT_BUFFER_SIZE];
+    BOOL Processed;             /* Sent by udev after processing it */
+    const char *Action;
+    const char *DevPath;
+    const char *Subsystem;
+    const char *DevName;
+    const char *DevType;
+} UEVENT, *PUEVENT;
+
+#define MAX_WAIT_NODES 64
+
+/* A partition whose device node is about to appear or go away */
+typedef struct _PARTITION_NODE {
+    ULONG Number;
+    BOOL Removed;
+    BOOL Processed;             /* udev has handled its event */
+    char Name[32];              /* Below /dev */
+    ULONG Major;
+    ULONG Minor;
+} PARTITION_NODE, *PPARTITION_NODE;
+
+typedef struct _PARTITION_NODE_WAIT {
+    int fd;                     /* uevent socket, -1 to poll the nodes instead */
+    BOOL Udev;
+    ULONG Count;
+    PARTITION_NODE Nodes[MAX_WAIT_NODES];
+} PARTITION_NODE_WAIT, *PPARTITION_NODE_WAIT;
+
 /* GLOBALS *******************************************************************/
 
 extern ListEntry DiskListHead;
@@ -192,6 +412,7 @@ extern ListEntry VolumeListHead;
 extern PDISKENTRY CurrentDisk;
 extern PPARTENTRY CurrentPartition;
 extern PVOLENTRY CurrentVolume;
+extern char CurrentVirtualDisk[MAX_PATH];
 
 /* COMMAND DISPATCH **********************************************************/
 
@@ -206,6 +427,9 @@ typedef struct _COMMAND {
 
 extern COMMAND cmds[];
 
+/* Set by a command that could not do what it was asked; see InterpretCmd */
+extern BOOL CommandFailed;
+
 /* FUNCTION PROTOTYPES *******************************************************/
 
 /* Each of these is one command source file */
@@ -216,13 +440,22 @@ BOOL attach_main(int argc, char **argv);
 BOOL attributes_main(int argc, char **argv);
 BOOL automount_main(int argc, char **argv);
 BOOL break_main(int argc, char **argv);
+
+void ConfigureIoBufferPool(size_t Limit, BOOL HugePages);
+void *AcquireIoBuffer(size_t Size);
+void ReleaseIoBuffer(void *Address);
+
 BOOL clean_main(int argc, char **argv);
+BOOL CleanDisk(PDISKENTRY DiskEntry, BOOL All, ULONG Jobs);
 BOOL compact_main(int argc, char **argv);
 BOOL convert_main(int argc, char **argv);
 
 BOOL CreateExtendedPartition(int argc, char **argv);
 BOOL CreateLogicalPartition(int argc, char **argv);
 BOOL CreatePrimaryPartition(int argc, char **argv);
+BOOL CreateVirtualDisk(int argc, char **argv);
+
+BOOL DaemonMain(const char *SocketPath);
 
 BOOL DeleteDisk(int argc, char **argv);
 BOOL DeletePartition(int argc, char **argv);
@@ -233,14 +466,43 @@ BOOL DetailDisk(int argc, char **argv);
 BOOL DetailPartition(int argc, char **argv);
 BOOL DetailVolume(int argc, char **argv);
 
+extern ULONG DiskLockTimeout;
+BOOL LockDisk(PDISKENTRY DiskEntry, BOOL Exclusive);
+void UnlockDisk(PDISKENTRY DiskEntry);
+
+int OpenDiskDevice(PDISKENTRY DiskEntry, int Flags);
+BOOL ReadDiskSectors(int fd, PDISKENTRY DiskEntry, ULONGLONG Lba, ULONG Count, void *Buffer);
+BOOL WriteDiskSectors(int fd, PDISKENTRY DiskEntry, ULONGLONG Lba, ULONG Count, const void *Buffer);
+BOOL ReadPartitionBytes(int fd, PPARTENTRY PartEntry, ULONGLONG Offset, size_t Length, void *Buffer);
+
 BOOL DumpDisk(int argc, char **argv);
 BOOL DumpPartition(int argc, char **argv);
 
 BOOL expand_main(int argc, char **argv);
 BOOL extend_main(int argc, char **argv);
 BOOL filesystems_main(int argc, char **argv);
+long long FindLastSetBit(const UCHAR *Bitmap, size_t BitCount);
+BOOL QueryFileSystemUsedSectors(PPARTENTRY PartEntry, ULONGLONG *UsedSectors, const char **FileSystemName);
+typedef void (*FREE_RANGE_CALLBACK)(void *Context, ULONGLONG Offset, ULONGLONG Length);
+BOOL EnumerateFileSystemFreeRanges(PPARTENTRY PartEntry, FREE_RANGE_CALLBACK Callback, void *Context);
+BOOL GetFileSystemAllocationBitmap(PPARTENTRY PartEntry, ULONG SectorsPerBit, UCHAR **Bitmap);
 BOOL format_main(int argc, char **argv);
+BOOL FormatPartition(PPARTENTRY PartEntry, const char *FileSystem, const char *Label, BOOL Quick);
+void ProbeFileSystems(void);
+void ProbeVolumeFileSystems(PVOLENTRY *Volumes, ULONG VolumeCount);
+
+void InitializeFreeExtentIndex(PFREE_EXTENT_INDEX Index);
+void DestroyFreeExtentIndex(PFREE_EXTENT_INDEX Index);
+BOOL InsertFreeExtent(PFREE_EXTENT_INDEX Index, ULONGLONG StartSector, ULONGLONG SectorCount);
+BOOL RemoveFreeExtent(PFREE_EXTENT_INDEX Index, ULONGLONG StartSector, ULONGLONG SectorCount);
+BOOL FindFreeExtent(const FREE_EXTENT_INDEX *Index, FREE_EXTENT_FIT Fit, ULONGLONG SectorCount, PFREE_EXTENT Extent);
+
 BOOL gpt_main(int argc, char **argv);
+ULONG GptCrc32(const void *Buffer, size_t Length);
+void GptCreateGuid(GUID *Guid);
+BOOL GptIsNullGuid(const GUID *Guid);
+void GptTypeFromMbrType(UCHAR PartitionType, GUID *TypeGuid);
+UCHAR MbrTypeFromGptType(const GUID *TypeGuid);
 BOOL help_main(int argc, char **argv);
 void HelpCommandList(void);
 BOOL HelpCommand(PCOMMAND pCommand);
@@ -248,16 +510,28 @@ BOOL import_main(int argc, char **argv);
 BOOL inactive_main(int argc, char **argv);
 BOOL InterpretScript(char *line);
 BOOL InterpretCmd(int argc, char **argv);
-void InterpretMain(void);
+
+BOOL KernelAddPartition(int fd, ULONG Number, ULONGLONG Start, ULONGLONG Length);
+BOOL KernelDeletePartition(int fd, ULONG Number);
+BOOL KernelResizePartition(int fd, ULONG Number, ULONGLONG Start, ULONGLONG Length);
+BOOL SyncKernelPartitions(PDISKENTRY DiskEntry, PPARTITION_NODE_WAIT Wait);
+void BeginPartitionNodeWait(PPARTITION_NODE_WAIT Wait);
+void ExpectPartitionNode(PPARTITION_NODE_WAIT Wait, int fd, ULONG Number, BOOL Removed);
+BOOL EndPartitionNodeWait(PPARTITION_NODE_WAIT Wait);
 
 BOOL ListDisk(int argc, char **argv);
 BOOL ListPartition(int argc, char **argv);
 BOOL ListVolume(int argc, char **argv);
 BOOL ListVirtualDisk(int argc, char **argv);
-void PrintDisk(PDISKENTRY DiskEntry);
-void PrintVolume(PVOLENTRY VolumeEntry);
+void PrintDisk(POUTPUT_TABLE Table, PDISKENTRY DiskEntry);
+void PrintVolume(POUTPUT_TABLE Table, PVOLENTRY VolumeEntry);
+extern const OUTPUT_COLUMN DiskColumns[];
+extern const OUTPUT_COLUMN VolumeColumns[];
+#define DISK_COLUMN_COUNT   4
+#define VOLUME_COLUMN_COUNT 6
 
 BOOL merge_main(int argc, char **argv);
+BOOL move_main(int argc, char **argv);
 BOOL IsDecString(char *pszDecString);
 BOOL IsHexString(char *pszHexString);
 BOOL HasPrefix(char *pszString, char *pszPrefix, char **pszSuffix);
@@ -265,15 +539,55 @@ ULONGLONG RoundingDivide(ULONGLONG Dividend, ULONGLONG Divisor);
 char *DuplicateQuotedString(char *pszInString);
 char *DuplicateString(char *pszInString);
 
+BOOL OpenMessageCatalog(const char *FileName);
+void CloseMessageCatalog(void);
+const char *LoadMessageString(ULONG Id);
+
 BOOL offline_main(int argc, char **argv);
 BOOL online_main(int argc, char **argv);
 
+extern OUTPUT_FORMAT DefaultOutputFormat;
+BOOL SetDefaultOutputFormat(const char *Name);
+void InitializeOutputBuffer(POUTPUT_BUFFER Buffer);
+void FreeOutputBuffer(POUTPUT_BUFFER Buffer);
+BOOL ParseOutputArguments(POUTPUT_BUFFER Buffer, int argc, char **argv, int First);
+void OutputBytes(POUTPUT_BUFFER Buffer, const char *Data, size_t Length);
+void OutputPrintf(POUTPUT_BUFFER Buffer, const char *Format, ...);
+void OutputBeginDocument(POUTPUT_BUFFER Buffer);
+void OutputEndDocument(POUTPUT_BUFFER Buffer);
+BOOL FlushOutputBuffer(POUTPUT_BUFFER Buffer);
+void InitializeOutputTable(POUTPUT_TABLE Table, POUTPUT_BUFFER Output, const char *Name,
+                           const OUTPUT_COLUMN *Columns, ULONG ColumnCount);
+void InitializeOutputRecord(POUTPUT_TABLE Table, POUTPUT_BUFFER Output, const char *Name,
+                            const OUTPUT_COLUMN *Columns, ULONG ColumnCount);
+void OutputTableRow(POUTPUT_TABLE Table, BOOL Selected);
+void OutputTableCell(POUTPUT_TABLE Table, const char *Format, ...);
+void OutputTableValue(POUTPUT_TABLE Table, ULONGLONG Value, const char *Format, ...);
+void OutputTableBoolean(POUTPUT_TABLE Table, BOOL Value);
+void OutputTable(POUTPUT_TABLE Table, const char *EmptyText);
+
 ULONGLONG AlignDown(ULONGLONG Value, ULONG Alignment);
+void GetPartitionDeviceName(PPARTENTRY PartEntry, char *Buffer, size_t Size);
+BOOL ParseMountInfoLine(const char *Line, dev_t *Device, char *MountPoint, size_t Size);
+BOOL GetPartitionMountPoint(PPARTENTRY PartEntry, char *MountPoint, size_t Size);
+BOOL ClaimPartition(PPARTENTRY PartEntry, int *Fd);
 NTSTATUS CreatePartitionList(void);
 void DestroyPartitionList(void);
+BOOL ClearPartitionList(PDISKENTRY DiskEntry);
+BOOL RebuildFreeSpaceEntries(PDISKENTRY DiskEntry);
+PPARTENTRY CreatePartitionEntry(PDISKENTRY DiskEntry, ULONGLONG StartSector, ULONGLONG SectorCount,
+                                UCHAR PartitionType);
+BOOL DeletePartitionEntry(PPARTENTRY PartEntry);
+ULONGLONG GetPartitionGrowLimit(PPARTENTRY PartEntry);
+void GetPartitionMoveRange(PPARTENTRY PartEntry, ULONGLONG *First, ULONGLONG *End);
+BOOL MovePartitionEntry(PPARTENTRY PartEntry, ULONGLONG NewStartSector);
+void FillMbrPartitionEntry(PMBR_PARTITION_ENTRY Entry, UCHAR Type, ULONGLONG Start, ULONGLONG Count, BOOL Boot);
 NTSTATUS CreateVolumeList(void);
 void DestroyVolumeList(void);
 NTSTATUS WritePartitions(PDISKENTRY DiskEntry);
+void RememberPartitionTable(PDISKENTRY DiskEntry);
+BOOL WriteMbrTable(PDISKENTRY DiskEntry, int fd, PPARTENTRY *Slots, PPARTENTRY *Logical, ULONG LogicalCount);
+BOOL WriteGptTable(PDISKENTRY DiskEntry, int fd, PPARTENTRY *Slots);
 void UpdateDiskLayout(PDISKENTRY DiskEntry);
 PPARTENTRY GetPrevUnpartitionedEntry(PPARTENTRY PartEntry);
 PPARTENTRY GetNextUnpartitionedEntry(PPARTENTRY PartEntry);
@@ -282,7 +596,18 @@ NTSTATUS DismountVolume(PPARTENTRY PartEntry);
 PVOLENTRY GetVolumeFromPartition(PPARTENTRY PartEntry);
 void RemoveVolume(PVOLENTRY VolumeEntry);
 
+BOOL BuildVolumeIndex(void);
+void DestroyVolumeIndex(void);
+void RemoveVolumeLinks(PVOLENTRY VolumeEntry);
+ULONG GetDiskVolumes(PDISKENTRY DiskEntry, PVOLUME_LINK *Links);
+ULONG GetPartitionVolumes(PPARTENTRY PartEntry, PVOLUME_LINK *Links);
+ULONG GetVolumeDisks(PVOLENTRY VolumeEntry, PVOLUME_LINK *Links);
+
 BOOL recover_main(int argc, char **argv);
+BOOL RelocateSectors(PDISKENTRY DiskEntry, ULONGLONG SourceLba, ULONGLONG TargetLba,
+                     ULONGLONG SectorCount, const UCHAR *Bitmap, ULONG SectorsPerBit);
+BOOL RelocatePartition(PPARTENTRY PartEntry, ULONGLONG NewStartSector,
+                       const UCHAR *Bitmap, ULONG SectorsPerBit);
 BOOL remove_main(int argc, char **argv);
 BOOL repair_main(int argc, char **argv);
 BOOL rescan_main(int argc, char **argv);
@@ -292,9 +617,33 @@ BOOL san_main(int argc, char **argv);
 BOOL SelectDisk(int argc, char **argv);
 BOOL SelectPartition(int argc, char **argv);
 BOOL SelectVolume(int argc, char **argv);
+BOOL SelectVirtualDisk(int argc, char **argv);
 
 BOOL setid_main(int argc, char **argv);
 BOOL shrink_main(int argc, char **argv);
+BOOL snapshot_main(int argc, char **argv);
+
+BOOL AddStackedVolumes(ULONG *VolumeNumber);
+
+BOOL ReadSysfsString(const char *Path, char *Buffer, size_t Size);
+ULONGLONG ReadSysfsNumber(const char *Path);
+BOOL GetDiskTopology(const char *DeviceName, PDISK_TOPOLOGY Topology);
+ULONGLONG GetPartitionAlignment(const DISK_TOPOLOGY *Topology);
+ULONGLONG AlignPartitionStart(const DISK_TOPOLOGY *Topology, ULONGLONG Alignment, ULONGLONG Offset);
+ULONGLONG AlignPartitionEnd(const DISK_TOPOLOGY *Topology, ULONGLONG Offset);
+
+int OpenUeventSocket(ULONG Group);
+BOOL ReadUevent(int fd, PUEVENT Event);
+BOOL IsBlockUevent(const UEVENT *Event);
+
 BOOL UniqueIdDisk(int argc, char **argv);
 
+BOOL AttachVirtualDisk(const char *FileName, BOOL ReadOnly, PVDISKENTRY VDiskEntry);
+BOOL DetachVirtualDisk(const char *FileName);
+BOOL ExpandVirtualDisk(const char *FileName, ULONGLONG NewSize);
+typedef BOOL (*VDISK_CALLBACK)(void *Context, PVDISKENTRY Entry);
+int EnumerateVirtualDisks(const char *FileName, VDISK_CALLBACK Callback, void *Context);
+BOOL FindAttachedVirtualDisk(const char *FileName, PVDISKENTRY VDiskEntry);
+BOOL SnapshotVirtualDisk(const char *Source, const char *Target, BOOL *Cloned);
+
 #endif /* DISKPART_H */
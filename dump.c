@@ -1,98 +1,160 @@
-#include <stdio.h>
-#include <stdlib.h>
+/*
+ * PROJECT:         ReactOS DiskPart (Linux port)
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * FILE:            base/system/diskpart/dump.c
+ * PURPOSE:         Dumps a sector of the selected disk or partition.
+ */
+
+#define _GNU_SOURCE
+#include "diskpart.h"
+
+#include <ctype.h>
 #include <fcntl.h>
 #include <unistd.h>
-#include <string.h>
-#include <ctype.h>
-#include <errno.h>
-#include <stdint.h>
 
-static void HexDump(const unsigned char *addr, int len)
+/* FUNCTIONS ******************************************************************/
+
+static
+void
+HexDump(
+    const UCHAR *Data,
+    ULONG Length)
 {
-    char buffer[17];
-    int i;
+    char Text[17];
+    ULONG i;
 
-    buffer[16] = '\0';
+    Text[16] = '\0';
 
-    for (i = 0; i < len; i++)
+    for (i = 0; i < Length; i++)
     {
         if ((i % 16) == 0)
-            printf(" %04x ", i);
-
-        printf(" %02x", addr[i]);
+            printf(" %04lx ", (unsigned long)i);
 
-        if (!isprint(addr[i]))
-            buffer[i % 16] = '.';
-        else
-            buffer[i % 16] = addr[i];
+        printf(" %02x", Data[i]);
+        Text[i % 16] = isprint(Data[i]) ? Data[i] : '.';
 
         if ((i % 16) == 15)
-            printf("  %s\n", buffer);
+            printf("  %s\n", Text);
     }
 
-    // Print last line if not complete 16 bytes
-    if ((len % 16) != 0)
+    /* Pad out an incomplete last line */
+    if ((Length % 16) != 0)
     {
-        int rem = 16 - (len % 16);
-        for (i = 0; i < rem; i++)
+        Text[Length % 16] = '\0';
+        for (i = Length % 16; i < 16; i++)
             printf("   ");
-        printf("  %s\n", buffer);
+        printf("  %s\n", Text);
     }
 }
 
-int DumpDisk(const char *device, int64_t sector, size_t sector_size)
+
+/* Reads and prints one sector; Lba is relative to the start of the disk */
+static
+void
+DumpSector(
+    PDISKENTRY DiskEntry,
+    ULONGLONG Lba)
 {
-    int fd = open(device, O_RDONLY);
-    if (fd < 0)
+    ULONG BytesPerSector = DiskEntry->BytesPerSector;
+    UCHAR *Sector;
+    int fd;
+
+    Sector = AcquireIoBuffer(BytesPerSector);
+    if (Sector == NULL)
     {
-        perror("Failed to open device");
-        return -1;
+        printf("Out of memory.\n");
+        return;
     }
 
-    unsigned char *buffer = malloc(sector_size);
-    if (!buffer)
+    /* The pool buffer is aligned, so we see the medium rather than the page cache */
+    fd = open(DiskEntry->DeviceName, O_RDONLY | O_DIRECT | O_CLOEXEC);
+    if (fd < 0)
+        fd = OpenDiskDevice(DiskEntry, O_RDONLY);
+
+    if (fd >= 0)
     {
-        perror("Failed to allocate buffer");
+        if (ReadDiskSectors(fd, DiskEntry, Lba, 1, Sector))
+        {
+            printf("\nSector %llu:\n\n", (unsigned long long)Lba);
+            HexDump(Sector, BytesPerSector);
+            printf("\n");
+        }
         close(fd);
-        return -1;
     }
 
-    off_t offset = sector * sector_size;
+    ReleaseIoBuffer(Sector);
+}
+
+
+static
+BOOL
+ParseSector(
+    int argc,
+    char **argv,
+    ULONGLONG SectorCount,
+    ULONGLONG *Sector)
+{
+    if (argc != 3 || !IsDecString(argv[2]))
+        return FALSE;
 
-    ssize_t bytes_read = pread(fd, buffer, sector_size, offset);
-    if (bytes_read != (ssize_t)sector_size)
+    *Sector = strtoull(argv[2], NULL, 10);
+    if (*Sector >= SectorCount)
     {
-        perror("Failed to read sector");
-        free(buffer);
-        close(fd);
-        return -1;
+        printf("The sector is beyond the end (%llu sectors).\n", (unsigned long long)SectorCount);
+        return FALSE;
     }
 
-    HexDump(buffer, sector_size);
-
-    free(buffer);
-    close(fd);
-    return 0;
+    return TRUE;
 }
 
-int main(int argc, char *argv[])
+
+BOOL
+DumpDisk(
+    int argc,
+    char **argv)
 {
-    if (argc != 4)
+    ULONGLONG Sector;
+
+    if (CurrentDisk == NULL)
+    {
+        printf("No disk selected.\n");
+        CommandFailed = TRUE;
+        return TRUE;
+    }
+
+    if (!ParseSector(argc, argv, CurrentDisk->SectorCount, &Sector))
     {
-        fprintf(stderr, "Usage: %s <device> <sector_number> <sector_size>\n", argv[0]);
-        fprintf(stderr, "Example: %s /dev/sda 0 512\n", argv[0]);
-        return 1;
+        printf("Usage: dump disk <sector>\n");
+        return TRUE;
     }
 
-    const char *device = argv[1];
-    int64_t sector = atoll(argv[2]);
-    size_t sector_size = (size_t)atoi(argv[3]);
+    DumpSector(CurrentDisk, Sector);
+
+    return TRUE;
+}
 
-    if (sector < 0 || sector_size == 0)
+
+BOOL
+DumpPartition(
+    int argc,
+    char **argv)
+{
+    ULONGLONG Sector;
+
+    if (CurrentPartition == NULL)
     {
-        fprintf(stderr, "Invalid sector number or sector size\n");
-        return 1;
+        printf("No partition selected.\n");
+        CommandFailed = TRUE;
+        return TRUE;
     }
 
-    return DumpDisk(device, sector, sector_size);
+    if (!ParseSector(argc, argv, CurrentPartition->SectorCount, &Sector))
+    {
+        printf("Usage: dump partition <sector>\n");
+        return TRUE;
+    }
+
+    DumpSector(CurrentPartition->DiskEntry, CurrentPartition->StartSector + Sector);
+
+    return TRUE;
 }
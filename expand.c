@@ -8,13 +8,69 @@
 
 #include "diskpart.h"
 
-BOOL expand_main(INT argc, LPWSTR *argv)
+#include <strings.h>
+
+/* expand vdisk maximum=<MB> [file=<path>] [noerr] */
+BOOL expand_main(int argc, char **argv)
 {
-    // TODO: Implement partition expansion for Linux using ioctl or libparted
-    // For now, stub returning success.
+    char *pszSuffix = NULL;
+    char *pszFile = NULL;
+    ULONGLONG MaxSize = 0;
+    BOOL bSuccess;
+    int i;
+
+    if (argc < 2 || strcasecmp(argv[1], "vdisk") != 0)
+    {
+        printf("Usage: expand vdisk maximum=<MB> [file=<path>]\n");
+        return TRUE;
+    }
+
+    for (i = 2; i < argc; i++)
+    {
+        if (HasPrefix(argv[i], "maximum=", &pszSuffix))
+        {
+            if (!IsDecString(pszSuffix))
+            {
+                printf("Invalid size: %s\n", pszSuffix);
+                free(pszFile);
+                return TRUE;
+            }
+            MaxSize = strtoull(pszSuffix, NULL, 10);
+        }
+        else if (HasPrefix(argv[i], "file=", &pszSuffix))
+        {
+            free(pszFile);
+            pszFile = DuplicateQuotedString(pszSuffix);
+        }
+        else if (strcasecmp(argv[i], "noerr") != 0)
+        {
+            printf("Invalid argument: %s\n", argv[i]);
+            free(pszFile);
+            return TRUE;
+        }
+    }
+
+    if (MaxSize == 0)
+    {
+        printf("Usage: expand vdisk maximum=<MB> [file=<path>]\n");
+        free(pszFile);
+        return TRUE;
+    }
+
+    if (pszFile == NULL && CurrentVirtualDisk[0] == '\0')
+    {
+        printf("No virtual disk selected.\n");
+        CommandFailed = TRUE;
+        return TRUE;
+    }
+
+    bSuccess = ExpandVirtualDisk(pszFile ? pszFile : CurrentVirtualDisk, MaxSize * 1048576ULL);
+    free(pszFile);
 
-    (void)argc; // silence unused parameter warnings
-    (void)argv;
+    if (bSuccess)
+        printf("\nDiskPart successfully expanded the virtual disk file.\n\n");
+    else
+        printf("\nDiskPart failed to expand the virtual disk file.\n\n");
 
     return TRUE;
 }
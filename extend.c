@@ -8,11 +8,332 @@
 
 #include "diskpart.h"
 
-BOOL extend_main(INT argc, LPWSTR *argv)
+#include <limits.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/statvfs.h>
+
+/* Online resize interfaces of the mounted filesystems */
+#define EXT4_IOC_RESIZE_FS _IOW('f', 16, uint64_t)
+
+typedef struct _XFS_FSOP_GEOM_V1 {
+    uint32_t blocksize;
+    uint32_t rtextsize;
+    uint32_t agblocks;
+    uint32_t agcount;
+    uint32_t logblocks;
+    uint32_t sectsize;
+    uint32_t inodesize;
+    uint32_t imaxpct;
+    uint64_t datablocks;
+    uint64_t rtblocks;
+    uint64_t rtextents;
+    uint64_t logstart;
+    unsigned char uuid[16];
+    uint32_t sunit;
+    uint32_t swidth;
+    int32_t version;
+    uint32_t flags;
+    uint32_t logsectsize;
+    uint32_t rtsectsize;
+    uint32_t dirblocksize;
+} XFS_FSOP_GEOM_V1;
+
+typedef struct _XFS_GROWFS_DATA {
+    uint64_t newblocks;
+    uint32_t imaxpct;
+} XFS_GROWFS_DATA;
+
+#define XFS_IOC_FSGEOMETRY_V1  _IOR('X', 100, XFS_FSOP_GEOM_V1)
+#define XFS_IOC_FSGROWFSDATA   _IOW('X', 110, XFS_GROWFS_DATA)
+
+/* Granularity of the allocation map used when the partition has to move */
+#define EXTEND_MOVE_BYTES_PER_BIT (1024 * 1024)
+
+/* FUNCTIONS ******************************************************************/
+
+/*
+ * Moves an unmounted partition down to the start of the free space in front
+ * of it, so that the free space ends up behind it, and writes the new table.
+ */
+static
+BOOL
+MovePartitionDown(
+    PPARTENTRY PartEntry,
+    ULONGLONG NewStartSector)
+{
+    PDISKENTRY DiskEntry = PartEntry->DiskEntry;
+    ULONG SectorsPerBit = EXTEND_MOVE_BYTES_PER_BIT / DiskEntry->BytesPerSector;
+    UCHAR *Bitmap = NULL;
+    BOOL Success;
+    int fd;
+
+    if (!GetFileSystemAllocationBitmap(PartEntry, SectorsPerBit, &Bitmap))
+        Bitmap = NULL;
+
+    if (!LockDisk(DiskEntry, TRUE))
+    {
+        free(Bitmap);
+        return FALSE;
+    }
+
+    if (!ClaimPartition(PartEntry, &fd))
+    {
+        UnlockDisk(DiskEntry);
+        free(Bitmap);
+        printf("The partition is in use (%s); DiskPart cannot move it.\n", strerror(errno));
+        return FALSE;
+    }
+
+    Success = RelocatePartition(PartEntry, NewStartSector, Bitmap, SectorsPerBit);
+    free(Bitmap);
+
+    if (fd >= 0)
+        close(fd);
+
+    if (Success && !NT_SUCCESS(WritePartitions(DiskEntry)))
+    {
+        printf("The data was moved to sector %llu but the partition table could not be written.\n",
+               (unsigned long long)NewStartSector);
+        printf("Do not use the partition until its table entry points there.\n");
+        Success = FALSE;
+    }
+
+    UnlockDisk(DiskEntry);
+
+    return Success;
+}
+
+
+/*
+ * Grows a mounted ext4 or XFS filesystem to the size of its partition.
+ * Returns FALSE if the partition is not mounted or the filesystem cannot be
+ * grown online.
+ */
+static
+BOOL
+GrowMountedFileSystem(
+    PPARTENTRY PartEntry)
+{
+    ULONGLONG NewBytes = PartEntry->SectorCount * PartEntry->DiskEntry->BytesPerSector;
+    char MountPoint[MAX_PATH];
+    struct statvfs Stat;
+    XFS_FSOP_GEOM_V1 Geometry;
+    XFS_GROWFS_DATA GrowData;
+    uint64_t NewBlocks;
+    BOOL Success = FALSE;
+    int fd;
+
+    if (!GetPartitionMountPoint(PartEntry, MountPoint, sizeof(MountPoint)))
+    {
+        printf("The partition is not mounted; its filesystem was not extended.\n");
+        return FALSE;
+    }
+
+    fd = open(MountPoint, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        perror("Failed to open mount point");
+        return FALSE;
+    }
+
+    if (ioctl(fd, XFS_IOC_FSGEOMETRY_V1, &Geometry) == 0)
+    {
+        memset(&GrowData, 0, sizeof(GrowData));
+        GrowData.newblocks = NewBytes / Geometry.blocksize;
+        GrowData.imaxpct = Geometry.imaxpct;
+
+        if (GrowData.newblocks <= Geometry.datablocks ||
+            ioctl(fd, XFS_IOC_FSGROWFSDATA, &GrowData) == 0)
+            Success = TRUE;
+        else
+            perror("ioctl XFS_IOC_FSGROWFSDATA");
+    }
+    else if (fstatvfs(fd, &Stat) == 0 && Stat.f_bsize != 0)
+    {
+        NewBlocks = NewBytes / Stat.f_bsize;
+
+        if (ioctl(fd, EXT4_IOC_RESIZE_FS, &NewBlocks) == 0)
+            Success = TRUE;
+        else
+            perror("ioctl EXT4_IOC_RESIZE_FS");
+    }
+
+    close(fd);
+
+    return Success;
+}
+
+
+BOOL
+extend_main(
+    int argc,
+    char **argv)
 {
-    // TODO: Implement partition extension logic on Linux using ioctl or libparted
-    (void)argc; // avoid unused param warnings
-    (void)argv;
+    PDISKENTRY DiskEntry = CurrentDisk;
+    PPARTENTRY PartEntry = CurrentPartition;
+    PPARTENTRY NextEntry;
+    ULONGLONG Size = 0, NewCount, Delta, End, Limit, First, MoveEnd, NewStart;
+    char MountPoint[MAX_PATH];
+    NTSTATUS Status;
+    BOOL bFileSystemOnly = FALSE;
+    char *pszSuffix = NULL;
+    int i;
+
+    if (DiskEntry == NULL)
+    {
+        printf("No disk selected.\n");
+        CommandFailed = TRUE;
+        return TRUE;
+    }
+
+    if (PartEntry == NULL || !PartEntry->IsPartitioned ||
+        IsContainerPartition(PartEntry->PartitionType))
+    {
+        printf("No partition selected.\n");
+        CommandFailed = TRUE;
+        return TRUE;
+    }
+
+    for (i = 1; i < argc; i++)
+    {
+        if (HasPrefix(argv[i], "size=", &pszSuffix))
+        {
+            if (!IsDecString(pszSuffix))
+            {
+                printf("Invalid size: %s\n", pszSuffix);
+                CommandFailed = TRUE;
+                return TRUE;
+            }
+            Size = strtoull(pszSuffix, NULL, 10);
+        }
+        else if (strcasecmp(argv[i], "filesystem") == 0)
+        {
+            bFileSystemOnly = TRUE;
+        }
+        else if (strcasecmp(argv[i], "noerr") != 0)
+        {
+            printf("Invalid argument: %s\n", argv[i]);
+            CommandFailed = TRUE;
+            return TRUE;
+        }
+    }
+
+    if (!bFileSystemOnly)
+    {
+        /* Everything up to the next partition, even a gap too small for a free space entry */
+        End = PartEntry->StartSector + PartEntry->SectorCount;
+        Limit = GetPartitionGrowLimit(PartEntry);
+
+        /* size= is in MB; without it the partition takes the whole gap */
+        Delta = 0;
+        if (Size != 0)
+            Delta = (Size <= ULLONG_MAX / 1048576ULL) ? Size * 1048576ULL / DiskEntry->BytesPerSector
+                                                      : ULLONG_MAX;
+
+        /* Too little room behind it: an unmounted partition can first slide into the space in front */
+        if (Limit <= End || Delta > Limit - End)
+        {
+            GetPartitionMoveRange(PartEntry, &First, &MoveEnd);
+            if (PartEntry->LogicalPartition)
+                First++;
+            NewStart = AlignDown(First + DiskEntry->SectorAlignment - 1, DiskEntry->SectorAlignment);
+
+            if (NewStart < PartEntry->StartSector &&
+                Limit - NewStart - PartEntry->SectorCount > Delta &&
+                !GetPartitionMountPoint(PartEntry, MountPoint, sizeof(MountPoint)))
+            {
+                if (!MovePartitionDown(PartEntry, NewStart))
+                {
+                    printf("\nDiskPart failed to move the partition to make room for it.\n\n");
+                    CommandFailed = TRUE;
+                    return TRUE;
+                }
+                End = PartEntry->StartSector + PartEntry->SectorCount;
+            }
+        }
+
+        if (Limit <= End)
+        {
+            printf("\nThere is no free space directly behind the selected partition.\n\n");
+            CommandFailed = TRUE;
+            return TRUE;
+        }
+
+        if (Size == 0)
+        {
+            Delta = Limit - End;
+        }
+        else if (Delta > Limit - End)
+        {
+            printf("\nThere is not enough free space to extend the partition by %llu MB.\n\n",
+                   (unsigned long long)Size);
+            CommandFailed = TRUE;
+            return TRUE;
+        }
+
+        /* Keep the new end on the disk's alignment if the gap allows it */
+        NewCount = AlignDown(End + Delta, DiskEntry->SectorAlignment) - PartEntry->StartSector;
+        if (NewCount > PartEntry->SectorCount)
+            Delta = NewCount - PartEntry->SectorCount;
+        NewCount = PartEntry->SectorCount + Delta;
+
+        if (!RemoveFreeExtent(PartEntry->LogicalPartition ? &DiskEntry->LogicalFreeExtents
+                                                           : &DiskEntry->PrimaryFreeExtents,
+                              End, Delta))
+        {
+            printf("Out of memory.\n");
+            CommandFailed = TRUE;
+            return TRUE;
+        }
+
+        /* The free space entry behind it, if any, loses what the partition took */
+        PartEntry->SectorCount = NewCount;
+        NextEntry = GetNextUnpartitionedEntry(PartEntry);
+        if (NextEntry != NULL && NextEntry->StartSector < End + Delta)
+        {
+            if (NextEntry->StartSector + NextEntry->SectorCount <= End + Delta)
+            {
+                RemoveEntryList(&NextEntry->ListEntry);
+                free(NextEntry);
+            }
+            else
+            {
+                NextEntry->SectorCount -= End + Delta - NextEntry->StartSector;
+                NextEntry->StartSector = End + Delta;
+            }
+        }
+
+        DiskEntry->Dirty = TRUE;
+
+        Status = WritePartitions(DiskEntry);
+        if (!NT_SUCCESS(Status))
+        {
+            printf("\nDiskPart failed to write the new partition size.\n\n");
+            CommandFailed = TRUE;
+            return TRUE;
+        }
+
+        /* A filesystem grown past the end the kernel knows of would be cut off */
+        if (Status == STATUS_KERNEL_NOT_SYNCED)
+        {
+            printf("\nDiskPart extended the partition, but not its filesystem.\n\n");
+            CommandFailed = TRUE;
+            return TRUE;
+        }
+    }
+
+    if (GrowMountedFileSystem(PartEntry))
+        printf("\nDiskPart successfully extended the volume.\n\n");
+    else if (!bFileSystemOnly)
+        printf("\nDiskPart extended the partition, but not its filesystem.\n\n");
+    else
+    {
+        printf("\nDiskPart failed to extend the filesystem.\n\n");
+        CommandFailed = TRUE;
+    }
 
     return TRUE;
 }
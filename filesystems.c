@@ -6,14 +6,10 @@
  * PROGRAMMERS:     Adapted by Radiump
  */
 
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
+#include "diskpart.h"
+
 #include <sys/statfs.h>
 #include <mntent.h>
-#include <errno.h>
-
-#define MAX_MOUNT_LEN 256
 
 // Show filesystem info for the device mounted at CurrentVolume->DeviceName
 static int ShowFileSystemInfo(const char *device)
@@ -42,7 +38,6 @@ static int ShowFileSystemInfo(const char *device)
             if (statfs(mnt->mnt_dir, &fsinfo) == 0)
             {
                 unsigned long block_size = fsinfo.f_bsize;
-                unsigned long cluster_size = block_size * fsinfo.f_bfree; // Approximate cluster size
 
                 printf("Block size: %lu bytes\n", block_size);
                 printf("Free blocks: %lu\n", (unsigned long)fsinfo.f_bfree);
@@ -96,19 +91,16 @@ static void ShowInstalledFileSystems(void)
     printf("\n");
 }
 
-// Simulated CurrentVolume struct
-typedef struct {
-    char DeviceName[MAX_MOUNT_LEN];
-} VOLENTRY;
-
-VOLENTRY *CurrentVolume = NULL;
-
-int filesystems_main(int argc, char **argv)
+BOOL filesystems_main(int argc, char **argv)
 {
+    (void)argc;
+    (void)argv;
+
     if (CurrentVolume == NULL)
     {
         printf("No volume selected. Use select volume first.\n");
-        return 1;
+        CommandFailed = TRUE;
+        return TRUE;
     }
 
     printf("\n");
@@ -118,23 +110,5 @@ int filesystems_main(int argc, char **argv)
         ShowInstalledFileSystems();
     }
 
-    return 0;
+    return TRUE;
 }
-
-int main(int argc, char **argv)
-{
-    // Example usage
-    VOLENTRY vol;
-    if (argc < 2)
-    {
-        fprintf(stderr, "Usage: %s <device>\n", argv[0]);
-        return 1;
-    }
-
-    strncpy(vol.DeviceName, argv[1], MAX_MOUNT_LEN - 1);
-    vol.DeviceName[MAX_MOUNT_LEN - 1] = '\0';
-    CurrentVolume = &vol;
-
-    return filesystems_main(argc, argv);
-}
-
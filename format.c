@@ -6,57 +6,227 @@
  * PROGRAMMERS:     Adapted by Radiump
  */
 
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
+#include "diskpart.h"
 
-typedef int BOOL;
-#define TRUE 1
-#define FALSE 0
+#include <strings.h>
+#include <unistd.h>
+#include <sys/wait.h>
 
-static void usage(const char *progname)
+/* The mkfs tools disagree on how to pass a label or skip their prompts */
+typedef struct _MKFS_OPTIONS {
+    const char *FileSystem;
+    const char *LabelOption;
+    const char *ForceOption;    /* Overwrite an old file system without asking */
+    const char *QuickOption;    /* Skip zeroing, for the tools that zero by default */
+} MKFS_OPTIONS;
+
+static const MKFS_OPTIONS MkfsOptions[] = {
+    { "ext2",  "-L", "-F", NULL },
+    { "ext3",  "-L", "-F", NULL },
+    { "ext4",  "-L", "-F", NULL },
+    { "xfs",   "-L", "-f", NULL },
+    { "btrfs", "-L", "-f", NULL },
+    { "f2fs",  "-l", "-f", NULL },
+    { "vfat",  "-n", NULL, NULL },
+    { "exfat", "-L", NULL, NULL },
+    { "ntfs",  "-L", "-F", "-Q" },
+};
+
+/* FUNCTIONS ******************************************************************/
+
+/* Runs a command without a shell in between; returns its exit status or -1 */
+static
+int
+RunProgram(
+    char **Arguments)
 {
-    printf("Usage: %s <device> <filesystem_type>\n", progname);
-    printf("Example: %s /dev/sda1 ext4\n", progname);
+    pid_t Child;
+    int Status;
+
+    fflush(stdout);
+
+    Child = fork();
+    if (Child < 0)
+    {
+        perror("fork");
+        return -1;
+    }
+
+    if (Child == 0)
+    {
+        execvp(Arguments[0], Arguments);
+        _exit(127);
+    }
+
+    while (waitpid(Child, &Status, 0) < 0)
+    {
+        if (errno != EINTR)
+            return -1;
+    }
+
+    return WIFEXITED(Status) ? WEXITSTATUS(Status) : -1;
 }
 
-BOOL format_main(int argc, char **argv)
+
+/*
+ * Creates a file system on a partition with the matching mkfs tool. Quick
+ * only matters to the tools that zero the volume unless told otherwise.
+ */
+BOOL
+FormatPartition(
+    PPARTENTRY PartEntry,
+    const char *FileSystem,
+    const char *Label,
+    BOOL Quick)
 {
-    if (argc < 3)
+    const MKFS_OPTIONS *Options = NULL;
+    char DeviceName[MAX_PATH];
+    char MountPoint[MAX_PATH];
+    char Program[32];
+    char *Arguments[8];
+    PVOLENTRY VolumeEntry;
+    int Count = 0;
+    int Status;
+    size_t i;
+
+    for (i = 0; i < ARRAYSIZE(MkfsOptions); i++)
+    {
+        if (strcasecmp(MkfsOptions[i].FileSystem, FileSystem) == 0)
+        {
+            Options = &MkfsOptions[i];
+            break;
+        }
+    }
+
+    if (Options == NULL)
     {
-        usage(argv[0]);
+        printf("The file system %s is not supported.\n", FileSystem);
         return FALSE;
     }
 
-    const char *device = argv[1];
-    const char *fs_type = argv[2];
+    if (!PartEntry->IsPartitioned || IsContainerPartition(PartEntry->PartitionType))
+    {
+        printf("Only a data partition can be formatted.\n");
+        return FALSE;
+    }
+
+    if (PartEntry->New || PartEntry->DiskEntry->Dirty)
+    {
+        printf("The partition table has changes that are not written yet.\n");
+        return FALSE;
+    }
 
-    // Basic sanity check on device name
-    if (strncmp(device, "/dev/", 5) != 0)
+    GetPartitionDeviceName(PartEntry, DeviceName, sizeof(DeviceName));
+    if (GetPartitionMountPoint(PartEntry, MountPoint, sizeof(MountPoint)))
     {
-        fprintf(stderr, "Error: Invalid device name '%s'. Must start with /dev/\n", device);
+        printf("The volume is mounted at %s; dismount it first.\n", MountPoint);
         return FALSE;
     }
 
-    char cmd[256];
-    snprintf(cmd, sizeof(cmd), "mkfs -t %s %s", fs_type, device);
+    snprintf(Program, sizeof(Program), "mkfs.%s", Options->FileSystem);
+    Arguments[Count++] = Program;
+    if (Options->ForceOption != NULL)
+        Arguments[Count++] = (char *)Options->ForceOption;
+    if (Quick && Options->QuickOption != NULL)
+        Arguments[Count++] = (char *)Options->QuickOption;
+    if (Label != NULL && Label[0] != '\0')
+    {
+        Arguments[Count++] = (char *)Options->LabelOption;
+        Arguments[Count++] = (char *)Label;
+    }
+    Arguments[Count++] = DeviceName;
+    Arguments[Count] = NULL;
+
+    if (!LockDisk(PartEntry->DiskEntry, TRUE))
+        return FALSE;
+
+    Status = RunProgram(Arguments);
+
+    UnlockDisk(PartEntry->DiskEntry);
 
-    printf("Formatting device %s with filesystem %s...\n", device, fs_type);
-    int ret = system(cmd);
-    if (ret != 0)
+    if (Status == 127)
     {
-        fprintf(stderr, "Format command failed with exit code %d\n", ret);
+        printf("%s was not found.\n", Program);
         return FALSE;
     }
+    if (Status != 0)
+    {
+        printf("%s failed on %s.\n", Program, DeviceName);
+        return FALSE;
+    }
+
+    snprintf(PartEntry->FileSystemName, sizeof(PartEntry->FileSystemName), "%s", Options->FileSystem);
+    snprintf(PartEntry->VolumeLabel, sizeof(PartEntry->VolumeLabel), "%s", Label ? Label : "");
+    PartEntry->FormatState = Formatted;
+
+    VolumeEntry = GetVolumeFromPartition(PartEntry);
+    if (VolumeEntry != NULL)
+    {
+        free(VolumeEntry->pszFilesystem);
+        free(VolumeEntry->pszLabel);
+        VolumeEntry->pszFilesystem = strdup(PartEntry->FileSystemName);
+        VolumeEntry->pszLabel = (Label && Label[0] != '\0') ? strdup(Label) : NULL;
+    }
 
-    printf("Format completed successfully.\n");
     return TRUE;
 }
 
-// For testing as standalone program
-#ifdef TEST_FORMAT_MAIN
-int main(int argc, char **argv)
+
+BOOL
+format_main(
+    int argc,
+    char **argv)
 {
-    return format_main(argc, argv) ? 0 : 1;
+    const char *FileSystem = "ext4";
+    char *Label = NULL;
+    BOOL Quick = FALSE;
+    size_t Length;
+    int i;
+
+    if (CurrentPartition == NULL)
+    {
+        printf("No partition selected.\n");
+        CommandFailed = TRUE;
+        return TRUE;
+    }
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strncasecmp(argv[i], "fs=", 3) == 0)
+        {
+            FileSystem = argv[i] + 3;
+        }
+        else if (strncasecmp(argv[i], "label=", 6) == 0)
+        {
+            Label = argv[i] + 6;
+
+            /* label="My Data" */
+            Length = strlen(Label);
+            if (Length >= 2 && Label[0] == '"' && Label[Length - 1] == '"')
+            {
+                Label[Length - 1] = '\0';
+                Label++;
+            }
+        }
+        else if (strcasecmp(argv[i], "quick") == 0)
+        {
+            Quick = TRUE;
+        }
+        else
+        {
+            printf("Usage: format [fs=<file system>] [label=<label>] [quick]\n");
+            CommandFailed = TRUE;
+            return TRUE;
+        }
+    }
+
+    if (FormatPartition(CurrentPartition, FileSystem, Label, Quick))
+        printf("\nDiskPart successfully formatted the volume.\n");
+    else
+    {
+        printf("\nDiskPart failed to format the volume.\n");
+        CommandFailed = TRUE;
+    }
+
+    return TRUE;
 }
-#endif
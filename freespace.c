@@ -0,0 +1,426 @@
+/*
+ * PROJECT:         ReactOS DiskPart (Linux port)
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * FILE:            base/system/diskpart/freespace.c
+ * PURPOSE:         Index of the free extents of a disk for placing partitions
+ *                  and reporting free space.
+ */
+
+#include "diskpart.h"
+
+/*
+ * Every free extent is a node in two treaps: ByStart, ordered by start
+ * sector, for coalescing and first fit, and BySize, ordered by size and then
+ * start, for best fit and largest free. A ByStart node also records the
+ * largest extent below it, so first fit skips subtrees too small for the
+ * request. Updates and queries take O(log n) expected time.
+ */
+
+#define BY_START    0
+#define BY_SIZE     1
+
+typedef struct _FREE_EXTENT_NODE {
+    FREE_EXTENT Extent;
+    ULONG Priority;
+    ULONGLONG MaxSectorCount;                   /* Largest extent of the ByStart subtree */
+    struct _FREE_EXTENT_NODE *Child[2][2];      /* [BY_START or BY_SIZE][left, right] */
+} FREE_EXTENT_NODE;
+
+/* FUNCTIONS ******************************************************************/
+
+void
+InitializeFreeExtentIndex(
+    PFREE_EXTENT_INDEX Index)
+{
+    memset(Index, 0, sizeof(*Index));
+    Index->Seed = 0x9E3779B9;
+}
+
+
+static
+void
+FreeNodes(
+    PFREE_EXTENT_NODE Node)
+{
+    if (Node == NULL)
+        return;
+
+    FreeNodes(Node->Child[BY_START][0]);
+    FreeNodes(Node->Child[BY_START][1]);
+    free(Node);
+}
+
+
+void
+DestroyFreeExtentIndex(
+    PFREE_EXTENT_INDEX Index)
+{
+    FreeNodes(Index->ByStart);
+    InitializeFreeExtentIndex(Index);
+}
+
+
+static
+BOOL
+ExtentLess(
+    int Tree,
+    const FREE_EXTENT *A,
+    const FREE_EXTENT *B)
+{
+    if (Tree == BY_SIZE && A->SectorCount != B->SectorCount)
+        return A->SectorCount < B->SectorCount;
+
+    return A->StartSector < B->StartSector;
+}
+
+
+static
+void
+UpdateNode(
+    PFREE_EXTENT_NODE Node)
+{
+    PFREE_EXTENT_NODE Left = Node->Child[BY_START][0];
+    PFREE_EXTENT_NODE Right = Node->Child[BY_START][1];
+
+    Node->MaxSectorCount = Node->Extent.SectorCount;
+    if (Left != NULL && Left->MaxSectorCount > Node->MaxSectorCount)
+        Node->MaxSectorCount = Left->MaxSectorCount;
+    if (Right != NULL && Right->MaxSectorCount > Node->MaxSectorCount)
+        Node->MaxSectorCount = Right->MaxSectorCount;
+}
+
+
+/* Splits a tree into the nodes ordered before Key and the others */
+static
+void
+SplitTree(
+    int Tree,
+    PFREE_EXTENT_NODE Root,
+    const FREE_EXTENT *Key,
+    PFREE_EXTENT_NODE *Left,
+    PFREE_EXTENT_NODE *Right)
+{
+    if (Root == NULL)
+    {
+        *Left = *Right = NULL;
+        return;
+    }
+
+    if (ExtentLess(Tree, &Root->Extent, Key))
+    {
+        SplitTree(Tree, Root->Child[Tree][1], Key, &Root->Child[Tree][1], Right);
+        *Left = Root;
+    }
+    else
+    {
+        SplitTree(Tree, Root->Child[Tree][0], Key, Left, &Root->Child[Tree][0]);
+        *Right = Root;
+    }
+
+    UpdateNode(Root);
+}
+
+
+/* Joins two trees, all of Left ordered before all of Right */
+static
+PFREE_EXTENT_NODE
+MergeTrees(
+    int Tree,
+    PFREE_EXTENT_NODE Left,
+    PFREE_EXTENT_NODE Right)
+{
+    if (Left == NULL)
+        return Right;
+    if (Right == NULL)
+        return Left;
+
+    if (Left->Priority > Right->Priority)
+    {
+        Left->Child[Tree][1] = MergeTrees(Tree, Left->Child[Tree][1], Right);
+        UpdateNode(Left);
+        return Left;
+    }
+
+    Right->Child[Tree][0] = MergeTrees(Tree, Left, Right->Child[Tree][0]);
+    UpdateNode(Right);
+    return Right;
+}
+
+
+static
+PFREE_EXTENT_NODE
+InsertNode(
+    int Tree,
+    PFREE_EXTENT_NODE Root,
+    PFREE_EXTENT_NODE Node)
+{
+    if (Root == NULL)
+        return Node;
+
+    if (Node->Priority > Root->Priority)
+    {
+        SplitTree(Tree, Root, &Node->Extent, &Node->Child[Tree][0], &Node->Child[Tree][1]);
+        UpdateNode(Node);
+        return Node;
+    }
+
+    if (ExtentLess(Tree, &Node->Extent, &Root->Extent))
+        Root->Child[Tree][0] = InsertNode(Tree, Root->Child[Tree][0], Node);
+    else
+        Root->Child[Tree][1] = InsertNode(Tree, Root->Child[Tree][1], Node);
+
+    UpdateNode(Root);
+    return Root;
+}
+
+
+static
+PFREE_EXTENT_NODE
+DeleteNode(
+    int Tree,
+    PFREE_EXTENT_NODE Root,
+    PFREE_EXTENT_NODE Node)
+{
+    if (Root == Node)
+        return MergeTrees(Tree, Node->Child[Tree][0], Node->Child[Tree][1]);
+
+    if (ExtentLess(Tree, &Node->Extent, &Root->Extent))
+        Root->Child[Tree][0] = DeleteNode(Tree, Root->Child[Tree][0], Node);
+    else
+        Root->Child[Tree][1] = DeleteNode(Tree, Root->Child[Tree][1], Node);
+
+    UpdateNode(Root);
+    return Root;
+}
+
+
+static
+void
+LinkExtent(
+    PFREE_EXTENT_INDEX Index,
+    PFREE_EXTENT_NODE Node)
+{
+    /* xorshift32; the priorities only need to be independent of the keys */
+    Index->Seed ^= Index->Seed << 13;
+    Index->Seed ^= Index->Seed >> 17;
+    Index->Seed ^= Index->Seed << 5;
+    Node->Priority = Index->Seed;
+
+    memset(Node->Child, 0, sizeof(Node->Child));
+    UpdateNode(Node);
+
+    Index->ByStart = InsertNode(BY_START, Index->ByStart, Node);
+    Index->BySize = InsertNode(BY_SIZE, Index->BySize, Node);
+    Index->Count++;
+    Index->TotalSectors += Node->Extent.SectorCount;
+}
+
+
+static
+void
+UnlinkExtent(
+    PFREE_EXTENT_INDEX Index,
+    PFREE_EXTENT_NODE Node)
+{
+    Index->ByStart = DeleteNode(BY_START, Index->ByStart, Node);
+    Index->BySize = DeleteNode(BY_SIZE, Index->BySize, Node);
+    Index->Count--;
+    Index->TotalSectors -= Node->Extent.SectorCount;
+}
+
+
+/* The last extent starting before Sector */
+static
+PFREE_EXTENT_NODE
+FindLastBefore(
+    const FREE_EXTENT_INDEX *Index,
+    ULONGLONG Sector)
+{
+    PFREE_EXTENT_NODE Node = Index->ByStart, Found = NULL;
+
+    while (Node != NULL)
+    {
+        if (Node->Extent.StartSector < Sector)
+        {
+            Found = Node;
+            Node = Node->Child[BY_START][1];
+        }
+        else
+        {
+            Node = Node->Child[BY_START][0];
+        }
+    }
+
+    return Found;
+}
+
+
+/*
+ * Adds a free extent, merging it with the extents it touches. Sectors that
+ * are already free are not counted twice.
+ */
+BOOL
+InsertFreeExtent(
+    PFREE_EXTENT_INDEX Index,
+    ULONGLONG StartSector,
+    ULONGLONG SectorCount)
+{
+    ULONGLONG EndSector = StartSector + SectorCount;
+    PFREE_EXTENT_NODE Node, Other;
+
+    if (SectorCount == 0)
+        return TRUE;
+
+    Node = malloc(sizeof(*Node));
+    if (Node == NULL)
+        return FALSE;
+
+    /* Absorb the extents that overlap or touch it, from the back */
+    while ((Other = FindLastBefore(Index, EndSector + 1)) != NULL &&
+           Other->Extent.StartSector + Other->Extent.SectorCount >= StartSector)
+    {
+        if (Other->Extent.StartSector < StartSector)
+            StartSector = Other->Extent.StartSector;
+        if (Other->Extent.StartSector + Other->Extent.SectorCount > EndSector)
+            EndSector = Other->Extent.StartSector + Other->Extent.SectorCount;
+
+        UnlinkExtent(Index, Other);
+        free(Other);
+    }
+
+    Node->Extent.StartSector = StartSector;
+    Node->Extent.SectorCount = EndSector - StartSector;
+    LinkExtent(Index, Node);
+
+    return TRUE;
+}
+
+
+/*
+ * Takes a range out of the free extents, e.g. for a new or grown partition.
+ * Parts of the range that are not free are ignored.
+ */
+BOOL
+RemoveFreeExtent(
+    PFREE_EXTENT_INDEX Index,
+    ULONGLONG StartSector,
+    ULONGLONG SectorCount)
+{
+    ULONGLONG EndSector = StartSector + SectorCount;
+    ULONGLONG ExtentStart, ExtentEnd;
+    PFREE_EXTENT_NODE Node, Spare = NULL;
+
+    if (SectorCount == 0)
+        return TRUE;
+
+    /* An extent the range is strictly inside of is split in two, and needs a second node */
+    Node = FindLastBefore(Index, EndSector);
+    if (Node != NULL && Node->Extent.StartSector < StartSector &&
+        Node->Extent.StartSector + Node->Extent.SectorCount > EndSector)
+    {
+        Spare = malloc(sizeof(*Spare));
+        if (Spare == NULL)
+            return FALSE;
+    }
+
+    while ((Node = FindLastBefore(Index, EndSector)) != NULL &&
+           Node->Extent.StartSector + Node->Extent.SectorCount > StartSector)
+    {
+        ExtentStart = Node->Extent.StartSector;
+        ExtentEnd = ExtentStart + Node->Extent.SectorCount;
+        UnlinkExtent(Index, Node);
+
+        /* Keep what sticks out on either side */
+        if (ExtentEnd > EndSector)
+        {
+            Node->Extent.StartSector = EndSector;
+            Node->Extent.SectorCount = ExtentEnd - EndSector;
+            LinkExtent(Index, Node);
+            Node = Spare;
+            Spare = NULL;
+        }
+
+        if (ExtentStart < StartSector)
+        {
+            Node->Extent.StartSector = ExtentStart;
+            Node->Extent.SectorCount = StartSector - ExtentStart;
+            LinkExtent(Index, Node);
+        }
+        else
+        {
+            free(Node);
+        }
+    }
+
+    free(Spare);
+
+    return TRUE;
+}
+
+
+/*
+ * Picks a free extent of at least SectorCount sectors: the smallest one
+ * (best fit), the one nearest the start of the disk (first fit) or the
+ * largest one. Returns FALSE if no extent is big enough.
+ */
+BOOL
+FindFreeExtent(
+    const FREE_EXTENT_INDEX *Index,
+    FREE_EXTENT_FIT Fit,
+    ULONGLONG SectorCount,
+    PFREE_EXTENT Extent)
+{
+    PFREE_EXTENT_NODE Node, Found = NULL;
+
+    switch (Fit)
+    {
+        case FREE_EXTENT_BEST_FIT:
+            for (Node = Index->BySize; Node != NULL; )
+            {
+                if (Node->Extent.SectorCount >= SectorCount)
+                {
+                    Found = Node;
+                    Node = Node->Child[BY_SIZE][0];
+                }
+                else
+                {
+                    Node = Node->Child[BY_SIZE][1];
+                }
+            }
+            break;
+
+        case FREE_EXTENT_FIRST_FIT:
+            /* Go left whenever the left subtree holds a big enough extent */
+            for (Node = Index->ByStart; Node != NULL && Node->MaxSectorCount >= SectorCount; )
+            {
+                if (Node->Child[BY_START][0] != NULL &&
+                    Node->Child[BY_START][0]->MaxSectorCount >= SectorCount)
+                {
+                    Node = Node->Child[BY_START][0];
+                }
+                else if (Node->Extent.SectorCount >= SectorCount)
+                {
+                    Found = Node;
+                    break;
+                }
+                else
+                {
+                    Node = Node->Child[BY_START][1];
+                }
+            }
+            break;
+
+        case FREE_EXTENT_LARGEST:
+            for (Node = Index->BySize; Node != NULL; Node = Node->Child[BY_SIZE][1])
+                Found = Node;
+            if (Found != NULL && Found->Extent.SectorCount < SectorCount)
+                Found = NULL;
+            break;
+    }
+
+    if (Found == NULL)
+        return FALSE;
+
+    *Extent = Found->Extent;
+    return TRUE;
+}
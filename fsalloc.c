@@ -0,0 +1,926 @@
+/*
+ * PROJECT:         ReactOS DiskPart (Linux port)
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * FILE:            base/system/diskpart/fsalloc.c
+ * PURPOSE:         Reads filesystem allocation maps (ext2/3/4 block bitmaps,
+ *                  FAT tables) straight from the disk, without mounting.
+ */
+
+#include "diskpart.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#define EXT4_FEATURE_INCOMPAT_META_BG   0x0010
+#define EXT4_FEATURE_INCOMPAT_64BIT     0x0080
+#define EXT4_FEATURE_RO_COMPAT_GDT_CSUM 0x0010
+#define EXT4_FEATURE_RO_COMPAT_METADATA_CSUM 0x0400
+#define EXT4_FEATURE_COMPAT_SPARSE_SUPER2 0x0200
+#define EXT4_FEATURE_RO_COMPAT_SPARSE_SUPER 0x0001
+#define EXT4_BG_BLOCK_UNINIT        0x0002
+
+#define FAT_SCAN_CHUNK              (1024 * 1024)
+
+/* FUNCTIONS ******************************************************************/
+
+/*
+ * Returns the index of the highest set bit of an LSB-first bitmap, or -1 if
+ * no bit is set. The bulk of the bitmap is checked 256 bits at a time, which
+ * the compiler turns into vector loads and ORs.
+ */
+long long
+FindLastSetBit(
+    const UCHAR *Bitmap,
+    size_t BitCount)
+{
+    size_t Bytes = BitCount / 8;
+    size_t Blocks;
+    ULONGLONG Words[4];
+    UCHAR Last;
+    int k;
+
+    if (BitCount & 7)
+    {
+        Last = Bitmap[Bytes] & ((1 << (BitCount & 7)) - 1);
+        if (Last != 0)
+            return (long long)Bytes * 8 + (31 - __builtin_clz(Last));
+    }
+
+    /* Bytes behind the last full 256-bit block */
+    while (Bytes & 31)
+    {
+        Bytes--;
+        if (Bitmap[Bytes] != 0)
+            return (long long)Bytes * 8 + (31 - __builtin_clz(Bitmap[Bytes]));
+    }
+
+    for (Blocks = Bytes / 32; Blocks > 0; Blocks--)
+    {
+        const UCHAR *Block = Bitmap + (Blocks - 1) * 32;
+
+        for (k = 0; k < 4; k++)
+            Words[k] = LoadLe64(Block + k * 8);
+
+        if ((Words[0] | Words[1] | Words[2] | Words[3]) == 0)
+            continue;
+
+        for (k = 3; k >= 0; k--)
+        {
+            if (Words[k] != 0)
+                return ((long long)(Blocks - 1) * 32 + k * 8) * 8 + (63 - __builtin_clzll(Words[k]));
+        }
+    }
+
+    return -1;
+}
+
+
+static
+BOOL
+IsPowerOf(
+    ULONGLONG Value,
+    ULONG Base)
+{
+    while (Value > 1 && Value % Base == 0)
+        Value /= Base;
+
+    return Value == 1;
+}
+
+
+/* Whether an ext group starts with a backup superblock and descriptor table */
+static
+BOOL
+ExtGroupHasSuperBackup(
+    const EXT_SUPER_BLOCK *Super,
+    ULONGLONG Group)
+{
+    if (Group == 0)
+        return TRUE;
+
+    if (ExtSuperGetFeatureCompat(Super) & EXT4_FEATURE_COMPAT_SPARSE_SUPER2)
+        return Group == ExtSuperGetBackupBg(Super, 0) || Group == ExtSuperGetBackupBg(Super, 1);
+
+    if (!(ExtSuperGetFeatureRoCompat(Super) & EXT4_FEATURE_RO_COMPAT_SPARSE_SUPER))
+        return TRUE;
+
+    return Group == 1 || IsPowerOf(Group, 3) || IsPowerOf(Group, 5) || IsPowerOf(Group, 7);
+}
+
+
+/* The parts of an ext superblock the allocation walkers need */
+typedef struct _EXT_GEOMETRY {
+    ULONG BlockSize;
+    ULONG BlocksPerGroup;
+    ULONG DescSize;
+    ULONG BackupBlocks;
+    ULONG InodeTableBlocks;
+    ULONGLONG FirstDataBlock;
+    ULONGLONG BlocksCount;
+    ULONGLONG GroupCount;
+    BOOL Is64Bit;
+    BOOL HasUninit;
+} EXT_GEOMETRY, *PEXT_GEOMETRY;
+
+/* Per group state taken from its descriptor */
+typedef struct _EXT_GROUP {
+    ULONGLONG FirstBlock;
+    ULONGLONG BlockCount;
+    ULONGLONG BitmapBlock;
+    ULONGLONG InodeBitmapBlock;
+    ULONGLONG InodeTableBlock;
+    ULONGLONG FreeBlocks;
+    BOOL BlockUninit;
+} EXT_GROUP, *PEXT_GROUP;
+
+/* A run of metadata blocks, used to rebuild the bitmap of BLOCK_UNINIT groups */
+typedef struct _EXT_EXTENT {
+    ULONGLONG Start;
+    ULONGLONG Count;
+} EXT_EXTENT, *PEXT_EXTENT;
+
+
+static
+BOOL
+ExtGetGeometry(
+    const EXT_SUPER_BLOCK *Super,
+    PEXT_GEOMETRY Geometry)
+{
+    ULONG Incompat = ExtSuperGetFeatureIncompat(Super);
+    ULONG RoCompat = ExtSuperGetFeatureRoCompat(Super);
+    ULONG LogBlockSize = ExtSuperGetLogBlockSize(Super);
+
+    if (LogBlockSize > 6)
+        return FALSE;
+
+    Geometry->BlockSize = 1024U << LogBlockSize;
+    Geometry->BlocksPerGroup = ExtSuperGetBlocksPerGroup(Super);
+    Geometry->FirstDataBlock = ExtSuperGetFirstDataBlock(Super);
+    Geometry->Is64Bit = (Incompat & EXT4_FEATURE_INCOMPAT_64BIT) != 0;
+    Geometry->HasUninit = (RoCompat & (EXT4_FEATURE_RO_COMPAT_GDT_CSUM | EXT4_FEATURE_RO_COMPAT_METADATA_CSUM)) != 0;
+    Geometry->DescSize = Geometry->Is64Bit ? ExtSuperGetDescSize(Super) : 32;
+
+    Geometry->BlocksCount = ExtSuperGetBlocksCountLo(Super);
+    if (Geometry->Is64Bit)
+        Geometry->BlocksCount |= (ULONGLONG)ExtSuperGetBlocksCountHi(Super) << 32;
+
+    if (Geometry->BlocksPerGroup == 0 ||
+        Geometry->BlocksPerGroup > Geometry->BlockSize * 8 ||
+        Geometry->DescSize < 32 || Geometry->BlocksCount <= Geometry->FirstDataBlock)
+        return FALSE;
+
+    /* The descriptors of META_BG filesystems are scattered over the groups */
+    if (Incompat & EXT4_FEATURE_INCOMPAT_META_BG)
+        return FALSE;
+
+    Geometry->GroupCount = (Geometry->BlocksCount - Geometry->FirstDataBlock + Geometry->BlocksPerGroup - 1) /
+                           Geometry->BlocksPerGroup;
+
+    /* Backup superblock, descriptors and reserved GDT blocks go away with their group */
+    Geometry->BackupBlocks = 1 + (ULONG)((Geometry->GroupCount * Geometry->DescSize + Geometry->BlockSize - 1) /
+                                         Geometry->BlockSize) + ExtSuperGetReservedGdtBlocks(Super);
+
+    /* Revision 0 filesystems have fixed 128-byte inodes */
+    Geometry->InodeTableBlocks = (ULONG)(((ULONGLONG)ExtSuperGetInodesPerGroup(Super) *
+                                          (ExtSuperGetRevLevel(Super) ? ExtSuperGetInodeSize(Super) : 128) +
+                                          Geometry->BlockSize - 1) / Geometry->BlockSize);
+
+    return TRUE;
+}
+
+
+static
+UCHAR *
+ExtReadDescriptors(
+    int fd,
+    PPARTENTRY PartEntry,
+    PEXT_GEOMETRY Geometry)
+{
+    UCHAR *Descriptors;
+
+    Descriptors = malloc(Geometry->GroupCount * Geometry->DescSize);
+    if (Descriptors == NULL)
+        return NULL;
+
+    if (!ReadPartitionBytes(fd, PartEntry, (Geometry->FirstDataBlock + 1) * Geometry->BlockSize,
+                            Geometry->GroupCount * Geometry->DescSize, Descriptors))
+    {
+        free(Descriptors);
+        return NULL;
+    }
+
+    return Descriptors;
+}
+
+
+/* Group is zero-based */
+static
+void
+ExtGetGroup(
+    PEXT_GEOMETRY Geometry,
+    const UCHAR *Descriptors,
+    ULONGLONG Group,
+    PEXT_GROUP GroupInfo)
+{
+    const EXT_GROUP_DESC *Desc = (const EXT_GROUP_DESC *)(Descriptors + Group * Geometry->DescSize);
+    BOOL HasHigh = Geometry->Is64Bit && Geometry->DescSize >= 64;
+
+    GroupInfo->FirstBlock = Geometry->FirstDataBlock + Group * Geometry->BlocksPerGroup;
+    GroupInfo->BlockCount = Geometry->BlocksPerGroup;
+    if (Group == Geometry->GroupCount - 1)
+        GroupInfo->BlockCount = Geometry->BlocksCount - GroupInfo->FirstBlock;
+
+    GroupInfo->BlockUninit = Geometry->HasUninit && (ExtGroupGetFlags(Desc) & EXT4_BG_BLOCK_UNINIT);
+
+    GroupInfo->FreeBlocks = ExtGroupGetFreeBlocksCountLo(Desc);
+    if (HasHigh)
+        GroupInfo->FreeBlocks |= (ULONGLONG)ExtGroupGetFreeBlocksCountHi(Desc) << 16;
+
+    GroupInfo->BitmapBlock = ExtGroupGetBlockBitmapLo(Desc);
+    GroupInfo->InodeBitmapBlock = ExtGroupGetInodeBitmapLo(Desc);
+    GroupInfo->InodeTableBlock = ExtGroupGetInodeTableLo(Desc);
+    if (HasHigh)
+    {
+        GroupInfo->BitmapBlock |= (ULONGLONG)ExtGroupGetBlockBitmapHi(Desc) << 32;
+        GroupInfo->InodeBitmapBlock |= (ULONGLONG)ExtGroupGetInodeBitmapHi(Desc) << 32;
+        GroupInfo->InodeTableBlock |= (ULONGLONG)ExtGroupGetInodeTableHi(Desc) << 32;
+    }
+}
+
+
+/*
+ * ext2/3/4: walks the group descriptors from the last group down and reads
+ * only the block bitmaps of groups that are not entirely free, stopping at
+ * the first group with an allocated block.
+ */
+static
+BOOL
+QueryExtUsedBytes(
+    int fd,
+    PPARTENTRY PartEntry,
+    const EXT_SUPER_BLOCK *Super,
+    ULONGLONG *UsedBytes)
+{
+    EXT_GEOMETRY Geometry;
+    EXT_GROUP GroupInfo;
+    ULONGLONG Group, LastBlock;
+    UCHAR *Descriptors = NULL, *Bitmap = NULL;
+    long long Bit;
+    BOOL Success = FALSE;
+
+    if (!ExtGetGeometry(Super, &Geometry))
+        return FALSE;
+
+    Descriptors = ExtReadDescriptors(fd, PartEntry, &Geometry);
+    Bitmap = malloc(Geometry.BlockSize);
+    if (Descriptors == NULL || Bitmap == NULL)
+        goto done;
+
+    LastBlock = Geometry.FirstDataBlock;
+
+    for (Group = Geometry.GroupCount; Group > 0; Group--)
+    {
+        ExtGetGroup(&Geometry, Descriptors, Group - 1, &GroupInfo);
+
+        if (GroupInfo.BlockUninit || GroupInfo.FreeBlocks >= GroupInfo.BlockCount)
+            continue;
+
+        if (!ReadPartitionBytes(fd, PartEntry, GroupInfo.BitmapBlock * Geometry.BlockSize,
+                                Geometry.BlockSize, Bitmap))
+            goto done;
+
+        Bit = FindLastSetBit(Bitmap, GroupInfo.BlockCount);
+        if (Group > 1 && ExtGroupHasSuperBackup(Super, Group - 1) && Bit < (long long)Geometry.BackupBlocks)
+            continue;
+        if (Bit >= 0)
+        {
+            LastBlock = GroupInfo.FirstBlock + Bit;
+            break;
+        }
+    }
+
+    *UsedBytes = (LastBlock + 1) * Geometry.BlockSize;
+    Success = TRUE;
+
+done:
+    free(Bitmap);
+    free(Descriptors);
+
+    return Success;
+}
+
+
+/*
+ * Calls Callback for every run of clear bits in an LSB-first bitmap. Words
+ * that are all ones, the common case in a full group, are skipped whole.
+ */
+static
+void
+EnumerateClearRuns(
+    const UCHAR *Bitmap,
+    ULONGLONG BitCount,
+    void (*Callback)(void *Context, ULONGLONG First, ULONGLONG Count),
+    void *Context)
+{
+    ULONGLONG Bit = 0, RunStart = 0;
+    BOOL InRun = FALSE;
+    BOOL Set;
+
+    while (Bit < BitCount)
+    {
+        if ((Bit & 63) == 0 && Bit + 64 <= BitCount)
+        {
+            ULONGLONG Word = LoadLe64(Bitmap + Bit / 8);
+
+            if (Word == ~0ULL)
+            {
+                if (InRun)
+                    Callback(Context, RunStart, Bit - RunStart);
+                InRun = FALSE;
+                Bit += 64;
+                continue;
+            }
+
+            if (Word == 0)
+            {
+                if (!InRun)
+                    RunStart = Bit;
+                InRun = TRUE;
+                Bit += 64;
+                continue;
+            }
+        }
+
+        Set = (Bitmap[Bit / 8] >> (Bit & 7)) & 1;
+        if (!Set && !InRun)
+        {
+            RunStart = Bit;
+            InRun = TRUE;
+        }
+        else if (Set && InRun)
+        {
+            Callback(Context, RunStart, Bit - RunStart);
+            InRun = FALSE;
+        }
+        Bit++;
+    }
+
+    if (InRun)
+        Callback(Context, RunStart, BitCount - RunStart);
+}
+
+
+typedef struct _FREE_RANGE_CONTEXT {
+    FREE_RANGE_CALLBACK Callback;
+    void *Context;
+    ULONGLONG Base;         /* Byte offset of unit 0 */
+    ULONG UnitSize;         /* Bytes per bitmap bit or FAT entry */
+} FREE_RANGE_CONTEXT, *PFREE_RANGE_CONTEXT;
+
+
+static
+void
+ReportFreeUnits(
+    void *Context,
+    ULONGLONG First,
+    ULONGLONG Count)
+{
+    PFREE_RANGE_CONTEXT Free = Context;
+
+    Free->Callback(Free->Context, Free->Base + First * Free->UnitSize, Count * Free->UnitSize);
+}
+
+
+static
+int
+CompareExtents(
+    const void *A,
+    const void *B)
+{
+    const EXT_EXTENT *First = A, *Second = B;
+
+    return (First->Start < Second->Start) ? -1 : (First->Start > Second->Start);
+}
+
+
+/*
+ * Collects the bitmaps and inode tables of all groups, sorted by block.
+ * With flex_bg they are packed into a few groups, which may well be
+ * BLOCK_UNINIT themselves.
+ */
+static
+PEXT_EXTENT
+ExtGetMetadataExtents(
+    PEXT_GEOMETRY Geometry,
+    const UCHAR *Descriptors)
+{
+    PEXT_EXTENT Extents;
+    EXT_GROUP GroupInfo;
+    ULONGLONG Group;
+
+    Extents = malloc(Geometry->GroupCount * 3 * sizeof(EXT_EXTENT));
+    if (Extents == NULL)
+        return NULL;
+
+    for (Group = 0; Group < Geometry->GroupCount; Group++)
+    {
+        ExtGetGroup(Geometry, Descriptors, Group, &GroupInfo);
+
+        Extents[Group * 3].Start = GroupInfo.BitmapBlock;
+        Extents[Group * 3].Count = 1;
+        Extents[Group * 3 + 1].Start = GroupInfo.InodeBitmapBlock;
+        Extents[Group * 3 + 1].Count = 1;
+        Extents[Group * 3 + 2].Start = GroupInfo.InodeTableBlock;
+        Extents[Group * 3 + 2].Count = Geometry->InodeTableBlocks;
+    }
+
+    qsort(Extents, Geometry->GroupCount * 3, sizeof(EXT_EXTENT), CompareExtents);
+
+    return Extents;
+}
+
+
+/*
+ * ext2/3/4: reports the clear bits of every initialized block bitmap. For
+ * BLOCK_UNINIT groups the bitmap is not on disk; like the kernel we take
+ * everything as free except the backup superblock area and the metadata
+ * extents that lie in the group.
+ */
+static
+BOOL
+EnumerateExtFreeRanges(
+    int fd,
+    PPARTENTRY PartEntry,
+    const EXT_SUPER_BLOCK *Super,
+    FREE_RANGE_CALLBACK Callback,
+    void *Context)
+{
+    EXT_GEOMETRY Geometry;
+    EXT_GROUP GroupInfo;
+    FREE_RANGE_CONTEXT Free;
+    UCHAR *Descriptors = NULL, *Bitmap = NULL;
+    PEXT_EXTENT Extents = NULL;
+    ULONGLONG Group, Next, End, Used, MetaCount, Meta = 0;
+    BOOL Success = FALSE;
+
+    if (!ExtGetGeometry(Super, &Geometry))
+        return FALSE;
+
+    Descriptors = ExtReadDescriptors(fd, PartEntry, &Geometry);
+    Bitmap = malloc(Geometry.BlockSize);
+    if (Descriptors == NULL || Bitmap == NULL)
+        goto done;
+
+    Extents = ExtGetMetadataExtents(&Geometry, Descriptors);
+    if (Extents == NULL)
+        goto done;
+    MetaCount = Geometry.GroupCount * 3;
+
+    Free.Callback = Callback;
+    Free.Context = Context;
+    Free.UnitSize = Geometry.BlockSize;
+    Free.Base = 0;
+
+    for (Group = 0; Group < Geometry.GroupCount; Group++)
+    {
+        ExtGetGroup(&Geometry, Descriptors, Group, &GroupInfo);
+        End = GroupInfo.FirstBlock + GroupInfo.BlockCount;
+
+        if (GroupInfo.BlockUninit)
+        {
+            Next = GroupInfo.FirstBlock;
+            if (ExtGroupHasSuperBackup(Super, Group))
+                Next += Geometry.BackupBlocks;
+
+            while (Meta < MetaCount && Extents[Meta].Start + Extents[Meta].Count <= Next)
+                Meta++;
+
+            for (; Next < End; Next = Used)
+            {
+                /* The free run ends at the next metadata extent in the group */
+                Used = (Meta < MetaCount && Extents[Meta].Start < End) ? Extents[Meta].Start : End;
+                if (Used > Next)
+                    ReportFreeUnits(&Free, Next, Used - Next);
+
+                if (Used < End)
+                {
+                    if (Extents[Meta].Start + Extents[Meta].Count > Used)
+                        Used = Extents[Meta].Start + Extents[Meta].Count;
+                    Meta++;
+                }
+                if (Used < Next)
+                    Used = Next;
+            }
+            continue;
+        }
+
+        if (GroupInfo.FreeBlocks == 0)
+            continue;
+
+        if (!ReadPartitionBytes(fd, PartEntry, GroupInfo.BitmapBlock * Geometry.BlockSize,
+                                Geometry.BlockSize, Bitmap))
+            goto done;
+
+        Free.Base = GroupInfo.FirstBlock * Geometry.BlockSize;
+        EnumerateClearRuns(Bitmap, GroupInfo.BlockCount, ReportFreeUnits, &Free);
+        Free.Base = 0;
+    }
+
+    Success = TRUE;
+
+done:
+    free(Extents);
+    free(Bitmap);
+    free(Descriptors);
+
+    return Success;
+}
+
+
+typedef struct _FAT_GEOMETRY {
+    ULONG BytesPerSector;
+    ULONG SectorsPerCluster;
+    ULONG FirstDataSector;
+    ULONG ClusterCount;
+    ULONG EntryBits;
+    ULONGLONG FatOffset;
+} FAT_GEOMETRY, *PFAT_GEOMETRY;
+
+
+static
+BOOL
+FatGetGeometry(
+    const FAT_BOOT_SECTOR *Boot,
+    PFAT_GEOMETRY Geometry,
+    const char **FileSystemName)
+{
+    ULONG ReservedSectors, FatCount, RootEntries, FatSectors, TotalSectors, RootSectors;
+
+    Geometry->BytesPerSector = FatGetBytesPerSector(Boot);
+    Geometry->SectorsPerCluster = Boot->SectorsPerCluster;
+    ReservedSectors = FatGetReservedSectors(Boot);
+    FatCount = Boot->NumberOfFats;
+    RootEntries = FatGetRootEntries(Boot);
+    TotalSectors = FatGetTotalSectors16(Boot) ? FatGetTotalSectors16(Boot) : FatGetTotalSectors32(Boot);
+    FatSectors = FatGetSectorsPerFat16(Boot) ? FatGetSectorsPerFat16(Boot)
+                                              : Fat32GetSectorsPerFat32((const FAT32_BOOT_SECTOR *)Boot);
+
+    if (Geometry->BytesPerSector < 512 || Geometry->BytesPerSector > 4096 ||
+        (Geometry->BytesPerSector & (Geometry->BytesPerSector - 1)) ||
+        Geometry->SectorsPerCluster == 0 || (Geometry->SectorsPerCluster & (Geometry->SectorsPerCluster - 1)) ||
+        FatCount == 0 || FatSectors == 0 || ReservedSectors == 0)
+        return FALSE;
+
+    RootSectors = (RootEntries * 32 + Geometry->BytesPerSector - 1) / Geometry->BytesPerSector;
+    Geometry->FirstDataSector = ReservedSectors + FatCount * FatSectors + RootSectors;
+    if (TotalSectors <= Geometry->FirstDataSector)
+        return FALSE;
+
+    Geometry->ClusterCount = (TotalSectors - Geometry->FirstDataSector) / Geometry->SectorsPerCluster;
+    if (Geometry->ClusterCount < 4085)
+    {
+        Geometry->EntryBits = 12;
+        *FileSystemName = "FAT";
+    }
+    else if (Geometry->ClusterCount < 65525)
+    {
+        Geometry->EntryBits = 16;
+        *FileSystemName = "FAT";
+    }
+    else
+    {
+        Geometry->EntryBits = 32;
+        *FileSystemName = "FAT32";
+    }
+
+    Geometry->FatOffset = (ULONGLONG)ReservedSectors * Geometry->BytesPerSector;
+
+    return TRUE;
+}
+
+
+/*
+ * FAT12/16/32: scans the first FAT backwards for the last cluster whose
+ * entry is not free.
+ */
+static
+BOOL
+QueryFatUsedBytes(
+    int fd,
+    PPARTENTRY PartEntry,
+    const FAT_BOOT_SECTOR *Boot,
+    ULONGLONG *UsedBytes,
+    const char **FileSystemName)
+{
+    FAT_GEOMETRY Geometry;
+    ULONG LastCluster = 0, Cluster;
+    ULONGLONG ChunkStart, ChunkEnd, FatBytes, i;
+    UCHAR *Buffer = NULL;
+    long long Bit;
+    BOOL Success = FALSE;
+
+    if (!FatGetGeometry(Boot, &Geometry, FileSystemName))
+        return FALSE;
+
+    if (Geometry.EntryBits == 12)
+    {
+        /* At most 6 KB, packed 1.5 bytes per entry: plain loop */
+        FatBytes = ((ULONGLONG)Geometry.ClusterCount + 2) * 12 / 8 + 1;
+        Buffer = malloc(FatBytes + 1);
+        if (Buffer == NULL || !ReadPartitionBytes(fd, PartEntry, Geometry.FatOffset, FatBytes, Buffer))
+            goto done;
+
+        for (Cluster = Geometry.ClusterCount + 1; Cluster >= 2; Cluster--)
+        {
+            ULONG Offset = Cluster + Cluster / 2;
+            ULONG Value = LoadLe16(Buffer + Offset);
+
+            Value = (Cluster & 1) ? (Value >> 4) : (Value & 0x0FFF);
+            if (Value != 0)
+            {
+                LastCluster = Cluster;
+                break;
+            }
+        }
+    }
+    else
+    {
+        Buffer = malloc(FAT_SCAN_CHUNK);
+        if (Buffer == NULL)
+            goto done;
+
+        FatBytes = ((ULONGLONG)Geometry.ClusterCount + 2) * (Geometry.EntryBits / 8);
+
+        for (ChunkEnd = FatBytes; ChunkEnd > 0 && LastCluster == 0; ChunkEnd = ChunkStart)
+        {
+            ChunkStart = (ChunkEnd > FAT_SCAN_CHUNK) ? ChunkEnd - FAT_SCAN_CHUNK : 0;
+
+            if (!ReadPartitionBytes(fd, PartEntry, Geometry.FatOffset + ChunkStart,
+                                    ChunkEnd - ChunkStart, Buffer))
+                goto done;
+
+            /* The top nibble of FAT32 entries is reserved and not part of the value */
+            if (Geometry.EntryBits == 32)
+            {
+                for (i = 3; i < ChunkEnd - ChunkStart; i += 4)
+                    Buffer[i] &= 0x0F;
+            }
+
+            Bit = FindLastSetBit(Buffer, (ChunkEnd - ChunkStart) * 8);
+            if (Bit >= 0)
+            {
+                Cluster = (ULONG)((ChunkStart * 8 + Bit) / Geometry.EntryBits);
+                if (Cluster >= 2)
+                    LastCluster = Cluster;
+                break;
+            }
+        }
+    }
+
+    if (LastCluster >= 2)
+        *UsedBytes = ((ULONGLONG)Geometry.FirstDataSector +
+                      (ULONGLONG)(LastCluster - 1) * Geometry.SectorsPerCluster) * Geometry.BytesPerSector;
+    else
+        *UsedBytes = (ULONGLONG)Geometry.FirstDataSector * Geometry.BytesPerSector;
+
+    Success = TRUE;
+
+done:
+    free(Buffer);
+
+    return Success;
+}
+
+
+/*
+ * FAT16/32: reports runs of clusters whose FAT entry is free. FAT12
+ * volumes are too small to be worth it and are left alone.
+ */
+static
+BOOL
+EnumerateFatFreeRanges(
+    int fd,
+    PPARTENTRY PartEntry,
+    const FAT_BOOT_SECTOR *Boot,
+    FREE_RANGE_CALLBACK Callback,
+    void *Context)
+{
+    FAT_GEOMETRY Geometry;
+    FREE_RANGE_CONTEXT Free;
+    const char *FileSystemName;
+    ULONG EntryBytes, EntriesPerChunk, Cluster, End, i, Value;
+    ULONG RunStart = 0;
+    BOOL InRun = FALSE;
+    UCHAR *Buffer;
+
+    if (!FatGetGeometry(Boot, &Geometry, &FileSystemName))
+        return FALSE;
+
+    if (Geometry.EntryBits == 12)
+        return TRUE;
+
+    Buffer = malloc(FAT_SCAN_CHUNK);
+    if (Buffer == NULL)
+        return FALSE;
+
+    EntryBytes = Geometry.EntryBits / 8;
+    EntriesPerChunk = FAT_SCAN_CHUNK / EntryBytes;
+
+    /* Cluster 2 is the first one of the data area */
+    Free.Callback = Callback;
+    Free.Context = Context;
+    Free.UnitSize = Geometry.SectorsPerCluster * Geometry.BytesPerSector;
+    Free.Base = (ULONGLONG)Geometry.FirstDataSector * Geometry.BytesPerSector - 2ULL * Free.UnitSize;
+
+    for (Cluster = 2; Cluster < Geometry.ClusterCount + 2; Cluster = End)
+    {
+        End = Cluster - (Cluster % EntriesPerChunk) + EntriesPerChunk;
+        if (End > Geometry.ClusterCount + 2)
+            End = Geometry.ClusterCount + 2;
+
+        if (!ReadPartitionBytes(fd, PartEntry, Geometry.FatOffset + (ULONGLONG)Cluster * EntryBytes,
+                                (size_t)(End - Cluster) * EntryBytes, Buffer))
+        {
+            free(Buffer);
+            return FALSE;
+        }
+
+        for (i = 0; i < End - Cluster; i++)
+        {
+            Value = (EntryBytes == 4) ? (LoadLe32(Buffer + i * 4) & 0x0FFFFFFF) : LoadLe16(Buffer + i * 2);
+
+            if (Value == 0 && !InRun)
+            {
+                RunStart = Cluster + i;
+                InRun = TRUE;
+            }
+            else if (Value != 0 && InRun)
+            {
+                ReportFreeUnits(&Free, RunStart, Cluster + i - RunStart);
+                InRun = FALSE;
+            }
+        }
+    }
+
+    if (InRun)
+        ReportFreeUnits(&Free, RunStart, Geometry.ClusterCount + 2 - RunStart);
+
+    free(Buffer);
+
+    return TRUE;
+}
+
+
+/*
+ * Returns in UsedSectors the number of disk sectors, counted from the start
+ * of the partition, that the filesystem needs to keep all its allocated
+ * blocks. Fails if the filesystem is not one we can read.
+ */
+BOOL
+QueryFileSystemUsedSectors(
+    PPARTENTRY PartEntry,
+    ULONGLONG *UsedSectors,
+    const char **FileSystemName)
+{
+    ULONG BytesPerSector = PartEntry->DiskEntry->BytesPerSector;
+    FAT_BOOT_SECTOR Boot;
+    EXT_SUPER_BLOCK Super;
+    ULONGLONG UsedBytes = 0;
+    BOOL Success = FALSE;
+    int fd;
+
+    fd = OpenDiskDevice(PartEntry->DiskEntry, O_RDONLY);
+    if (fd < 0)
+        return FALSE;
+
+    if (ReadPartitionBytes(fd, PartEntry, EXT_SUPER_BLOCK_OFFSET, sizeof(Super), &Super) &&
+        ExtSuperGetMagic(&Super) == EXT4_SUPER_MAGIC)
+    {
+        *FileSystemName = "ext";
+        Success = QueryExtUsedBytes(fd, PartEntry, &Super, &UsedBytes);
+    }
+    else if (ReadPartitionBytes(fd, PartEntry, 0, sizeof(Boot), &Boot) &&
+             FatGetSignature(&Boot) == 0xAA55 &&
+             (Boot.Jump[0] == 0xEB || Boot.Jump[0] == 0xE9))
+    {
+        Success = QueryFatUsedBytes(fd, PartEntry, &Boot, &UsedBytes, FileSystemName);
+    }
+
+    close(fd);
+
+    if (Success)
+        *UsedSectors = (UsedBytes + BytesPerSector - 1) / BytesPerSector;
+
+    return Success;
+}
+
+
+/*
+ * Calls Callback with every range of the partition, in bytes from its
+ * start, that the filesystem's allocation map marks as free. Fails if the
+ * filesystem is not one we can read.
+ */
+BOOL
+EnumerateFileSystemFreeRanges(
+    PPARTENTRY PartEntry,
+    FREE_RANGE_CALLBACK Callback,
+    void *Context)
+{
+    FAT_BOOT_SECTOR Boot;
+    EXT_SUPER_BLOCK Super;
+    BOOL Success = FALSE;
+    int fd;
+
+    fd = OpenDiskDevice(PartEntry->DiskEntry, O_RDONLY);
+    if (fd < 0)
+        return FALSE;
+
+    if (ReadPartitionBytes(fd, PartEntry, EXT_SUPER_BLOCK_OFFSET, sizeof(Super), &Super) &&
+        ExtSuperGetMagic(&Super) == EXT4_SUPER_MAGIC)
+    {
+        Success = EnumerateExtFreeRanges(fd, PartEntry, &Super, Callback, Context);
+    }
+    else if (ReadPartitionBytes(fd, PartEntry, 0, sizeof(Boot), &Boot) &&
+             FatGetSignature(&Boot) == 0xAA55 &&
+             (Boot.Jump[0] == 0xEB || Boot.Jump[0] == 0xE9) &&
+             (memcmp(Boot.FileSystemType, "FAT", 3) == 0 ||
+              memcmp(((PFAT32_BOOT_SECTOR)&Boot)->FileSystemType, "FAT", 3) == 0))
+    {
+        /* Boot loaders in an MBR start with a jump too; ask for the type string */
+        Success = EnumerateFatFreeRanges(fd, PartEntry, &Boot, Callback, Context);
+    }
+
+    close(fd);
+
+    return Success;
+}
+
+
+typedef struct _ALLOCATION_BITMAP {
+    UCHAR *Bitmap;
+    ULONGLONG BitCount;
+    ULONGLONG BytesPerBit;
+} ALLOCATION_BITMAP, *PALLOCATION_BITMAP;
+
+/* Clears the bits whose whole range lies in the free range */
+static
+void
+ClearFreeBits(
+    void *Context,
+    ULONGLONG Offset,
+    ULONGLONG Length)
+{
+    PALLOCATION_BITMAP Map = Context;
+    ULONGLONG Bit = (Offset + Map->BytesPerBit - 1) / Map->BytesPerBit;
+    ULONGLONG End = (Offset + Length) / Map->BytesPerBit;
+
+    if (End > Map->BitCount)
+        End = Map->BitCount;
+
+    for (; Bit < End && (Bit & 7) != 0; Bit++)
+        Map->Bitmap[Bit >> 3] &= ~(1 << (Bit & 7));
+
+    /* Free ranges are long runs, clear them a byte at a time */
+    if (Bit + 8 <= End)
+    {
+        memset(&Map->Bitmap[Bit >> 3], 0, (End - Bit) >> 3);
+        Bit += (End - Bit) & ~7ULL;
+    }
+
+    for (; Bit < End; Bit++)
+        Map->Bitmap[Bit >> 3] &= ~(1 << (Bit & 7));
+}
+
+
+/*
+ * Builds a bitmap of the partition in which bit N is set if any of the
+ * sectors [N * SectorsPerBit, (N + 1) * SectorsPerBit) holds filesystem
+ * data, for RelocateSectors. Fails if the filesystem is not one we can
+ * read; the caller then copies everything. Free the bitmap with free().
+ */
+BOOL
+GetFileSystemAllocationBitmap(
+    PPARTENTRY PartEntry,
+    ULONG SectorsPerBit,
+    UCHAR **Bitmap)
+{
+    ALLOCATION_BITMAP Map;
+
+    Map.BitCount = (PartEntry->SectorCount + SectorsPerBit - 1) / SectorsPerBit;
+    Map.BytesPerBit = (ULONGLONG)SectorsPerBit * PartEntry->DiskEntry->BytesPerSector;
+    Map.Bitmap = malloc((Map.BitCount + 7) / 8);
+    if (Map.Bitmap == NULL)
+        return FALSE;
+
+    memset(Map.Bitmap, 0xFF, (Map.BitCount + 7) / 8);
+
+    if (!EnumerateFileSystemFreeRanges(PartEntry, ClearFreeBits, &Map))
+    {
+        free(Map.Bitmap);
+        return FALSE;
+    }
+
+    *Bitmap = Map.Bitmap;
+
+    return TRUE;
+}
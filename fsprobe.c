@@ -0,0 +1,562 @@
+/*
+ * PROJECT:         ReactOS DiskPart (Linux port)
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * FILE:            base/system/diskpart/fsprobe.c
+ * PURPOSE:         Identifies the file system and label of every partition
+ *                  and stacked volume from its superblock, with one batch
+ *                  of reads for all.
+ */
+
+#define _GNU_SOURCE
+#include "diskpart.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/aio_abi.h>
+
+/*
+ * Two reads per partition cover every signature we know: the head holds
+ * the boot sectors, LUKS, LVM, XFS, ext and swap up to 16K pages; the tail
+ * holds the btrfs superblock and the end of a 64K swap page.
+ */
+#define PROBE_HEAD_SIZE     (16 * 1024)
+#define PROBE_TAIL_OFFSET   (60 * 1024)
+#define PROBE_TAIL_SIZE     (8 * 1024)
+#define PROBE_SLOT_SIZE     (PROBE_HEAD_SIZE + PROBE_TAIL_SIZE)
+
+/* Devices per batch; the reads of one batch are all in flight at once */
+#define PROBE_BATCH         128
+
+#define EXT3_FEATURE_COMPAT_HAS_JOURNAL     0x0004
+#define EXT4_FEATURE_INCOMPAT_EXTENTS       0x0040
+#define EXT4_FEATURE_INCOMPAT_64BIT         0x0080
+#define EXT4_FEATURE_INCOMPAT_FLEX_BG       0x0200
+
+/* A partition, or a volume of its own device, and what was found on it */
+typedef struct _PROBE_REQUEST {
+    PPARTENTRY PartEntry;
+    PVOLENTRY VolumeEntry;
+    int fd;
+    ULONGLONG Offset;
+    UCHAR *Buffer;              /* Head, then tail */
+    BOOL HasTail;
+    BOOL HeadValid;
+    BOOL TailValid;
+    char FileSystemName[sizeof(((PARTENTRY *)0)->FileSystemName)];
+    char VolumeLabel[sizeof(((PARTENTRY *)0)->VolumeLabel)];
+} PROBE_REQUEST, *PPROBE_REQUEST;
+
+/* FUNCTIONS ******************************************************************/
+
+/* Copies an on-disk label, dropping the padding at its end */
+static
+void
+CopyLabel(
+    PPROBE_REQUEST Request,
+    const UCHAR *Label,
+    size_t Size)
+{
+    size_t Length = strnlen((const char *)Label, Size);
+
+    while (Length > 0 && (Label[Length - 1] == ' ' || Label[Length - 1] == '\0'))
+        Length--;
+
+    if (Length >= sizeof(Request->VolumeLabel))
+        Length = sizeof(Request->VolumeLabel) - 1;
+
+    memcpy(Request->VolumeLabel, Label, Length);
+    Request->VolumeLabel[Length] = '\0';
+}
+
+
+static
+BOOL
+ProbeSwap(
+    PPROBE_REQUEST Request,
+    const UCHAR *Head,
+    const UCHAR *Tail)
+{
+    static const ULONG PageSizes[] = { 4096, 8192, 16384 };
+    const UCHAR *Magic = NULL;
+    size_t i;
+
+    for (i = 0; i < ARRAYSIZE(PageSizes) && Magic == NULL; i++)
+    {
+        if (memcmp(Head + PageSizes[i] - SWAP_MAGIC_SIZE, "SWAPSPACE2", SWAP_MAGIC_SIZE) == 0)
+            Magic = Head + PageSizes[i] - SWAP_MAGIC_SIZE;
+    }
+
+    if (Magic == NULL && Tail != NULL &&
+        memcmp(Tail + 65536 - PROBE_TAIL_OFFSET - SWAP_MAGIC_SIZE, "SWAPSPACE2", SWAP_MAGIC_SIZE) == 0)
+        Magic = Tail;
+
+    if (Magic == NULL)
+        return FALSE;
+
+    strcpy(Request->FileSystemName, "swap");
+    CopyLabel(Request, ((const SWAP_HEADER *)Head)->VolumeName, sizeof(((SWAP_HEADER *)0)->VolumeName));
+    return TRUE;
+}
+
+
+static
+BOOL
+ProbeBootSector(
+    PPROBE_REQUEST Request,
+    const UCHAR *Head)
+{
+    const FAT_BOOT_SECTOR *Fat = (const FAT_BOOT_SECTOR *)Head;
+    const FAT32_BOOT_SECTOR *Fat32 = (const FAT32_BOOT_SECTOR *)Head;
+
+    if (FatGetSignature(Fat) != 0xAA55)
+        return FALSE;
+
+    /* NTFS and exFAT keep their labels in a file, not in the boot sector */
+    if (memcmp(Head + 3, "NTFS    ", 8) == 0)
+    {
+        strcpy(Request->FileSystemName, "ntfs");
+        return TRUE;
+    }
+
+    if (memcmp(Head + 3, "EXFAT   ", 8) == 0)
+    {
+        strcpy(Request->FileSystemName, "exfat");
+        return TRUE;
+    }
+
+    if (memcmp(Fat32->FileSystemType, "FAT32   ", 8) == 0)
+    {
+        strcpy(Request->FileSystemName, "vfat");
+        if (memcmp(Fat32->VolumeLabel, "NO NAME    ", 11) != 0)
+            CopyLabel(Request, Fat32->VolumeLabel, sizeof(Fat32->VolumeLabel));
+        return TRUE;
+    }
+
+    if (memcmp(Fat->FileSystemType, "FAT1", 4) == 0)
+    {
+        strcpy(Request->FileSystemName, "vfat");
+        if (memcmp(Fat->VolumeLabel, "NO NAME    ", 11) != 0)
+            CopyLabel(Request, Fat->VolumeLabel, sizeof(Fat->VolumeLabel));
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+
+/*
+ * Containers and file systems that own their first sectors come first; the
+ * boot sector formats last, as their signature can outlive a reformat.
+ */
+static
+BOOL
+ProbeSignatures(
+    PPROBE_REQUEST Request)
+{
+    const UCHAR *Head = Request->Buffer;
+    const UCHAR *Tail = Request->TailValid ? Request->Buffer + PROBE_HEAD_SIZE : NULL;
+    const EXT_SUPER_BLOCK *Ext = (const EXT_SUPER_BLOCK *)(Head + EXT_SUPER_BLOCK_OFFSET);
+    const BTRFS_SUPER_BLOCK *Btrfs;
+    const LUKS_HEADER *Luks = (const LUKS_HEADER *)Head;
+    ULONG Sector;
+
+    if (memcmp(Luks->Magic, "LUKS\xba\xbe", 6) == 0)
+    {
+        strcpy(Request->FileSystemName, "LUKS");
+        if (LuksGetVersion(Luks) == 2)
+            CopyLabel(Request, Luks->Label, sizeof(Luks->Label));
+        return TRUE;
+    }
+
+    /* The LVM label may be in any of the first four sectors */
+    for (Sector = 0; Sector < 4; Sector++)
+    {
+        const LVM_LABEL_HEADER *Lvm = (const LVM_LABEL_HEADER *)(Head + Sector * 512);
+
+        if (memcmp(Lvm->Id, "LABELONE", 8) == 0 && memcmp(Lvm->Type, "LVM2 001", 8) == 0)
+        {
+            strcpy(Request->FileSystemName, "LVM2");
+            return TRUE;
+        }
+    }
+
+    if (memcmp(Head, "XFSB", 4) == 0)
+    {
+        strcpy(Request->FileSystemName, "xfs");
+        CopyLabel(Request, Head + XFS_LABEL_OFFSET, XFS_LABEL_SIZE);
+        return TRUE;
+    }
+
+    if (Tail != NULL)
+    {
+        Btrfs = (const BTRFS_SUPER_BLOCK *)(Tail + BTRFS_SUPER_BLOCK_OFFSET - PROBE_TAIL_OFFSET);
+        if (memcmp(Btrfs->Magic, "_BHRfS_M", 8) == 0)
+        {
+            strcpy(Request->FileSystemName, "btrfs");
+            CopyLabel(Request, (const UCHAR *)Btrfs + BTRFS_LABEL_OFFSET, BTRFS_LABEL_SIZE);
+            return TRUE;
+        }
+    }
+
+    if (ExtSuperGetMagic(Ext) == EXT4_SUPER_MAGIC)
+    {
+        if (ExtSuperGetFeatureIncompat(Ext) &
+            (EXT4_FEATURE_INCOMPAT_EXTENTS | EXT4_FEATURE_INCOMPAT_64BIT | EXT4_FEATURE_INCOMPAT_FLEX_BG))
+            strcpy(Request->FileSystemName, "ext4");
+        else if (ExtSuperGetFeatureCompat(Ext) & EXT3_FEATURE_COMPAT_HAS_JOURNAL)
+            strcpy(Request->FileSystemName, "ext3");
+        else
+            strcpy(Request->FileSystemName, "ext2");
+
+        CopyLabel(Request, Ext->VolumeName, sizeof(Ext->VolumeName));
+        return TRUE;
+    }
+
+    return ProbeSwap(Request, Head, Tail) || ProbeBootSector(Request, Head);
+}
+
+
+static
+void
+ApplyProbeResult(
+    PPROBE_REQUEST Request,
+    BOOL Found)
+{
+    PPARTENTRY PartEntry = Request->PartEntry;
+    PVOLENTRY VolumeEntry = Request->VolumeEntry;
+
+    if (PartEntry != NULL)
+    {
+        strcpy(PartEntry->FileSystemName, Request->FileSystemName);
+        strcpy(PartEntry->VolumeLabel, Request->VolumeLabel);
+        PartEntry->FormatState = Found ? Formatted : UnknownFormat;
+    }
+    else
+    {
+        if (Request->FileSystemName[0] != '\0')
+            VolumeEntry->pszFilesystem = strdup(Request->FileSystemName);
+        if (Request->VolumeLabel[0] != '\0')
+            VolumeEntry->pszLabel = strdup(Request->VolumeLabel);
+    }
+}
+
+
+static
+void
+PrepareRead(
+    struct iocb *Iocb,
+    PPROBE_REQUEST Request,
+    ULONG Index,
+    BOOL Tail)
+{
+    memset(Iocb, 0, sizeof(*Iocb));
+    Iocb->aio_data = ((ULONGLONG)Index << 1) | (Tail ? 1 : 0);
+    Iocb->aio_lio_opcode = IOCB_CMD_PREAD;
+    Iocb->aio_fildes = Request->fd;
+    Iocb->aio_buf = (uint64_t)(uintptr_t)(Request->Buffer + (Tail ? PROBE_HEAD_SIZE : 0));
+    Iocb->aio_nbytes = Tail ? PROBE_TAIL_SIZE : PROBE_HEAD_SIZE;
+    Iocb->aio_offset = (int64_t)(Request->Offset + (Tail ? PROBE_TAIL_OFFSET : 0));
+}
+
+
+/*
+ * Puts the reads of all requests in flight with one submission and reaps
+ * them together. Whatever AIO does not take is read synchronously.
+ */
+static
+void
+ReadProbeBatch(
+    PPROBE_REQUEST Requests,
+    ULONG Count)
+{
+    struct iocb Iocbs[PROBE_BATCH * 2];
+    struct iocb *IocbPointers[PROBE_BATCH * 2];
+    struct io_event Events[PROBE_BATCH * 2];
+    aio_context_t Context = 0;
+    long Submitted = 0, Completed = 0, Total = 0, Result;
+    PPROBE_REQUEST Request;
+    ULONG i;
+    int Tail;
+
+    for (i = 0; i < Count; i++)
+    {
+        PrepareRead(&Iocbs[Total], &Requests[i], i, FALSE);
+        IocbPointers[Total] = &Iocbs[Total];
+        Total++;
+
+        if (Requests[i].HasTail)
+        {
+            PrepareRead(&Iocbs[Total], &Requests[i], i, TRUE);
+            IocbPointers[Total] = &Iocbs[Total];
+            Total++;
+        }
+    }
+
+    if (syscall(__NR_io_setup, Total, &Context) == 0)
+    {
+        while (Submitted < Total)
+        {
+            Result = syscall(__NR_io_submit, Context, Total - Submitted, IocbPointers + Submitted);
+            if (Result <= 0)
+                break;
+            Submitted += Result;
+        }
+
+        while (Completed < Submitted)
+        {
+            Result = syscall(__NR_io_getevents, Context, Submitted - Completed, Submitted - Completed,
+                             Events, NULL);
+            if (Result < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                break;
+            }
+
+            for (i = 0; i < (ULONG)Result; i++)
+            {
+                Request = &Requests[Events[i].data >> 1];
+                Tail = (int)(Events[i].data & 1);
+
+                if (Events[i].res == (Tail ? PROBE_TAIL_SIZE : PROBE_HEAD_SIZE))
+                {
+                    if (Tail)
+                        Request->TailValid = TRUE;
+                    else
+                        Request->HeadValid = TRUE;
+                }
+            }
+
+            Completed += Result;
+        }
+
+        syscall(__NR_io_destroy, Context);
+    }
+
+    /* Without AIO, or for what it would not take */
+    for (; Submitted < Total; Submitted++)
+    {
+        Request = &Requests[Iocbs[Submitted].aio_data >> 1];
+        Tail = (int)(Iocbs[Submitted].aio_data & 1);
+
+        Result = pread(Request->fd, (void *)(uintptr_t)Iocbs[Submitted].aio_buf,
+                       Iocbs[Submitted].aio_nbytes, Iocbs[Submitted].aio_offset);
+        if (Result == (long)Iocbs[Submitted].aio_nbytes)
+        {
+            if (Tail)
+                Request->TailValid = TRUE;
+            else
+                Request->HeadValid = TRUE;
+        }
+    }
+}
+
+
+static
+BOOL
+IsProbeCandidate(
+    PPARTENTRY PartEntry)
+{
+    ULONGLONG Size = PartEntry->SectorCount * PartEntry->DiskEntry->BytesPerSector;
+
+    return PartEntry->IsPartitioned && !PartEntry->New &&
+           !IsContainerPartition(PartEntry->PartitionType) &&
+           Size >= PROBE_HEAD_SIZE;
+}
+
+
+static
+PPROBE_REQUEST
+AddProbeRequest(
+    PPROBE_REQUEST *Requests,
+    ULONG *Count,
+    ULONG *Allocated,
+    int fd,
+    ULONGLONG Offset,
+    ULONGLONG Size)
+{
+    PPROBE_REQUEST NewArray, Request;
+
+    if (*Count == *Allocated)
+    {
+        NewArray = realloc(*Requests, (*Allocated ? *Allocated * 2 : 64) * sizeof(PROBE_REQUEST));
+        if (NewArray == NULL)
+            return NULL;
+        *Requests = NewArray;
+        *Allocated = *Allocated ? *Allocated * 2 : 64;
+    }
+
+    Request = &(*Requests)[(*Count)++];
+    memset(Request, 0, sizeof(PROBE_REQUEST));
+    Request->fd = fd;
+    Request->Offset = Offset;
+    Request->HasTail = Size >= PROBE_TAIL_OFFSET + PROBE_TAIL_SIZE;
+
+    return Request;
+}
+
+
+/* The buffers are aligned for O_DIRECT, and AIO is only asynchronous with it */
+static
+int
+OpenProbeDevice(
+    const char *DeviceName)
+{
+    int fd;
+
+    fd = open(DeviceName, O_RDONLY | O_DIRECT | O_CLOEXEC);
+    if (fd < 0)
+        fd = open(DeviceName, O_RDONLY | O_CLOEXEC);
+
+    return fd;
+}
+
+
+/*
+ * Reads and probes the requests PROBE_BATCH at a time, then closes their
+ * descriptors. Requests on one device are next to each other and share it.
+ */
+static
+void
+RunProbeRequests(
+    PPROBE_REQUEST Requests,
+    ULONG Count)
+{
+    UCHAR *Buffer;
+    ULONG First, BatchCount, i;
+
+    for (First = 0; First < Count; First += BatchCount)
+    {
+        BatchCount = (Count - First < PROBE_BATCH) ? Count - First : PROBE_BATCH;
+
+        Buffer = AcquireIoBuffer((size_t)BatchCount * PROBE_SLOT_SIZE);
+        if (Buffer == NULL)
+            break;
+
+        for (i = 0; i < BatchCount; i++)
+            Requests[First + i].Buffer = Buffer + (size_t)i * PROBE_SLOT_SIZE;
+
+        ReadProbeBatch(&Requests[First], BatchCount);
+
+        for (i = 0; i < BatchCount; i++)
+        {
+            if (Requests[First + i].HeadValid)
+                ApplyProbeResult(&Requests[First + i], ProbeSignatures(&Requests[First + i]));
+        }
+
+        ReleaseIoBuffer(Buffer);
+    }
+
+    for (i = 0; i < Count; i++)
+    {
+        if (i + 1 == Count || Requests[i + 1].fd != Requests[i].fd)
+            close(Requests[i].fd);
+    }
+}
+
+
+/*
+ * Fills FileSystemName, VolumeLabel and FormatState of every partition on
+ * the disks. Each disk is opened once and the reads of up to PROBE_BATCH
+ * partitions, on whatever disks, go out together.
+ */
+void
+ProbeFileSystems(void)
+{
+    PPROBE_REQUEST Requests = NULL;
+    PPROBE_REQUEST Request;
+    ULONG Count = 0, Allocated = 0;
+    ListEntry *DiskListEntry, *Entry;
+    ListEntry *Heads[2];
+    PDISKENTRY DiskEntry;
+    PPARTENTRY PartEntry;
+    ULONG i;
+    int fd;
+
+    for (DiskListEntry = DiskListHead.Flink; DiskListEntry != &DiskListHead; DiskListEntry = DiskListEntry->Flink)
+    {
+        DiskEntry = CONTAINING_RECORD(DiskListEntry, DISKENTRY, ListEntry);
+        Heads[0] = &DiskEntry->PrimaryPartListHead;
+        Heads[1] = &DiskEntry->LogicalPartListHead;
+        fd = -1;
+
+        for (i = 0; i < 2; i++)
+        {
+            for (Entry = Heads[i]->Flink; Entry != Heads[i]; Entry = Entry->Flink)
+            {
+                PartEntry = CONTAINING_RECORD(Entry, PARTENTRY, ListEntry);
+                if (!IsProbeCandidate(PartEntry))
+                    continue;
+
+                if (fd < 0)
+                {
+                    fd = OpenProbeDevice(DiskEntry->DeviceName);
+                    if (fd < 0)
+                        break;
+                }
+
+                Request = AddProbeRequest(&Requests, &Count, &Allocated, fd,
+                                          PartEntry->StartSector * DiskEntry->BytesPerSector,
+                                          PartEntry->SectorCount * DiskEntry->BytesPerSector);
+                if (Request == NULL)
+                    break;
+                Request->PartEntry = PartEntry;
+            }
+        }
+
+        /* Nothing of this disk made it into the list */
+        if (fd >= 0 && (Count == 0 || Requests[Count - 1].fd != fd))
+            close(fd);
+    }
+
+    RunProbeRequests(Requests, Count);
+
+    free(Requests);
+}
+
+
+/*
+ * Fills pszFilesystem and pszLabel of volumes on devices of their own, such
+ * as device-mapper and md volumes. There may be thousands, so they are
+ * opened and probed one batch at a time.
+ */
+void
+ProbeVolumeFileSystems(
+    PVOLENTRY *Volumes,
+    ULONG VolumeCount)
+{
+    PPROBE_REQUEST Requests = NULL;
+    PPROBE_REQUEST Request;
+    ULONG Count, Allocated = 0;
+    ULONG Next = 0;
+    int fd;
+
+    while (Next < VolumeCount)
+    {
+        Count = 0;
+
+        for (; Next < VolumeCount && Count < PROBE_BATCH; Next++)
+        {
+            if (Volumes[Next]->Size < PROBE_HEAD_SIZE)
+                continue;
+
+            fd = OpenProbeDevice(Volumes[Next]->DeviceName);
+            if (fd < 0)
+                continue;
+
+            Request = AddProbeRequest(&Requests, &Count, &Allocated, fd, 0, Volumes[Next]->Size);
+            if (Request == NULL)
+            {
+                close(fd);
+                Next = VolumeCount;
+                break;
+            }
+            Request->VolumeEntry = Volumes[Next];
+        }
+
+        RunProbeRequests(Requests, Count);
+    }
+
+    free(Requests);
+}
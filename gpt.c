@@ -6,14 +6,143 @@
  * PROGRAMMERS:     Adapted by Anonymous
  */
 
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <parted/parted.h>
-
-typedef int BOOL;
-#define TRUE 1
-#define FALSE 0
+#include "diskpart.h"
+
+#include <sys/random.h>
+
+typedef struct _GPT_MBR_TYPE_MAP {
+    UCHAR MbrType;
+    GUID TypeGuid;
+} GPT_MBR_TYPE_MAP;
+
+/* The first entry for a given GUID is the one used for GPT -> MBR */
+static const GPT_MBR_TYPE_MAP TypeMap[] = {
+    { 0x07, { 0xEBD0A0A2, 0xB9E5, 0x4433, { 0x87, 0xC0, 0x68, 0xB6, 0xB7, 0x26, 0x99, 0xC7 } } },
+    { 0xEF, { 0xC12A7328, 0xF81F, 0x11D2, { 0xBA, 0x4B, 0x00, 0xA0, 0xC9, 0x3E, 0xC9, 0x3B } } },
+    { 0x83, { 0x0FC63DAF, 0x8483, 0x4772, { 0x8E, 0x79, 0x3D, 0x69, 0xD8, 0x47, 0x7D, 0xE4 } } },
+    { 0x82, { 0x0657FD6D, 0xA4AB, 0x43C4, { 0x84, 0xE5, 0x09, 0x33, 0xC8, 0x4B, 0x4F, 0x4F } } },
+    { 0x8E, { 0xE6D6D379, 0xF507, 0x44C2, { 0xA2, 0x3C, 0x23, 0x8F, 0x2A, 0x3D, 0xF9, 0x28 } } },
+    { 0xFD, { 0xA19D880F, 0x05FC, 0x4D3B, { 0xA0, 0x06, 0x74, 0x3F, 0x0F, 0x84, 0x91, 0x1E } } },
+};
+
+/* MBR types that all describe FAT/NTFS data and become "basic data" on GPT */
+static const UCHAR BasicDataTypes[] = {
+    0x01, 0x04, 0x06, 0x07, 0x0B, 0x0C, 0x0E,
+    0x11, 0x14, 0x16, 0x17, 0x1B, 0x1C, 0x1E
+};
+
+static ULONG Crc32Table[256];
+static BOOL Crc32TableReady = FALSE;
+
+/* FUNCTIONS ******************************************************************/
+
+ULONG
+GptCrc32(
+    const void *Buffer,
+    size_t Length)
+{
+    const UCHAR *Data = Buffer;
+    ULONG Crc = 0xFFFFFFFF;
+    ULONG i, j, c;
+
+    if (!Crc32TableReady)
+    {
+        for (i = 0; i < 256; i++)
+        {
+            c = i;
+            for (j = 0; j < 8; j++)
+                c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+            Crc32Table[i] = c;
+        }
+        Crc32TableReady = TRUE;
+    }
+
+    while (Length--)
+        Crc = Crc32Table[(Crc ^ *Data++) & 0xFF] ^ (Crc >> 8);
+
+    return Crc ^ 0xFFFFFFFF;
+}
+
+
+void
+GptCreateGuid(
+    GUID *Guid)
+{
+    size_t Done = 0;
+    ssize_t Result;
+
+    while (Done < sizeof(*Guid))
+    {
+        Result = getrandom((UCHAR *)Guid + Done, sizeof(*Guid) - Done, 0);
+        if (Result < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        Done += Result;
+    }
+
+    /* RFC 4122 version 4, variant 1 */
+    Guid->Data3 = (Guid->Data3 & 0x0FFF) | 0x4000;
+    Guid->Data4[0] = (Guid->Data4[0] & 0x3F) | 0x80;
+}
+
+
+BOOL
+GptIsNullGuid(
+    const GUID *Guid)
+{
+    static const GUID NullGuid;
+
+    return memcmp(Guid, &NullGuid, sizeof(GUID)) == 0;
+}
+
+
+void
+GptTypeFromMbrType(
+    UCHAR PartitionType,
+    GUID *TypeGuid)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(BasicDataTypes); i++)
+    {
+        if (BasicDataTypes[i] == PartitionType)
+        {
+            PartitionType = 0x07;
+            break;
+        }
+    }
+
+    for (i = 0; i < sizeof(TypeMap) / sizeof(TypeMap[0]); i++)
+    {
+        if (TypeMap[i].MbrType == PartitionType)
+        {
+            *TypeGuid = TypeMap[i].TypeGuid;
+            return;
+        }
+    }
+
+    /* Anything else is treated as Linux filesystem data */
+    *TypeGuid = TypeMap[2].TypeGuid;
+}
+
+
+UCHAR
+MbrTypeFromGptType(
+    const GUID *TypeGuid)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(TypeMap) / sizeof(TypeMap[0]); i++)
+    {
+        if (memcmp(&TypeMap[i].TypeGuid, TypeGuid, sizeof(GUID)) == 0)
+            return TypeMap[i].MbrType;
+    }
+
+    return 0x83;
+}
 
 static void usage(const char *progname)
 {
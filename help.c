@@ -7,45 +7,29 @@
  *                  Adapted for Linux by CB
  */
 
-#include <stdio.h>
-#include <string.h>
-#include <wchar.h>
-#include <stdbool.h>
 #include "diskpart.h"
 
-/* Simulated commands[] array must be provided externally */
+#include <strings.h>
 
-static void PrintWide(const wchar_t* str)
+/* Prints a catalog string, or nothing if it is missing */
+static void PrintMessage(ULONG Id)
 {
-    // Print wide string to stdout using wprintf
-    wprintf(L"%ls", str);
-}
+    const char *Text = LoadMessageString(Id);
 
-static void PrintWideLine(const wchar_t* str)
-{
-    wprintf(L"%ls\n", str);
+    if (Text != NULL)
+        fputs(Text, stdout);
 }
 
-// Simple formatting, replacing %s for command and description only
-static void PrintFormatted(const wchar_t* format, const wchar_t* cmd, const wchar_t* desc)
+// One line of a command list: the command and its short description
+static void PrintCommandLine(const char *cmd, int help)
 {
-    // Example format might be: L"  %-12s  %s\n"
-    wprintf(format, cmd, desc);
-}
+    const char *format = LoadMessageString(IDS_HELP_FORMAT_STRING);
+    const char *desc = LoadMessageString((ULONG)help);
 
-// Helper: Case-insensitive wide string compare (like _wcsicmp)
-static int WideStrCaseCmp(const wchar_t* s1, const wchar_t* s2)
-{
-    while (*s1 && *s2)
-    {
-        wchar_t c1 = towlower(*s1);
-        wchar_t c2 = towlower(*s2);
-        if (c1 != c2)
-            return c1 - c2;
-        s1++;
-        s2++;
-    }
-    return towlower(*s1) - towlower(*s2);
+    if (format == NULL)
+        format = "%-11.11s - %s";
+
+    printf(format, cmd, desc != NULL ? desc : "\n");
 }
 
 /*
@@ -55,9 +39,8 @@ static int WideStrCaseCmp(const wchar_t* s1, const wchar_t* s2)
 void HelpCommandList(void)
 {
     PCOMMAND cmdptr;
-    const wchar_t* format = L"  %-12ls  %ls\n";
 
-    PrintWideLine(L"\nDiskPart - Available commands:\n");
+    printf("\nDiskPart - Available commands:\n\n");
 
     for (cmdptr = cmds; cmdptr && cmdptr->cmd1; cmdptr++)
     {
@@ -66,72 +49,68 @@ void HelpCommandList(void)
             cmdptr->cmd3 == NULL &&
             cmdptr->help != IDS_NONE)
         {
-            // For Linux port, let's assume cmds[].help points to a wchar_t* description string directly
-            // Instead of loading from resource, just print description stored in cmds struct
-            PrintFormatted(format, cmdptr->cmd1, (wchar_t*)cmdptr->help);
+            PrintCommandLine(cmdptr->cmd1, cmdptr->help);
         }
     }
 
-    PrintWideLine(L"");
+    printf("\n");
 }
 
-bool HelpCommand(PCOMMAND pCommand)
+BOOL HelpCommand(PCOMMAND pCommand)
 {
     PCOMMAND cmdptr;
-    bool bSubCommands = false;
-    const wchar_t* format = L"  %-12ls  %ls\n";
+    BOOL bSubCommands = FALSE;
 
-    PrintWideLine(L"\n");
+    printf("\n\n");
 
     for (cmdptr = cmds; cmdptr && cmdptr->cmd1; cmdptr++)
     {
         if (pCommand->cmd1 != NULL && pCommand->cmd2 == NULL && pCommand->cmd3 == NULL)
         {
-            if ((cmdptr->cmd1 != NULL && WideStrCaseCmp(pCommand->cmd1, cmdptr->cmd1) == 0) &&
+            if ((cmdptr->cmd1 != NULL && strcasecmp(pCommand->cmd1, cmdptr->cmd1) == 0) &&
                 (cmdptr->cmd2 != NULL) &&
                 (cmdptr->cmd3 == NULL) &&
                 (cmdptr->help != IDS_NONE))
             {
-                PrintFormatted(format, cmdptr->cmd2, (wchar_t*)cmdptr->help);
-                bSubCommands = true;
+                PrintCommandLine(cmdptr->cmd2, cmdptr->help);
+                bSubCommands = TRUE;
             }
         }
         else if (pCommand->cmd1 != NULL && pCommand->cmd2 != NULL && pCommand->cmd3 == NULL)
         {
-            if ((cmdptr->cmd1 != NULL && WideStrCaseCmp(pCommand->cmd1, cmdptr->cmd1) == 0) &&
-                (cmdptr->cmd2 != NULL && WideStrCaseCmp(pCommand->cmd2, cmdptr->cmd2) == 0) &&
+            if ((cmdptr->cmd1 != NULL && strcasecmp(pCommand->cmd1, cmdptr->cmd1) == 0) &&
+                (cmdptr->cmd2 != NULL && strcasecmp(pCommand->cmd2, cmdptr->cmd2) == 0) &&
                 (cmdptr->cmd3 != NULL) &&
                 (cmdptr->help != IDS_NONE))
             {
-                PrintFormatted(format, cmdptr->cmd3, (wchar_t*)cmdptr->help);
-                bSubCommands = true;
+                PrintCommandLine(cmdptr->cmd3, cmdptr->help);
+                bSubCommands = TRUE;
             }
         }
         else if (pCommand->cmd1 != NULL && pCommand->cmd2 != NULL && pCommand->cmd3 != NULL)
         {
-            if ((cmdptr->cmd1 != NULL && WideStrCaseCmp(pCommand->cmd1, cmdptr->cmd1) == 0) &&
-                (cmdptr->cmd2 != NULL && WideStrCaseCmp(pCommand->cmd2, cmdptr->cmd2) == 0) &&
-                (cmdptr->cmd3 != NULL && WideStrCaseCmp(pCommand->cmd3, cmdptr->cmd3) == 0) &&
+            if ((cmdptr->cmd1 != NULL && strcasecmp(pCommand->cmd1, cmdptr->cmd1) == 0) &&
+                (cmdptr->cmd2 != NULL && strcasecmp(pCommand->cmd2, cmdptr->cmd2) == 0) &&
+                (cmdptr->cmd3 != NULL && strcasecmp(pCommand->cmd3, cmdptr->cmd3) == 0) &&
                 (cmdptr->help_detail != MSG_NONE))
             {
-                // Just print help_detail as a wide string pointer
-                PrintWide((wchar_t*)cmdptr->help_detail);
-                bSubCommands = true;
+                PrintMessage(cmdptr->help_detail);
+                bSubCommands = TRUE;
             }
         }
     }
 
     if (!bSubCommands && pCommand->help_detail != MSG_NONE)
     {
-        PrintWide((wchar_t*)pCommand->help_detail);
+        PrintMessage(pCommand->help_detail);
     }
 
-    PrintWideLine(L"");
+    printf("\n");
 
-    return true;
+    return TRUE;
 }
 
-bool help_main(int argc, wchar_t* argv[])
+BOOL help_main(int argc, char **argv)
 {
     PCOMMAND cmdptr;
     PCOMMAND cmdptr1 = NULL;
@@ -141,28 +120,28 @@ bool help_main(int argc, wchar_t* argv[])
     if (argc == 1)
     {
         HelpCommandList();
-        return true;
+        return TRUE;
     }
 
     for (cmdptr = cmds; cmdptr && cmdptr->cmd1; cmdptr++)
     {
         if (cmdptr1 == NULL &&
-            cmdptr->cmd1 != NULL && WideStrCaseCmp(argv[1], cmdptr->cmd1) == 0)
+            cmdptr->cmd1 != NULL && strcasecmp(argv[1], cmdptr->cmd1) == 0)
         {
             cmdptr1 = cmdptr;
         }
 
         if (cmdptr2 == NULL && argc >= 3 &&
-            cmdptr->cmd1 != NULL && WideStrCaseCmp(argv[1], cmdptr->cmd1) == 0 &&
-            cmdptr->cmd2 != NULL && WideStrCaseCmp(argv[2], cmdptr->cmd2) == 0)
+            cmdptr->cmd1 != NULL && strcasecmp(argv[1], cmdptr->cmd1) == 0 &&
+            cmdptr->cmd2 != NULL && strcasecmp(argv[2], cmdptr->cmd2) == 0)
         {
             cmdptr2 = cmdptr;
         }
 
         if (cmdptr3 == NULL && argc >= 4 &&
-            cmdptr->cmd1 != NULL && WideStrCaseCmp(argv[1], cmdptr->cmd1) == 0 &&
-            cmdptr->cmd2 != NULL && WideStrCaseCmp(argv[2], cmdptr->cmd2) == 0 &&
-            cmdptr->cmd3 != NULL && WideStrCaseCmp(argv[3], cmdptr->cmd3) == 0)
+            cmdptr->cmd1 != NULL && strcasecmp(argv[1], cmdptr->cmd1) == 0 &&
+            cmdptr->cmd2 != NULL && strcasecmp(argv[2], cmdptr->cmd2) == 0 &&
+            cmdptr->cmd3 != NULL && strcasecmp(argv[3], cmdptr->cmd3) == 0)
         {
             cmdptr3 = cmdptr;
         }
@@ -177,5 +156,5 @@ bool help_main(int argc, wchar_t* argv[])
 
     HelpCommandList();
 
-    return true;
+    return TRUE;
 }
@@ -9,10 +9,13 @@
 
 #include "diskpart.h"
 
-bool import_main(int argc, wchar_t **argv)
+BOOL import_main(int argc, char **argv)
 {
     // TODO: Implement import functionality for Linux
-    // Currently just returns true as a stub.
+    // Currently just returns TRUE as a stub.
 
-    return true;
+    (void)argc;
+    (void)argv;
+
+    return TRUE;
 }
@@ -9,37 +9,39 @@
 
 #include "diskpart.h"
 
-#include <stdio.h>
-#include <stdbool.h>
-
-bool inactive_main(int argc, wchar_t **argv)
+BOOL inactive_main(int argc, char **argv)
 {
+    (void)argc;
+    (void)argv;
+
     if (CurrentDisk == NULL)
     {
         printf("No disk selected.\n");
-        return true;
+        CommandFailed = TRUE;
+        return TRUE;
     }
 
     if (CurrentPartition == NULL)
     {
         printf("No partition selected.\n");
-        return true;
+        CommandFailed = TRUE;
+        return TRUE;
     }
 
     if (!CurrentPartition->BootIndicator)
     {
         printf("Partition is already inactive.\n");
-        return true;
+        return TRUE;
     }
 
     // Clear boot indicator
-    CurrentPartition->BootIndicator = false;
-    CurrentDisk->Dirty = true;
+    CurrentPartition->BootIndicator = FALSE;
+    CurrentDisk->Dirty = TRUE;
 
     // Update disk layout and write changes back to disk
     UpdateDiskLayout(CurrentDisk);
 
-    if (WritePartitions(CurrentDisk) == 0) // assume 0 == success in Linux version
+    if (NT_SUCCESS(WritePartitions(CurrentDisk)))
     {
         printf("Partition marked as inactive successfully.\n");
     }
@@ -48,5 +50,5 @@ bool inactive_main(int argc, wchar_t **argv)
         printf("Failed to mark partition as inactive.\n");
     }
 
-    return true;
+    return TRUE;
 }
@@ -7,55 +7,118 @@
  */
 
 #include "diskpart.h"
-#include <stdio.h>
-#include <wchar.h>
-#include <wctype.h>
-#include <string.h>
-#include <stdbool.h>
-
-#define MAX_ARGS_COUNT 32
-#define MAX_STRING_SIZE 1024
+#include <ctype.h>
+#include <strings.h>
 
 // Forward declarations
-BOOL exit_main(int argc, wchar_t **argv);
-BOOL rem_main(int argc, wchar_t **argv);
 BOOL HelpCommand(PCOMMAND cmd);
-VOID HelpCommandList(void);
+void HelpCommandList(void);
 
-// Command table same as original (not repeated here)...
+// Cleared before each command; its handler sets it when the command fails
+BOOL CommandFailed;
 
-BOOL InterpretCmd(int argc, wchar_t **argv)
+// Command table: the longest match of up to three words runs the command,
+// an entry without a function shows the help of its sub-commands
+COMMAND cmds[] =
+{
+    {"active",      NULL,        NULL,       active_main,              IDS_HELP_ACTIVE,                     MSG_COMMAND_ACTIVE},
+    {"add",         NULL,        NULL,       add_main,                 IDS_HELP_ADD,                        MSG_COMMAND_ADD},
+    {"assign",      NULL,        NULL,       assign_main,              IDS_HELP_ASSIGN,                     MSG_COMMAND_ASSIGN},
+    {"attach",      NULL,        NULL,       attach_main,              IDS_HELP_ATTACH,                     MSG_COMMAND_ATTACH},
+    {"attributes",  NULL,        NULL,       attributes_main,          IDS_HELP_ATTRIBUTES,                 MSG_COMMAND_ATTRIBUTES},
+    {"automount",   NULL,        NULL,       automount_main,           IDS_HELP_AUTOMOUNT,                  MSG_COMMAND_AUTOMOUNT},
+    {"break",       NULL,        NULL,       break_main,               IDS_HELP_BREAK,                      MSG_COMMAND_BREAK},
+    {"clean",       NULL,        NULL,       clean_main,               IDS_HELP_CLEAN,                      MSG_COMMAND_CLEAN},
+    {"compact",     NULL,        NULL,       compact_main,             IDS_HELP_COMPACT,                    MSG_COMMAND_COMPACT},
+    {"convert",     NULL,        NULL,       convert_main,             IDS_HELP_CONVERT,                    MSG_COMMAND_CONVERT},
+    {"create",      NULL,        NULL,       NULL,                     IDS_HELP_CREATE,                     MSG_NONE},
+    {"create",      "partition", NULL,       NULL,                     IDS_HELP_CREATE_PARTITION,           MSG_NONE},
+    {"create",      "partition", "extended", CreateExtendedPartition,  IDS_HELP_CREATE_PARTITION_EXTENDED,  MSG_COMMAND_CREATE_PARTITION_EXTENDED},
+    {"create",      "partition", "logical",  CreateLogicalPartition,   IDS_HELP_CREATE_PARTITION_LOGICAL,   MSG_COMMAND_CREATE_PARTITION_LOGICAL},
+    {"create",      "partition", "primary",  CreatePrimaryPartition,   IDS_HELP_CREATE_PARTITION_PRIMARY,   MSG_COMMAND_CREATE_PARTITION_PRIMARY},
+    {"create",      "vdisk",     NULL,       CreateVirtualDisk,        IDS_HELP_CREATE_VDISK,               MSG_NONE},
+    {"delete",      NULL,        NULL,       NULL,                     IDS_HELP_DELETE,                     MSG_NONE},
+    {"delete",      "partition", NULL,       DeletePartition,          IDS_HELP_DELETE_PARTITION,           MSG_COMMAND_DELETE_PARTITION},
+    {"detach",      NULL,        NULL,       detach_main,              IDS_HELP_DETACH,                     MSG_COMMAND_DETACH},
+    {"detail",      NULL,        NULL,       NULL,                     IDS_HELP_DETAIL,                     MSG_NONE},
+    {"detail",      "disk",      NULL,       DetailDisk,               IDS_HELP_DETAIL_DISK,                MSG_COMMAND_DETAIL_DISK},
+    {"detail",      "partition", NULL,       DetailPartition,          IDS_HELP_DETAIL_PARTITION,           MSG_COMMAND_DETAIL_PARTITION},
+    {"detail",      "volume",    NULL,       DetailVolume,             IDS_HELP_DETAIL_VOLUME,              MSG_COMMAND_DETAIL_VOLUME},
+    {"dump",        NULL,        NULL,       NULL,                     IDS_NONE,                            MSG_NONE},
+    {"dump",        "disk",      NULL,       DumpDisk,                 IDS_NONE,                            MSG_NONE},
+    {"dump",        "partition", NULL,       DumpPartition,            IDS_NONE,                            MSG_NONE},
+    {"exit",        NULL,        NULL,       NULL,                     IDS_HELP_EXIT,                       MSG_COMMAND_EXIT},
+    {"expand",      NULL,        NULL,       expand_main,              IDS_HELP_EXPAND,                     MSG_COMMAND_EXPAND},
+    {"extend",      NULL,        NULL,       extend_main,              IDS_HELP_EXTEND,                     MSG_COMMAND_EXTEND},
+    {"filesystems", NULL,        NULL,       filesystems_main,         IDS_HELP_FILESYSTEMS,                MSG_COMMAND_FILESYSTEMS},
+    {"format",      NULL,        NULL,       format_main,              IDS_HELP_FORMAT,                     MSG_COMMAND_FORMAT},
+    {"gpt",         NULL,        NULL,       gpt_main,                 IDS_HELP_GPT,                        MSG_COMMAND_GPT},
+    {"help",        NULL,        NULL,       help_main,                IDS_HELP_HELP,                       MSG_COMMAND_HELP},
+    {"import",      NULL,        NULL,       import_main,              IDS_HELP_IMPORT,                     MSG_COMMAND_IMPORT},
+    {"inactive",    NULL,        NULL,       inactive_main,            IDS_HELP_INACTIVE,                   MSG_COMMAND_INACTIVE},
+    {"list",        NULL,        NULL,       NULL,                     IDS_HELP_LIST,                       MSG_NONE},
+    {"list",        "disk",      NULL,       ListDisk,                 IDS_HELP_LIST_DISK,                  MSG_COMMAND_LIST_DISK},
+    {"list",        "partition", NULL,       ListPartition,            IDS_HELP_LIST_PARTITION,             MSG_COMMAND_LIST_PARTITION},
+    {"list",        "vdisk",     NULL,       ListVirtualDisk,          IDS_HELP_LIST_VDISK,                 MSG_COMMAND_LIST_VDISK},
+    {"list",        "volume",    NULL,       ListVolume,               IDS_HELP_LIST_VOLUME,                MSG_COMMAND_LIST_VOLUME},
+    {"merge",       NULL,        NULL,       merge_main,               IDS_HELP_MERGE,                      MSG_COMMAND_MERGE},
+    {"move",        NULL,        NULL,       move_main,                IDS_NONE,                            MSG_NONE},
+    {"offline",     NULL,        NULL,       offline_main,             IDS_HELP_OFFLINE,                    MSG_COMMAND_OFFLINE},
+    {"online",      NULL,        NULL,       online_main,              IDS_HELP_ONLINE,                     MSG_COMMAND_ONLINE},
+    {"recover",     NULL,        NULL,       recover_main,             IDS_HELP_RECOVER,                    MSG_COMMAND_RECOVER},
+    {"rem",         NULL,        NULL,       NULL,                     IDS_HELP_REM,                        MSG_COMMAND_REM},
+    {"remove",      NULL,        NULL,       remove_main,              IDS_HELP_REMOVE,                     MSG_COMMAND_REMOVE},
+    {"repair",      NULL,        NULL,       repair_main,              IDS_HELP_REPAIR,                     MSG_COMMAND_REPAIR},
+    {"rescan",      NULL,        NULL,       rescan_main,              IDS_HELP_RESCAN,                     MSG_COMMAND_RESCAN},
+    {"retain",      NULL,        NULL,       retain_main,              IDS_HELP_RETAIN,                     MSG_COMMAND_RETAIN},
+    {"san",         NULL,        NULL,       san_main,                 IDS_HELP_SAN,                        MSG_COMMAND_SAN},
+    {"select",      NULL,        NULL,       NULL,                     IDS_HELP_SELECT,                     MSG_NONE},
+    {"select",      "disk",      NULL,       SelectDisk,               IDS_HELP_SELECT_DISK,                MSG_COMMAND_SELECT_DISK},
+    {"select",      "partition", NULL,       SelectPartition,          IDS_HELP_SELECT_PARTITION,           MSG_COMMAND_SELECT_PARTITION},
+    {"select",      "vdisk",     NULL,       SelectVirtualDisk,        IDS_HELP_SELECT_VDISK,               MSG_COMMAND_SELECT_VDISK},
+    {"select",      "volume",    NULL,       SelectVolume,             IDS_HELP_SELECT_VOLUME,              MSG_COMMAND_SELECT_VOLUME},
+    {"setid",       NULL,        NULL,       setid_main,               IDS_HELP_SETID,                      MSG_COMMAND_SETID},
+    {"shrink",      NULL,        NULL,       shrink_main,              IDS_HELP_SHRINK,                     MSG_COMMAND_SHRINK},
+    {"snapshot",    NULL,        NULL,       snapshot_main,            IDS_NONE,                            MSG_NONE},
+    {"uniqueid",    NULL,        NULL,       NULL,                     IDS_HELP_UNIQUEID,                   MSG_NONE},
+    {"uniqueid",    "disk",      NULL,       UniqueIdDisk,             IDS_HELP_UNIQUEID_DISK,              MSG_COMMAND_UNIQUEID_DISK},
+    {NULL,          NULL,        NULL,       NULL,                     IDS_NONE,                            MSG_NONE}
+};
+
+BOOL InterpretCmd(int argc, char **argv)
 {
     PCOMMAND cmdptr;
     PCOMMAND cmdptr1 = NULL;
     PCOMMAND cmdptr2 = NULL;
     PCOMMAND cmdptr3 = NULL;
 
+    CommandFailed = FALSE;
+
     if (argc < 1)
         return true;
 
     // Exit command
-    if (wcscasecmp(argv[0], L"exit") == 0)
+    if (strcasecmp(argv[0], "exit") == 0)
         return false;
 
     // Comment command
-    if (wcscasecmp(argv[0], L"rem") == 0)
+    if (strcasecmp(argv[0], "rem") == 0)
         return true;
 
     for (cmdptr = cmds; cmdptr->cmd1; cmdptr++)
     {
-        if (!cmdptr1 && cmdptr->cmd1 && wcscasecmp(argv[0], cmdptr->cmd1) == 0)
+        if (!cmdptr1 && cmdptr->cmd1 && strcasecmp(argv[0], cmdptr->cmd1) == 0)
             cmdptr1 = cmdptr;
 
         if (!cmdptr2 && argc >= 2 && cmdptr->cmd1 && cmdptr->cmd2 &&
-            wcscasecmp(argv[0], cmdptr->cmd1) == 0 &&
-            wcscasecmp(argv[1], cmdptr->cmd2) == 0)
+            strcasecmp(argv[0], cmdptr->cmd1) == 0 &&
+            strcasecmp(argv[1], cmdptr->cmd2) == 0)
             cmdptr2 = cmdptr;
 
         if (!cmdptr3 && argc >= 3 && cmdptr->cmd1 && cmdptr->cmd2 && cmdptr->cmd3 &&
-            wcscasecmp(argv[0], cmdptr->cmd1) == 0 &&
-            wcscasecmp(argv[1], cmdptr->cmd2) == 0 &&
-            wcscasecmp(argv[2], cmdptr->cmd3) == 0)
+            strcasecmp(argv[0], cmdptr->cmd1) == 0 &&
+            strcasecmp(argv[1], cmdptr->cmd2) == 0 &&
+            strcasecmp(argv[2], cmdptr->cmd3) == 0)
             cmdptr3 = cmdptr;
     }
 
@@ -82,26 +145,27 @@ BOOL InterpretCmd(int argc, wchar_t **argv)
     }
 
     HelpCommandList();
+    CommandFailed = TRUE;
 
     return true;
 }
 
-BOOL InterpretScript(wchar_t *input_line)
+BOOL InterpretScript(char *input_line)
 {
-    wchar_t *args_vector[MAX_ARGS_COUNT];
+    char *args_vector[MAX_ARGS_COUNT];
     int args_count = 0;
     bool bWhiteSpace = true;
     bool bQuote = false;
-    wchar_t *ptr = input_line;
+    char *ptr = input_line;
 
     memset(args_vector, 0, sizeof(args_vector));
 
     while (*ptr != 0)
     {
-        if (*ptr == L'"')
+        if (*ptr == '"')
             bQuote = !bQuote;
 
-        if ((iswspace(*ptr) && !bQuote) || *ptr == L'\n')
+        if ((isspace((unsigned char)*ptr) && !bQuote) || *ptr == '\n')
         {
             *ptr = 0;
             bWhiteSpace = true;
@@ -120,56 +184,3 @@ BOOL InterpretScript(wchar_t *input_line)
 
     return InterpretCmd(args_count, args_vector);
 }
-
-void InterpretMain(void)
-{
-    wchar_t input_line[MAX_STRING_SIZE];
-    wchar_t *args_vector[MAX_ARGS_COUNT];
-    int args_count = 0;
-    bool bWhiteSpace = true;
-    bool bQuote = false;
-    bool bRun = true;
-    wchar_t *ptr;
-
-    while (bRun)
-    {
-        args_count = 0;
-        memset(args_vector, 0, sizeof(args_vector));
-
-        // Linux-friendly prompt
-        wprintf(L"diskpart> ");
-        fflush(stdout);
-
-        if (!fgetws(input_line, MAX_STRING_SIZE, stdin))
-        {
-            wprintf(L"\n");
-            break; // EOF or error
-        }
-
-        bQuote = false;
-        ptr = input_line;
-        while (*ptr != 0)
-        {
-            if (*ptr == L'"')
-                bQuote = !bQuote;
-
-            if ((iswspace(*ptr) && !bQuote) || *ptr == L'\n')
-            {
-                *ptr = 0;
-                bWhiteSpace = true;
-            }
-            else
-            {
-                if (bWhiteSpace && !bQuote && args_count < MAX_ARGS_COUNT)
-                {
-                    args_vector[args_count] = ptr;
-                    args_count++;
-                }
-                bWhiteSpace = false;
-            }
-            ptr++;
-        }
-
-        bRun = InterpretCmd(args_count, args_vector);
-    }
-}
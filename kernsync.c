@@ -0,0 +1,596 @@
+/*
+ * PROJECT:         ReactOS DiskPart (Linux port)
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * FILE:            base/system/diskpart/kernsync.c
+ * PURPOSE:         Brings the kernel's view of a disk's partitions in line
+ *                  with our partition lists using targeted BLKPG requests.
+ */
+
+#include "diskpart.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <linux/fs.h>
+#include <linux/blkpg.h>
+
+#define MAX_KERNEL_PARTITIONS 256
+
+/* Bounds the wait for udev, which may be busy with unrelated devices */
+#define NODE_WAIT_TIMEOUT_MS    30000
+#define NODE_POLL_INTERVAL_MS   50
+
+/* Start and length are in bytes, as BLKPG wants them */
+typedef struct _KERNEL_PARTITION {
+    ULONG Number;
+    ULONGLONG Start;
+    ULONGLONG Length;
+} KERNEL_PARTITION, *PKERNEL_PARTITION;
+
+/* FUNCTIONS ******************************************************************/
+
+static
+BOOL
+KernelPartitionIoctl(
+    int fd,
+    int Operation,
+    ULONG Number,
+    ULONGLONG Start,
+    ULONGLONG Length)
+{
+    struct blkpg_partition Partition;
+    struct blkpg_ioctl_arg Arg;
+
+    memset(&Partition, 0, sizeof(Partition));
+    Partition.start = (long long)Start;
+    Partition.length = (long long)Length;
+    Partition.pno = (int)Number;
+
+    memset(&Arg, 0, sizeof(Arg));
+    Arg.op = Operation;
+    Arg.datalen = sizeof(Partition);
+    Arg.data = &Partition;
+
+    return ioctl(fd, BLKPG, &Arg) == 0;
+}
+
+
+BOOL
+KernelAddPartition(
+    int fd,
+    ULONG Number,
+    ULONGLONG Start,
+    ULONGLONG Length)
+{
+    if (!KernelPartitionIoctl(fd, BLKPG_ADD_PARTITION, Number, Start, Length))
+    {
+        fprintf(stderr, "Failed to add partition %lu to the kernel: %s\n",
+                (unsigned long)Number, strerror(errno));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+BOOL
+KernelDeletePartition(
+    int fd,
+    ULONG Number)
+{
+    if (!KernelPartitionIoctl(fd, BLKPG_DEL_PARTITION, Number, 0, 0))
+    {
+        /* Nothing to do if the kernel never knew the partition */
+        if (errno == ENXIO)
+            return TRUE;
+
+        if (errno == EBUSY)
+        {
+            fprintf(stderr, "Partition %lu is in use; the kernel keeps it until it is released "
+                    "and the disk is rescanned.\n", (unsigned long)Number);
+            return FALSE;
+        }
+
+        fprintf(stderr, "Failed to remove partition %lu from the kernel: %s\n",
+                (unsigned long)Number, strerror(errno));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+BOOL
+KernelResizePartition(
+    int fd,
+    ULONG Number,
+    ULONGLONG Start,
+    ULONGLONG Length)
+{
+    if (!KernelPartitionIoctl(fd, BLKPG_RESIZE_PARTITION, Number, Start, Length))
+    {
+        fprintf(stderr, "Failed to resize partition %lu in the kernel: %s\n",
+                (unsigned long)Number, strerror(errno));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+/* Reads the partitions the kernel currently has for the disk from sysfs */
+static
+int
+GetKernelPartitions(
+    int fd,
+    PKERNEL_PARTITION Table,
+    int MaxCount)
+{
+    char DiskDirectory[MAX_PATH];
+    char PartDirectory[MAX_PATH * 2];
+    char Path[MAX_PATH * 3];
+    struct stat StatBuffer;
+    struct dirent *DirEntry;
+    ULONGLONG Number;
+    DIR *Dir;
+    int Count = 0;
+
+    if (fstat(fd, &StatBuffer) < 0 || !S_ISBLK(StatBuffer.st_mode))
+        return -1;
+
+    snprintf(DiskDirectory, sizeof(DiskDirectory), "/sys/dev/block/%u:%u",
+             major(StatBuffer.st_rdev), minor(StatBuffer.st_rdev));
+
+    Dir = opendir(DiskDirectory);
+    if (Dir == NULL)
+        return -1;
+
+    while ((DirEntry = readdir(Dir)) != NULL && Count < MaxCount)
+    {
+        if (DirEntry->d_name[0] == '.')
+            continue;
+
+        snprintf(PartDirectory, sizeof(PartDirectory), "%s/%s", DiskDirectory, DirEntry->d_name);
+
+        /* Only partitions have a number; the other entries read as 0 */
+        snprintf(Path, sizeof(Path), "%s/partition", PartDirectory);
+        Number = ReadSysfsNumber(Path);
+        if (Number == 0)
+            continue;
+
+        /* sysfs start and size are always in 512-byte units */
+        Table[Count].Number = (ULONG)Number;
+        snprintf(Path, sizeof(Path), "%s/start", PartDirectory);
+        Table[Count].Start = ReadSysfsNumber(Path) * 512;
+        snprintf(Path, sizeof(Path), "%s/size", PartDirectory);
+        Table[Count].Length = ReadSysfsNumber(Path) * 512;
+        Count++;
+    }
+
+    closedir(Dir);
+
+    return Count;
+}
+
+
+/* Builds the partitions the kernel should have from our lists */
+static
+int
+GetWantedPartitions(
+    PDISKENTRY DiskEntry,
+    PKERNEL_PARTITION Table,
+    int MaxCount)
+{
+    ListEntry *Heads[2] = { &DiskEntry->PrimaryPartListHead, &DiskEntry->LogicalPartListHead };
+    ListEntry *Entry;
+    PPARTENTRY PartEntry;
+    ULONGLONG Length, Stub;
+    int Count = 0, i;
+
+    for (i = 0; i < 2; i++)
+    {
+        for (Entry = Heads[i]->Flink; Entry != Heads[i]; Entry = Entry->Flink)
+        {
+            PartEntry = CONTAINING_RECORD(Entry, PARTENTRY, ListEntry);
+            if (!PartEntry->IsPartitioned || PartEntry->PartitionNumber == 0)
+                continue;
+
+            if (Count == MaxCount)
+                return Count;
+
+            Length = PartEntry->SectorCount * DiskEntry->BytesPerSector;
+
+            /*
+             * Like the kernel's msdos parser, an extended partition is only
+             * exposed as a stub covering its first EBR.
+             */
+            if (IsContainerPartition(PartEntry->PartitionType))
+            {
+                Stub = DiskEntry->BytesPerSector > 1024 ? DiskEntry->BytesPerSector : 1024;
+                if (Length > Stub)
+                    Length = Stub;
+            }
+
+            Table[Count].Number = PartEntry->PartitionNumber;
+            Table[Count].Start = PartEntry->StartSector * DiskEntry->BytesPerSector;
+            Table[Count].Length = Length;
+            Count++;
+        }
+    }
+
+    return Count;
+}
+
+
+static
+PKERNEL_PARTITION
+FindPartition(
+    PKERNEL_PARTITION Table,
+    int Count,
+    ULONG Number)
+{
+    int i;
+
+    for (i = 0; i < Count; i++)
+    {
+        if (Table[i].Number == Number)
+            return &Table[i];
+    }
+
+    return NULL;
+}
+
+
+/* Finds the kernel's name and device number of a partition of the disk */
+static
+BOOL
+LookupKernelPartition(
+    int fd,
+    ULONG Number,
+    PPARTITION_NODE Node)
+{
+    char DiskDirectory[MAX_PATH];
+    char PartDirectory[MAX_PATH * 2];
+    char Path[MAX_PATH * 3];
+    char Device[32];
+    struct stat StatBuffer;
+    struct dirent *DirEntry;
+    unsigned int Major, Minor;
+    BOOL Found = FALSE;
+    char *Slash;
+    DIR *Dir;
+
+    if (fstat(fd, &StatBuffer) < 0 || !S_ISBLK(StatBuffer.st_mode))
+        return FALSE;
+
+    snprintf(DiskDirectory, sizeof(DiskDirectory), "/sys/dev/block/%u:%u",
+             major(StatBuffer.st_rdev), minor(StatBuffer.st_rdev));
+
+    Dir = opendir(DiskDirectory);
+    if (Dir == NULL)
+        return FALSE;
+
+    while (!Found && (DirEntry = readdir(Dir)) != NULL)
+    {
+        if (DirEntry->d_name[0] == '.')
+            continue;
+
+        snprintf(PartDirectory, sizeof(PartDirectory), "%s/%s", DiskDirectory, DirEntry->d_name);
+        snprintf(Path, sizeof(Path), "%s/partition", PartDirectory);
+        if (ReadSysfsNumber(Path) != Number)
+            continue;
+
+        snprintf(Path, sizeof(Path), "%s/dev", PartDirectory);
+        if (!ReadSysfsString(Path, Device, sizeof(Device)))
+            break;
+
+        /* The kernel's own names are shorter than Name (DISK_NAME_LEN) */
+        if (sscanf(Device, "%u:%u", &Major, &Minor) == 2 &&
+            (size_t)snprintf(Node->Name, sizeof(Node->Name), "%s", DirEntry->d_name) < sizeof(Node->Name))
+        {
+            /* cciss!c0d0p1 is /dev/cciss/c0d0p1 */
+            while ((Slash = strchr(Node->Name, '!')) != NULL)
+                *Slash = '/';
+
+            Node->Major = Major;
+            Node->Minor = Minor;
+            Found = TRUE;
+        }
+    }
+
+    closedir(Dir);
+
+    return Found;
+}
+
+
+/*
+ * Starts listening for the events of partition changes. It has to come
+ * before the changes, so that none of their events is missed. With udev
+ * running, its own events tell when a node has been fully processed; the
+ * udev queue as a whole is not waited for.
+ */
+void
+BeginPartitionNodeWait(
+    PPARTITION_NODE_WAIT Wait)
+{
+    Wait->Count = 0;
+    Wait->Udev = (access("/run/udev/control", F_OK) == 0);
+    Wait->fd = OpenUeventSocket(Wait->Udev ? UEVENT_GROUP_UDEV : UEVENT_GROUP_KERNEL);
+}
+
+
+/*
+ * Adds a partition of the disk open on fd to the wait: one that was just
+ * added, or one that is about to be removed, as the kernel forgets its
+ * name with it.
+ */
+void
+ExpectPartitionNode(
+    PPARTITION_NODE_WAIT Wait,
+    int fd,
+    ULONG Number,
+    BOOL Removed)
+{
+    PPARTITION_NODE Node;
+
+    if (Wait->Count == MAX_WAIT_NODES)
+        return;
+
+    Node = &Wait->Nodes[Wait->Count];
+    memset(Node, 0, sizeof(*Node));
+    Node->Number = Number;
+    Node->Removed = Removed;
+
+    if (LookupKernelPartition(fd, Number, Node))
+        Wait->Count++;
+}
+
+
+static
+ULONGLONG
+GetMonotonicMilliseconds(void)
+{
+    struct timespec Now;
+
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return (ULONGLONG)Now.tv_sec * 1000 + Now.tv_nsec / 1000000;
+}
+
+
+static
+BOOL
+IsPartitionNodeReady(
+    PPARTITION_NODE_WAIT Wait,
+    PPARTITION_NODE Node)
+{
+    char Path[MAX_PATH];
+    struct stat StatBuffer;
+    BOOL Present;
+
+    snprintf(Path, sizeof(Path), "/dev/%s", Node->Name);
+    Present = (stat(Path, &StatBuffer) == 0 && S_ISBLK(StatBuffer.st_mode) &&
+               major(StatBuffer.st_rdev) == Node->Major &&
+               minor(StatBuffer.st_rdev) == Node->Minor);
+
+    if (Present == Node->Removed)
+        return FALSE;
+
+    if (!Wait->Udev || Node->Processed)
+        return TRUE;
+
+    /* Without its events, udev's database entry is the next best sign */
+    if (Wait->fd < 0)
+    {
+        snprintf(Path, sizeof(Path), "/run/udev/data/b%lu:%lu",
+                 (unsigned long)Node->Major, (unsigned long)Node->Minor);
+        return (access(Path, F_OK) == 0) != Node->Removed;
+    }
+
+    return FALSE;
+}
+
+
+static
+void
+ReceivePartitionNodeEvents(
+    PPARTITION_NODE_WAIT Wait)
+{
+    UEVENT Event;
+    const char *Name;
+    BOOL Removed;
+    ULONG i;
+
+    while (ReadUevent(Wait->fd, &Event))
+    {
+        if (!IsBlockUevent(&Event) || Event.DevName == NULL)
+            continue;
+
+        /* The kernel sends sda1, udev /dev/sda1 */
+        Name = Event.DevName;
+        if (strncmp(Name, "/dev/", 5) == 0)
+            Name += 5;
+
+        Removed = (strcmp(Event.Action, "remove") == 0);
+
+        for (i = 0; i < Wait->Count; i++)
+        {
+            if (Wait->Nodes[i].Removed == Removed && strcmp(Wait->Nodes[i].Name, Name) == 0)
+                Wait->Nodes[i].Processed = Event.Processed;
+        }
+    }
+}
+
+
+/*
+ * Returns once the expected nodes exist, or are gone, and udev is done
+ * with them, or when the wait times out. The caller must not hold the lock
+ * of the disk: udev leaves a locked disk alone until it is unlocked.
+ */
+BOOL
+EndPartitionNodeWait(
+    PPARTITION_NODE_WAIT Wait)
+{
+    ULONGLONG Deadline, Now;
+    struct pollfd PollFd;
+    ULONG Pending, i;
+    int Timeout;
+
+    Deadline = GetMonotonicMilliseconds() + NODE_WAIT_TIMEOUT_MS;
+
+    for (;;)
+    {
+        if (Wait->fd >= 0)
+            ReceivePartitionNodeEvents(Wait);
+
+        Pending = 0;
+        for (i = 0; i < Wait->Count; i++)
+        {
+            if (!IsPartitionNodeReady(Wait, &Wait->Nodes[i]))
+                Pending++;
+        }
+
+        Now = GetMonotonicMilliseconds();
+        if (Pending == 0 || Now >= Deadline)
+            break;
+
+        /* Events only wake us up early; the nodes are checked either way */
+        Timeout = (Deadline - Now < 1000) ? (int)(Deadline - Now) : 1000;
+        if (Wait->fd >= 0)
+        {
+            PollFd.fd = Wait->fd;
+            PollFd.events = POLLIN;
+            poll(&PollFd, 1, Timeout);
+        }
+        else
+        {
+            usleep((Timeout < NODE_POLL_INTERVAL_MS ? Timeout : NODE_POLL_INTERVAL_MS) * 1000);
+        }
+    }
+
+    for (i = 0; i < Wait->Count && Pending > 0; i++)
+    {
+        if (!IsPartitionNodeReady(Wait, &Wait->Nodes[i]))
+            printf("/dev/%s is not %s yet.\n", Wait->Nodes[i].Name,
+                   Wait->Nodes[i].Removed ? "gone" : "ready");
+    }
+
+    if (Wait->fd >= 0)
+        close(Wait->fd);
+    Wait->fd = -1;
+    Wait->Count = 0;
+
+    return Pending == 0;
+}
+
+
+/*
+ * Diffs the kernel's partitions against the disk's partition lists and issues
+ * BLKPG requests for the changed entries only: removals first, then shrinks,
+ * then grows and finally additions, so that no step overlaps a partition
+ * that is still registered. Untouched partitions stay online. Added and
+ * removed partitions go into Wait, if given.
+ */
+BOOL
+SyncKernelPartitions(
+    PDISKENTRY DiskEntry,
+    PPARTITION_NODE_WAIT Wait)
+{
+    KERNEL_PARTITION *Current = NULL, *Wanted = NULL;
+    PKERNEL_PARTITION Old, New;
+    int CurrentCount, WantedCount, WaitCount, i, Pass;
+    BOOL Success = FALSE;
+    int fd;
+
+    fd = OpenDiskDevice(DiskEntry, O_RDONLY);
+    if (fd < 0)
+        return FALSE;
+
+    Current = calloc(MAX_KERNEL_PARTITIONS, sizeof(KERNEL_PARTITION));
+    Wanted = calloc(MAX_KERNEL_PARTITIONS, sizeof(KERNEL_PARTITION));
+    if (Current == NULL || Wanted == NULL)
+        goto done;
+
+    CurrentCount = GetKernelPartitions(fd, Current, MAX_KERNEL_PARTITIONS);
+    if (CurrentCount < 0)
+    {
+        /* No sysfs view of the disk: fall back to a full rescan */
+        Success = (ioctl(fd, BLKRRPART) == 0);
+        if (!Success)
+            perror("ioctl BLKRRPART");
+        goto done;
+    }
+
+    WantedCount = GetWantedPartitions(DiskEntry, Wanted, MAX_KERNEL_PARTITIONS);
+
+    Success = TRUE;
+
+    for (i = 0; i < CurrentCount; i++)
+    {
+        Old = &Current[i];
+        New = FindPartition(Wanted, WantedCount, Old->Number);
+
+        /* A partition that moved is removed here and added back below */
+        if (New == NULL || New->Start != Old->Start)
+        {
+            /* Its name is only in sysfs while the kernel still has it */
+            WaitCount = (Wait != NULL) ? Wait->Count : 0;
+            if (New == NULL && Wait != NULL)
+                ExpectPartitionNode(Wait, fd, Old->Number, TRUE);
+
+            /* A busy partition stays as it is, and nothing else is put in its place */
+            if (!KernelDeletePartition(fd, Old->Number))
+            {
+                if (Wait != NULL)
+                    Wait->Count = WaitCount;
+                Success = FALSE;
+                continue;
+            }
+            Old->Length = 0;
+        }
+    }
+
+    for (Pass = 0; Pass < 2; Pass++)
+    {
+        for (i = 0; i < WantedCount; i++)
+        {
+            New = &Wanted[i];
+            Old = FindPartition(Current, CurrentCount, New->Number);
+            if (Old == NULL || Old->Length == 0 || Old->Length == New->Length ||
+                Old->Start != New->Start)
+                continue;
+
+            /* Pass 0 shrinks, pass 1 grows */
+            if ((Pass == 0) != (New->Length < Old->Length))
+                continue;
+
+            if (!KernelResizePartition(fd, New->Number, New->Start, New->Length))
+                Success = FALSE;
+        }
+    }
+
+    for (i = 0; i < WantedCount; i++)
+    {
+        New = &Wanted[i];
+        Old = FindPartition(Current, CurrentCount, New->Number);
+        if (Old != NULL && Old->Length != 0)
+            continue;
+
+        if (!KernelAddPartition(fd, New->Number, New->Start, New->Length))
+            Success = FALSE;
+        else if (Wait != NULL)
+            ExpectPartitionNode(Wait, fd, New->Number, FALSE);
+    }
+
+done:
+    free(Wanted);
+    free(Current);
+    close(fd);
+
+    return Success;
+}
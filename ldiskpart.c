@@ -0,0 +1,709 @@
+/*
+ * PROJECT:         ReactOS DiskPart (Linux port)
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * FILE:            base/system/diskpart/ldiskpart.c
+ * PURPOSE:         Public interface of libldiskpart, on top of the
+ *                  partition and volume lists the commands use.
+ */
+
+#define _GNU_SOURCE
+#include "diskpart.h"
+#include "ldiskpart.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define LDP_MESSAGE_SIZE 4096
+
+/* Where stdout and stderr were while the engine's output is collected */
+typedef struct _MESSAGE_CAPTURE {
+    int SavedStdout;
+    int SavedStderr;
+} MESSAGE_CAPTURE, *PMESSAGE_CAPTURE;
+
+static char LastMessage[LDP_MESSAGE_SIZE];
+static int MessageFile = -1;
+
+/* FUNCTIONS ******************************************************************/
+
+static
+void
+CopyGuid(
+    LDP_GUID *Target,
+    const GUID *Source)
+{
+    Target->Data1 = Source->Data1;
+    Target->Data2 = Source->Data2;
+    Target->Data3 = Source->Data3;
+    memcpy(Target->Data4, Source->Data4, sizeof(Target->Data4));
+}
+
+
+/*
+ * The engine reports problems with printf, as the commands do. A library
+ * call must not write to its caller's stdout or stderr, so what the engine
+ * prints during one is collected for LdpGetLastErrorMessage instead.
+ */
+static
+void
+BeginMessageCapture(
+    PMESSAGE_CAPTURE Capture)
+{
+    LastMessage[0] = '\0';
+    Capture->SavedStdout = -1;
+    Capture->SavedStderr = -1;
+
+    if (MessageFile < 0)
+        MessageFile = memfd_create("ldiskpart-messages", MFD_CLOEXEC);
+    if (MessageFile < 0 || ftruncate(MessageFile, 0) < 0)
+        return;
+
+    fflush(stdout);
+    fflush(stderr);
+
+    Capture->SavedStdout = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+    Capture->SavedStderr = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 0);
+    if (Capture->SavedStdout < 0 || Capture->SavedStderr < 0)
+    {
+        if (Capture->SavedStdout >= 0)
+            close(Capture->SavedStdout);
+        if (Capture->SavedStderr >= 0)
+            close(Capture->SavedStderr);
+        Capture->SavedStdout = -1;
+        return;
+    }
+
+    /* Both append to the file, in the order they are written */
+    lseek(MessageFile, 0, SEEK_SET);
+    dup2(MessageFile, STDOUT_FILENO);
+    dup2(MessageFile, STDERR_FILENO);
+}
+
+
+/* Puts stdout and stderr back; keeps errno for FailureStatus */
+static
+void
+EndMessageCapture(
+    PMESSAGE_CAPTURE Capture)
+{
+    int SavedErrno = errno;
+    ssize_t Length;
+
+    if (Capture->SavedStdout < 0)
+        return;
+
+    fflush(stdout);
+    fflush(stderr);
+
+    dup2(Capture->SavedStdout, STDOUT_FILENO);
+    dup2(Capture->SavedStderr, STDERR_FILENO);
+    close(Capture->SavedStdout);
+    close(Capture->SavedStderr);
+
+    Length = pread(MessageFile, LastMessage, sizeof(LastMessage) - 1, 0);
+    LastMessage[(Length > 0) ? Length : 0] = '\0';
+
+    errno = SavedErrno;
+}
+
+
+/* LockDisk leaves EBUSY behind when it gave up waiting */
+static
+LDP_STATUS
+FailureStatus(void)
+{
+    return (errno == EBUSY) ? LDP_ERROR_LOCKED : LDP_ERROR_IO;
+}
+
+
+/* Hands the caller as much of the structure as its StructSize says it knows */
+static
+LDP_STATUS
+ReturnInfo(
+    void *Info,
+    const void *Source,
+    size_t Size)
+{
+    uint32_t StructSize = *(const uint32_t *)Info;
+
+    if (StructSize < sizeof(uint32_t))
+        return LDP_ERROR_INVALID_PARAMETER;
+
+    if (StructSize > Size)
+        StructSize = (uint32_t)Size;
+
+    memcpy((char *)Info + sizeof(uint32_t), (const char *)Source + sizeof(uint32_t),
+           StructSize - sizeof(uint32_t));
+
+    return LDP_SUCCESS;
+}
+
+
+uint32_t
+LdpGetApiVersion(void)
+{
+    return LDP_API_VERSION;
+}
+
+
+const char *
+LdpStatusString(
+    LDP_STATUS Status)
+{
+    switch (Status)
+    {
+        case LDP_SUCCESS:
+            return "The operation completed successfully";
+        case LDP_ERROR_INVALID_PARAMETER:
+            return "Invalid parameter";
+        case LDP_ERROR_NOT_FOUND:
+            return "Not found";
+        case LDP_ERROR_NO_MEMORY:
+            return "Out of memory";
+        case LDP_ERROR_IO:
+            return "I/O error";
+        case LDP_ERROR_NO_SPACE:
+            return "Not enough free space";
+        case LDP_ERROR_NOT_SUPPORTED:
+            return "Not supported on this disk";
+        case LDP_ERROR_IN_USE:
+            return "The volume is in use";
+        case LDP_ERROR_NOT_COMMITTED:
+            return "The partition table has changes that are not written yet";
+        case LDP_ERROR_LOCKED:
+            return "The disk is locked by another process";
+    }
+
+    return "Unknown error";
+}
+
+
+const char *
+LdpGetLastErrorMessage(void)
+{
+    return LastMessage;
+}
+
+
+LDP_STATUS
+LdpInitialize(void)
+{
+    MESSAGE_CAPTURE Capture;
+    LDP_STATUS Status = LDP_SUCCESS;
+
+    BeginMessageCapture(&Capture);
+
+    if (!NT_SUCCESS(CreatePartitionList()))
+    {
+        Status = LDP_ERROR_IO;
+    }
+    else if (!NT_SUCCESS(CreateVolumeList()))
+    {
+        DestroyPartitionList();
+        Status = LDP_ERROR_NO_MEMORY;
+    }
+
+    EndMessageCapture(&Capture);
+
+    return Status;
+}
+
+
+void
+LdpSetLockTimeout(
+    uint32_t Seconds)
+{
+    DiskLockTimeout = Seconds;
+}
+
+
+LDP_STATUS
+LdpRescan(void)
+{
+    LdpShutdown();
+
+    return LdpInitialize();
+}
+
+
+void
+LdpShutdown(void)
+{
+    DestroyVolumeList();
+    DestroyPartitionList();
+}
+
+
+uint32_t
+LdpGetDiskCount(void)
+{
+    ListEntry *Entry;
+    uint32_t Count = 0;
+
+    for (Entry = DiskListHead.Flink; Entry != &DiskListHead; Entry = Entry->Flink)
+        Count++;
+
+    return Count;
+}
+
+
+LDP_STATUS
+LdpGetDisk(
+    uint32_t Index,
+    LDP_DISK_HANDLE *Disk)
+{
+    ListEntry *Entry;
+
+    if (Disk == NULL)
+        return LDP_ERROR_INVALID_PARAMETER;
+
+    for (Entry = DiskListHead.Flink; Entry != &DiskListHead; Entry = Entry->Flink)
+    {
+        if (Index-- == 0)
+        {
+            *Disk = CONTAINING_RECORD(Entry, DISKENTRY, ListEntry);
+            return LDP_SUCCESS;
+        }
+    }
+
+    return LDP_ERROR_NOT_FOUND;
+}
+
+
+LDP_STATUS
+LdpFindDisk(
+    const char *DeviceName,
+    LDP_DISK_HANDLE *Disk)
+{
+    ListEntry *Entry;
+    PDISKENTRY DiskEntry;
+
+    if (DeviceName == NULL || Disk == NULL)
+        return LDP_ERROR_INVALID_PARAMETER;
+
+    for (Entry = DiskListHead.Flink; Entry != &DiskListHead; Entry = Entry->Flink)
+    {
+        DiskEntry = CONTAINING_RECORD(Entry, DISKENTRY, ListEntry);
+        if (strcmp(DiskEntry->DeviceName, DeviceName) == 0)
+        {
+            *Disk = DiskEntry;
+            return LDP_SUCCESS;
+        }
+    }
+
+    return LDP_ERROR_NOT_FOUND;
+}
+
+
+LDP_STATUS
+LdpQueryDisk(
+    LDP_DISK_HANDLE Disk,
+    LDP_DISK_INFO *Info)
+{
+    LDP_DISK_INFO Result;
+
+    if (Disk == NULL || Info == NULL)
+        return LDP_ERROR_INVALID_PARAMETER;
+
+    memset(&Result, 0, sizeof(Result));
+    Result.Number = Disk->DiskNumber;
+    snprintf(Result.DeviceName, sizeof(Result.DeviceName), "%s", Disk->DeviceName);
+    Result.Size = Disk->SectorCount * Disk->BytesPerSector;
+    Result.FreeSize = (Disk->PrimaryFreeExtents.TotalSectors + Disk->LogicalFreeExtents.TotalSectors) *
+                      Disk->BytesPerSector;
+    Result.BytesPerSector = Disk->BytesPerSector;
+    Result.PartitionCount = LdpGetPartitionCount(Disk);
+    Result.Style = (uint32_t)Disk->PartitionStyle;
+    Result.Dirty = Disk->Dirty ? 1 : 0;
+    CopyGuid(&Result.DiskGuid, &Disk->DiskGuid);
+
+    return ReturnInfo(Info, &Result, sizeof(Result));
+}
+
+
+uint32_t
+LdpGetPartitionCount(
+    LDP_DISK_HANDLE Disk)
+{
+    ListEntry *Heads[2];
+    ListEntry *Entry;
+    uint32_t Count = 0;
+    int i;
+
+    if (Disk == NULL)
+        return 0;
+
+    Heads[0] = &Disk->PrimaryPartListHead;
+    Heads[1] = &Disk->LogicalPartListHead;
+
+    for (i = 0; i < 2; i++)
+    {
+        for (Entry = Heads[i]->Flink; Entry != Heads[i]; Entry = Entry->Flink)
+        {
+            if (CONTAINING_RECORD(Entry, PARTENTRY, ListEntry)->IsPartitioned)
+                Count++;
+        }
+    }
+
+    return Count;
+}
+
+
+LDP_STATUS
+LdpGetPartition(
+    LDP_DISK_HANDLE Disk,
+    uint32_t Index,
+    LDP_PARTITION_HANDLE *Partition)
+{
+    ListEntry *Heads[2];
+    ListEntry *Entry;
+    PPARTENTRY PartEntry;
+    int i;
+
+    if (Disk == NULL || Partition == NULL)
+        return LDP_ERROR_INVALID_PARAMETER;
+
+    Heads[0] = &Disk->PrimaryPartListHead;
+    Heads[1] = &Disk->LogicalPartListHead;
+
+    for (i = 0; i < 2; i++)
+    {
+        for (Entry = Heads[i]->Flink; Entry != Heads[i]; Entry = Entry->Flink)
+        {
+            PartEntry = CONTAINING_RECORD(Entry, PARTENTRY, ListEntry);
+            if (PartEntry->IsPartitioned && Index-- == 0)
+            {
+                *Partition = PartEntry;
+                return LDP_SUCCESS;
+            }
+        }
+    }
+
+    return LDP_ERROR_NOT_FOUND;
+}
+
+
+LDP_STATUS
+LdpQueryPartition(
+    LDP_PARTITION_HANDLE Partition,
+    LDP_PARTITION_INFO *Info)
+{
+    LDP_PARTITION_INFO Result;
+    PDISKENTRY DiskEntry;
+
+    if (Partition == NULL || Info == NULL || !Partition->IsPartitioned)
+        return LDP_ERROR_INVALID_PARAMETER;
+
+    DiskEntry = Partition->DiskEntry;
+
+    memset(&Result, 0, sizeof(Result));
+    Result.Number = Partition->New ? 0 : Partition->PartitionNumber;
+    if (!Partition->New)
+        GetPartitionDeviceName(Partition, Result.DeviceName, sizeof(Result.DeviceName));
+    Result.Offset = Partition->StartSector * DiskEntry->BytesPerSector;
+    Result.Size = Partition->SectorCount * DiskEntry->BytesPerSector;
+    Result.MbrType = Partition->PartitionType;
+    Result.Active = Partition->BootIndicator ? 1 : 0;
+    Result.Logical = Partition->LogicalPartition ? 1 : 0;
+    Result.Extended = IsContainerPartition(Partition->PartitionType) ? 1 : 0;
+    CopyGuid(&Result.TypeGuid, &Partition->PartitionTypeGuid);
+    CopyGuid(&Result.PartitionGuid, &Partition->PartitionGuid);
+    snprintf(Result.FileSystem, sizeof(Result.FileSystem), "%s", Partition->FileSystemName);
+    snprintf(Result.Label, sizeof(Result.Label), "%s", Partition->VolumeLabel);
+
+    return ReturnInfo(Info, &Result, sizeof(Result));
+}
+
+
+uint32_t
+LdpGetVolumeCount(void)
+{
+    ListEntry *Entry;
+    uint32_t Count = 0;
+
+    for (Entry = VolumeListHead.Flink; Entry != &VolumeListHead; Entry = Entry->Flink)
+        Count++;
+
+    return Count;
+}
+
+
+LDP_STATUS
+LdpQueryVolume(
+    uint32_t Index,
+    LDP_VOLUME_INFO *Info)
+{
+    LDP_VOLUME_INFO Result;
+    ListEntry *Entry;
+    PVOLENTRY VolumeEntry;
+
+    if (Info == NULL)
+        return LDP_ERROR_INVALID_PARAMETER;
+
+    for (Entry = VolumeListHead.Flink; Entry != &VolumeListHead; Entry = Entry->Flink)
+    {
+        if (Index-- != 0)
+            continue;
+
+        VolumeEntry = CONTAINING_RECORD(Entry, VOLENTRY, ListEntry);
+
+        memset(&Result, 0, sizeof(Result));
+        Result.Number = VolumeEntry->VolumeNumber;
+        snprintf(Result.DeviceName, sizeof(Result.DeviceName), "%s", VolumeEntry->DeviceName);
+        snprintf(Result.MountPoint, sizeof(Result.MountPoint), "%s", VolumeEntry->VolumeName);
+        snprintf(Result.FileSystem, sizeof(Result.FileSystem), "%s",
+                 VolumeEntry->pszFilesystem ? VolumeEntry->pszFilesystem : "");
+        snprintf(Result.Label, sizeof(Result.Label), "%s",
+                 VolumeEntry->pszLabel ? VolumeEntry->pszLabel : "");
+        Result.Size = VolumeEntry->Size;
+        Result.ExtentCount = VolumeEntry->pExtents ? VolumeEntry->pExtents->NumberOfDiskExtents : 0;
+
+        return ReturnInfo(Info, &Result, sizeof(Result));
+    }
+
+    return LDP_ERROR_NOT_FOUND;
+}
+
+
+/* The free space entry holding a sector, primary or inside the extended partition */
+static
+PPARTENTRY
+FindFreeEntry(
+    PDISKENTRY DiskEntry,
+    ULONGLONG Sector)
+{
+    ListEntry *Heads[2] = { &DiskEntry->PrimaryPartListHead, &DiskEntry->LogicalPartListHead };
+    ListEntry *Entry;
+    PPARTENTRY PartEntry;
+    int i;
+
+    for (i = 0; i < 2; i++)
+    {
+        for (Entry = Heads[i]->Flink; Entry != Heads[i]; Entry = Entry->Flink)
+        {
+            PartEntry = CONTAINING_RECORD(Entry, PARTENTRY, ListEntry);
+            if (!PartEntry->IsPartitioned &&
+                PartEntry->StartSector <= Sector &&
+                Sector < PartEntry->StartSector + PartEntry->SectorCount)
+                return PartEntry;
+        }
+    }
+
+    return NULL;
+}
+
+
+LDP_STATUS
+LdpCreatePartition(
+    LDP_DISK_HANDLE Disk,
+    uint64_t Offset,
+    uint64_t Size,
+    uint8_t MbrType,
+    LDP_PARTITION_HANDLE *Partition)
+{
+    MESSAGE_CAPTURE Capture;
+    FREE_EXTENT Extent;
+    ULONGLONG StartSector, SectorCount;
+    PPARTENTRY PartEntry, FreeEntry;
+    BOOL Logical;
+
+    if (Disk == NULL || MbrType == PARTITION_ENTRY_UNUSED ||
+        Offset % Disk->BytesPerSector != 0)
+        return LDP_ERROR_INVALID_PARAMETER;
+
+    if (Disk->PartitionStyle == PARTITION_STYLE_RAW)
+        return LDP_ERROR_NOT_SUPPORTED;
+
+    SectorCount = Size / Disk->BytesPerSector;
+    if (Size != 0 && SectorCount == 0)
+        return LDP_ERROR_INVALID_PARAMETER;
+
+    if (Offset == 0)
+    {
+        /*
+         * Primary space while the table has a free entry, then the space in
+         * the extended partition. The two are indexed apart, so the extent
+         * picked never spans the extended partition's boundary.
+         */
+        Logical = Disk->PartitionStyle == PARTITION_STYLE_MBR && Disk->ExtendedPartition != NULL &&
+                  !IsContainerPartition(MbrType) && GetPrimaryPartitionCount(Disk) >= MBR_PARTITION_COUNT;
+
+        if (!FindFreeExtent(Logical ? &Disk->LogicalFreeExtents : &Disk->PrimaryFreeExtents,
+                            (SectorCount != 0) ? FREE_EXTENT_BEST_FIT : FREE_EXTENT_LARGEST,
+                            (SectorCount != 0) ? SectorCount : 1,
+                            &Extent))
+            return LDP_ERROR_NO_SPACE;
+
+        StartSector = Extent.StartSector;
+        if (SectorCount == 0)
+            SectorCount = Extent.SectorCount;
+    }
+    else
+    {
+        StartSector = Offset / Disk->BytesPerSector;
+
+        /* Up to the end of the free space the offset falls into */
+        if (SectorCount == 0)
+        {
+            FreeEntry = FindFreeEntry(Disk, StartSector);
+            if (FreeEntry == NULL)
+                return LDP_ERROR_NO_SPACE;
+
+            SectorCount = FreeEntry->StartSector + FreeEntry->SectorCount - StartSector;
+        }
+    }
+
+    BeginMessageCapture(&Capture);
+    PartEntry = CreatePartitionEntry(Disk, StartSector, SectorCount, MbrType);
+    EndMessageCapture(&Capture);
+    if (PartEntry == NULL)
+        return LDP_ERROR_NO_SPACE;
+
+    if (Partition != NULL)
+        *Partition = PartEntry;
+
+    return LDP_SUCCESS;
+}
+
+
+LDP_STATUS
+LdpDeletePartition(
+    LDP_PARTITION_HANDLE Partition)
+{
+    MESSAGE_CAPTURE Capture;
+    char MountPoint[MAX_PATH];
+    BOOL Success;
+    int fd;
+
+    if (Partition == NULL || !Partition->IsPartitioned)
+        return LDP_ERROR_INVALID_PARAMETER;
+
+    /* Swap, RAID, LVM and dm-crypt hold a partition without mounting it */
+    if (!Partition->New)
+    {
+        if (GetPartitionMountPoint(Partition, MountPoint, sizeof(MountPoint)) ||
+            !ClaimPartition(Partition, &fd))
+            return LDP_ERROR_IN_USE;
+        if (fd >= 0)
+            close(fd);
+    }
+
+    BeginMessageCapture(&Capture);
+    Success = DeletePartitionEntry(Partition);
+    EndMessageCapture(&Capture);
+
+    return Success ? LDP_SUCCESS : LDP_ERROR_IN_USE;
+}
+
+
+LDP_STATUS
+LdpCommitDisk(
+    LDP_DISK_HANDLE Disk)
+{
+    MESSAGE_CAPTURE Capture;
+    NTSTATUS Status;
+
+    if (Disk == NULL)
+        return LDP_ERROR_INVALID_PARAMETER;
+
+    if (Disk->PartitionStyle == PARTITION_STYLE_RAW)
+        return Disk->Dirty ? LDP_ERROR_NOT_SUPPORTED : LDP_SUCCESS;
+
+    BeginMessageCapture(&Capture);
+    errno = 0;
+    Status = WritePartitions(Disk);
+    EndMessageCapture(&Capture);
+
+    return NT_SUCCESS(Status) ? LDP_SUCCESS : FailureStatus();
+}
+
+
+LDP_STATUS
+LdpCleanDisk(
+    LDP_DISK_HANDLE Disk,
+    int All)
+{
+    MESSAGE_CAPTURE Capture;
+    BOOL Success;
+
+    if (Disk == NULL)
+        return LDP_ERROR_INVALID_PARAMETER;
+
+    BeginMessageCapture(&Capture);
+    errno = 0;
+    Success = CleanDisk(Disk, All ? TRUE : FALSE, 1);
+    EndMessageCapture(&Capture);
+
+    return Success ? LDP_SUCCESS : FailureStatus();
+}
+
+
+LDP_STATUS
+LdpFormatPartition(
+    LDP_PARTITION_HANDLE Partition,
+    const char *FileSystem,
+    const char *Label,
+    int Quick)
+{
+    MESSAGE_CAPTURE Capture;
+    char MountPoint[MAX_PATH];
+    BOOL Success;
+    int fd;
+
+    if (Partition == NULL || FileSystem == NULL || !Partition->IsPartitioned ||
+        IsContainerPartition(Partition->PartitionType))
+        return LDP_ERROR_INVALID_PARAMETER;
+
+    if (Partition->New || Partition->DiskEntry->Dirty)
+        return LDP_ERROR_NOT_COMMITTED;
+
+    /* mkfs opens the partition exclusively itself, so the claim is only a check */
+    if (GetPartitionMountPoint(Partition, MountPoint, sizeof(MountPoint)) ||
+        !ClaimPartition(Partition, &fd))
+        return LDP_ERROR_IN_USE;
+    if (fd >= 0)
+        close(fd);
+
+    BeginMessageCapture(&Capture);
+    errno = 0;
+    Success = FormatPartition(Partition, FileSystem, Label, Quick ? TRUE : FALSE);
+    EndMessageCapture(&Capture);
+
+    return Success ? LDP_SUCCESS : FailureStatus();
+}
+
+
+int
+LdpRunCommand(
+    const char *CommandLine)
+{
+    char Line[MAX_STRING_SIZE];
+
+    if (CommandLine == NULL)
+        return 1;
+
+    /* The interpreter splits the line in place */
+    snprintf(Line, sizeof(Line), "%s", CommandLine);
+
+    return InterpretScript(Line) ? 1 : 0;
+}
+
+
+LDP_STATUS
+LdpSetOutputFormat(
+    const char *Name)
+{
+    if (Name == NULL || !SetDefaultOutputFormat(Name))
+        return LDP_ERROR_INVALID_PARAMETER;
+
+    return LDP_SUCCESS;
+}
+
+
+LDP_STATUS
+LdpServe(
+    const char *SocketPath)
+{
+    return DaemonMain(SocketPath) ? LDP_SUCCESS : LDP_ERROR_IO;
+}
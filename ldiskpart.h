@@ -0,0 +1,176 @@
+/*
+ * PROJECT:         ReactOS DiskPart (Linux port)
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * FILE:            base/system/diskpart/ldiskpart.h
+ * PURPOSE:         Public interface of libldiskpart: disk and partition
+ *                  enumeration, partition table edits, clean and format.
+ */
+
+#ifndef LDISKPART_H
+#define LDISKPART_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Only what is declared here is part of the stable interface. Structures
+ * that the library fills start with StructSize, which the caller sets to
+ * sizeof() the structure it was built with; members added later are only
+ * filled for callers that know them.
+ *
+ * The library keeps one list of disks per process and is not thread safe.
+ * Handles stay valid until LdpRescan or LdpShutdown, except that deleting
+ * a partition invalidates its handle.
+ */
+
+#define LDP_API_VERSION 1
+
+/* The library is built with hidden visibility; only these functions are exported */
+#if defined(__GNUC__) && __GNUC__ >= 4
+#define LDP_API __attribute__((visibility("default")))
+#else
+#define LDP_API
+#endif
+
+typedef enum _LDP_STATUS {
+    LDP_SUCCESS = 0,
+    LDP_ERROR_INVALID_PARAMETER = -1,
+    LDP_ERROR_NOT_FOUND = -2,
+    LDP_ERROR_NO_MEMORY = -3,
+    LDP_ERROR_IO = -4,
+    LDP_ERROR_NO_SPACE = -5,
+    LDP_ERROR_NOT_SUPPORTED = -6,
+    LDP_ERROR_IN_USE = -7,
+    LDP_ERROR_NOT_COMMITTED = -8,
+    LDP_ERROR_LOCKED = -9
+} LDP_STATUS;
+
+typedef enum _LDP_PARTITION_STYLE {
+    LDP_PARTITION_STYLE_MBR,
+    LDP_PARTITION_STYLE_GPT,
+    LDP_PARTITION_STYLE_RAW
+} LDP_PARTITION_STYLE;
+
+typedef struct _LDP_GUID {
+    uint32_t Data1;
+    uint16_t Data2;
+    uint16_t Data3;
+    uint8_t Data4[8];
+} LDP_GUID;
+
+/* Opaque */
+typedef struct _DISKENTRY *LDP_DISK_HANDLE;
+typedef struct _PARTENTRY *LDP_PARTITION_HANDLE;
+
+typedef struct _LDP_DISK_INFO {
+    uint32_t StructSize;
+    uint32_t Number;
+    char DeviceName[260];
+    uint64_t Size;                  /* Bytes */
+    uint64_t FreeSize;              /* Bytes not in any partition */
+    uint32_t BytesPerSector;
+    uint32_t PartitionCount;
+    uint32_t Style;                 /* LDP_PARTITION_STYLE */
+    uint32_t Dirty;                 /* Has edits that are not committed */
+    LDP_GUID DiskGuid;              /* GPT only */
+} LDP_DISK_INFO;
+
+typedef struct _LDP_PARTITION_INFO {
+    uint32_t StructSize;
+    uint32_t Number;                /* Kernel partition number, 0 until committed */
+    char DeviceName[260];           /* Empty until committed */
+    uint64_t Offset;                /* Bytes from the start of the disk */
+    uint64_t Size;                  /* Bytes */
+    uint8_t MbrType;
+    uint8_t Active;
+    uint8_t Logical;
+    uint8_t Extended;
+    LDP_GUID TypeGuid;              /* GPT only */
+    LDP_GUID PartitionGuid;         /* GPT only */
+    char FileSystem[16];
+    char Label[40];
+} LDP_PARTITION_INFO;
+
+typedef struct _LDP_VOLUME_INFO {
+    uint32_t StructSize;
+    uint32_t Number;
+    char DeviceName[260];
+    char MountPoint[260];
+    char FileSystem[16];
+    char Label[40];
+    uint64_t Size;                  /* Bytes */
+    uint32_t ExtentCount;           /* Disk ranges the volume spans */
+} LDP_VOLUME_INFO;
+
+LDP_API uint32_t LdpGetApiVersion(void);
+LDP_API const char *LdpStatusString(LDP_STATUS Status);
+
+/*
+ * The library does not print. The messages of the last call that scanned
+ * or changed a disk, errors as well as warnings, are kept here instead;
+ * empty if it had none. stdout and stderr are redirected while such a call
+ * runs, so other threads must not write to them meanwhile.
+ */
+LDP_API const char *LdpGetLastErrorMessage(void);
+
+/* Enumerates the disks and volumes; LdpRescan starts over */
+LDP_API LDP_STATUS LdpInitialize(void);
+LDP_API LDP_STATUS LdpRescan(void);
+LDP_API void LdpShutdown(void);
+
+/*
+ * Disks are locked the way udev expects while they are read or written;
+ * this bounds the wait for another process that holds a lock (default 10).
+ * Operations that time out fail with LDP_ERROR_LOCKED.
+ */
+LDP_API void LdpSetLockTimeout(uint32_t Seconds);
+
+LDP_API uint32_t LdpGetDiskCount(void);
+LDP_API LDP_STATUS LdpGetDisk(uint32_t Index, LDP_DISK_HANDLE *Disk);
+LDP_API LDP_STATUS LdpFindDisk(const char *DeviceName, LDP_DISK_HANDLE *Disk);
+LDP_API LDP_STATUS LdpQueryDisk(LDP_DISK_HANDLE Disk, LDP_DISK_INFO *Info);
+
+/* Primary partitions, the extended partition and logical drives, in that order */
+LDP_API uint32_t LdpGetPartitionCount(LDP_DISK_HANDLE Disk);
+LDP_API LDP_STATUS LdpGetPartition(LDP_DISK_HANDLE Disk, uint32_t Index, LDP_PARTITION_HANDLE *Partition);
+LDP_API LDP_STATUS LdpQueryPartition(LDP_PARTITION_HANDLE Partition, LDP_PARTITION_INFO *Info);
+
+LDP_API uint32_t LdpGetVolumeCount(void);
+LDP_API LDP_STATUS LdpQueryVolume(uint32_t Index, LDP_VOLUME_INFO *Info);
+
+/*
+ * Layout edits change the disk in memory only; LdpCommitDisk writes its
+ * partition table and updates the kernel's partitions. An Offset of 0
+ * picks the smallest free extent that fits, a Size of 0 takes all of it.
+ * Logical drives go into the free space of the extended partition.
+ */
+LDP_API LDP_STATUS LdpCreatePartition(LDP_DISK_HANDLE Disk, uint64_t Offset, uint64_t Size, uint8_t MbrType,
+                                      LDP_PARTITION_HANDLE *Partition);
+/* Partitions that are mounted or held by another device fail with LDP_ERROR_IN_USE */
+LDP_API LDP_STATUS LdpDeletePartition(LDP_PARTITION_HANDLE Partition);
+LDP_API LDP_STATUS LdpCommitDisk(LDP_DISK_HANDLE Disk);
+
+/* Takes effect at once; All zeroes the whole disk instead of its tables */
+LDP_API LDP_STATUS LdpCleanDisk(LDP_DISK_HANDLE Disk, int All);
+LDP_API LDP_STATUS LdpFormatPartition(LDP_PARTITION_HANDLE Partition, const char *FileSystem,
+                                      const char *Label, int Quick);
+
+/*
+ * The diskpart command language on top of the same lists. LdpRunCommand
+ * runs one line and prints its output; it returns 0 once the line was
+ * "exit", else 1. LdpSetOutputFormat takes "text", "json" or "csv" for
+ * the list and detail commands. LdpServe answers commands on a Unix
+ * socket (NULL for /run/ldiskpart.sock) until SIGTERM or SIGINT.
+ */
+LDP_API int LdpRunCommand(const char *CommandLine);
+LDP_API LDP_STATUS LdpSetOutputFormat(const char *Name);
+LDP_API LDP_STATUS LdpServe(const char *SocketPath);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LDISKPART_H */
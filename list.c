@@ -8,278 +8,314 @@
 
 #include "diskpart.h"
 
-#include <wchar.h>
-#include <stdio.h>
+const OUTPUT_COLUMN DiskColumns[DISK_COLUMN_COUNT] = {
+    { "Disk ###", "disk", FALSE },
+    { "Status", "status", FALSE },
+    { "Size", "size", TRUE },
+    { "Free", "free", TRUE },
+};
+
+const OUTPUT_COLUMN VolumeColumns[VOLUME_COLUMN_COUNT] = {
+    { "Volume ###", "volume", FALSE },
+    { "Ltr", "letter", FALSE },
+    { "Label", "label", FALSE },
+    { "Fs", "filesystem", FALSE },
+    { "Type", "type", FALSE },
+    { "Size", "size", TRUE },
+};
+
+static const OUTPUT_COLUMN PartitionColumns[] = {
+    { "Partition ###", "partition", FALSE },
+    { "Type", "type", FALSE },
+    { "Size", "size", TRUE },
+    { "Offset", "offset", TRUE },
+};
+
+static const OUTPUT_COLUMN VirtualDiskColumns[] = {
+    { "VDisk ###", "vdisk", FALSE },
+    { "Device", "device", FALSE },
+    { "Size", "size", TRUE },
+    { "Block", "block_size", TRUE },
+    { "I/O", "io", FALSE },
+    { "RO", "read_only", FALSE },
+    { "File", "file", FALSE },
+};
+
+/* FUNCTIONS ******************************************************************/
 
-VOID PrintDisk(PDISKENTRY DiskEntry)
+/*
+ * Adds a size cell: GB from 10 GB up, MB from 10 MB up, KB below. JSON
+ * and CSV get the size in bytes.
+ */
+static
+void
+OutputSizeCell(
+    POUTPUT_TABLE Table,
+    ULONGLONG Size)
 {
-    unsigned long long DiskSize;
-    unsigned long long FreeSize;
-    const wchar_t *lpSizeUnit;
-    const wchar_t *lpFreeUnit;
+    if (Size >= 10737418240ULL) /* 10 GB */
+        OutputTableValue(Table, Size, "%llu GB", (unsigned long long)RoundingDivide(Size, 1073741824ULL));
+    else if (Size >= 10485760ULL) /* 10 MB */
+        OutputTableValue(Table, Size, "%llu MB", (unsigned long long)RoundingDivide(Size, 1048576ULL));
+    else
+        OutputTableValue(Table, Size, "%llu KB", (unsigned long long)RoundingDivide(Size, 1024ULL));
+}
 
-    DiskSize = DiskEntry->SectorCount.QuadPart *
-               (unsigned long long)DiskEntry->BytesPerSector;
+
+void
+PrintDisk(
+    POUTPUT_TABLE Table,
+    PDISKENTRY DiskEntry)
+{
+    ULONGLONG DiskSize;
+    ULONGLONG FreeSize;
+    ULONGLONG RoundedSize;
+
+    DiskSize = DiskEntry->SectorCount * DiskEntry->BytesPerSector;
+    FreeSize = (DiskEntry->PrimaryFreeExtents.TotalSectors + DiskEntry->LogicalFreeExtents.TotalSectors) *
+               DiskEntry->BytesPerSector;
+
+    OutputTableRow(Table, CurrentDisk == DiskEntry);
+    OutputTableValue(Table, DiskEntry->DiskNumber, "Disk %lu", (unsigned long)DiskEntry->DiskNumber);
+    OutputTableCell(Table, "Online");
 
     if (DiskSize >= 10737418240ULL) /* 10 GB */
     {
-        DiskSize = RoundingDivide(DiskSize, 1073741824ULL);
-        lpSizeUnit = L"GB";
+        OutputTableValue(Table, DiskSize, "%llu GB",
+                         (unsigned long long)RoundingDivide(DiskSize, 1073741824ULL));
     }
     else
     {
-        DiskSize = RoundingDivide(DiskSize, 1048576ULL);
-        if (DiskSize == 0)
-            DiskSize = 1;
-        lpSizeUnit = L"MB";
+        RoundedSize = RoundingDivide(DiskSize, 1048576ULL);
+        if (RoundedSize == 0)
+            RoundedSize = 1;
+        OutputTableValue(Table, DiskSize, "%llu MB", (unsigned long long)RoundedSize);
     }
 
-    /* FIXME */
-    FreeSize = 0;
-    lpFreeUnit = L"B";
-
-    // Example format string, adjust as needed
-    wprintf(L"%c Disk %d Online %llu %s Free %llu %s\n",
-            (CurrentDisk == DiskEntry) ? L'*' : L' ',
-            DiskEntry->DiskNumber,
-            DiskSize,
-            lpSizeUnit,
-            FreeSize,
-            lpFreeUnit);
+    if (FreeSize == 0)
+        OutputTableValue(Table, 0, "0 B");
+    else
+        OutputSizeCell(Table, FreeSize);
 }
 
-BOOL ListDisk(INT argc, PWSTR *argv)
+
+BOOL
+ListDisk(
+    int argc,
+    char **argv)
 {
-    PLIST_ENTRY Entry;
-    PDISKENTRY DiskEntry;
+    OUTPUT_BUFFER Output;
+    OUTPUT_TABLE Table;
+    ListEntry *Entry;
 
-    wprintf(L"\n");
-    wprintf(L"Disk ###  Status         Size     Free\n");
-    wprintf(L"-------------------------------------\n");
+    InitializeOutputBuffer(&Output);
+    if (!ParseOutputArguments(&Output, argc, argv, 2))
+        return TRUE;
 
-    Entry = DiskListHead.Flink;
-    while (Entry != &DiskListHead)
-    {
-        DiskEntry = CONTAINING_RECORD(Entry, DISKENTRY, ListEntry);
-        PrintDisk(DiskEntry);
-        Entry = Entry->Flink;
-    }
+    OutputBeginDocument(&Output);
+    InitializeOutputTable(&Table, &Output, "disks", DiskColumns, DISK_COLUMN_COUNT);
+
+    for (Entry = DiskListHead.Flink; Entry != &DiskListHead; Entry = Entry->Flink)
+        PrintDisk(&Table, CONTAINING_RECORD(Entry, DISKENTRY, ListEntry));
+
+    OutputTable(&Table, NULL);
+    OutputEndDocument(&Output);
+
+    FlushOutputBuffer(&Output);
+    FreeOutputBuffer(&Output);
 
-    wprintf(L"\n\n");
     return TRUE;
 }
 
-BOOL ListPartition(INT argc, PWSTR *argv)
+
+static
+void
+PrintPartitions(
+    POUTPUT_TABLE Table,
+    ListEntry *ListHead,
+    BOOL Logical,
+    ULONG *PartNumber)
 {
-    PLIST_ENTRY Entry;
+    ListEntry *Entry;
     PPARTENTRY PartEntry;
-    unsigned long long PartSize;
-    unsigned long long PartOffset;
-    const wchar_t *lpSizeUnit;
-    const wchar_t *lpOffsetUnit;
-    unsigned long PartNumber = 1;
+
+    for (Entry = ListHead->Flink; Entry != ListHead; Entry = Entry->Flink)
+    {
+        PartEntry = CONTAINING_RECORD(Entry, PARTENTRY, ListEntry);
+        if (!PartEntry->IsPartitioned)
+            continue;
+
+        OutputTableRow(Table, CurrentPartition == PartEntry);
+        OutputTableValue(Table, *PartNumber, "Partition %lu", (unsigned long)*PartNumber);
+        (*PartNumber)++;
+        OutputTableCell(Table, "%s", Logical ? "Logical" :
+                        IsContainerPartition(PartEntry->PartitionType) ? "Extended" : "Primary");
+        OutputSizeCell(Table, PartEntry->SectorCount * CurrentDisk->BytesPerSector);
+        OutputSizeCell(Table, PartEntry->StartSector * CurrentDisk->BytesPerSector);
+    }
+}
+
+
+BOOL
+ListPartition(
+    int argc,
+    char **argv)
+{
+    OUTPUT_BUFFER Output;
+    OUTPUT_TABLE Table;
+    ULONG PartNumber = 1;
 
     if (CurrentDisk == NULL)
     {
-        wprintf(L"No disk selected.\n");
+        printf("No disk selected.\n");
+        CommandFailed = TRUE;
         return TRUE;
     }
 
-    wprintf(L"\n");
-    wprintf(L"Partition ###  Type      Size     Offset\n");
-    wprintf(L"---------------------------------------\n");
+    InitializeOutputBuffer(&Output);
+    if (!ParseOutputArguments(&Output, argc, argv, 2))
+        return TRUE;
 
-    Entry = CurrentDisk->PrimaryPartListHead.Flink;
-    while (Entry != &CurrentDisk->PrimaryPartListHead)
-    {
-        PartEntry = CONTAINING_RECORD(Entry, PARTENTRY, ListEntry);
+    OutputBeginDocument(&Output);
+    InitializeOutputTable(&Table, &Output, "partitions", PartitionColumns, ARRAYSIZE(PartitionColumns));
 
-        if (PartEntry->PartitionType != 0)
-        {
-            PartSize = PartEntry->SectorCount.QuadPart * CurrentDisk->BytesPerSector;
-
-            if (PartSize >= 10737418240ULL) /* 10 GB */
-            {
-                PartSize = RoundingDivide(PartSize, 1073741824ULL);
-                lpSizeUnit = L"GB";
-            }
-            else if (PartSize >= 10485760ULL) /* 10 MB */
-            {
-                PartSize = RoundingDivide(PartSize, 1048576ULL);
-                lpSizeUnit = L"MB";
-            }
-            else
-            {
-                PartSize = RoundingDivide(PartSize, 1024ULL);
-                lpSizeUnit = L"KB";
-            }
-
-            PartOffset = PartEntry->StartSector.QuadPart * CurrentDisk->BytesPerSector;
-
-            if (PartOffset >= 10737418240ULL) /* 10 GB */
-            {
-                PartOffset = RoundingDivide(PartOffset, 1073741824ULL);
-                lpOffsetUnit = L"GB";
-            }
-            else if (PartOffset >= 10485760ULL) /* 10 MB */
-            {
-                PartOffset = RoundingDivide(PartOffset, 1048576ULL);
-                lpOffsetUnit = L"MB";
-            }
-            else
-            {
-                PartOffset = RoundingDivide(PartOffset, 1024ULL);
-                lpOffsetUnit = L"KB";
-            }
-
-            wprintf(L"%c %3lu  %9ls  %6llu %2ls  %6llu %2ls\n",
-                    (CurrentPartition == PartEntry) ? L'*' : L' ',
-                    PartNumber++,
-                    IsContainerPartition(PartEntry->PartitionType) ? L"Extended" : L"Primary",
-                    PartSize,
-                    lpSizeUnit,
-                    PartOffset,
-                    lpOffsetUnit);
-        }
-
-        Entry = Entry->Flink;
-    }
+    PrintPartitions(&Table, &CurrentDisk->PrimaryPartListHead, FALSE, &PartNumber);
+    PrintPartitions(&Table, &CurrentDisk->LogicalPartListHead, TRUE, &PartNumber);
 
-    Entry = CurrentDisk->LogicalPartListHead.Flink;
-    while (Entry != &CurrentDisk->LogicalPartListHead)
-    {
-        PartEntry = CONTAINING_RECORD(Entry, PARTENTRY, ListEntry);
+    OutputTable(&Table, NULL);
+    OutputEndDocument(&Output);
 
-        if (PartEntry->PartitionType != 0)
-        {
-            PartSize = PartEntry->SectorCount.QuadPart * CurrentDisk->BytesPerSector;
-
-            if (PartSize >= 10737418240ULL) /* 10 GB */
-            {
-                PartSize = RoundingDivide(PartSize, 1073741824ULL);
-                lpSizeUnit = L"GB";
-            }
-            else if (PartSize >= 10485760ULL) /* 10 MB */
-            {
-                PartSize = RoundingDivide(PartSize, 1048576ULL);
-                lpSizeUnit = L"MB";
-            }
-            else
-            {
-                PartSize = RoundingDivide(PartSize, 1024ULL);
-                lpSizeUnit = L"KB";
-            }
-
-            PartOffset = PartEntry->StartSector.QuadPart * CurrentDisk->BytesPerSector;
-
-            if (PartOffset >= 10737418240ULL) /* 10 GB */
-            {
-                PartOffset = RoundingDivide(PartOffset, 1073741824ULL);
-                lpOffsetUnit = L"GB";
-            }
-            else if (PartOffset >= 10485760ULL) /* 10 MB */
-            {
-                PartOffset = RoundingDivide(PartOffset, 1048576ULL);
-                lpOffsetUnit = L"MB";
-            }
-            else
-            {
-                PartOffset = RoundingDivide(PartOffset, 1024ULL);
-                lpOffsetUnit = L"KB";
-            }
-
-            wprintf(L"%c %3lu  Logical   %6llu %2ls  %6llu %2ls\n",
-                    (CurrentPartition == PartEntry) ? L'*' : L' ',
-                    PartNumber++,
-                    PartSize,
-                    lpSizeUnit,
-                    PartOffset,
-                    lpOffsetUnit);
-        }
-
-        Entry = Entry->Flink;
-    }
+    FlushOutputBuffer(&Output);
+    FreeOutputBuffer(&Output);
 
-    wprintf(L"\n");
     return TRUE;
 }
 
-VOID PrintVolume(PVOLENTRY VolumeEntry)
-{
-    unsigned long long VolumeSize;
-    const wchar_t *pszSizeUnit;
-    const wchar_t *pszVolumeType;
 
-    VolumeSize = VolumeEntry->Size.QuadPart;
-    if (VolumeSize >= 10737418240ULL) /* 10 GB */
-    {
-        VolumeSize = RoundingDivide(VolumeSize, 1073741824ULL);
-        pszSizeUnit = L"GB";
-    }
-    else if (VolumeSize >= 10485760ULL) /* 10 MB */
-    {
-        VolumeSize = RoundingDivide(VolumeSize, 1048576ULL);
-        pszSizeUnit = L"MB";
-    }
-    else
-    {
-        VolumeSize = RoundingDivide(VolumeSize, 1024ULL);
-        pszSizeUnit = L"KB";
-    }
+void
+PrintVolume(
+    POUTPUT_TABLE Table,
+    PVOLENTRY VolumeEntry)
+{
+    const char *pszVolumeType;
 
     switch (VolumeEntry->VolumeType)
     {
         case VOLUME_TYPE_CDROM:
-            pszVolumeType = L"DVD";
+            pszVolumeType = "DVD";
             break;
         case VOLUME_TYPE_PARTITION:
-            pszVolumeType = L"Partition";
+            pszVolumeType = "Partition";
             break;
         case VOLUME_TYPE_REMOVABLE:
-            pszVolumeType = L"Removable";
+            pszVolumeType = "Removable";
+            break;
+        case VOLUME_TYPE_SIMPLE:
+            pszVolumeType = "Simple";
+            break;
+        case VOLUME_TYPE_SPANNED:
+            pszVolumeType = "Spanned";
+            break;
+        case VOLUME_TYPE_STRIPE:
+            pszVolumeType = "Stripe";
+            break;
+        case VOLUME_TYPE_MIRROR:
+            pszVolumeType = "Mirror";
+            break;
+        case VOLUME_TYPE_RAID5:
+            pszVolumeType = "RAID-5";
             break;
         default:
-            pszVolumeType = L"Unknown";
+            pszVolumeType = "Unknown";
             break;
     }
 
-    wprintf(L"%c Volume %d %lc %ls %ls %ls %llu %ls\n",
-            (CurrentVolume == VolumeEntry) ? L'*' : L' ',
-            VolumeEntry->VolumeNumber,
-            VolumeEntry->DriveLetter,
-            (VolumeEntry->pszLabel) ? VolumeEntry->pszLabel : L"",
-            (VolumeEntry->pszFilesystem) ? VolumeEntry->pszFilesystem : L"",
-            pszVolumeType,
-            VolumeSize,
-            pszSizeUnit);
+    OutputTableRow(Table, CurrentVolume == VolumeEntry);
+    OutputTableValue(Table, VolumeEntry->VolumeNumber, "Volume %lu", (unsigned long)VolumeEntry->VolumeNumber);
+    OutputTableCell(Table, "%.*s", VolumeEntry->DriveLetter ? 1 : 0, &VolumeEntry->DriveLetter);
+    OutputTableCell(Table, "%s", VolumeEntry->pszLabel ? VolumeEntry->pszLabel : "");
+    OutputTableCell(Table, "%s", VolumeEntry->pszFilesystem ? VolumeEntry->pszFilesystem : "");
+    OutputTableCell(Table, "%s", pszVolumeType);
+    OutputSizeCell(Table, VolumeEntry->Size);
 }
 
-BOOL ListVolume(INT argc, PWSTR *argv)
+
+BOOL
+ListVolume(
+    int argc,
+    char **argv)
 {
-    PLIST_ENTRY Entry;
-    PVOLENTRY VolumeEntry;
+    OUTPUT_BUFFER Output;
+    OUTPUT_TABLE Table;
+    ListEntry *Entry;
 
-    wprintf(L"\n");
-    wprintf(L"Volume ###  Ltr  Label       Fs     Type       Size\n");
-    wprintf(L"-------------------------------------------------\n");
+    InitializeOutputBuffer(&Output);
+    if (!ParseOutputArguments(&Output, argc, argv, 2))
+        return TRUE;
 
-    Entry = VolumeListHead.Flink;
-    while (Entry != &VolumeListHead)
-    {
-        VolumeEntry = CONTAINING_RECORD(Entry, VOLENTRY, ListEntry);
+    OutputBeginDocument(&Output);
+    InitializeOutputTable(&Table, &Output, "volumes", VolumeColumns, VOLUME_COLUMN_COUNT);
 
-        PrintVolume(VolumeEntry);
+    for (Entry = VolumeListHead.Flink; Entry != &VolumeListHead; Entry = Entry->Flink)
+        PrintVolume(&Table, CONTAINING_RECORD(Entry, VOLENTRY, ListEntry));
 
-        Entry = Entry->Flink;
-    }
+    OutputTable(&Table, NULL);
+    OutputEndDocument(&Output);
+
+    FlushOutputBuffer(&Output);
+    FreeOutputBuffer(&Output);
 
-    wprintf(L"\n");
     return TRUE;
 }
 
-BOOL ListVirtualDisk(INT argc, PWSTR *argv)
+
+static
+BOOL
+PrintVirtualDisk(
+    void *Context,
+    PVDISKENTRY VDiskEntry)
 {
-    wprintf(L"ListVirtualDisk()!\n");
+    POUTPUT_TABLE Table = Context;
+    ULONGLONG VDiskSize = VDiskEntry->Size;
+
+    OutputTableRow(Table, strcmp(VDiskEntry->FileName, CurrentVirtualDisk) == 0);
+    OutputTableValue(Table, VDiskEntry->LoopNumber, "VDisk %lu", (unsigned long)VDiskEntry->LoopNumber);
+    OutputTableCell(Table, "%s", VDiskEntry->DeviceName);
+    if (VDiskSize >= 10737418240ULL) /* 10 GB */
+        OutputTableValue(Table, VDiskSize, "%llu GB", (unsigned long long)RoundingDivide(VDiskSize, 1073741824ULL));
+    else
+        OutputTableValue(Table, VDiskSize, "%llu MB", (unsigned long long)RoundingDivide(VDiskSize, 1048576ULL));
+    OutputTableValue(Table, VDiskEntry->BlockSize, "%lu", (unsigned long)VDiskEntry->BlockSize);
+    OutputTableCell(Table, "%s", VDiskEntry->DirectIo ? "Direct" : "Buffered");
+    OutputTableBoolean(Table, VDiskEntry->ReadOnly);
+    OutputTableCell(Table, "%s", VDiskEntry->FileName);
+
     return TRUE;
 }
 
+
+BOOL
+ListVirtualDisk(
+    int argc,
+    char **argv)
+{
+    OUTPUT_BUFFER Output;
+    OUTPUT_TABLE Table;
+
+    InitializeOutputBuffer(&Output);
+    if (!ParseOutputArguments(&Output, argc, argv, 2))
+        return TRUE;
+
+    OutputBeginDocument(&Output);
+    InitializeOutputTable(&Table, &Output, "vdisks", VirtualDiskColumns, ARRAYSIZE(VirtualDiskColumns));
+
+    EnumerateVirtualDisks(NULL, PrintVirtualDisk, &Table);
+
+    OutputTable(&Table, "There are no virtual disks to show.");
+    OutputEndDocument(&Output);
+
+    FlushOutputBuffer(&Output);
+    FreeOutputBuffer(&Output);
+
+    return TRUE;
+}
@@ -8,15 +8,16 @@
 
 #include "diskpart.h"
 
-#include <wchar.h>
 #include <stdio.h>
 
-BOOL merge_main(int argc, LPWSTR *argv)
+BOOL merge_main(int argc, char **argv)
 {
     // TODO: Implement merging partitions functionality here.
 
     // For now, just print a placeholder message.
-    wprintf(L"merge_main: Merge command is not yet implemented.\n");
+    printf("merge_main: Merge command is not yet implemented.\n");
+    (void)argc;
+    (void)argv;
 
     return TRUE;
 }
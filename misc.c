@@ -8,26 +8,24 @@
 
 #include "diskpart.h"
 
-#include <wchar.h>
-#include <wctype.h>  // For iswdigit, iswxdigit
-#include <stdlib.h>  // For malloc, free
-#include <string.h>  // For wcslen, wcsncpy, wcscpy
+#include <ctype.h>
+#include <strings.h>
 
 /* FUNCTIONS ******************************************************************/
 
 BOOL
 IsDecString(
-    _In_ PWSTR pszDecString)
+    char *pszDecString)
 {
-    PWSTR ptr;
+    char *ptr;
 
-    if ((pszDecString == NULL) || (*pszDecString == L'\0'))
+    if ((pszDecString == NULL) || (*pszDecString == '\0'))
         return FALSE;
 
     ptr = pszDecString;
-    while (*ptr != L'\0')
+    while (*ptr != '\0')
     {
-        if (!iswdigit(*ptr))
+        if (!isdigit((unsigned char)*ptr))
             return FALSE;
 
         ptr++;
@@ -39,17 +37,17 @@ IsDecString(
 
 BOOL
 IsHexString(
-    _In_ PWSTR pszHexString)
+    char *pszHexString)
 {
-    PWSTR ptr;
+    char *ptr;
 
-    if ((pszHexString == NULL) || (*pszHexString == L'\0'))
+    if ((pszHexString == NULL) || (*pszHexString == '\0'))
         return FALSE;
 
     ptr = pszHexString;
-    while (*ptr != L'\0')
+    while (*ptr != '\0')
     {
-        if (!iswxdigit(*ptr))
+        if (!isxdigit((unsigned char)*ptr))
             return FALSE;
 
         ptr++;
@@ -61,15 +59,15 @@ IsHexString(
 
 BOOL
 HasPrefix(
-    _In_ PWSTR pszString,
-    _In_ PWSTR pszPrefix,
-    _Out_opt_ PWSTR *ppszSuffix)
+    char *pszString,
+    char *pszPrefix,
+    char **ppszSuffix)
 {
-    INT nPrefixLength;
+    size_t nPrefixLength;
     int ret;
 
-    nPrefixLength = wcslen(pszPrefix);
-    ret = wcsncasecmp(pszString, pszPrefix, nPrefixLength); // Linux equivalent of _wcsnicmp
+    nPrefixLength = strlen(pszPrefix);
+    ret = strncasecmp(pszString, pszPrefix, nPrefixLength);
     if ((ret == 0) && (ppszSuffix != NULL))
         *ppszSuffix = &pszString[nPrefixLength];
 
@@ -79,74 +77,63 @@ HasPrefix(
 
 ULONGLONG
 RoundingDivide(
-    _In_ ULONGLONG Dividend,
-    _In_ ULONGLONG Divisor)
+    ULONGLONG Dividend,
+    ULONGLONG Divisor)
 {
     return (Dividend + Divisor / 2) / Divisor;
 }
 
 
-PWSTR
+char *
 DuplicateQuotedString(
-    _In_ PWSTR pszInString)
+    char *pszInString)
 {
-    PWSTR pszOutString = NULL;
-    PWSTR pStart, pEnd;
-    INT nLength;
+    char *pszOutString = NULL;
+    char *pStart, *pEnd;
+    size_t nLength;
 
-    if ((pszInString == NULL) || (pszInString[0] == L'\0'))
+    if ((pszInString == NULL) || (pszInString[0] == '\0'))
         return NULL;
 
-    if (pszInString[0] == L'"')
+    if (pszInString[0] == '"')
     {
-        if (pszInString[1] == L'\0')
+        if (pszInString[1] == '\0')
             return NULL;
 
         pStart = &pszInString[1];
-        pEnd = wcschr(pStart, L'"');
+        pEnd = strchr(pStart, '"');
         if (pEnd == NULL)
         {
-            nLength = wcslen(pStart);
+            nLength = strlen(pStart);
         }
         else
         {
-            nLength = (int)(pEnd - pStart);
+            nLength = (size_t)(pEnd - pStart);
         }
     }
     else
     {
         pStart = pszInString;
-        nLength = (int)wcslen(pStart);
+        nLength = strlen(pStart);
     }
 
-    pszOutString = (PWSTR)malloc((nLength + 1) * sizeof(wchar_t));
+    pszOutString = malloc(nLength + 1);
     if (pszOutString == NULL)
         return NULL;
 
-    wcsncpy(pszOutString, pStart, nLength);
-    pszOutString[nLength] = L'\0';
+    memcpy(pszOutString, pStart, nLength);
+    pszOutString[nLength] = '\0';
 
     return pszOutString;
 }
 
 
-PWSTR
+char *
 DuplicateString(
-    _In_ PWSTR pszInString)
+    char *pszInString)
 {
-    PWSTR pszOutString = NULL;
-    INT nLength;
-
-    if ((pszInString == NULL) || (pszInString[0] == L'\0'))
-        return NULL;
-
-    nLength = (INT)wcslen(pszInString);
-    pszOutString = (PWSTR)malloc((nLength + 1) * sizeof(wchar_t));
-    if (pszOutString == NULL)
+    if ((pszInString == NULL) || (pszInString[0] == '\0'))
         return NULL;
 
-    wcscpy(pszOutString, pszInString);
-
-    return pszOutString;
+    return strdup(pszInString);
 }
-
@@ -0,0 +1,165 @@
+/*
+ * PROJECT:         ReactOS DiskPart (Linux port)
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * FILE:            base/system/diskpart/move.c
+ * PURPOSE:         Moves a partition and its data within the free space
+ *                  around it.
+ */
+
+#include "diskpart.h"
+
+#include <strings.h>
+#include <unistd.h>
+
+/* One bit per MiB; RelocateSectors skips whole copy chunks without data */
+#define MOVE_BYTES_PER_BIT (1024 * 1024)
+
+/* FUNCTIONS ******************************************************************/
+
+/* move [offset=<KB>] [noerr] */
+BOOL
+move_main(
+    int argc,
+    char **argv)
+{
+    PDISKENTRY DiskEntry = CurrentDisk;
+    PPARTENTRY PartEntry = CurrentPartition;
+    ULONGLONG Offset = 0, NewStart, First, End;
+    ULONG SectorsPerBit;
+    UCHAR *Bitmap = NULL;
+    char MountPoint[MAX_PATH];
+    char *pszSuffix = NULL;
+    BOOL bOffset = FALSE, Success;
+    int fd, i;
+
+    if (DiskEntry == NULL)
+    {
+        printf("No disk selected.\n");
+        CommandFailed = TRUE;
+        return TRUE;
+    }
+
+    if (PartEntry == NULL || !PartEntry->IsPartitioned ||
+        IsContainerPartition(PartEntry->PartitionType))
+    {
+        printf("No partition selected.\n");
+        CommandFailed = TRUE;
+        return TRUE;
+    }
+
+    for (i = 1; i < argc; i++)
+    {
+        if (HasPrefix(argv[i], "offset=", &pszSuffix))
+        {
+            if (!IsDecString(pszSuffix))
+            {
+                printf("Invalid offset: %s\n", pszSuffix);
+                CommandFailed = TRUE;
+                return TRUE;
+            }
+            Offset = strtoull(pszSuffix, NULL, 10) * 1024;
+            bOffset = TRUE;
+        }
+        else if (strcasecmp(argv[i], "noerr") != 0)
+        {
+            printf("Invalid argument: %s\n", argv[i]);
+            CommandFailed = TRUE;
+            return TRUE;
+        }
+    }
+
+    /* The filesystem must not change under the copy */
+    if (GetPartitionMountPoint(PartEntry, MountPoint, sizeof(MountPoint)))
+    {
+        printf("\nThe partition is mounted on %s; unmount it first.\n\n", MountPoint);
+        CommandFailed = TRUE;
+        return TRUE;
+    }
+
+    /* Without offset= the partition moves to the start of the free space in front of it */
+    if (bOffset)
+    {
+        if (Offset % DiskEntry->BytesPerSector != 0)
+        {
+            printf("The offset must be a multiple of the %lu byte sector size.\n",
+                   (unsigned long)DiskEntry->BytesPerSector);
+            CommandFailed = TRUE;
+            return TRUE;
+        }
+        NewStart = Offset / DiskEntry->BytesPerSector;
+    }
+    else
+    {
+        GetPartitionMoveRange(PartEntry, &First, &End);
+        NewStart = AlignDown(First + DiskEntry->SectorAlignment - 1, DiskEntry->SectorAlignment);
+        if (NewStart >= PartEntry->StartSector)
+        {
+            printf("\nThere is no free space in front of the selected partition.\n\n");
+            CommandFailed = TRUE;
+            return TRUE;
+        }
+    }
+
+    if (NewStart == PartEntry->StartSector)
+    {
+        printf("\nThe partition already starts at that offset.\n\n");
+        return TRUE;
+    }
+
+    /* Free space inside the filesystem is not copied, if we can read its allocation map */
+    SectorsPerBit = MOVE_BYTES_PER_BIT / DiskEntry->BytesPerSector;
+    if (!GetFileSystemAllocationBitmap(PartEntry, SectorsPerBit, &Bitmap))
+    {
+        DPRINT("No allocation map for %s, copying every sector\n", PartEntry->FileSystemName);
+        Bitmap = NULL;
+    }
+
+    if (!LockDisk(DiskEntry, TRUE))
+    {
+        free(Bitmap);
+        printf("\nDiskPart failed to move the partition.\n\n");
+        CommandFailed = TRUE;
+        return TRUE;
+    }
+
+    /* Swap, RAID, LVM and dm-crypt hold the partition without mounting it */
+    if (!ClaimPartition(PartEntry, &fd))
+    {
+        UnlockDisk(DiskEntry);
+        free(Bitmap);
+        printf("\nThe partition is in use (%s); DiskPart cannot move it.\n\n", strerror(errno));
+        CommandFailed = TRUE;
+        return TRUE;
+    }
+
+    Success = RelocatePartition(PartEntry, NewStart, Bitmap, SectorsPerBit);
+    free(Bitmap);
+
+    /* The kernel does not drop a partition that is open, so let go before the table is written */
+    if (fd >= 0)
+        close(fd);
+
+    /* The data is at the new location now; the table has to follow it */
+    if (Success && !NT_SUCCESS(WritePartitions(DiskEntry)))
+    {
+        printf("\nThe data was moved to sector %llu but the partition table could not be written.\n",
+               (unsigned long long)NewStart);
+        printf("Do not use the partition until its table entry points there.\n\n");
+        UnlockDisk(DiskEntry);
+        CommandFailed = TRUE;
+        return TRUE;
+    }
+
+    UnlockDisk(DiskEntry);
+
+    if (Success)
+        printf("\nDiskPart successfully moved the partition to offset %llu KB.\n\n",
+               (unsigned long long)(NewStart * DiskEntry->BytesPerSector / 1024));
+    else
+    {
+        printf("\nDiskPart failed to move the partition.\n\n");
+        CommandFailed = TRUE;
+    }
+
+    return TRUE;
+}
@@ -0,0 +1,294 @@
+/*
+ * PROJECT:         ReactOS DiskPart (Linux port)
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * FILE:            base/system/diskpart/msgcat.c
+ * PURPOSE:         Looks up messages and strings in the compiled catalog,
+ *                  which is mapped read-only and shared between instances.
+ */
+
+#include "diskpart.h"
+#include "msgcat.h"
+
+#include <fcntl.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifndef MSGCAT_DEFAULT_PATH
+#define MSGCAT_DEFAULT_PATH "/usr/share/diskpart/diskpart.cat"
+#endif
+
+#define MSGCAT_FALLBACK_LANGUAGE "en-US"
+
+static const UCHAR *CatalogBase;
+static size_t CatalogSize;
+static const MSGCAT_LANGUAGE *CatalogLanguage;
+static const MSGCAT_LANGUAGE *CatalogFallback;
+static BOOL CatalogOpened;
+
+/* FUNCTIONS ******************************************************************/
+
+static
+BOOL
+IsCatalogValid(
+    const UCHAR *Base,
+    size_t Size)
+{
+    const MSGCAT_HEADER *Header = (const MSGCAT_HEADER *)Base;
+    const MSGCAT_LANGUAGE *Languages;
+    size_t SlotBytes;
+    ULONG i;
+
+    if (Size < sizeof(*Header) || Header->Magic != MSGCAT_MAGIC ||
+        Header->Version != MSGCAT_VERSION || Header->FileSize != Size)
+        return FALSE;
+
+    if (Header->LanguageCount > (Size - sizeof(*Header)) / sizeof(MSGCAT_LANGUAGE))
+        return FALSE;
+
+    /* Every text ends before the last byte, which is a NUL */
+    if (Base[Size - 1] != '\0')
+        return FALSE;
+
+    Languages = (const MSGCAT_LANGUAGE *)(Base + sizeof(*Header));
+    for (i = 0; i < Header->LanguageCount; i++)
+    {
+        if (Languages[i].SlotShift == 0 || Languages[i].SlotShift > 31 ||
+            (Languages[i].SlotOffset % sizeof(uint32_t)) != 0)
+            return FALSE;
+
+        SlotBytes = ((size_t)1 << (32 - Languages[i].SlotShift)) * sizeof(MSGCAT_SLOT);
+        if (Languages[i].SlotOffset > Size || SlotBytes > Size - Languages[i].SlotOffset)
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+static
+const MSGCAT_LANGUAGE *
+FindLanguage(
+    const char *Name,
+    size_t Length)
+{
+    const MSGCAT_HEADER *Header = (const MSGCAT_HEADER *)CatalogBase;
+    const MSGCAT_LANGUAGE *Languages = (const MSGCAT_LANGUAGE *)(CatalogBase + sizeof(*Header));
+    ULONG i;
+
+    for (i = 0; i < Header->LanguageCount; i++)
+    {
+        if (Length < MSGCAT_NAME_SIZE &&
+            strncasecmp(Languages[i].Name, Name, Length) == 0 &&
+            (Languages[i].Name[Length] == '\0' || Languages[i].Name[Length] == '-'))
+            return &Languages[i];
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Picks the catalog language from the locale environment: "de_DE.UTF-8"
+ * selects de-DE, "de_AT" falls back to the first German one, and C or an
+ * unknown locale gives English.
+ */
+static
+const MSGCAT_LANGUAGE *
+SelectLanguage(void)
+{
+    static const char *Variables[] = { "LC_ALL", "LC_MESSAGES", "LANG" };
+    const MSGCAT_LANGUAGE *Language = NULL;
+    const char *Locale = NULL;
+    char Name[MSGCAT_NAME_SIZE];
+    size_t Length, Primary;
+    ULONG i;
+
+    for (i = 0; i < sizeof(Variables) / sizeof(Variables[0]) && Locale == NULL; i++)
+    {
+        Locale = getenv(Variables[i]);
+        if (Locale != NULL && *Locale == '\0')
+            Locale = NULL;
+    }
+
+    if (Locale != NULL)
+    {
+        /* ll_CC.charset@modifier -> ll-CC */
+        for (Length = 0; Length < sizeof(Name) - 1 && Locale[Length] != '\0' &&
+             Locale[Length] != '.' && Locale[Length] != '@'; Length++)
+        {
+            Name[Length] = (Locale[Length] == '_') ? '-' : Locale[Length];
+        }
+        Name[Length] = '\0';
+
+        Language = FindLanguage(Name, Length);
+        if (Language == NULL)
+        {
+            Primary = strcspn(Name, "-");
+            if (Primary > 0 && Primary < Length)
+                Language = FindLanguage(Name, Primary);
+        }
+    }
+
+    if (Language == NULL)
+        Language = CatalogFallback;
+
+    return Language;
+}
+
+
+/* An uninstalled build keeps the catalog next to the executable */
+static
+int
+OpenBuildCatalog(void)
+{
+    char Path[MAX_PATH];
+    char *Slash;
+    ssize_t Length;
+
+    Length = readlink("/proc/self/exe", Path, sizeof(Path) - 1);
+    if (Length <= 0)
+        return -1;
+    Path[Length] = '\0';
+
+    Slash = strrchr(Path, '/');
+    if (Slash == NULL || (size_t)(Slash - Path) + sizeof("/diskpart.cat") > sizeof(Path))
+        return -1;
+    strcpy(Slash, "/diskpart.cat");
+
+    return open(Path, O_RDONLY | O_CLOEXEC);
+}
+
+
+/*
+ * Maps the message catalog. FileName may be NULL for DISKPART_CATALOG, the
+ * installed catalog or the one next to the executable, in that order.
+ * Without a catalog every lookup returns NULL.
+ */
+BOOL
+OpenMessageCatalog(
+    const char *FileName)
+{
+    struct stat StatBuffer;
+    void *Base;
+    int fd;
+
+    CatalogOpened = TRUE;
+
+    if (FileName == NULL)
+        FileName = getenv("DISKPART_CATALOG");
+
+    if (FileName != NULL)
+    {
+        fd = open(FileName, O_RDONLY | O_CLOEXEC);
+    }
+    else
+    {
+        fd = open(MSGCAT_DEFAULT_PATH, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            fd = OpenBuildCatalog();
+    }
+    if (fd < 0)
+        return FALSE;
+
+    if (fstat(fd, &StatBuffer) < 0 || StatBuffer.st_size <= 0)
+    {
+        close(fd);
+        return FALSE;
+    }
+
+    Base = mmap(NULL, (size_t)StatBuffer.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (Base == MAP_FAILED)
+        return FALSE;
+
+    if (!IsCatalogValid(Base, (size_t)StatBuffer.st_size))
+    {
+        munmap(Base, (size_t)StatBuffer.st_size);
+        return FALSE;
+    }
+
+    CloseMessageCatalog();
+    CatalogOpened = TRUE;
+
+    CatalogBase = Base;
+    CatalogSize = (size_t)StatBuffer.st_size;
+    CatalogFallback = FindLanguage(MSGCAT_FALLBACK_LANGUAGE, strlen(MSGCAT_FALLBACK_LANGUAGE));
+    CatalogLanguage = SelectLanguage();
+
+    return TRUE;
+}
+
+
+void
+CloseMessageCatalog(void)
+{
+    if (CatalogBase != NULL)
+        munmap((void *)CatalogBase, CatalogSize);
+
+    CatalogBase = NULL;
+    CatalogSize = 0;
+    CatalogLanguage = NULL;
+    CatalogFallback = NULL;
+    CatalogOpened = FALSE;
+}
+
+
+static
+const char *
+LookupText(
+    const MSGCAT_LANGUAGE *Language,
+    ULONG Id)
+{
+    const MSGCAT_SLOT *Slots;
+    uint32_t Mask, Index, Probes;
+
+    if (Language == NULL)
+        return NULL;
+
+    Slots = (const MSGCAT_SLOT *)(CatalogBase + Language->SlotOffset);
+    Mask = (uint32_t)(((size_t)1 << (32 - Language->SlotShift)) - 1);
+
+    /* The tables are at most half full, so this soon ends at an empty slot */
+    Index = MsgCatHash(Id, Language->SlotShift);
+    for (Probes = 0; Probes <= Mask; Probes++, Index = (Index + 1) & Mask)
+    {
+        if (Slots[Index].Id == MSGCAT_EMPTY_ID)
+            return NULL;
+
+        if (Slots[Index].Id == Id)
+        {
+            if (Slots[Index].TextOffset >= CatalogSize)
+                return NULL;
+            return (const char *)CatalogBase + Slots[Index].TextOffset;
+        }
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Returns the text of a message (MSG_*) or string (IDS_*) in the user's
+ * language, or in English if it has not been translated. The text lives
+ * in the mapped catalog; NULL means there is no such ID or no catalog.
+ */
+const char *
+LoadMessageString(
+    ULONG Id)
+{
+    const char *Text;
+
+    if (!CatalogOpened)
+        OpenMessageCatalog(NULL);
+
+    if (CatalogBase == NULL || Id == MSGCAT_EMPTY_ID)
+        return NULL;
+
+    Text = LookupText(CatalogLanguage, Id);
+    if (Text == NULL && CatalogLanguage != CatalogFallback)
+        Text = LookupText(CatalogFallback, Id);
+
+    return Text;
+}
@@ -0,0 +1,57 @@
+/*
+ * PROJECT:         ReactOS DiskPart (Linux port)
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * FILE:            base/system/diskpart/msgcat.h
+ * PURPOSE:         Layout of the compiled message catalog, shared by the
+ *                  catalog compiler (tools/mkmsgcat.c) and msgcat.c.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * The catalog holds every message of diskpart_msg.mc and every string of
+ * lang/<name>.rc in one file that is mapped read-only:
+ *
+ *   MSGCAT_HEADER
+ *   MSGCAT_LANGUAGE[LanguageCount]
+ *   per language, a hash table of MSGCAT_SLOT, keyed by message or string ID
+ *   the texts, NUL-terminated UTF-8
+ *
+ * All numbers are in the byte order of the machine that built the catalog;
+ * a catalog from another byte order fails the magic check. The file always
+ * ends in a NUL byte, so every text offset inside it is terminated.
+ */
+
+#define MSGCAT_MAGIC     0x5441434D /* "MCAT" */
+#define MSGCAT_VERSION   1
+#define MSGCAT_EMPTY_ID  0xFFFFFFFF
+#define MSGCAT_NAME_SIZE 8
+
+typedef struct _MSGCAT_HEADER {
+    uint32_t Magic;
+    uint32_t Version;
+    uint32_t LanguageCount;
+    uint32_t FileSize;
+} MSGCAT_HEADER;
+
+typedef struct _MSGCAT_LANGUAGE {
+    char Name[MSGCAT_NAME_SIZE];    /* "de-DE", NUL-padded */
+    uint32_t SlotOffset;
+    uint32_t SlotShift;             /* 32 - log2(slot count) */
+} MSGCAT_LANGUAGE;
+
+typedef struct _MSGCAT_SLOT {
+    uint32_t Id;                    /* MSGCAT_EMPTY_ID if unused */
+    uint32_t TextOffset;
+} MSGCAT_SLOT;
+
+/* First slot to probe; collisions go to the following slots */
+static inline uint32_t
+MsgCatHash(
+    uint32_t Id,
+    uint32_t SlotShift)
+{
+    return (uint32_t)(Id * 2654435761u) >> SlotShift;
+}
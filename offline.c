@@ -8,18 +8,7 @@
 
 #include "diskpart.h"
 
-/* Linux doesn't have LPWSTR, so define if not defined */
-#ifndef LPWSTR
-typedef wchar_t* LPWSTR;
-#endif
-
-#ifndef BOOL
-typedef int BOOL;
-#define TRUE 1
-#define FALSE 0
-#endif
-
-BOOL offline_main(int argc, LPWSTR *argv)
+BOOL offline_main(int argc, char **argv)
 {
     (void)argc;
     (void)argv;
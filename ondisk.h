@@ -0,0 +1,560 @@
+/*
+ * PROJECT:         ReactOS DiskPart (Linux Port)
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * FILE:            ondisk.h
+ * PURPOSE:         Fixed-layout codecs for the on-disk structures DiskPart
+ *                  reads and writes: MBR/EBR, GPT header and entry, and the
+ *                  filesystem superblocks used for probing.
+ */
+
+#ifndef ONDISK_H
+#define ONDISK_H
+
+/*
+ * Every structure in here is made of byte arrays only, so its alignment is 1
+ * and it may be laid over any I/O buffer position without a copy. Multi-byte
+ * fields are never read directly; the generated Get/Set accessors decode
+ * them with the endianness the format defines, which keeps the code correct
+ * on big-endian hosts. On little-endian hosts each accessor compiles to a
+ * single (possibly unaligned) load or store.
+ */
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define ONDISK_HOST_BIG_ENDIAN 1
+#else
+#define ONDISK_HOST_BIG_ENDIAN 0
+#endif
+
+/* LOAD / STORE **************************************************************/
+
+static inline USHORT LoadLe16(const void *p)
+{
+    USHORT v;
+    memcpy(&v, p, sizeof(v));
+    return ONDISK_HOST_BIG_ENDIAN ? __builtin_bswap16(v) : v;
+}
+
+static inline ULONG LoadLe32(const void *p)
+{
+    ULONG v;
+    memcpy(&v, p, sizeof(v));
+    return ONDISK_HOST_BIG_ENDIAN ? __builtin_bswap32(v) : v;
+}
+
+static inline ULONGLONG LoadLe64(const void *p)
+{
+    ULONGLONG v;
+    memcpy(&v, p, sizeof(v));
+    return ONDISK_HOST_BIG_ENDIAN ? __builtin_bswap64(v) : v;
+}
+
+static inline USHORT LoadBe16(const void *p)
+{
+    USHORT v;
+    memcpy(&v, p, sizeof(v));
+    return ONDISK_HOST_BIG_ENDIAN ? v : __builtin_bswap16(v);
+}
+
+static inline ULONG LoadBe32(const void *p)
+{
+    ULONG v;
+    memcpy(&v, p, sizeof(v));
+    return ONDISK_HOST_BIG_ENDIAN ? v : __builtin_bswap32(v);
+}
+
+static inline ULONGLONG LoadBe64(const void *p)
+{
+    ULONGLONG v;
+    memcpy(&v, p, sizeof(v));
+    return ONDISK_HOST_BIG_ENDIAN ? v : __builtin_bswap64(v);
+}
+
+static inline void StoreLe16(void *p, USHORT v)
+{
+    v = ONDISK_HOST_BIG_ENDIAN ? __builtin_bswap16(v) : v;
+    memcpy(p, &v, sizeof(v));
+}
+
+static inline void StoreLe32(void *p, ULONG v)
+{
+    v = ONDISK_HOST_BIG_ENDIAN ? __builtin_bswap32(v) : v;
+    memcpy(p, &v, sizeof(v));
+}
+
+static inline void StoreLe64(void *p, ULONGLONG v)
+{
+    v = ONDISK_HOST_BIG_ENDIAN ? __builtin_bswap64(v) : v;
+    memcpy(p, &v, sizeof(v));
+}
+
+/* GPT GUIDs are stored mixed-endian: the first three fields little-endian */
+static inline void LoadGuid(GUID *Guid, const void *p)
+{
+    const UCHAR *b = p;
+
+    Guid->Data1 = LoadLe32(b);
+    Guid->Data2 = LoadLe16(b + 4);
+    Guid->Data3 = LoadLe16(b + 6);
+    memcpy(Guid->Data4, b + 8, sizeof(Guid->Data4));
+}
+
+static inline void StoreGuid(void *p, const GUID *Guid)
+{
+    UCHAR *b = p;
+
+    StoreLe32(b, Guid->Data1);
+    StoreLe16(b + 4, Guid->Data2);
+    StoreLe16(b + 6, Guid->Data3);
+    memcpy(b + 8, Guid->Data4, sizeof(Guid->Data4));
+}
+
+/*
+ * Generates Prefix##Get##Field() and Prefix##Set##Field() for a fixed-width
+ * field of Type. Bits selects the width, Order is Le or Be.
+ */
+#define ONDISK_FIELD(Prefix, Type, Field, Order, Bits, CType) \
+    static inline CType Prefix##Get##Field(const Type *Record) \
+    { \
+        return (CType)Load##Order##Bits(Record->Field); \
+    } \
+    static inline void Prefix##Set##Field(Type *Record, CType Value) \
+    { \
+        Store##Order##Bits(Record->Field, Value); \
+    }
+
+#define ONDISK_FIELD_RO(Prefix, Type, Field, Order, Bits, CType) \
+    static inline CType Prefix##Get##Field(const Type *Record) \
+    { \
+        return (CType)Load##Order##Bits(Record->Field); \
+    }
+
+#define ONDISK_GUID_FIELD(Prefix, Type, Field) \
+    static inline void Prefix##Get##Field(const Type *Record, GUID *Guid) \
+    { \
+        LoadGuid(Guid, Record->Field); \
+    } \
+    static inline void Prefix##Set##Field(Type *Record, const GUID *Guid) \
+    { \
+        StoreGuid(Record->Field, Guid); \
+    }
+
+#define ONDISK_ASSERT_SIZE(Type, Size) \
+    __extension__ _Static_assert(sizeof(Type) == (Size), #Type " has the wrong size")
+
+#define ONDISK_ASSERT_OFFSET(Type, Field, Offset) \
+    __extension__ _Static_assert(offsetof(Type, Field) == (Offset), #Type "." #Field " is misplaced")
+
+/* MBR / EBR *****************************************************************/
+
+#define MBR_SIGNATURE       0xAA55
+#define MBR_MAX_LBA         0xFFFFFFFFULL
+#define MBR_PARTITION_COUNT 4
+
+typedef struct _MBR_PARTITION_ENTRY {
+    UCHAR BootIndicator;
+    UCHAR StartChs[3];
+    UCHAR PartitionType;
+    UCHAR EndChs[3];
+    UCHAR StartingLba[4];
+    UCHAR SectorCount[4];
+} MBR_PARTITION_ENTRY, *PMBR_PARTITION_ENTRY;
+
+ONDISK_ASSERT_SIZE(MBR_PARTITION_ENTRY, 16);
+ONDISK_ASSERT_OFFSET(MBR_PARTITION_ENTRY, PartitionType, 4);
+ONDISK_ASSERT_OFFSET(MBR_PARTITION_ENTRY, StartingLba, 8);
+ONDISK_ASSERT_OFFSET(MBR_PARTITION_ENTRY, SectorCount, 12);
+
+ONDISK_FIELD(MbrEntry, MBR_PARTITION_ENTRY, StartingLba, Le, 32, ULONG)
+ONDISK_FIELD(MbrEntry, MBR_PARTITION_ENTRY, SectorCount, Le, 32, ULONG)
+
+/* An EBR has the same layout; only the first two table entries are used */
+typedef struct _MASTER_BOOT_RECORD {
+    UCHAR BootCode[440];
+    UCHAR Signature[4];
+    UCHAR Reserved[2];
+    MBR_PARTITION_ENTRY PartitionTable[MBR_PARTITION_COUNT];
+    UCHAR MasterBootRecordMagic[2];
+} MASTER_BOOT_RECORD, *PMASTER_BOOT_RECORD;
+
+ONDISK_ASSERT_SIZE(MASTER_BOOT_RECORD, 512);
+ONDISK_ASSERT_OFFSET(MASTER_BOOT_RECORD, Signature, 440);
+ONDISK_ASSERT_OFFSET(MASTER_BOOT_RECORD, PartitionTable, 446);
+ONDISK_ASSERT_OFFSET(MASTER_BOOT_RECORD, MasterBootRecordMagic, 510);
+
+ONDISK_FIELD(Mbr, MASTER_BOOT_RECORD, Signature, Le, 32, ULONG)
+ONDISK_FIELD(Mbr, MASTER_BOOT_RECORD, MasterBootRecordMagic, Le, 16, USHORT)
+
+/* GPT ***********************************************************************/
+
+#define EFI_PT_SIGNATURE     0x5452415020494645ULL /* "EFI PART" */
+#define EFI_PT_REVISION      0x00010000
+#define EFI_PT_HEADER_SIZE   92
+#define EFI_PT_ENTRY_COUNT   128
+#define EFI_PT_ENTRY_SIZE    128
+
+#define GPT_ATTRIBUTE_LEGACY_BIOS_BOOTABLE (1ULL << 2)
+
+typedef struct _EFI_PARTITION_HEADER {
+    UCHAR Signature[8];
+    UCHAR Revision[4];
+    UCHAR HeaderSize[4];
+    UCHAR HeaderCRC32[4];
+    UCHAR Reserved[4];
+    UCHAR MyLBA[8];
+    UCHAR AlternateLBA[8];
+    UCHAR FirstUsableLBA[8];
+    UCHAR LastUsableLBA[8];
+    UCHAR DiskGUID[16];
+    UCHAR PartitionEntryLBA[8];
+    UCHAR NumberOfEntries[4];
+    UCHAR SizeOfPartitionEntry[4];
+    UCHAR PartitionEntryCRC32[4];
+} EFI_PARTITION_HEADER, *PEFI_PARTITION_HEADER;
+
+ONDISK_ASSERT_SIZE(EFI_PARTITION_HEADER, EFI_PT_HEADER_SIZE);
+ONDISK_ASSERT_OFFSET(EFI_PARTITION_HEADER, HeaderCRC32, 16);
+ONDISK_ASSERT_OFFSET(EFI_PARTITION_HEADER, MyLBA, 24);
+ONDISK_ASSERT_OFFSET(EFI_PARTITION_HEADER, DiskGUID, 56);
+ONDISK_ASSERT_OFFSET(EFI_PARTITION_HEADER, PartitionEntryLBA, 72);
+ONDISK_ASSERT_OFFSET(EFI_PARTITION_HEADER, PartitionEntryCRC32, 88);
+
+ONDISK_FIELD(GptHeader, EFI_PARTITION_HEADER, Signature, Le, 64, ULONGLONG)
+ONDISK_FIELD(GptHeader, EFI_PARTITION_HEADER, Revision, Le, 32, ULONG)
+ONDISK_FIELD(GptHeader, EFI_PARTITION_HEADER, HeaderSize, Le, 32, ULONG)
+ONDISK_FIELD(GptHeader, EFI_PARTITION_HEADER, HeaderCRC32, Le, 32, ULONG)
+ONDISK_FIELD(GptHeader, EFI_PARTITION_HEADER, MyLBA, Le, 64, ULONGLONG)
+ONDISK_FIELD(GptHeader, EFI_PARTITION_HEADER, AlternateLBA, Le, 64, ULONGLONG)
+ONDISK_FIELD(GptHeader, EFI_PARTITION_HEADER, FirstUsableLBA, Le, 64, ULONGLONG)
+ONDISK_FIELD(GptHeader, EFI_PARTITION_HEADER, LastUsableLBA, Le, 64, ULONGLONG)
+ONDISK_GUID_FIELD(GptHeader, EFI_PARTITION_HEADER, DiskGUID)
+ONDISK_FIELD(GptHeader, EFI_PARTITION_HEADER, PartitionEntryLBA, Le, 64, ULONGLONG)
+ONDISK_FIELD(GptHeader, EFI_PARTITION_HEADER, NumberOfEntries, Le, 32, ULONG)
+ONDISK_FIELD(GptHeader, EFI_PARTITION_HEADER, SizeOfPartitionEntry, Le, 32, ULONG)
+ONDISK_FIELD(GptHeader, EFI_PARTITION_HEADER, PartitionEntryCRC32, Le, 32, ULONG)
+
+typedef struct _EFI_PARTITION_ENTRY {
+    UCHAR PartitionType[16];
+    UCHAR UniquePartition[16];
+    UCHAR StartingLBA[8];
+    UCHAR EndingLBA[8];
+    UCHAR Attributes[8];
+    UCHAR Name[72];
+} EFI_PARTITION_ENTRY, *PEFI_PARTITION_ENTRY;
+
+ONDISK_ASSERT_SIZE(EFI_PARTITION_ENTRY, EFI_PT_ENTRY_SIZE);
+ONDISK_ASSERT_OFFSET(EFI_PARTITION_ENTRY, StartingLBA, 32);
+ONDISK_ASSERT_OFFSET(EFI_PARTITION_ENTRY, Attributes, 48);
+ONDISK_ASSERT_OFFSET(EFI_PARTITION_ENTRY, Name, 56);
+
+ONDISK_GUID_FIELD(GptEntry, EFI_PARTITION_ENTRY, PartitionType)
+ONDISK_GUID_FIELD(GptEntry, EFI_PARTITION_ENTRY, UniquePartition)
+ONDISK_FIELD(GptEntry, EFI_PARTITION_ENTRY, StartingLBA, Le, 64, ULONGLONG)
+ONDISK_FIELD(GptEntry, EFI_PARTITION_ENTRY, EndingLBA, Le, 64, ULONGLONG)
+ONDISK_FIELD(GptEntry, EFI_PARTITION_ENTRY, Attributes, Le, 64, ULONGLONG)
+
+/* An unused entry has an all-zero type GUID, no need to decode it */
+static inline BOOL GptEntryIsUsed(const EFI_PARTITION_ENTRY *Entry)
+{
+    static const UCHAR Zero[16];
+
+    return memcmp(Entry->PartitionType, Zero, sizeof(Zero)) != 0;
+}
+
+/* EXT2/3/4 ******************************************************************/
+
+#define EXT_SUPER_BLOCK_OFFSET 1024
+#define EXT4_SUPER_MAGIC       0xEF53
+
+/* Only the fields DiskPart looks at are named, the rest is padding */
+typedef struct _EXT_SUPER_BLOCK {
+    UCHAR InodesCount[4];
+    UCHAR BlocksCountLo[4];
+    UCHAR Padding1[12];
+    UCHAR FirstDataBlock[4];            /* 0x14 */
+    UCHAR LogBlockSize[4];              /* 0x18 */
+    UCHAR Padding2[4];
+    UCHAR BlocksPerGroup[4];            /* 0x20 */
+    UCHAR Padding3[4];
+    UCHAR InodesPerGroup[4];            /* 0x28 */
+    UCHAR Padding4[12];
+    UCHAR Magic[2];                     /* 0x38 */
+    UCHAR Padding5[18];
+    UCHAR RevLevel[4];                  /* 0x4C */
+    UCHAR Padding6[8];
+    UCHAR InodeSize[2];                 /* 0x58 */
+    UCHAR BlockGroupNr[2];              /* 0x5A */
+    UCHAR FeatureCompat[4];             /* 0x5C */
+    UCHAR FeatureIncompat[4];           /* 0x60 */
+    UCHAR FeatureRoCompat[4];           /* 0x64 */
+    UCHAR Uuid[16];                     /* 0x68 */
+    UCHAR VolumeName[16];               /* 0x78 */
+    UCHAR Padding7[70];
+    UCHAR ReservedGdtBlocks[2];         /* 0xCE */
+    UCHAR Padding8[46];
+    UCHAR DescSize[2];                  /* 0xFE */
+    UCHAR Padding9[80];
+    UCHAR BlocksCountHi[4];             /* 0x150 */
+    UCHAR Padding10[248];
+    UCHAR BackupBgs[2][4];              /* 0x24C */
+    UCHAR Padding11[428];
+} EXT_SUPER_BLOCK, *PEXT_SUPER_BLOCK;
+
+ONDISK_ASSERT_SIZE(EXT_SUPER_BLOCK, 1024);
+ONDISK_ASSERT_OFFSET(EXT_SUPER_BLOCK, FirstDataBlock, 0x14);
+ONDISK_ASSERT_OFFSET(EXT_SUPER_BLOCK, BlocksPerGroup, 0x20);
+ONDISK_ASSERT_OFFSET(EXT_SUPER_BLOCK, Magic, 0x38);
+ONDISK_ASSERT_OFFSET(EXT_SUPER_BLOCK, RevLevel, 0x4C);
+ONDISK_ASSERT_OFFSET(EXT_SUPER_BLOCK, FeatureCompat, 0x5C);
+ONDISK_ASSERT_OFFSET(EXT_SUPER_BLOCK, VolumeName, 0x78);
+ONDISK_ASSERT_OFFSET(EXT_SUPER_BLOCK, ReservedGdtBlocks, 0xCE);
+ONDISK_ASSERT_OFFSET(EXT_SUPER_BLOCK, DescSize, 0xFE);
+ONDISK_ASSERT_OFFSET(EXT_SUPER_BLOCK, BlocksCountHi, 0x150);
+ONDISK_ASSERT_OFFSET(EXT_SUPER_BLOCK, BackupBgs, 0x24C);
+
+ONDISK_FIELD_RO(ExtSuper, EXT_SUPER_BLOCK, InodesCount, Le, 32, ULONG)
+ONDISK_FIELD_RO(ExtSuper, EXT_SUPER_BLOCK, BlocksCountLo, Le, 32, ULONG)
+ONDISK_FIELD_RO(ExtSuper, EXT_SUPER_BLOCK, FirstDataBlock, Le, 32, ULONG)
+ONDISK_FIELD_RO(ExtSuper, EXT_SUPER_BLOCK, LogBlockSize, Le, 32, ULONG)
+ONDISK_FIELD_RO(ExtSuper, EXT_SUPER_BLOCK, BlocksPerGroup, Le, 32, ULONG)
+ONDISK_FIELD_RO(ExtSuper, EXT_SUPER_BLOCK, InodesPerGroup, Le, 32, ULONG)
+ONDISK_FIELD_RO(ExtSuper, EXT_SUPER_BLOCK, Magic, Le, 16, USHORT)
+ONDISK_FIELD_RO(ExtSuper, EXT_SUPER_BLOCK, RevLevel, Le, 32, ULONG)
+ONDISK_FIELD_RO(ExtSuper, EXT_SUPER_BLOCK, InodeSize, Le, 16, USHORT)
+ONDISK_FIELD_RO(ExtSuper, EXT_SUPER_BLOCK, BlockGroupNr, Le, 16, USHORT)
+ONDISK_FIELD_RO(ExtSuper, EXT_SUPER_BLOCK, FeatureCompat, Le, 32, ULONG)
+ONDISK_FIELD_RO(ExtSuper, EXT_SUPER_BLOCK, FeatureIncompat, Le, 32, ULONG)
+ONDISK_FIELD_RO(ExtSuper, EXT_SUPER_BLOCK, FeatureRoCompat, Le, 32, ULONG)
+ONDISK_FIELD_RO(ExtSuper, EXT_SUPER_BLOCK, ReservedGdtBlocks, Le, 16, USHORT)
+ONDISK_FIELD_RO(ExtSuper, EXT_SUPER_BLOCK, DescSize, Le, 16, USHORT)
+ONDISK_FIELD_RO(ExtSuper, EXT_SUPER_BLOCK, BlocksCountHi, Le, 32, ULONG)
+
+static inline ULONG ExtSuperGetBackupBg(const EXT_SUPER_BLOCK *Super, int Index)
+{
+    return LoadLe32(Super->BackupBgs[Index]);
+}
+
+/* Descriptors are 32 bytes, or DescSize (>= 64) with the 64bit feature */
+typedef struct _EXT_GROUP_DESC {
+    UCHAR BlockBitmapLo[4];
+    UCHAR InodeBitmapLo[4];
+    UCHAR InodeTableLo[4];
+    UCHAR FreeBlocksCountLo[2];
+    UCHAR Padding1[4];
+    UCHAR Flags[2];                     /* 0x12 */
+    UCHAR Padding2[12];
+    UCHAR BlockBitmapHi[4];             /* 0x20 */
+    UCHAR InodeBitmapHi[4];
+    UCHAR InodeTableHi[4];
+    UCHAR FreeBlocksCountHi[2];         /* 0x2C */
+    UCHAR Padding3[18];
+} EXT_GROUP_DESC, *PEXT_GROUP_DESC;
+
+ONDISK_ASSERT_SIZE(EXT_GROUP_DESC, 64);
+ONDISK_ASSERT_OFFSET(EXT_GROUP_DESC, FreeBlocksCountLo, 0x0C);
+ONDISK_ASSERT_OFFSET(EXT_GROUP_DESC, Flags, 0x12);
+ONDISK_ASSERT_OFFSET(EXT_GROUP_DESC, BlockBitmapHi, 0x20);
+ONDISK_ASSERT_OFFSET(EXT_GROUP_DESC, FreeBlocksCountHi, 0x2C);
+
+ONDISK_FIELD_RO(ExtGroup, EXT_GROUP_DESC, BlockBitmapLo, Le, 32, ULONG)
+ONDISK_FIELD_RO(ExtGroup, EXT_GROUP_DESC, InodeBitmapLo, Le, 32, ULONG)
+ONDISK_FIELD_RO(ExtGroup, EXT_GROUP_DESC, InodeTableLo, Le, 32, ULONG)
+ONDISK_FIELD_RO(ExtGroup, EXT_GROUP_DESC, FreeBlocksCountLo, Le, 16, USHORT)
+ONDISK_FIELD_RO(ExtGroup, EXT_GROUP_DESC, Flags, Le, 16, USHORT)
+ONDISK_FIELD_RO(ExtGroup, EXT_GROUP_DESC, BlockBitmapHi, Le, 32, ULONG)
+ONDISK_FIELD_RO(ExtGroup, EXT_GROUP_DESC, InodeBitmapHi, Le, 32, ULONG)
+ONDISK_FIELD_RO(ExtGroup, EXT_GROUP_DESC, InodeTableHi, Le, 32, ULONG)
+ONDISK_FIELD_RO(ExtGroup, EXT_GROUP_DESC, FreeBlocksCountHi, Le, 16, USHORT)
+
+/* FAT ***********************************************************************/
+
+/* BIOS parameter block shared by FAT12/16/32 */
+#define FAT_COMMON_BPB \
+    UCHAR Jump[3]; \
+    UCHAR OemName[8]; \
+    UCHAR BytesPerSector[2]; \
+    UCHAR SectorsPerCluster; \
+    UCHAR ReservedSectors[2]; \
+    UCHAR NumberOfFats; \
+    UCHAR RootEntries[2]; \
+    UCHAR TotalSectors16[2]; \
+    UCHAR Media; \
+    UCHAR SectorsPerFat16[2]; \
+    UCHAR SectorsPerTrack[2]; \
+    UCHAR Heads[2]; \
+    UCHAR HiddenSectors[4]; \
+    UCHAR TotalSectors32[4];
+
+typedef struct _FAT_BOOT_SECTOR {
+    FAT_COMMON_BPB
+    UCHAR DriveNumber;
+    UCHAR Reserved1;
+    UCHAR BootSignature;
+    UCHAR VolumeId[4];
+    UCHAR VolumeLabel[11];
+    UCHAR FileSystemType[8];            /* 54 */
+    UCHAR BootCode[448];
+    UCHAR Signature[2];
+} FAT_BOOT_SECTOR, *PFAT_BOOT_SECTOR;
+
+typedef struct _FAT32_BOOT_SECTOR {
+    FAT_COMMON_BPB
+    UCHAR SectorsPerFat32[4];           /* 36 */
+    UCHAR ExtFlags[2];
+    UCHAR FsVersion[2];
+    UCHAR RootCluster[4];
+    UCHAR FsInfoSector[2];
+    UCHAR BackupBootSector[2];
+    UCHAR Reserved[12];
+    UCHAR DriveNumber;
+    UCHAR Reserved1;
+    UCHAR BootSignature;
+    UCHAR VolumeId[4];
+    UCHAR VolumeLabel[11];
+    UCHAR FileSystemType[8];            /* 82 */
+    UCHAR BootCode[420];
+    UCHAR Signature[2];
+} FAT32_BOOT_SECTOR, *PFAT32_BOOT_SECTOR;
+
+ONDISK_ASSERT_SIZE(FAT_BOOT_SECTOR, 512);
+ONDISK_ASSERT_SIZE(FAT32_BOOT_SECTOR, 512);
+ONDISK_ASSERT_OFFSET(FAT_BOOT_SECTOR, BytesPerSector, 11);
+ONDISK_ASSERT_OFFSET(FAT_BOOT_SECTOR, TotalSectors32, 32);
+ONDISK_ASSERT_OFFSET(FAT_BOOT_SECTOR, FileSystemType, 54);
+ONDISK_ASSERT_OFFSET(FAT32_BOOT_SECTOR, SectorsPerFat32, 36);
+ONDISK_ASSERT_OFFSET(FAT32_BOOT_SECTOR, FileSystemType, 82);
+ONDISK_ASSERT_OFFSET(FAT32_BOOT_SECTOR, Signature, 510);
+
+ONDISK_FIELD_RO(Fat, FAT_BOOT_SECTOR, BytesPerSector, Le, 16, USHORT)
+ONDISK_FIELD_RO(Fat, FAT_BOOT_SECTOR, ReservedSectors, Le, 16, USHORT)
+ONDISK_FIELD_RO(Fat, FAT_BOOT_SECTOR, RootEntries, Le, 16, USHORT)
+ONDISK_FIELD_RO(Fat, FAT_BOOT_SECTOR, TotalSectors16, Le, 16, USHORT)
+ONDISK_FIELD_RO(Fat, FAT_BOOT_SECTOR, SectorsPerFat16, Le, 16, USHORT)
+ONDISK_FIELD_RO(Fat, FAT_BOOT_SECTOR, TotalSectors32, Le, 32, ULONG)
+ONDISK_FIELD_RO(Fat, FAT_BOOT_SECTOR, Signature, Le, 16, USHORT)
+ONDISK_FIELD_RO(Fat32, FAT32_BOOT_SECTOR, SectorsPerFat32, Le, 32, ULONG)
+
+/* NTFS **********************************************************************/
+
+typedef struct _NTFS_BOOT_SECTOR {
+    UCHAR Jump[3];
+    UCHAR OemId[8];
+    UCHAR BytesPerSector[2];
+    UCHAR SectorsPerCluster;
+    UCHAR Padding1[26];
+    UCHAR TotalSectors[8];              /* 0x28 */
+    UCHAR MftCluster[8];
+    UCHAR MftMirrorCluster[8];
+    UCHAR Padding2[446];
+    UCHAR Signature[2];
+} NTFS_BOOT_SECTOR, *PNTFS_BOOT_SECTOR;
+
+ONDISK_ASSERT_SIZE(NTFS_BOOT_SECTOR, 512);
+ONDISK_ASSERT_OFFSET(NTFS_BOOT_SECTOR, BytesPerSector, 0x0B);
+ONDISK_ASSERT_OFFSET(NTFS_BOOT_SECTOR, TotalSectors, 0x28);
+
+ONDISK_FIELD_RO(Ntfs, NTFS_BOOT_SECTOR, BytesPerSector, Le, 16, USHORT)
+ONDISK_FIELD_RO(Ntfs, NTFS_BOOT_SECTOR, TotalSectors, Le, 64, ULONGLONG)
+
+/* XFS (big-endian) **********************************************************/
+
+typedef struct _XFS_SUPER_BLOCK {
+    UCHAR Magic[4];
+    UCHAR BlockSize[4];
+    UCHAR DataBlocks[8];
+} XFS_SUPER_BLOCK, *PXFS_SUPER_BLOCK;
+
+ONDISK_ASSERT_SIZE(XFS_SUPER_BLOCK, 16);
+
+ONDISK_FIELD_RO(Xfs, XFS_SUPER_BLOCK, BlockSize, Be, 32, ULONG)
+ONDISK_FIELD_RO(Xfs, XFS_SUPER_BLOCK, DataBlocks, Be, 64, ULONGLONG)
+
+/* sb_fname, past the part of the superblock declared above */
+#define XFS_LABEL_OFFSET    108
+#define XFS_LABEL_SIZE      12
+
+/* BTRFS *********************************************************************/
+
+#define BTRFS_SUPER_BLOCK_OFFSET 0x10000
+
+typedef struct _BTRFS_SUPER_BLOCK {
+    UCHAR Checksum[32];
+    UCHAR FsId[16];
+    UCHAR ByteNr[8];                    /* 0x30 */
+    UCHAR Flags[8];
+    UCHAR Magic[8];                     /* 0x40 */
+    UCHAR Generation[8];
+    UCHAR Root[8];
+    UCHAR ChunkRoot[8];
+    UCHAR LogRoot[8];
+    UCHAR LogRootTransId[8];
+    UCHAR TotalBytes[8];                /* 0x70 */
+} BTRFS_SUPER_BLOCK, *PBTRFS_SUPER_BLOCK;
+
+ONDISK_ASSERT_OFFSET(BTRFS_SUPER_BLOCK, ByteNr, 0x30);
+ONDISK_ASSERT_OFFSET(BTRFS_SUPER_BLOCK, Magic, 0x40);
+ONDISK_ASSERT_OFFSET(BTRFS_SUPER_BLOCK, TotalBytes, 0x70);
+
+ONDISK_FIELD_RO(Btrfs, BTRFS_SUPER_BLOCK, ByteNr, Le, 64, ULONGLONG)
+ONDISK_FIELD_RO(Btrfs, BTRFS_SUPER_BLOCK, Magic, Le, 64, ULONGLONG)
+ONDISK_FIELD_RO(Btrfs, BTRFS_SUPER_BLOCK, TotalBytes, Le, 64, ULONGLONG)
+
+#define BTRFS_LABEL_OFFSET  0x12B
+#define BTRFS_LABEL_SIZE    256
+
+/* LVM2 **********************************************************************/
+
+typedef struct _LVM_LABEL_HEADER {
+    UCHAR Id[8];                        /* "LABELONE" */
+    UCHAR SectorXl[8];
+    UCHAR Crc[4];
+    UCHAR OffsetXl[4];
+    UCHAR Type[8];                      /* "LVM2 001" */
+} LVM_LABEL_HEADER, *PLVM_LABEL_HEADER;
+
+ONDISK_ASSERT_SIZE(LVM_LABEL_HEADER, 32);
+
+ONDISK_FIELD_RO(Lvm, LVM_LABEL_HEADER, SectorXl, Le, 64, ULONGLONG)
+ONDISK_FIELD_RO(Lvm, LVM_LABEL_HEADER, OffsetXl, Le, 32, ULONG)
+
+/* The PV header sits at OffsetXl from the label: a 32 byte UUID, then the size */
+typedef struct _LVM_PV_HEADER {
+    UCHAR PvUuid[32];
+    UCHAR DeviceSize[8];
+} LVM_PV_HEADER, *PLVM_PV_HEADER;
+
+ONDISK_ASSERT_SIZE(LVM_PV_HEADER, 40);
+
+ONDISK_FIELD_RO(Lvm, LVM_PV_HEADER, DeviceSize, Le, 64, ULONGLONG)
+
+/* SWAP **********************************************************************/
+
+/* "SWAPSPACE2" ends the first page, whatever the page size of the system was */
+#define SWAP_MAGIC_SIZE 10
+
+typedef struct _SWAP_HEADER {
+    UCHAR BootBits[1024];
+    UCHAR Version[4];
+    UCHAR LastPage[4];
+    UCHAR NrBadPages[4];
+    UCHAR Uuid[16];
+    UCHAR VolumeName[16];
+} SWAP_HEADER, *PSWAP_HEADER;
+
+ONDISK_ASSERT_OFFSET(SWAP_HEADER, VolumeName, 1052);
+
+/* LUKS (big-endian) *********************************************************/
+
+/* LUKS1 ends the common part after Version; only LUKS2 has a label */
+typedef struct _LUKS_HEADER {
+    UCHAR Magic[6];                     /* "LUKS\xba\xbe" */
+    UCHAR Version[2];
+    UCHAR HeaderSize[8];
+    UCHAR SequenceId[8];
+    UCHAR Label[48];                    /* 24 */
+} LUKS_HEADER, *PLUKS_HEADER;
+
+ONDISK_ASSERT_OFFSET(LUKS_HEADER, Label, 24);
+
+ONDISK_FIELD_RO(Luks, LUKS_HEADER, Version, Be, 16, USHORT)
+
+#endif /* ONDISK_H */
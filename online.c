@@ -8,17 +8,7 @@
 
 #include "diskpart.h"
 
-#ifndef LPWSTR
-typedef wchar_t* LPWSTR;
-#endif
-
-#ifndef BOOL
-typedef int BOOL;
-#define TRUE 1
-#define FALSE 0
-#endif
-
-BOOL online_main(int argc, LPWSTR *argv)
+BOOL online_main(int argc, char **argv)
 {
     (void)argc;
     (void)argv;
@@ -0,0 +1,817 @@
+/*
+ * PROJECT:         ReactOS DiskPart (Linux port)
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * FILE:            base/system/diskpart/output.c
+ * PURPOSE:         Output buffer and table formatting for the list and detail
+ *                  commands, as text, JSON or CSV: a command's output is
+ *                  written with one write().
+ */
+
+#include "diskpart.h"
+
+#include <stdarg.h>
+#include <strings.h>
+#include <unistd.h>
+
+#define OUTPUT_INITIAL_SIZE 4096
+#define OUTPUT_COLUMN_GAP   2
+
+OUTPUT_FORMAT DefaultOutputFormat = OUTPUT_FORMAT_TEXT;
+
+static const struct {
+    const char *Name;
+    OUTPUT_FORMAT Format;
+} OutputFormats[] = {
+    { "text", OUTPUT_FORMAT_TEXT },
+    { "json", OUTPUT_FORMAT_JSON },
+    { "csv", OUTPUT_FORMAT_CSV },
+};
+
+/* FUNCTIONS ******************************************************************/
+
+static
+BOOL
+LookupOutputFormat(
+    const char *Name,
+    OUTPUT_FORMAT *Format)
+{
+    ULONG i;
+
+    for (i = 0; i < ARRAYSIZE(OutputFormats); i++)
+    {
+        if (strcasecmp(Name, OutputFormats[i].Name) == 0)
+        {
+            *Format = OutputFormats[i].Format;
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+
+/* Sets the format of every command's output: "text", "json" or "csv" */
+BOOL
+SetDefaultOutputFormat(
+    const char *Name)
+{
+    return LookupOutputFormat(Name, &DefaultOutputFormat);
+}
+
+
+void
+InitializeOutputBuffer(
+    POUTPUT_BUFFER Buffer)
+{
+    memset(Buffer, 0, sizeof(*Buffer));
+    Buffer->Format = DefaultOutputFormat;
+}
+
+
+void
+FreeOutputBuffer(
+    POUTPUT_BUFFER Buffer)
+{
+    free(Buffer->Data);
+    InitializeOutputBuffer(Buffer);
+}
+
+
+/* Makes room for Length more bytes plus a terminating NUL */
+static
+BOOL
+ReserveOutput(
+    POUTPUT_BUFFER Buffer,
+    size_t Length)
+{
+    size_t Allocated;
+    char *Data;
+
+    if (Buffer->Failed)
+        return FALSE;
+
+    if (Buffer->Length + Length + 1 <= Buffer->Allocated)
+        return TRUE;
+
+    Allocated = (Buffer->Allocated != 0) ? Buffer->Allocated : OUTPUT_INITIAL_SIZE;
+    while (Allocated < Buffer->Length + Length + 1)
+        Allocated *= 2;
+
+    Data = realloc(Buffer->Data, Allocated);
+    if (Data == NULL)
+    {
+        Buffer->Failed = TRUE;
+        return FALSE;
+    }
+
+    Buffer->Data = Data;
+    Buffer->Allocated = Allocated;
+
+    return TRUE;
+}
+
+
+void
+OutputBytes(
+    POUTPUT_BUFFER Buffer,
+    const char *Data,
+    size_t Length)
+{
+    if (!ReserveOutput(Buffer, Length))
+        return;
+
+    memcpy(Buffer->Data + Buffer->Length, Data, Length);
+    Buffer->Length += Length;
+    Buffer->Data[Buffer->Length] = '\0';
+}
+
+
+static
+void
+OutputFill(
+    POUTPUT_BUFFER Buffer,
+    char Character,
+    size_t Count)
+{
+    if (!ReserveOutput(Buffer, Count))
+        return;
+
+    memset(Buffer->Data + Buffer->Length, Character, Count);
+    Buffer->Length += Count;
+    Buffer->Data[Buffer->Length] = '\0';
+}
+
+
+static
+void
+OutputVPrintf(
+    POUTPUT_BUFFER Buffer,
+    const char *Format,
+    va_list Args)
+{
+    va_list Copy;
+    int Length;
+
+    /* Usually fits in what is left; otherwise grow and format again */
+    va_copy(Copy, Args);
+    Length = vsnprintf(Buffer->Data ? Buffer->Data + Buffer->Length : NULL,
+                       Buffer->Data ? Buffer->Allocated - Buffer->Length : 0,
+                       Format, Copy);
+    va_end(Copy);
+
+    if (Length < 0)
+    {
+        Buffer->Failed = TRUE;
+        return;
+    }
+
+    if (Buffer->Data == NULL || Buffer->Length + (size_t)Length >= Buffer->Allocated)
+    {
+        if (!ReserveOutput(Buffer, (size_t)Length))
+            return;
+        vsnprintf(Buffer->Data + Buffer->Length, Buffer->Allocated - Buffer->Length, Format, Args);
+    }
+
+    Buffer->Length += (size_t)Length;
+}
+
+
+void
+OutputPrintf(
+    POUTPUT_BUFFER Buffer,
+    const char *Format,
+    ...)
+{
+    va_list Args;
+
+    va_start(Args, Format);
+    OutputVPrintf(Buffer, Format, Args);
+    va_end(Args);
+}
+
+
+/*
+ * Takes the arguments of a list or detail command from argv[First] on;
+ * the only one is format=<text|json|csv>, which overrides --output.
+ */
+BOOL
+ParseOutputArguments(
+    POUTPUT_BUFFER Buffer,
+    int argc,
+    char **argv,
+    int First)
+{
+    char *pszSuffix;
+    int i;
+
+    for (i = First; i < argc; i++)
+    {
+        if (!HasPrefix(argv[i], "format=", &pszSuffix) ||
+            !LookupOutputFormat(pszSuffix, &Buffer->Format))
+        {
+            printf("Invalid argument: %s\n", argv[i]);
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+
+void
+OutputBeginDocument(
+    POUTPUT_BUFFER Buffer)
+{
+    if (Buffer->Format == OUTPUT_FORMAT_JSON)
+        OutputBytes(Buffer, "{", 1);
+    else if (Buffer->Format == OUTPUT_FORMAT_TEXT)
+        OutputBytes(Buffer, "\n", 1);
+}
+
+
+void
+OutputEndDocument(
+    POUTPUT_BUFFER Buffer)
+{
+    if (Buffer->Format == OUTPUT_FORMAT_JSON)
+        OutputBytes(Buffer, "}\n", 2);
+    else if (Buffer->Format == OUTPUT_FORMAT_TEXT)
+        OutputBytes(Buffer, "\n", 1);
+}
+
+
+/* A JSON string; control characters are escaped, UTF-8 is passed through */
+static
+void
+OutputJsonString(
+    POUTPUT_BUFFER Buffer,
+    const char *Text)
+{
+    const char *Run = Text;
+    char Escape[2];
+
+    OutputBytes(Buffer, "\"", 1);
+
+    for (; *Text != '\0'; Text++)
+    {
+        if (*Text != '"' && *Text != '\\' && (UCHAR)*Text >= 0x20)
+            continue;
+
+        OutputBytes(Buffer, Run, (size_t)(Text - Run));
+        if (*Text == '"' || *Text == '\\')
+        {
+            Escape[0] = '\\';
+            Escape[1] = *Text;
+            OutputBytes(Buffer, Escape, 2);
+        }
+        else
+        {
+            OutputPrintf(Buffer, "\\u%04x", (UCHAR)*Text);
+        }
+        Run = Text + 1;
+    }
+
+    OutputBytes(Buffer, Run, (size_t)(Text - Run));
+    OutputBytes(Buffer, "\"", 1);
+}
+
+
+/* A CSV field, quoted only if it has to be (RFC 4180) */
+static
+void
+OutputCsvField(
+    POUTPUT_BUFFER Buffer,
+    const char *Text)
+{
+    const char *Quote;
+
+    if (strpbrk(Text, ",\"\r\n") == NULL)
+    {
+        OutputBytes(Buffer, Text, strlen(Text));
+        return;
+    }
+
+    OutputBytes(Buffer, "\"", 1);
+    while ((Quote = strchr(Text, '"')) != NULL)
+    {
+        OutputBytes(Buffer, Text, (size_t)(Quote - Text) + 1);
+        OutputBytes(Buffer, "\"", 1);
+        Text = Quote + 1;
+    }
+    OutputBytes(Buffer, Text, strlen(Text));
+    OutputBytes(Buffer, "\"", 1);
+}
+
+
+/*
+ * Writes the buffer to standard output and empties it. Anything still in
+ * the stdio buffer goes first, so the order of the output is kept.
+ */
+BOOL
+FlushOutputBuffer(
+    POUTPUT_BUFFER Buffer)
+{
+    size_t Offset = 0;
+    ssize_t Result;
+    BOOL Success = !Buffer->Failed;
+
+    if (Buffer->Failed)
+        printf("Out of memory.\n");
+
+    fflush(stdout);
+
+    while (Offset < Buffer->Length)
+    {
+        Result = write(STDOUT_FILENO, Buffer->Data + Offset, Buffer->Length - Offset);
+        if (Result < 0 && errno == EINTR)
+            continue;
+        if (Result <= 0)
+        {
+            Success = FALSE;
+            break;
+        }
+        Offset += (size_t)Result;
+    }
+
+    Buffer->Length = 0;
+    Buffer->Failed = FALSE;
+
+    return Success;
+}
+
+
+/* Width of a UTF-8 string in characters: every byte that starts one */
+static
+ULONG
+GetDisplayWidth(
+    const char *Text)
+{
+    ULONG Width = 0;
+
+    for (; *Text != '\0'; Text++)
+    {
+        if (((UCHAR)*Text & 0xC0) != 0x80)
+            Width++;
+    }
+
+    return Width;
+}
+
+
+/* Ends a line without trailing blanks, which empty cells leave */
+static
+void
+OutputEndLine(
+    POUTPUT_BUFFER Buffer)
+{
+    while (Buffer->Length > 0 && Buffer->Data[Buffer->Length - 1] == ' ')
+        Buffer->Length--;
+
+    OutputBytes(Buffer, "\n", 1);
+}
+
+
+static
+void
+InitializeSection(
+    POUTPUT_TABLE Table,
+    POUTPUT_BUFFER Output,
+    const char *Name,
+    BOOL IsRecord,
+    const OUTPUT_COLUMN *Columns,
+    ULONG ColumnCount)
+{
+    ULONG Width = 0;
+    ULONG i;
+
+    memset(Table, 0, sizeof(*Table));
+    Table->Output = Output;
+    Table->Name = Name;
+    Table->IsRecord = IsRecord;
+    Table->Columns = Columns;
+    Table->ColumnCount = (ColumnCount < OUTPUT_MAX_COLUMNS) ? ColumnCount : OUTPUT_MAX_COLUMNS;
+    InitializeOutputBuffer(&Table->Cells);
+
+    /* Sections follow each other: a blank line apart, or JSON members */
+    if (Output->Sections++ > 0)
+        OutputBytes(Output, (Output->Format == OUTPUT_FORMAT_JSON) ? "," : "\n", 1);
+
+    switch (Output->Format)
+    {
+        case OUTPUT_FORMAT_TEXT:
+            for (i = 0; i < Table->ColumnCount; i++)
+            {
+                Table->Widths[i] = GetDisplayWidth(Columns[i].Title);
+                if (Table->Widths[i] > Width)
+                    Width = Table->Widths[i];
+            }
+
+            /* The titles of a record are one column */
+            if (IsRecord)
+            {
+                for (i = 0; i < Table->ColumnCount; i++)
+                    Table->Widths[i] = Width;
+            }
+            break;
+
+        case OUTPUT_FORMAT_JSON:
+            OutputJsonString(Output, Name);
+            OutputBytes(Output, IsRecord ? ":{" : ":[", 2);
+            break;
+
+        case OUTPUT_FORMAT_CSV:
+            if (!IsRecord)
+                OutputBytes(Output, "selected", 8);
+            for (i = 0; i < Table->ColumnCount; i++)
+            {
+                if (i > 0 || !IsRecord)
+                    OutputBytes(Output, ",", 1);
+                OutputCsvField(Output, Columns[i].Key);
+            }
+            OutputBytes(Output, "\n", 1);
+            break;
+    }
+
+    /* A record is a table of one row that is always there */
+    if (IsRecord)
+        Table->RowCount = 1;
+}
+
+
+/*
+ * Starts a table named Name (the JSON member) in Output. Sections of a
+ * document are written one after the other: finish a table with
+ * OutputTable before starting the next one.
+ */
+void
+InitializeOutputTable(
+    POUTPUT_TABLE Table,
+    POUTPUT_BUFFER Output,
+    const char *Name,
+    const OUTPUT_COLUMN *Columns,
+    ULONG ColumnCount)
+{
+    InitializeSection(Table, Output, Name, FALSE, Columns, ColumnCount);
+}
+
+
+/* Starts a record: one object whose fields are shown as "Title : value" */
+void
+InitializeOutputRecord(
+    POUTPUT_TABLE Table,
+    POUTPUT_BUFFER Output,
+    const char *Name,
+    const OUTPUT_COLUMN *Columns,
+    ULONG ColumnCount)
+{
+    InitializeSection(Table, Output, Name, TRUE, Columns, ColumnCount);
+}
+
+
+/*
+ * Ends the current row. Cells left out are empty in a text table and in
+ * CSV, and missing from JSON objects and text records.
+ */
+static
+void
+EndRow(
+    POUTPUT_TABLE Table)
+{
+    if (Table->RowCount == 0)
+        return;
+
+    switch (Table->Output->Format)
+    {
+        case OUTPUT_FORMAT_TEXT:
+            while (!Table->IsRecord && Table->CellCount < Table->ColumnCount)
+            {
+                OutputBytes(&Table->Cells, "", 1);
+                Table->CellCount++;
+            }
+            break;
+
+        case OUTPUT_FORMAT_JSON:
+            if (!Table->IsRecord)
+                OutputBytes(Table->Output, "}", 1);
+            break;
+
+        case OUTPUT_FORMAT_CSV:
+            for (; Table->CellCount < Table->ColumnCount; Table->CellCount++)
+            {
+                if (Table->CellCount > 0 || !Table->IsRecord)
+                    OutputBytes(Table->Output, ",", 1);
+            }
+            OutputBytes(Table->Output, "\n", 1);
+            break;
+    }
+}
+
+
+/* Starts a row; a selected row is marked with an asterisk like in Windows */
+void
+OutputTableRow(
+    POUTPUT_TABLE Table,
+    BOOL Selected)
+{
+    if (Table->IsRecord)
+        return;
+
+    EndRow(Table);
+
+    switch (Table->Output->Format)
+    {
+        case OUTPUT_FORMAT_TEXT:
+            OutputBytes(&Table->Cells, Selected ? "*" : " ", 1);
+            break;
+
+        case OUTPUT_FORMAT_JSON:
+            OutputPrintf(Table->Output, "%s{\"selected\":%s",
+                         (Table->RowCount > 0) ? "," : "", Selected ? "true" : "false");
+            break;
+
+        case OUTPUT_FORMAT_CSV:
+            OutputPrintf(Table->Output, "%s", Selected ? "true" : "false");
+            break;
+    }
+
+    Table->RowCount++;
+    Table->CellCount = 0;
+}
+
+
+static
+BOOL
+BeginCell(
+    POUTPUT_TABLE Table)
+{
+    const OUTPUT_COLUMN *Column;
+    POUTPUT_BUFFER Output = Table->Output;
+
+    if (Table->RowCount == 0 || Table->CellCount >= Table->ColumnCount)
+        return FALSE;
+
+    Column = &Table->Columns[Table->CellCount];
+
+    switch (Output->Format)
+    {
+        case OUTPUT_FORMAT_TEXT:
+            if (Table->IsRecord)
+            {
+                OutputPrintf(Output, "%s%*s : ", Column->Title,
+                             (int)(Table->Widths[0] - GetDisplayWidth(Column->Title)), "");
+            }
+            break;
+
+        case OUTPUT_FORMAT_JSON:
+            if (Table->CellCount > 0 || !Table->IsRecord)
+                OutputBytes(Output, ",", 1);
+            OutputJsonString(Output, Column->Key);
+            OutputBytes(Output, ":", 1);
+            break;
+
+        case OUTPUT_FORMAT_CSV:
+            if (Table->CellCount > 0 || !Table->IsRecord)
+                OutputBytes(Output, ",", 1);
+            break;
+    }
+
+    return TRUE;
+}
+
+
+static
+void
+EndCell(
+    POUTPUT_TABLE Table,
+    size_t Start)
+{
+    ULONG Width;
+
+    if (Table->Output->Format == OUTPUT_FORMAT_TEXT && Table->IsRecord)
+    {
+        OutputEndLine(Table->Output);
+    }
+    else if (Table->Output->Format == OUTPUT_FORMAT_TEXT)
+    {
+        /* Keep the NUL: it separates the cells */
+        OutputBytes(&Table->Cells, "", 1);
+        if (!Table->Cells.Failed)
+        {
+            Width = GetDisplayWidth(Table->Cells.Data + Start);
+            if (Width > Table->Widths[Table->CellCount])
+                Table->Widths[Table->CellCount] = Width;
+        }
+    }
+
+    Table->CellCount++;
+}
+
+
+static
+void
+OutputTextCell(
+    POUTPUT_TABLE Table,
+    const char *Format,
+    va_list Args)
+{
+    POUTPUT_BUFFER Output = Table->Output;
+
+    if (Output->Format == OUTPUT_FORMAT_TEXT)
+    {
+        OutputVPrintf(Table->IsRecord ? Output : &Table->Cells, Format, Args);
+        return;
+    }
+
+    /* Format into the scratch buffer, then quote it for JSON or CSV */
+    Table->Cells.Length = 0;
+    OutputVPrintf(&Table->Cells, Format, Args);
+    if (Table->Cells.Failed)
+    {
+        Output->Failed = TRUE;
+        return;
+    }
+
+    if (Output->Format == OUTPUT_FORMAT_JSON)
+        OutputJsonString(Output, Table->Cells.Data);
+    else
+        OutputCsvField(Output, Table->Cells.Data);
+}
+
+
+/* Adds the next cell of the current row as a string */
+void
+OutputTableCell(
+    POUTPUT_TABLE Table,
+    const char *Format,
+    ...)
+{
+    size_t Start = Table->Cells.Length;
+    va_list Args;
+
+    if (!BeginCell(Table))
+        return;
+
+    va_start(Args, Format);
+    OutputTextCell(Table, Format, Args);
+    va_end(Args);
+
+    EndCell(Table, Start);
+}
+
+
+/*
+ * Adds the next cell as a number. Text shows it through Format, which may
+ * round it or add a unit; JSON and CSV get the exact Value.
+ */
+void
+OutputTableValue(
+    POUTPUT_TABLE Table,
+    ULONGLONG Value,
+    const char *Format,
+    ...)
+{
+    size_t Start = Table->Cells.Length;
+    va_list Args;
+
+    if (!BeginCell(Table))
+        return;
+
+    if (Table->Output->Format == OUTPUT_FORMAT_TEXT)
+    {
+        va_start(Args, Format);
+        OutputTextCell(Table, Format, Args);
+        va_end(Args);
+    }
+    else
+    {
+        OutputPrintf(Table->Output, "%llu", (unsigned long long)Value);
+    }
+
+    EndCell(Table, Start);
+}
+
+
+void
+OutputTableBoolean(
+    POUTPUT_TABLE Table,
+    BOOL Value)
+{
+    if (Table->Output->Format == OUTPUT_FORMAT_TEXT)
+    {
+        OutputTableCell(Table, "%s", Value ? "Yes" : "No");
+        return;
+    }
+
+    if (!BeginCell(Table))
+        return;
+
+    OutputPrintf(Table->Output, "%s", Value ? "true" : "false");
+    EndCell(Table, 0);
+}
+
+
+static
+void
+OutputCell(
+    POUTPUT_BUFFER Buffer,
+    const OUTPUT_TABLE *Table,
+    ULONG Column,
+    const char *Text)
+{
+    ULONG Padding = Table->Widths[Column] - GetDisplayWidth(Text);
+    BOOL Last = (Column + 1 == Table->ColumnCount);
+
+    if (Column > 0)
+        OutputFill(Buffer, ' ', OUTPUT_COLUMN_GAP);
+
+    if (Table->Columns[Column].AlignRight)
+        OutputFill(Buffer, ' ', Padding);
+
+    OutputBytes(Buffer, Text, strlen(Text));
+
+    if (!Table->Columns[Column].AlignRight && !Last)
+        OutputFill(Buffer, ' ', Padding);
+}
+
+
+/* The titles, a line of dashes and the rows, each column as wide as its widest cell */
+static
+void
+OutputTextTable(
+    POUTPUT_BUFFER Buffer,
+    POUTPUT_TABLE Table)
+{
+    const char *Cell;
+    ULONG Row, Column;
+
+    OutputFill(Buffer, ' ', 2);
+    for (Column = 0; Column < Table->ColumnCount; Column++)
+        OutputCell(Buffer, Table, Column, Table->Columns[Column].Title);
+    OutputEndLine(Buffer);
+
+    OutputFill(Buffer, ' ', 2);
+    for (Column = 0; Column < Table->ColumnCount; Column++)
+    {
+        if (Column > 0)
+            OutputFill(Buffer, ' ', OUTPUT_COLUMN_GAP);
+        OutputFill(Buffer, '-', Table->Widths[Column]);
+    }
+    OutputBytes(Buffer, "\n", 1);
+
+    Cell = Table->Cells.Data;
+    for (Row = 0; Row < Table->RowCount && !Table->Cells.Failed; Row++)
+    {
+        /* Each row is a marker byte followed by one string per column */
+        OutputBytes(Buffer, Cell, 1);
+        OutputBytes(Buffer, " ", 1);
+        Cell++;
+
+        for (Column = 0; Column < Table->ColumnCount; Column++)
+        {
+            OutputCell(Buffer, Table, Column, Cell);
+            Cell += strlen(Cell) + 1;
+        }
+        OutputEndLine(Buffer);
+    }
+}
+
+
+/*
+ * Finishes a table or record and frees its cells. A text table without
+ * rows is shown as EmptyText instead, if there is one.
+ */
+void
+OutputTable(
+    POUTPUT_TABLE Table,
+    const char *EmptyText)
+{
+    POUTPUT_BUFFER Output = Table->Output;
+
+    EndRow(Table);
+
+    if (Table->Cells.Failed)
+        Output->Failed = TRUE;
+
+    switch (Output->Format)
+    {
+        case OUTPUT_FORMAT_TEXT:
+            if (Table->IsRecord)
+                break;
+            if (Table->RowCount == 0 && EmptyText != NULL)
+                OutputPrintf(Output, "%s\n", EmptyText);
+            else
+                OutputTextTable(Output, Table);
+            break;
+
+        case OUTPUT_FORMAT_JSON:
+            OutputBytes(Output, Table->IsRecord ? "}" : "]", 1);
+            break;
+
+        case OUTPUT_FORMAT_CSV:
+            break;
+    }
+
+    FreeOutputBuffer(&Table->Cells);
+    Table->RowCount = 0;
+    Table->CellCount = 0;
+}
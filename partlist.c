@@ -1,83 +1,202 @@
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <stdbool.h>
+/*
+ * PROJECT:         ReactOS DiskPart (Linux port)
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * FILE:            base/system/diskpart/partlist.c
+ * PURPOSE:         Partition list helpers shared by the commands.
+ */
+
+#define _GNU_SOURCE
+#include "diskpart.h"
+
+#include <ctype.h>
+#include <dirent.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <unistd.h>
-#include <sys/ioctl.h>
-#include <linux/fs.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
-#include <errno.h>
-#include <linux/hdreg.h>
-#include <sys/types.h>
-#include <sys/statvfs.h>
-
-typedef struct _PARTENTRY {
-    char device_path[256];   // e.g. "/dev/sda1"
-    unsigned long long start_sector;
-    unsigned long long sector_count;
-    int partition_type;      // Partition type ID or code (e.g. Linux = 0x83)
-    bool is_partitioned;
-    bool logical_partition;
-    int partition_number;
-    int partition_index;
-    bool boot_indicator;
-    bool new_partition;
-    bool dirty;
-    struct _DISKENTRY *disk_entry;
-    struct _PARTENTRY *next;
-} PARTENTRY;
-
-typedef struct _DISKENTRY {
-    char device_path[256];  // e.g. "/dev/sda"
-    unsigned long long bytes_per_sector;
-    unsigned int sector_alignment;
-    bool dirty;
-    PARTENTRY *primary_partitions;
-    PARTENTRY *logical_partitions;
-    int partition_count;
-} DISKENTRY;
-
-
-// -- Dismount volume by unmounting the device
-int DismountVolume(PARTENTRY *part_entry)
-{
-    if (!part_entry || !part_entry->is_partitioned)
-        return 0;  // Success, nothing to do
-
-    // Assuming device_path points to e.g. "/dev/sda1"
-    // We try to umount the mountpoint if it is mounted
-
-    // Get mountpoint by reading /proc/mounts or /etc/mtab (simplified)
-    FILE *mounts = fopen("/proc/mounts", "r");
-    if (!mounts) {
-        perror("Failed to open /proc/mounts");
-        return -1;
+#include <sys/sysmacros.h>
+
+/* Longest EBR chain we follow or write */
+#define MAX_LOGICAL_PARTITIONS 128
+
+/* FUNCTIONS ******************************************************************/
+
+ULONGLONG
+AlignDown(
+    ULONGLONG Value,
+    ULONG Alignment)
+{
+    ULONGLONG Temp;
+
+    if (Alignment == 0)
+        return Value;
+
+    Temp = Value / Alignment;
+
+    return Temp * Alignment;
+}
+
+
+/*
+ * Builds the /dev node of a partition: "/dev/sda" + 1 gives "/dev/sda1",
+ * "/dev/nvme0n1" + 1 gives "/dev/nvme0n1p1".
+ */
+void
+GetPartitionDeviceName(
+    PPARTENTRY PartEntry,
+    char *Buffer,
+    size_t Size)
+{
+    const char *DiskName = PartEntry->DiskEntry->DeviceName;
+    size_t Length = strlen(DiskName);
+
+    snprintf(Buffer, Size, "%s%s%lu",
+             DiskName,
+             (Length > 0 && isdigit((unsigned char)DiskName[Length - 1])) ? "p" : "",
+             (unsigned long)PartEntry->PartitionNumber);
+}
+
+
+/*
+ * Splits a /proc/self/mountinfo line into the mounted device and its mount
+ * point. The kernel writes blanks and backslashes in the path as octal
+ * escapes (\040 for a space); these are undone. Fails on malformed lines and
+ * on mount points that do not fit in Size bytes.
+ */
+BOOL
+ParseMountInfoLine(
+    const char *Line,
+    dev_t *Device,
+    char *MountPoint,
+    size_t Size)
+{
+    unsigned int Major, Minor;
+    const char *Field;
+    size_t Length = 0;
+    int Offset = 0;
+
+    /* mount-id parent-id major:minor root mount-point ... */
+    if (sscanf(Line, "%*u %*u %u:%u %*s %n", &Major, &Minor, &Offset) != 2 || Offset == 0)
+        return FALSE;
+
+    for (Field = Line + Offset; *Field != '\0' && *Field != ' ' && *Field != '\n'; Field++)
+    {
+        if (Length + 1 >= Size)
+            return FALSE;
+
+        if (Field[0] == '\\' &&
+            Field[1] >= '0' && Field[1] <= '3' &&
+            Field[2] >= '0' && Field[2] <= '7' &&
+            Field[3] >= '0' && Field[3] <= '7')
+        {
+            MountPoint[Length++] = (char)(((Field[1] - '0') << 6) | ((Field[2] - '0') << 3) | (Field[3] - '0'));
+            Field += 3;
+        }
+        else
+        {
+            MountPoint[Length++] = *Field;
+        }
     }
 
-    char line[1024];
-    char device[256];
-    char mountpoint[256];
-    int found = 0;
+    if (Length == 0)
+        return FALSE;
 
-    while (fgets(line, sizeof(line), mounts)) {
-        if (sscanf(line, "%255s %255s", device, mountpoint) == 2) {
-            if (strcmp(device, part_entry->device_path) == 0) {
-                found = 1;
-                break;
-            }
+    MountPoint[Length] = '\0';
+    *Device = makedev(Major, Minor);
+
+    return TRUE;
+}
+
+
+/*
+ * Looks up where the partition is mounted by comparing device numbers with
+ * /proc/self/mountinfo, so that /dev/disk/by-* and mapper aliases match too.
+ */
+BOOL
+GetPartitionMountPoint(
+    PPARTENTRY PartEntry,
+    char *MountPoint,
+    size_t Size)
+{
+    char DeviceName[MAX_PATH];
+    char Path[PATH_MAX];
+    char *Line = NULL;
+    size_t LineSize = 0;
+    dev_t Device;
+    struct stat StatBuffer;
+    BOOL Found = FALSE;
+    FILE *MountInfo;
+
+    GetPartitionDeviceName(PartEntry, DeviceName, sizeof(DeviceName));
+    if (stat(DeviceName, &StatBuffer) < 0 || !S_ISBLK(StatBuffer.st_mode))
+        return FALSE;
+
+    MountInfo = fopen("/proc/self/mountinfo", "r");
+    if (MountInfo == NULL)
+        return FALSE;
+
+    while (getline(&Line, &LineSize, MountInfo) > 0)
+    {
+        if (!ParseMountInfoLine(Line, &Device, Path, sizeof(Path)))
+            continue;
+
+        if (Device == StatBuffer.st_rdev)
+        {
+            /* Still mounted if the caller's buffer is too small, just not openable */
+            if ((size_t)snprintf(MountPoint, Size, "%s", Path) >= Size)
+                MountPoint[0] = '\0';
+            Found = TRUE;
+            break;
         }
     }
-    fclose(mounts);
 
-    if (!found) {
-        // Not mounted, nothing to do
+    free(Line);
+    fclose(MountInfo);
+
+    return Found;
+}
+
+
+/*
+ * Opens the node of the partition exclusively. The kernel refuses that
+ * while anything holds the partition: a mount, active swap, an md array or
+ * a device-mapper target such as LVM or dm-crypt. The descriptor keeps them
+ * out until it is closed; it is -1 for a partition the kernel does not know
+ * yet, which nothing can be using either. Fails with errno EBUSY if the
+ * partition is in use.
+ */
+BOOL
+ClaimPartition(
+    PPARTENTRY PartEntry,
+    int *Fd)
+{
+    char DeviceName[MAX_PATH];
+
+    GetPartitionDeviceName(PartEntry, DeviceName, sizeof(DeviceName));
+
+    *Fd = open(DeviceName, O_RDONLY | O_EXCL | O_CLOEXEC);
+    if (*Fd >= 0 || errno == ENOENT || errno == ENXIO)
+        return TRUE;
+
+    return FALSE;
+}
+
+
+NTSTATUS
+DismountVolume(
+    PPARTENTRY PartEntry)
+{
+    char MountPoint[MAX_PATH];
+
+    if (PartEntry == NULL || !PartEntry->IsPartitioned)
+        return 0;
+
+    if (!GetPartitionMountPoint(PartEntry, MountPoint, sizeof(MountPoint)))
         return 0;
-    }
 
-    // Attempt to unmount
-    if (umount(mountpoint) != 0) {
+    if (umount(MountPoint) != 0)
+    {
         perror("Failed to unmount volume");
         return -1;
     }
@@ -85,158 +204,2020 @@ int DismountVolume(PARTENTRY *part_entry)
     return 0;
 }
 
+
+static
+void
+PrintPartitionList(
+    const char *Kind,
+    ListEntry *ListHead)
+{
+    ListEntry *Entry;
+    PPARTENTRY PartEntry;
+
+    for (Entry = ListHead->Flink; Entry != ListHead; Entry = Entry->Flink)
+    {
+        PartEntry = CONTAINING_RECORD(Entry, PARTENTRY, ListEntry);
+        if (!PartEntry->IsPartitioned)
+            continue;
+
+        printf(" %s %lu: start %llu sectors, count %llu sectors, type 0x%x\n",
+               Kind,
+               (unsigned long)PartEntry->PartitionNumber,
+               (unsigned long long)PartEntry->StartSector,
+               (unsigned long long)PartEntry->SectorCount,
+               PartEntry->PartitionType);
+    }
+}
+
+
 // -- Update disk layout (simplified for Linux)
 // Linux partition tables are manipulated with tools like parted/libparted;
 // here we just update our data structures
-void UpdateDiskLayout(DISKENTRY *disk_entry)
+void
+UpdateDiskLayout(
+    PDISKENTRY DiskEntry)
 {
-    if (!disk_entry)
+    if (DiskEntry == NULL)
         return;
 
-    // Example logic: mark disk dirty if layout changed
-    disk_entry->dirty = true;
+    DiskEntry->Dirty = TRUE;
+
+    printf("Primary partitions for disk %s:\n", DiskEntry->DeviceName);
+    PrintPartitionList("Partition", &DiskEntry->PrimaryPartListHead);
 
-    // Normally, you would call libparted or write partition table with ioctl
-    // For example, you might use ioctl(fd, BLKPG_ADD_PARTITION, ...) or similar,
-    // but it's complex; you usually use parted tools or write MBR/GPT sectors manually.
+    printf("Logical partitions for disk %s:\n", DiskEntry->DeviceName);
+    PrintPartitionList("Logical", &DiskEntry->LogicalPartListHead);
+}
 
-    // For demonstration, we'll just print the partitions
-    PARTENTRY *part = disk_entry->primary_partitions;
-    int index = 0;
 
-    printf("Primary partitions for disk %s:\n", disk_entry->device_path);
-    while (part) {
-        printf(" Partition %d: start %llu sectors, count %llu sectors, type 0x%x\n",
-               index + 1, part->start_sector, part->sector_count, part->partition_type);
-        part = part->next;
-        index++;
-    }
+/*
+ * Fills a table entry, with LBA markers in place of the CHS addresses that
+ * mean nothing on any disk we handle.
+ */
+void
+FillMbrPartitionEntry(
+    PMBR_PARTITION_ENTRY Entry,
+    UCHAR Type,
+    ULONGLONG Start,
+    ULONGLONG Count,
+    BOOL Boot)
+{
+    Entry->BootIndicator = Boot ? 0x80 : 0x00;
+    Entry->StartChs[0] = 0xFE;
+    Entry->StartChs[1] = 0xFF;
+    Entry->StartChs[2] = 0xFF;
+    Entry->PartitionType = Type;
+    Entry->EndChs[0] = 0xFE;
+    Entry->EndChs[1] = 0xFF;
+    Entry->EndChs[2] = 0xFF;
+    MbrEntrySetStartingLba(Entry, (ULONG)Start);
+    MbrEntrySetSectorCount(Entry, (ULONG)Count);
+}
 
-    // Same for logical partitions
-    part = disk_entry->logical_partitions;
-    index = 0;
-    printf("Logical partitions for disk %s:\n", disk_entry->device_path);
-    while (part) {
-        printf(" Logical %d: start %llu sectors, count %llu sectors, type 0x%x\n",
-               index + 1, part->start_sector, part->sector_count, part->partition_type);
-        part = part->next;
-        index++;
+
+/*
+ * Gives every partition of the list a slot in the partition table. Existing
+ * partitions keep theirs, so that their device names do not change; new
+ * ones take the first free slot.
+ */
+static
+BOOL
+AssignTableSlots(
+    ListEntry *ListHead,
+    PPARTENTRY *Slots,
+    ULONG SlotCount)
+{
+    ListEntry *Entry;
+    PPARTENTRY PartEntry;
+    ULONG i;
+    int Pass;
+
+    memset(Slots, 0, SlotCount * sizeof(*Slots));
+
+    for (Pass = 0; Pass < 2; Pass++)
+    {
+        for (Entry = ListHead->Flink; Entry != ListHead; Entry = Entry->Flink)
+        {
+            PartEntry = CONTAINING_RECORD(Entry, PARTENTRY, ListEntry);
+            if (!PartEntry->IsPartitioned)
+                continue;
+
+            if (Pass == 0)
+            {
+                if (!PartEntry->New && PartEntry->PartitionIndex < SlotCount &&
+                    Slots[PartEntry->PartitionIndex] == NULL)
+                {
+                    Slots[PartEntry->PartitionIndex] = PartEntry;
+                }
+                continue;
+            }
+
+            if (PartEntry->PartitionIndex < SlotCount && Slots[PartEntry->PartitionIndex] == PartEntry)
+                continue;
+
+            for (i = 0; i < SlotCount && Slots[i] != NULL; i++)
+                ;
+            if (i == SlotCount)
+            {
+                printf("The partition table has no free entry left.\n");
+                return FALSE;
+            }
+            Slots[i] = PartEntry;
+        }
     }
 
-    // Reset dirty after update simulation
-    disk_entry->dirty = false;
+    return TRUE;
 }
 
-// -- Write partitions to disk (simulate with printing)
-int WritePartitions(DISKENTRY *disk_entry)
+
+/*
+ * Writes the MBR of the disk: Slots holds the partitions of its four table
+ * entries and, when one of them is an extended partition, Logical the drives
+ * of its EBR chain in sector order. The boot code and disk signature of
+ * LBA 0 are kept. On success the partitions are numbered after the table.
+ */
+BOOL
+WriteMbrTable(
+    PDISKENTRY DiskEntry,
+    int fd,
+    PPARTENTRY *Slots,
+    PPARTENTRY *Logical,
+    ULONG LogicalCount)
 {
-    if (!disk_entry)
-        return -1;
+    PPARTENTRY ExtendedEntry = NULL;
+    ULONG BytesPerSector = DiskEntry->BytesPerSector;
+    ULONGLONG ExtStart = 0, Ebr, NextEbr, PrevEnd = 0;
+    UCHAR *Sector = NULL, *EbrSector = NULL;
+    PMASTER_BOOT_RECORD Mbr, EbrRecord;
+    GUID Random;
+    ULONG i;
+    BOOL Success = FALSE;
 
-    if (!disk_entry->dirty) {
-        printf("Disk layout not dirty, nothing to write.\n");
-        return 0;
+    for (i = 0; i < MBR_PARTITION_COUNT; i++)
+    {
+        if (Slots[i] == NULL)
+            continue;
+
+        if (Slots[i]->StartSector + Slots[i]->SectorCount > MBR_MAX_LBA)
+        {
+            printf("Partition %lu ends beyond the 2^32 sector limit of MBR.\n", (unsigned long)i + 1);
+            return FALSE;
+        }
+
+        if (IsContainerPartition(Slots[i]->PartitionType))
+            ExtendedEntry = Slots[i];
     }
 
-    // WARNING: Real writing requires raw disk access and proper partition table building.
-    // On Linux, use libparted or manually write MBR/GPT sectors.
+    for (i = 0; i < LogicalCount; i++)
+    {
+        if (Logical[i]->StartSector + Logical[i]->SectorCount > MBR_MAX_LBA)
+        {
+            printf("Partition %lu ends beyond the 2^32 sector limit of MBR.\n", (unsigned long)i + 5);
+            return FALSE;
+        }
+    }
 
-    printf("Writing partitions to disk %s (simulated)...\n", disk_entry->device_path);
+    if (LogicalCount > 0 && ExtendedEntry == NULL)
+    {
+        printf("Logical drives need an extended partition.\n");
+        return FALSE;
+    }
 
-    PARTENTRY *part = disk_entry->primary_partitions;
-    while (part) {
-        if (part->is_partitioned) {
-            printf(" Writing partition %d at start %llu sectors, size %llu sectors, type 0x%x\n",
-                   part->partition_number, part->start_sector, part->sector_count, part->partition_type);
+    /* The first EBR sits at the start of the extended partition, the others right in front of their drive */
+    if (ExtendedEntry != NULL)
+    {
+        ExtStart = PrevEnd = ExtendedEntry->StartSector;
+        for (i = 0; i < LogicalCount; i++)
+        {
+            Ebr = (i == 0) ? ExtStart : Logical[i]->StartSector - 1;
+            if (Ebr >= Logical[i]->StartSector || (i > 0 && Ebr <= PrevEnd))
+            {
+                printf("There is no free sector for the EBR in front of the logical drive at sector %llu.\n",
+                       (unsigned long long)Logical[i]->StartSector);
+                return FALSE;
+            }
+            PrevEnd = Logical[i]->StartSector + Logical[i]->SectorCount - 1;
         }
-        part = part->next;
     }
 
-    part = disk_entry->logical_partitions;
-    while (part) {
-        if (part->is_partitioned) {
-            printf(" Writing logical partition %d at start %llu sectors, size %llu sectors, type 0x%x\n",
-                   part->partition_number, part->start_sector, part->sector_count, part->partition_type);
+    Sector = calloc(1, BytesPerSector);
+    EbrSector = calloc(1, BytesPerSector);
+    if (Sector == NULL || EbrSector == NULL)
+    {
+        printf("Out of memory.\n");
+        goto done;
+    }
+
+    /* Keep the boot code and disk signature, replace the table */
+    if (!ReadDiskSectors(fd, DiskEntry, 0, 1, Sector))
+        goto done;
+
+    Mbr = (PMASTER_BOOT_RECORD)Sector;
+    if (MbrGetMasterBootRecordMagic(Mbr) != MBR_SIGNATURE)
+        memset(Sector, 0, BytesPerSector);
+    memset(Mbr->PartitionTable, 0, sizeof(Mbr->PartitionTable));
+    MbrSetMasterBootRecordMagic(Mbr, MBR_SIGNATURE);
+    if (MbrGetSignature(Mbr) == 0)
+    {
+        GptCreateGuid(&Random);
+        MbrSetSignature(Mbr, Random.Data1);
+    }
+
+    for (i = 0; i < MBR_PARTITION_COUNT; i++)
+    {
+        if (Slots[i] == NULL)
+            continue;
+
+        FillMbrPartitionEntry(&Mbr->PartitionTable[i], Slots[i]->PartitionType,
+                              Slots[i]->StartSector, Slots[i]->SectorCount,
+                              Slots[i]->BootIndicator);
+    }
+
+    /* An extended partition without logical drives still gets an empty EBR */
+    for (i = 0; ExtendedEntry != NULL && (i == 0 || i < LogicalCount); i++)
+    {
+        EbrRecord = (PMASTER_BOOT_RECORD)EbrSector;
+        memset(EbrSector, 0, BytesPerSector);
+        Ebr = (i == 0) ? ExtStart : Logical[i]->StartSector - 1;
+
+        if (i < LogicalCount)
+        {
+            FillMbrPartitionEntry(&EbrRecord->PartitionTable[0], Logical[i]->PartitionType,
+                                  Logical[i]->StartSector - Ebr, Logical[i]->SectorCount, FALSE);
+        }
+
+        if (i + 1 < LogicalCount)
+        {
+            NextEbr = Logical[i + 1]->StartSector - 1;
+            FillMbrPartitionEntry(&EbrRecord->PartitionTable[1], PARTITION_EXTENDED,
+                                  NextEbr - ExtStart,
+                                  Logical[i + 1]->StartSector + Logical[i + 1]->SectorCount - NextEbr,
+                                  FALSE);
         }
-        part = part->next;
+
+        MbrSetMasterBootRecordMagic(EbrRecord, MBR_SIGNATURE);
+
+        if (!WriteDiskSectors(fd, DiskEntry, Ebr, 1, EbrSector))
+            goto done;
+    }
+
+    /* The EBRs first: the old MBR does not point at the new chain until it is rewritten */
+    if (fsync(fd) < 0 ||
+        !WriteDiskSectors(fd, DiskEntry, 0, 1, Sector) ||
+        fsync(fd) < 0)
+    {
+        printf("Failed to write the MBR.\n");
+        goto done;
     }
 
-    // Mark disk as clean after "writing"
-    disk_entry->dirty = false;
+    for (i = 0; i < MBR_PARTITION_COUNT; i++)
+    {
+        if (Slots[i] == NULL)
+            continue;
 
-    return 0;
+        Slots[i]->PartitionIndex = i;
+        Slots[i]->PartitionNumber = i + 1;
+        Slots[i]->OnDiskPartitionNumber = i + 1;
+        Slots[i]->New = FALSE;
+    }
+
+    for (i = 0; i < LogicalCount; i++)
+    {
+        Logical[i]->PartitionIndex = i * 4;
+        Logical[i]->PartitionNumber = 5 + i;
+        Logical[i]->OnDiskPartitionNumber = 5 + i;
+        Logical[i]->New = FALSE;
+    }
+
+    Success = TRUE;
+
+done:
+    free(EbrSector);
+    free(Sector);
+
+    return Success;
 }
 
 
-// Helper: get previous unpartitioned partition entry in a linked list
-PARTENTRY *GetPrevUnpartitionedEntry(PARTENTRY *part_entry)
+static
+BOOL
+WriteMbrPartitions(
+    PDISKENTRY DiskEntry)
 {
-    if (!part_entry || !part_entry->disk_entry)
-        return NULL;
+    PPARTENTRY Slots[MBR_PARTITION_COUNT];
+    PPARTENTRY Logical[MAX_LOGICAL_PARTITIONS];
+    ListEntry *Entry;
+    PPARTENTRY PartEntry;
+    ULONG LogicalCount = 0;
+    int fd;
+    BOOL Success;
+
+    if (!AssignTableSlots(&DiskEntry->PrimaryPartListHead, Slots, ARRAYSIZE(Slots)))
+        return FALSE;
 
-    PARTENTRY *current = NULL;
-    PARTENTRY *prev = NULL;
-    PARTENTRY *head = part_entry->logical_partition ? part_entry->disk_entry->logical_partitions
-                                                   : part_entry->disk_entry->primary_partitions;
+    for (Entry = DiskEntry->LogicalPartListHead.Flink;
+         Entry != &DiskEntry->LogicalPartListHead;
+         Entry = Entry->Flink)
+    {
+        PartEntry = CONTAINING_RECORD(Entry, PARTENTRY, ListEntry);
+        if (!PartEntry->IsPartitioned)
+            continue;
 
-    current = head;
-    while (current && current != part_entry) {
-        if (!current->is_partitioned)
-            prev = current;
-        current = current->next;
+        if (LogicalCount == ARRAYSIZE(Logical))
+        {
+            printf("The disk has more than %d logical drives.\n", MAX_LOGICAL_PARTITIONS);
+            return FALSE;
+        }
+        Logical[LogicalCount++] = PartEntry;
     }
 
-    return prev;
+    fd = OpenDiskDevice(DiskEntry, O_RDWR);
+    if (fd < 0)
+        return FALSE;
+
+    Success = WriteMbrTable(DiskEntry, fd, Slots, Logical, LogicalCount);
+
+    close(fd);
+
+    return Success;
 }
 
-// Helper: get next unpartitioned partition entry in a linked list
-PARTENTRY *GetNextUnpartitionedEntry(PARTENTRY *part_entry)
+
+static
+void
+FillGptHeaderCrc(
+    PEFI_PARTITION_HEADER Header)
 {
-    if (!part_entry)
-        return NULL;
+    GptHeaderSetHeaderCRC32(Header, 0);
+    GptHeaderSetHeaderCRC32(Header, GptCrc32(Header, EFI_PT_HEADER_SIZE));
+}
+
 
-    PARTENTRY *current = part_entry->next;
+/*
+ * Writes the GPT of the disk, with Slots holding the partitions of its
+ * EFI_PT_ENTRY_COUNT entries, and the protective MBR in front of it. Types
+ * and GUIDs the partitions lack are filled in. On a GPT disk the entries of
+ * partitions that keep their slot keep their name and attributes. On
+ * success the partitions are numbered after their entries.
+ */
+BOOL
+WriteGptTable(
+    PDISKENTRY DiskEntry,
+    int fd,
+    PPARTENTRY *Slots)
+{
+    ULONG BytesPerSector = DiskEntry->BytesPerSector;
+    ULONG EntrySectors;
+    ULONGLONG LastLba, FirstUsable, LastUsable, Attributes;
+    UCHAR *Primary = NULL, *Backup = NULL;
+    PMASTER_BOOT_RECORD Mbr;
+    PEFI_PARTITION_HEADER Header;
+    PEFI_PARTITION_ENTRY Entries;
+    BOOL KeepEntries;
+    ULONG i;
+    BOOL Success = FALSE;
 
-    while (current) {
-        if (!current->is_partitioned)
-            return current;
-        current = current->next;
+    EntrySectors = (EFI_PT_ENTRY_COUNT * EFI_PT_ENTRY_SIZE + BytesPerSector - 1) / BytesPerSector;
+    if (DiskEntry->SectorCount < 2 * (ULONGLONG)EntrySectors + 4)
+    {
+        printf("The disk is too small for a GPT.\n");
+        return FALSE;
     }
 
-    return NULL;
+    LastLba = DiskEntry->SectorCount - 1;
+    FirstUsable = 2 + EntrySectors;
+    LastUsable = LastLba - EntrySectors - 1;
+
+    for (i = 0; i < EFI_PT_ENTRY_COUNT; i++)
+    {
+        if (Slots[i] != NULL &&
+            (Slots[i]->StartSector < FirstUsable ||
+             Slots[i]->StartSector + Slots[i]->SectorCount - 1 > LastUsable))
+        {
+            printf("The partition at sectors %llu-%llu does not fit between the GPT tables (%llu-%llu).\n",
+                   (unsigned long long)Slots[i]->StartSector,
+                   (unsigned long long)(Slots[i]->StartSector + Slots[i]->SectorCount - 1),
+                   (unsigned long long)FirstUsable,
+                   (unsigned long long)LastUsable);
+            return FALSE;
+        }
+    }
+
+    /* LBA 0 .. FirstUsable-1 and LastUsable+1 .. LastLba are each one write */
+    Primary = calloc(FirstUsable, BytesPerSector);
+    Backup = calloc(EntrySectors + 1, BytesPerSector);
+    if (Primary == NULL || Backup == NULL)
+    {
+        printf("Out of memory.\n");
+        goto done;
+    }
+
+    if (!ReadDiskSectors(fd, DiskEntry, 0, (ULONG)FirstUsable, Primary))
+        goto done;
+
+    /* Entries of existing partitions keep their name and attributes if the old array is where we put ours */
+    Header = (PEFI_PARTITION_HEADER)(Primary + BytesPerSector);
+    KeepEntries = DiskEntry->PartitionStyle == PARTITION_STYLE_GPT &&
+                  GptHeaderGetSignature(Header) == EFI_PT_SIGNATURE &&
+                  GptHeaderGetPartitionEntryLBA(Header) == 2 &&
+                  GptHeaderGetNumberOfEntries(Header) == EFI_PT_ENTRY_COUNT &&
+                  GptHeaderGetSizeOfPartitionEntry(Header) == EFI_PT_ENTRY_SIZE;
+
+    Entries = (PEFI_PARTITION_ENTRY)(Primary + 2 * BytesPerSector);
+    for (i = 0; i < EFI_PT_ENTRY_COUNT; i++)
+    {
+        if (Slots[i] == NULL || Slots[i]->New || !KeepEntries || Slots[i]->PartitionIndex != i)
+            memset(&Entries[i], 0, sizeof(Entries[i]));
+        if (Slots[i] == NULL)
+            continue;
+
+        if (GptIsNullGuid(&Slots[i]->PartitionTypeGuid))
+            GptTypeFromMbrType(Slots[i]->PartitionType, &Slots[i]->PartitionTypeGuid);
+        if (GptIsNullGuid(&Slots[i]->PartitionGuid))
+            GptCreateGuid(&Slots[i]->PartitionGuid);
+
+        GptEntrySetPartitionType(&Entries[i], &Slots[i]->PartitionTypeGuid);
+        GptEntrySetUniquePartition(&Entries[i], &Slots[i]->PartitionGuid);
+        GptEntrySetStartingLBA(&Entries[i], Slots[i]->StartSector);
+        GptEntrySetEndingLBA(&Entries[i], Slots[i]->StartSector + Slots[i]->SectorCount - 1);
+
+        Attributes = GptEntryGetAttributes(&Entries[i]) & ~GPT_ATTRIBUTE_LEGACY_BIOS_BOOTABLE;
+        if (Slots[i]->BootIndicator)
+            Attributes |= GPT_ATTRIBUTE_LEGACY_BIOS_BOOTABLE;
+        GptEntrySetAttributes(&Entries[i], Attributes);
+    }
+
+    /* Protective MBR: one entry covering the disk, boot code and signature kept */
+    Mbr = (PMASTER_BOOT_RECORD)Primary;
+    memset(Mbr->PartitionTable, 0, sizeof(Mbr->PartitionTable));
+    Mbr->PartitionTable[0].StartChs[1] = 0x02;
+    Mbr->PartitionTable[0].PartitionType = PARTITION_GPT;
+    memset(Mbr->PartitionTable[0].EndChs, 0xFF, 3);
+    MbrEntrySetStartingLba(&Mbr->PartitionTable[0], 1);
+    MbrEntrySetSectorCount(&Mbr->PartitionTable[0],
+                           (LastLba > MBR_MAX_LBA) ? (ULONG)MBR_MAX_LBA : (ULONG)LastLba);
+    MbrSetMasterBootRecordMagic(Mbr, MBR_SIGNATURE);
+
+    if (GptIsNullGuid(&DiskEntry->DiskGuid))
+        GptCreateGuid(&DiskEntry->DiskGuid);
+
+    memset(Header, 0, BytesPerSector);
+    GptHeaderSetSignature(Header, EFI_PT_SIGNATURE);
+    GptHeaderSetRevision(Header, EFI_PT_REVISION);
+    GptHeaderSetHeaderSize(Header, EFI_PT_HEADER_SIZE);
+    GptHeaderSetMyLBA(Header, 1);
+    GptHeaderSetAlternateLBA(Header, LastLba);
+    GptHeaderSetFirstUsableLBA(Header, FirstUsable);
+    GptHeaderSetLastUsableLBA(Header, LastUsable);
+    GptHeaderSetDiskGUID(Header, &DiskEntry->DiskGuid);
+    GptHeaderSetPartitionEntryLBA(Header, 2);
+    GptHeaderSetNumberOfEntries(Header, EFI_PT_ENTRY_COUNT);
+    GptHeaderSetSizeOfPartitionEntry(Header, EFI_PT_ENTRY_SIZE);
+    GptHeaderSetPartitionEntryCRC32(Header, GptCrc32(Entries, EFI_PT_ENTRY_COUNT * EFI_PT_ENTRY_SIZE));
+    FillGptHeaderCrc(Header);
+
+    /* The backup is the same entry array followed by a mirrored header */
+    memcpy(Backup, Entries, (size_t)EntrySectors * BytesPerSector);
+    Header = (PEFI_PARTITION_HEADER)(Backup + (size_t)EntrySectors * BytesPerSector);
+    memcpy(Header, Primary + BytesPerSector, EFI_PT_HEADER_SIZE);
+    GptHeaderSetMyLBA(Header, LastLba);
+    GptHeaderSetAlternateLBA(Header, 1);
+    GptHeaderSetPartitionEntryLBA(Header, LastUsable + 1);
+    FillGptHeaderCrc(Header);
+
+    /*
+     * Backup first, so that an interrupted write leaves one valid copy; on an
+     * MBR disk the old label stays in force until LBA 0 is rewritten.
+     */
+    if (!WriteDiskSectors(fd, DiskEntry, LastUsable + 1, EntrySectors + 1, Backup) ||
+        fsync(fd) < 0 ||
+        !WriteDiskSectors(fd, DiskEntry, 0, (ULONG)FirstUsable, Primary) ||
+        fsync(fd) < 0)
+    {
+        printf("Failed to write the GPT.\n");
+        goto done;
+    }
+
+    for (i = 0; i < EFI_PT_ENTRY_COUNT; i++)
+    {
+        if (Slots[i] == NULL)
+            continue;
+
+        Slots[i]->PartitionIndex = i;
+        Slots[i]->PartitionNumber = i + 1;
+        Slots[i]->OnDiskPartitionNumber = i + 1;
+        Slots[i]->New = FALSE;
+    }
+
+    Success = TRUE;
+
+done:
+    free(Backup);
+    free(Primary);
+
+    return Success;
+}
+
+
+static
+BOOL
+WriteGptPartitions(
+    PDISKENTRY DiskEntry)
+{
+    PPARTENTRY Slots[EFI_PT_ENTRY_COUNT];
+    int fd;
+    BOOL Success;
+
+    if (!AssignTableSlots(&DiskEntry->PrimaryPartListHead, Slots, ARRAYSIZE(Slots)))
+        return FALSE;
+
+    fd = OpenDiskDevice(DiskEntry, O_RDWR);
+    if (fd < 0)
+        return FALSE;
+
+    Success = WriteGptTable(DiskEntry, fd, Slots);
+
+    close(fd);
+
+    return Success;
+}
+
+
+static
+void
+ChainChecksum(
+    ULONG *Checksum,
+    const void *Data,
+    size_t Length)
+{
+    ULONG Pair[2];
+
+    Pair[0] = *Checksum;
+    Pair[1] = GptCrc32(Data, Length);
+    *Checksum = GptCrc32(Pair, sizeof(Pair));
 }
 
-// Remove volume entry from a linked list and free
-typedef struct _VOLENTRY {
-    char device_path[256];
-    char label[256];
-    char fs_type[256];
-    unsigned long long size_bytes;
-    struct _VOLENTRY *next;
-} VOLENTRY;
 
-VOLENTRY *VolumeListHead = NULL;
-VOLENTRY *CurrentVolume = NULL;
+/*
+ * Checksum of the partition table on the disk: the partition entries of
+ * the MBR and of the EBR chain, or the primary GPT header, whose CRC covers
+ * the entry array. The boot code and the disk signature are left out.
+ */
+static
+BOOL
+ReadTableChecksum(
+    int fd,
+    PDISKENTRY DiskEntry,
+    ULONG *Checksum)
+{
+    PMASTER_BOOT_RECORD Record;
+    PMBR_PARTITION_ENTRY Link;
+    ULONGLONG ExtStart = 0, ExtEnd = 0, Ebr;
+    UCHAR *Sector;
+    ULONG Count;
+    BOOL Success = FALSE;
+    int i;
+
+    Sector = malloc(DiskEntry->BytesPerSector);
+    if (Sector == NULL)
+        return FALSE;
+
+    *Checksum = 0;
+    Record = (PMASTER_BOOT_RECORD)Sector;
+
+    if (!ReadDiskSectors(fd, DiskEntry, 0, 1, Sector))
+        goto done;
 
-void RemoveVolume(VOLENTRY *volume)
+    if (MbrGetMasterBootRecordMagic(Record) != MBR_SIGNATURE)
+    {
+        ChainChecksum(Checksum, Sector, DiskEntry->BytesPerSector);
+        Success = TRUE;
+        goto done;
+    }
+
+    ChainChecksum(Checksum, Record->PartitionTable, sizeof(Record->PartitionTable));
+
+    if (Record->PartitionTable[0].PartitionType == PARTITION_GPT)
+    {
+        Success = ReadDiskSectors(fd, DiskEntry, 1, 1, Sector);
+        if (Success)
+            ChainChecksum(Checksum, Sector, DiskEntry->BytesPerSector);
+        goto done;
+    }
+
+    for (i = 0; i < 4; i++)
+    {
+        if (IsContainerPartition(Record->PartitionTable[i].PartitionType))
+        {
+            ExtStart = MbrEntryGetStartingLba(&Record->PartitionTable[i]);
+            ExtEnd = ExtStart + MbrEntryGetSectorCount(&Record->PartitionTable[i]);
+            break;
+        }
+    }
+
+    /* The same walk as ReadLogicalPartitions */
+    for (Ebr = ExtStart, Count = 0; ExtEnd > ExtStart && Count < MAX_LOGICAL_PARTITIONS &&
+         Ebr >= ExtStart && Ebr < ExtEnd; Count++)
+    {
+        if (!ReadDiskSectors(fd, DiskEntry, Ebr, 1, Sector))
+            goto done;
+
+        if (MbrGetMasterBootRecordMagic(Record) != MBR_SIGNATURE)
+            break;
+
+        ChainChecksum(Checksum, Record->PartitionTable, sizeof(Record->PartitionTable));
+
+        Link = &Record->PartitionTable[1];
+        if (!IsContainerPartition(Link->PartitionType) || MbrEntryGetSectorCount(Link) == 0)
+            break;
+
+        Ebr = ExtStart + MbrEntryGetStartingLba(Link);
+    }
+
+    Success = TRUE;
+
+done:
+    free(Sector);
+
+    return Success;
+}
+
+
+/*
+ * Takes note of the partition table now on the disk, after it was written
+ * by this process, so that WritePartitions does not take the change for
+ * another program's.
+ */
+void
+RememberPartitionTable(
+    PDISKENTRY DiskEntry)
 {
-    if (!volume)
+    int fd;
+
+    fd = OpenDiskDevice(DiskEntry, O_RDONLY);
+    if (fd < 0)
         return;
 
-    VOLENTRY **indirect = &VolumeListHead;
-    while (*indirect && *indirect != volume) {
-        indirect = &(*indirect)->next;
+    if (!ReadTableChecksum(fd, DiskEntry, &DiskEntry->TableChecksum))
+        DiskEntry->TableChecksum = 0;
+
+    close(fd);
+}
+
+
+/*
+ * Writes the partition table of the disk from its partition lists, brings
+ * the kernel's view of the disk in line with it and waits for the device
+ * nodes of the changed partitions.
+ */
+NTSTATUS
+WritePartitions(
+    PDISKENTRY DiskEntry)
+{
+    PARTITION_NODE_WAIT Wait;
+    NTSTATUS Status = 0;
+    ULONG Checksum;
+    BOOL Success, Unchanged;
+    int fd;
+
+    if (DiskEntry == NULL)
+        return -1;
+
+    if (!DiskEntry->Dirty)
+        return 0;
+
+    if (DiskEntry->PartitionStyle == PARTITION_STYLE_RAW)
+    {
+        printf("The disk has no partition table; convert it to MBR or GPT first.\n");
+        return -1;
+    }
+
+    /* Held until the kernel is in sync, so udev does not probe a half-written table */
+    if (!LockDisk(DiskEntry, TRUE))
+        return -1;
+
+    /* The lists were read under a lock long released; another program may have written since */
+    fd = OpenDiskDevice(DiskEntry, O_RDONLY);
+    Unchanged = fd >= 0 && ReadTableChecksum(fd, DiskEntry, &Checksum) &&
+                Checksum == DiskEntry->TableChecksum;
+    if (fd >= 0)
+        close(fd);
+
+    if (!Unchanged)
+    {
+        UnlockDisk(DiskEntry);
+        printf("The partition table of %s was changed by another program; rescan the disk.\n",
+               DiskEntry->DeviceName);
+        return -1;
+    }
+
+    BeginPartitionNodeWait(&Wait);
+
+    if (DiskEntry->PartitionStyle == PARTITION_STYLE_GPT)
+        Success = WriteGptPartitions(DiskEntry);
+    else
+        Success = WriteMbrPartitions(DiskEntry);
+
+    if (Success)
+    {
+        RememberPartitionTable(DiskEntry);
+
+        if (!SyncKernelPartitions(DiskEntry, &Wait))
+        {
+            printf("The kernel partition table could not be updated; rescan the disk.\n");
+            Status = STATUS_KERNEL_NOT_SYNCED;
+        }
+
+        DiskEntry->Dirty = FALSE;
+    }
+
+    UnlockDisk(DiskEntry);
+
+    /* Callers go on to format the new partitions right away */
+    EndPartitionNodeWait(&Wait);
+
+    if (!Success)
+        return -1;
+
+    return Status;
+}
+
+/* Returns the free space entry directly in front of the partition, if any */
+PPARTENTRY
+GetPrevUnpartitionedEntry(
+    PPARTENTRY PartEntry)
+{
+    PDISKENTRY DiskEntry = PartEntry->DiskEntry;
+    ListEntry *ListHead;
+    PPARTENTRY PrevPartEntry;
+
+    ListHead = PartEntry->LogicalPartition ? &DiskEntry->LogicalPartListHead
+                                           : &DiskEntry->PrimaryPartListHead;
+
+    if (PartEntry->ListEntry.Blink != ListHead)
+    {
+        PrevPartEntry = CONTAINING_RECORD(PartEntry->ListEntry.Blink, PARTENTRY, ListEntry);
+        if (!PrevPartEntry->IsPartitioned)
+            return PrevPartEntry;
     }
 
-    if (*indirect == volume) {
-        *indirect = volume->next;
+    return NULL;
+}
+
+
+/* Returns the free space entry directly behind the partition, if any */
+PPARTENTRY
+GetNextUnpartitionedEntry(
+    PPARTENTRY PartEntry)
+{
+    PDISKENTRY DiskEntry = PartEntry->DiskEntry;
+    ListEntry *ListHead;
+    PPARTENTRY NextPartEntry;
+
+    ListHead = PartEntry->LogicalPartition ? &DiskEntry->LogicalPartListHead
+                                           : &DiskEntry->PrimaryPartListHead;
+
+    if (PartEntry->ListEntry.Flink != ListHead)
+    {
+        NextPartEntry = CONTAINING_RECORD(PartEntry->ListEntry.Flink, PARTENTRY, ListEntry);
+        if (!NextPartEntry->IsPartitioned)
+            return NextPartEntry;
     }
 
-    if (CurrentVolume == volume) {
+    return NULL;
+}
+
+
+void
+RemoveVolume(
+    PVOLENTRY VolumeEntry)
+{
+    if (VolumeEntry == NULL)
+        return;
+
+    RemoveEntryList(&VolumeEntry->ListEntry);
+    RemoveVolumeLinks(VolumeEntry);
+
+    if (CurrentVolume == VolumeEntry)
         CurrentVolume = NULL;
+
+    free(VolumeEntry->pszLabel);
+    free(VolumeEntry->pszFilesystem);
+    free(VolumeEntry->pExtents);
+    free(VolumeEntry);
+}
+
+
+static
+PPARTENTRY
+AllocatePartEntry(
+    PDISKENTRY DiskEntry,
+    ULONGLONG StartSector,
+    ULONGLONG SectorCount,
+    BOOL LogicalPartition)
+{
+    PPARTENTRY PartEntry;
+
+    PartEntry = calloc(1, sizeof(PARTENTRY));
+    if (PartEntry == NULL)
+        return NULL;
+
+    PartEntry->DiskEntry = DiskEntry;
+    PartEntry->StartSector = StartSector;
+    PartEntry->SectorCount = SectorCount;
+    PartEntry->LogicalPartition = LogicalPartition;
+    PartEntry->FormatState = Unformatted;
+
+    return PartEntry;
+}
+
+
+/* Inserts an entry into its partition list, which is kept in sector order */
+static
+void
+InsertPartitionEntry(
+    PPARTENTRY PartEntry)
+{
+    PDISKENTRY DiskEntry = PartEntry->DiskEntry;
+    ListEntry *ListHead, *Pos;
+
+    ListHead = PartEntry->LogicalPartition ? &DiskEntry->LogicalPartListHead
+                                           : &DiskEntry->PrimaryPartListHead;
+
+    for (Pos = ListHead->Flink; Pos != ListHead; Pos = Pos->Flink)
+    {
+        if (CONTAINING_RECORD(Pos, PARTENTRY, ListEntry)->StartSector > PartEntry->StartSector)
+            break;
     }
 
-    free(volume);
+    /* In front of Pos */
+    InsertTailList(Pos, &PartEntry->ListEntry);
 }
 
 
+/*
+ * Adds free space entries for the aligned gaps between FirstSector and
+ * LastSector that the partitions of the list leave, and indexes them. Gaps
+ * smaller than the alignment are not worth a partition and are left out.
+ */
+static
+BOOL
+AddFreeSpaceEntries(
+    PDISKENTRY DiskEntry,
+    BOOL LogicalPartition,
+    ULONGLONG FirstSector,
+    ULONGLONG LastSector)
+{
+    ListEntry *ListHead, *Entry;
+    PPARTENTRY PartEntry = NULL, FreeEntry;
+    PFREE_EXTENT_INDEX Index;
+    ULONG Alignment = DiskEntry->SectorAlignment ? DiskEntry->SectorAlignment : 1;
+    ULONGLONG Next = FirstSector, Start, End;
+
+    ListHead = LogicalPartition ? &DiskEntry->LogicalPartListHead
+                                : &DiskEntry->PrimaryPartListHead;
+    Index = LogicalPartition ? &DiskEntry->LogicalFreeExtents
+                             : &DiskEntry->PrimaryFreeExtents;
+
+    for (Entry = ListHead->Flink; ; Entry = Entry->Flink)
+    {
+        if (Entry == ListHead)
+        {
+            End = LastSector + 1;
+        }
+        else
+        {
+            PartEntry = CONTAINING_RECORD(Entry, PARTENTRY, ListEntry);
+            End = (PartEntry->StartSector < LastSector + 1) ? PartEntry->StartSector : LastSector + 1;
+        }
+
+        Start = AlignDown(Next + Alignment - 1, Alignment);
+        if (End > Start && End - Start >= Alignment)
+        {
+            FreeEntry = AllocatePartEntry(DiskEntry, Start, End - Start, LogicalPartition);
+            if (FreeEntry == NULL)
+                return FALSE;
+
+            InsertTailList(Entry, &FreeEntry->ListEntry);
+            if (!InsertFreeExtent(Index, Start, End - Start))
+                return FALSE;
+        }
+
+        if (Entry == ListHead)
+            break;
+
+        if (PartEntry->StartSector + PartEntry->SectorCount > Next)
+            Next = PartEntry->StartSector + PartEntry->SectorCount;
+    }
+
+    return TRUE;
+}
+
+
+static
+void
+FreePartitionEntries(
+    PDISKENTRY DiskEntry)
+{
+    ListEntry *Heads[2] = { &DiskEntry->PrimaryPartListHead, &DiskEntry->LogicalPartListHead };
+    ListEntry *Entry;
+    int i;
+
+    for (i = 0; i < 2; i++)
+    {
+        while (!IsListEmpty(Heads[i]))
+        {
+            Entry = Heads[i]->Flink;
+            RemoveEntryList(Entry);
+            free(CONTAINING_RECORD(Entry, PARTENTRY, ListEntry));
+        }
+    }
+
+    DiskEntry->ExtendedPartition = NULL;
+    DestroyFreeExtentIndex(&DiskEntry->PrimaryFreeExtents);
+    DestroyFreeExtentIndex(&DiskEntry->LogicalFreeExtents);
+}
+
+
+static
+BOOL
+AddTablePartition(
+    PDISKENTRY DiskEntry,
+    const MBR_PARTITION_ENTRY *TableEntry,
+    ULONGLONG BaseSector,
+    BOOL LogicalPartition,
+    ULONG Index,
+    ULONG Number)
+{
+    PPARTENTRY PartEntry;
+
+    PartEntry = AllocatePartEntry(DiskEntry,
+                                  BaseSector + MbrEntryGetStartingLba(TableEntry),
+                                  MbrEntryGetSectorCount(TableEntry),
+                                  LogicalPartition);
+    if (PartEntry == NULL)
+        return FALSE;
+
+    PartEntry->BootIndicator = (TableEntry->BootIndicator & 0x80) != 0;
+    PartEntry->PartitionType = TableEntry->PartitionType;
+    PartEntry->PartitionIndex = Index;
+    PartEntry->PartitionNumber = Number;
+    PartEntry->OnDiskPartitionNumber = Number;
+    PartEntry->IsPartitioned = TRUE;
+
+    InsertPartitionEntry(PartEntry);
+
+    if (!LogicalPartition && IsContainerPartition(PartEntry->PartitionType) &&
+        DiskEntry->ExtendedPartition == NULL)
+    {
+        DiskEntry->ExtendedPartition = PartEntry;
+    }
+
+    return TRUE;
+}
+
+
+/* Follows the EBR chain of the extended partition; Sector is scratch space */
+static
+BOOL
+ReadLogicalPartitions(
+    int fd,
+    PDISKENTRY DiskEntry,
+    UCHAR *Sector)
+{
+    PPARTENTRY ExtendedEntry = DiskEntry->ExtendedPartition;
+    ULONGLONG ExtStart = ExtendedEntry->StartSector;
+    ULONGLONG ExtEnd = ExtStart + ExtendedEntry->SectorCount;
+    ULONGLONG Ebr = ExtStart;
+    PMASTER_BOOT_RECORD EbrRecord = (PMASTER_BOOT_RECORD)Sector;
+    PMBR_PARTITION_ENTRY TableEntry, Link;
+    ULONG Count = 0;
+
+    /* The count also stops chains that loop back on themselves */
+    while (Count < MAX_LOGICAL_PARTITIONS && Ebr >= ExtStart && Ebr < ExtEnd)
+    {
+        if (!ReadDiskSectors(fd, DiskEntry, Ebr, 1, Sector))
+            return FALSE;
+
+        if (MbrGetMasterBootRecordMagic(EbrRecord) != MBR_SIGNATURE)
+            break;
+
+        TableEntry = &EbrRecord->PartitionTable[0];
+        if (TableEntry->PartitionType != PARTITION_ENTRY_UNUSED &&
+            MbrEntryGetSectorCount(TableEntry) != 0)
+        {
+            if (!AddTablePartition(DiskEntry, TableEntry, Ebr, TRUE, Count * 4, 5 + Count))
+                return FALSE;
+            Count++;
+        }
+
+        Link = &EbrRecord->PartitionTable[1];
+        if (!IsContainerPartition(Link->PartitionType) || MbrEntryGetSectorCount(Link) == 0)
+            break;
+
+        Ebr = ExtStart + MbrEntryGetStartingLba(Link);
+    }
+
+    return TRUE;
+}
+
+
+/* Sector holds LBA 0 */
+static
+BOOL
+ReadMbrPartitions(
+    int fd,
+    PDISKENTRY DiskEntry,
+    UCHAR *Sector)
+{
+    PMASTER_BOOT_RECORD Mbr = (PMASTER_BOOT_RECORD)Sector;
+    MBR_PARTITION_ENTRY Table[4];
+    ULONG i;
+
+    /* Sector is reused for the EBRs */
+    memcpy(Table, Mbr->PartitionTable, sizeof(Table));
+
+    for (i = 0; i < 4; i++)
+    {
+        if (Table[i].PartitionType == PARTITION_ENTRY_UNUSED ||
+            MbrEntryGetSectorCount(&Table[i]) == 0)
+            continue;
+
+        if (!AddTablePartition(DiskEntry, &Table[i], 0, FALSE, i, i + 1))
+            return FALSE;
+    }
+
+    if (DiskEntry->ExtendedPartition != NULL)
+        return ReadLogicalPartitions(fd, DiskEntry, Sector);
+
+    return TRUE;
+}
+
+
+/*
+ * Reads the primary GPT. Returns FALSE if it is missing or damaged, in which
+ * case no partitions have been added.
+ */
+static
+BOOL
+ReadGptPartitions(
+    int fd,
+    PDISKENTRY DiskEntry,
+    UCHAR *Sector,
+    ULONGLONG *FirstUsable,
+    ULONGLONG *LastUsable)
+{
+    PEFI_PARTITION_HEADER Header = (PEFI_PARTITION_HEADER)Sector;
+    PEFI_PARTITION_ENTRY Entry;
+    PPARTENTRY PartEntry;
+    ULONG BytesPerSector = DiskEntry->BytesPerSector;
+    ULONG EntryCount, EntrySize, EntrySectors, HeaderCrc, i;
+    ULONGLONG Start, End;
+    UCHAR *Entries;
+    BOOL Success = FALSE;
+
+    if (!ReadDiskSectors(fd, DiskEntry, 1, 1, Sector) ||
+        GptHeaderGetSignature(Header) != EFI_PT_SIGNATURE ||
+        GptHeaderGetHeaderSize(Header) < EFI_PT_HEADER_SIZE ||
+        GptHeaderGetHeaderSize(Header) > BytesPerSector)
+        return FALSE;
+
+    HeaderCrc = GptHeaderGetHeaderCRC32(Header);
+    GptHeaderSetHeaderCRC32(Header, 0);
+    if (GptCrc32(Header, GptHeaderGetHeaderSize(Header)) != HeaderCrc)
+        return FALSE;
+
+    EntryCount = GptHeaderGetNumberOfEntries(Header);
+    EntrySize = GptHeaderGetSizeOfPartitionEntry(Header);
+    if (EntryCount == 0 || EntryCount > 1024 ||
+        EntrySize < EFI_PT_ENTRY_SIZE || EntrySize > 1024 || (EntrySize & (EntrySize - 1)) != 0)
+        return FALSE;
+
+    EntrySectors = (EntryCount * EntrySize + BytesPerSector - 1) / BytesPerSector;
+    Entries = malloc((size_t)EntrySectors * BytesPerSector);
+    if (Entries == NULL)
+        return FALSE;
+
+    if (!ReadDiskSectors(fd, DiskEntry, GptHeaderGetPartitionEntryLBA(Header), EntrySectors, Entries) ||
+        GptCrc32(Entries, EntryCount * EntrySize) != GptHeaderGetPartitionEntryCRC32(Header))
+        goto done;
+
+    GptHeaderGetDiskGUID(Header, &DiskEntry->DiskGuid);
+    *FirstUsable = GptHeaderGetFirstUsableLBA(Header);
+    *LastUsable = GptHeaderGetLastUsableLBA(Header);
+
+    for (i = 0; i < EntryCount; i++)
+    {
+        Entry = (PEFI_PARTITION_ENTRY)(Entries + (size_t)i * EntrySize);
+        if (!GptEntryIsUsed(Entry))
+            continue;
+
+        Start = GptEntryGetStartingLBA(Entry);
+        End = GptEntryGetEndingLBA(Entry);
+        if (End < Start)
+            continue;
+
+        PartEntry = AllocatePartEntry(DiskEntry, Start, End - Start + 1, FALSE);
+        if (PartEntry == NULL)
+            goto done;
+
+        GptEntryGetPartitionType(Entry, &PartEntry->PartitionTypeGuid);
+        GptEntryGetUniquePartition(Entry, &PartEntry->PartitionGuid);
+        PartEntry->PartitionType = MbrTypeFromGptType(&PartEntry->PartitionTypeGuid);
+        PartEntry->BootIndicator = (GptEntryGetAttributes(Entry) & GPT_ATTRIBUTE_LEGACY_BIOS_BOOTABLE) != 0;
+        PartEntry->PartitionIndex = i;
+        PartEntry->PartitionNumber = i + 1;
+        PartEntry->OnDiskPartitionNumber = i + 1;
+        PartEntry->IsPartitioned = TRUE;
+
+        InsertPartitionEntry(PartEntry);
+    }
+
+    Success = TRUE;
+
+done:
+    free(Entries);
+
+    return Success;
+}
+
+
+/*
+ * Fills the partition lists of the disk from its partition table, with free
+ * space entries for the gaps. A disk without a table we can read is raw.
+ */
+static
+BOOL
+ReadPartitionTable(
+    PDISKENTRY DiskEntry)
+{
+    ULONGLONG FirstSector = DiskEntry->SectorAlignment;
+    ULONGLONG LastSector = DiskEntry->SectorCount - 1;
+    ULONGLONG FirstUsable, LastUsable;
+    PMASTER_BOOT_RECORD Mbr;
+    PPARTENTRY ExtendedEntry;
+    UCHAR *Sector;
+    BOOL Success = TRUE;
+    int fd;
+
+    DiskEntry->PartitionStyle = PARTITION_STYLE_RAW;
+
+    Sector = malloc(DiskEntry->BytesPerSector);
+    if (Sector == NULL)
+        return FALSE;
+
+    fd = OpenDiskDevice(DiskEntry, O_RDONLY);
+    if (fd >= 0 && !ReadTableChecksum(fd, DiskEntry, &DiskEntry->TableChecksum))
+        DiskEntry->TableChecksum = 0;
+
+    if (fd >= 0 && ReadDiskSectors(fd, DiskEntry, 0, 1, Sector))
+    {
+        Mbr = (PMASTER_BOOT_RECORD)Sector;
+
+        if (MbrGetMasterBootRecordMagic(Mbr) != MBR_SIGNATURE)
+        {
+            /* Raw */
+        }
+        else if (Mbr->PartitionTable[0].PartitionType == PARTITION_GPT)
+        {
+            if (ReadGptPartitions(fd, DiskEntry, Sector, &FirstUsable, &LastUsable))
+            {
+                DiskEntry->PartitionStyle = PARTITION_STYLE_GPT;
+                if (FirstUsable > FirstSector)
+                    FirstSector = FirstUsable;
+                if (LastUsable < LastSector)
+                    LastSector = LastUsable;
+            }
+            else
+            {
+                FreePartitionEntries(DiskEntry);
+                printf("The GPT of %s is missing or damaged.\n", DiskEntry->DeviceName);
+            }
+        }
+        else
+        {
+            DiskEntry->PartitionStyle = PARTITION_STYLE_MBR;
+            Success = ReadMbrPartitions(fd, DiskEntry, Sector);
+            if (LastSector > MBR_MAX_LBA - 1)
+                LastSector = MBR_MAX_LBA - 1;
+
+            ExtendedEntry = DiskEntry->ExtendedPartition;
+            if (Success && ExtendedEntry != NULL)
+            {
+                Success = AddFreeSpaceEntries(DiskEntry, TRUE, ExtendedEntry->StartSector + 1,
+                                              ExtendedEntry->StartSector + ExtendedEntry->SectorCount - 1);
+            }
+        }
+    }
+
+    if (fd >= 0)
+        close(fd);
+    free(Sector);
+
+    return Success &&
+           AddFreeSpaceEntries(DiskEntry, FALSE, FirstSector, LastSector);
+}
+
+
+/* Block devices that are not disks of their own, or that hold no media */
+static
+BOOL
+IsPartitionableDisk(
+    const char *Name)
+{
+    char Path[MAX_PATH];
+
+    if (strncmp(Name, "ram", 3) == 0 || strncmp(Name, "zram", 4) == 0 ||
+        strncmp(Name, "dm-", 3) == 0 || strncmp(Name, "md", 2) == 0 ||
+        strncmp(Name, "sr", 2) == 0 || strncmp(Name, "fd", 2) == 0)
+        return FALSE;
+
+    /* Detached loop devices and empty card readers have no size */
+    snprintf(Path, sizeof(Path), "/sys/block/%s/size", Name);
+
+    return ReadSysfsNumber(Path) != 0;
+}
+
+
+static
+void
+ReadScsiAddress(
+    PDISKENTRY DiskEntry,
+    const char *Name)
+{
+    char Path[MAX_PATH];
+    struct dirent *DirEntry;
+    unsigned short Host, Channel, Target, Lun;
+    DIR *Dir;
+
+    /* device/scsi_device/ holds one entry named host:channel:target:lun */
+    snprintf(Path, sizeof(Path), "/sys/block/%s/device/scsi_device", Name);
+    Dir = opendir(Path);
+    if (Dir == NULL)
+        return;
+
+    while ((DirEntry = readdir(Dir)) != NULL)
+    {
+        if (sscanf(DirEntry->d_name, "%hu:%hu:%hu:%hu", &Host, &Channel, &Target, &Lun) == 4)
+        {
+            DiskEntry->Port = Host;
+            DiskEntry->PathId = Channel;
+            DiskEntry->TargetId = Target;
+            DiskEntry->Lun = Lun;
+            break;
+        }
+    }
+
+    closedir(Dir);
+}
+
+
+static
+PDISKENTRY
+CreateDiskEntry(
+    const char *Name,
+    ULONG DiskNumber)
+{
+    PDISKENTRY DiskEntry;
+    char Path[MAX_PATH];
+    char *Slash;
+    BOOL Locked;
+    BOOL Success;
+
+    DiskEntry = calloc(1, sizeof(DISKENTRY));
+    if (DiskEntry == NULL)
+        return NULL;
+
+    /* sysfs spells the '/' of names like cciss/c0d0 as '!' */
+    snprintf(DiskEntry->DeviceName, sizeof(DiskEntry->DeviceName), "/dev/%s", Name);
+    while ((Slash = strchr(DiskEntry->DeviceName, '!')) != NULL)
+        *Slash = '/';
+
+    snprintf(Path, sizeof(Path), "/sys/block/%s/queue/logical_block_size", Name);
+    DiskEntry->BytesPerSector = (ULONG)ReadSysfsNumber(Path);
+    if (DiskEntry->BytesPerSector == 0)
+        DiskEntry->BytesPerSector = 512;
+
+    /* sysfs sizes are always in 512-byte units */
+    snprintf(Path, sizeof(Path), "/sys/block/%s/size", Name);
+    DiskEntry->SectorCount = ReadSysfsNumber(Path) * 512 / DiskEntry->BytesPerSector;
+
+    DiskEntry->SectorsPerTrack = 63;
+    DiskEntry->TracksPerCylinder = 255;
+    DiskEntry->Cylinders = DiskEntry->SectorCount / (63 * 255);
+    DiskEntry->CylinderAlignment = 63 * 255;
+    DiskEntry->SectorAlignment = 1048576 / DiskEntry->BytesPerSector;
+
+    DiskEntry->DiskNumber = DiskNumber;
+    ReadScsiAddress(DiskEntry, Name);
+
+    InitializeListHead(&DiskEntry->PrimaryPartListHead);
+    InitializeListHead(&DiskEntry->LogicalPartListHead);
+    InitializeFreeExtentIndex(&DiskEntry->PrimaryFreeExtents);
+    InitializeFreeExtentIndex(&DiskEntry->LogicalFreeExtents);
+
+    /* A disk that stays busy is read anyway; LockDisk has said why it waited */
+    DiskEntry->LockFd = -1;
+    Locked = LockDisk(DiskEntry, FALSE);
+    Success = ReadPartitionTable(DiskEntry);
+    if (Locked)
+        UnlockDisk(DiskEntry);
+
+    if (!Success)
+    {
+        FreePartitionEntries(DiskEntry);
+        free(DiskEntry);
+        return NULL;
+    }
+
+    return DiskEntry;
+}
+
+
+/* Numbers the disks of /sys/block in name order, so sdb stays disk 1 */
+NTSTATUS
+CreatePartitionList(void)
+{
+    struct dirent **Names;
+    PDISKENTRY DiskEntry;
+    ULONG DiskNumber = 0;
+    int Count, i;
+
+    Count = scandir("/sys/block", &Names, NULL, versionsort);
+    if (Count < 0)
+    {
+        perror("Failed to list /sys/block");
+        return -1;
+    }
+
+    for (i = 0; i < Count; i++)
+    {
+        if (Names[i]->d_name[0] != '.' && IsPartitionableDisk(Names[i]->d_name))
+        {
+            DiskEntry = CreateDiskEntry(Names[i]->d_name, DiskNumber);
+            if (DiskEntry != NULL)
+            {
+                InsertTailList(&DiskListHead, &DiskEntry->ListEntry);
+                DiskNumber++;
+            }
+            else
+            {
+                printf("Failed to read the partitions of %s.\n", Names[i]->d_name);
+            }
+        }
+
+        free(Names[i]);
+    }
+
+    free(Names);
+
+    /* One batch of superblock reads for the partitions of all disks */
+    ProbeFileSystems();
+
+    return 0;
+}
+
+
+void
+DestroyPartitionList(void)
+{
+    ListEntry *Entry;
+    PDISKENTRY DiskEntry;
+
+    while (!IsListEmpty(&DiskListHead))
+    {
+        Entry = DiskListHead.Flink;
+        RemoveEntryList(Entry);
+
+        DiskEntry = CONTAINING_RECORD(Entry, DISKENTRY, ListEntry);
+        if (DiskEntry->LockDepth > 0)
+        {
+            DiskEntry->LockDepth = 1;
+            UnlockDisk(DiskEntry);
+        }
+        FreePartitionEntries(DiskEntry);
+        free(DiskEntry->LayoutBuffer);
+        free(DiskEntry);
+    }
+
+    CurrentDisk = NULL;
+    CurrentPartition = NULL;
+}
+
+
+/*
+ * Drops all partitions of the disk after its partition table has been
+ * wiped; the disk is raw and free from end to end.
+ */
+BOOL
+ClearPartitionList(
+    PDISKENTRY DiskEntry)
+{
+    ListEntry *Heads[2] = { &DiskEntry->PrimaryPartListHead, &DiskEntry->LogicalPartListHead };
+    ListEntry *Entry;
+    PPARTENTRY PartEntry;
+    PVOLENTRY VolumeEntry;
+    int i;
+
+    for (i = 0; i < 2; i++)
+    {
+        for (Entry = Heads[i]->Flink; Entry != Heads[i]; Entry = Entry->Flink)
+        {
+            PartEntry = CONTAINING_RECORD(Entry, PARTENTRY, ListEntry);
+            if (CurrentPartition == PartEntry)
+                CurrentPartition = NULL;
+
+            VolumeEntry = GetVolumeFromPartition(PartEntry);
+            if (VolumeEntry != NULL)
+                RemoveVolume(VolumeEntry);
+        }
+    }
+
+    FreePartitionEntries(DiskEntry);
+
+    DiskEntry->PartitionStyle = PARTITION_STYLE_RAW;
+    memset(&DiskEntry->DiskGuid, 0, sizeof(GUID));
+    DiskEntry->Dirty = FALSE;
+
+    return AddFreeSpaceEntries(DiskEntry, FALSE, DiskEntry->SectorAlignment, DiskEntry->SectorCount - 1);
+}
+
+
+/* The sectors the table of the disk can hand out to partitions */
+static
+void
+GetUsableSectors(
+    PDISKENTRY DiskEntry,
+    ULONGLONG *FirstSector,
+    ULONGLONG *LastSector)
+{
+    ULONG EntrySectors;
+
+    *FirstSector = DiskEntry->SectorAlignment;
+    *LastSector = DiskEntry->SectorCount - 1;
+
+    if (DiskEntry->PartitionStyle == PARTITION_STYLE_GPT)
+    {
+        /* The headers and entry arrays at either end of the disk */
+        EntrySectors = (EFI_PT_ENTRY_COUNT * EFI_PT_ENTRY_SIZE + DiskEntry->BytesPerSector - 1) /
+                       DiskEntry->BytesPerSector;
+        if (*FirstSector < 2 + EntrySectors)
+            *FirstSector = 2 + EntrySectors;
+        *LastSector = DiskEntry->SectorCount - EntrySectors - 2;
+    }
+    else if (DiskEntry->PartitionStyle == PARTITION_STYLE_MBR && *LastSector > MBR_MAX_LBA - 1)
+    {
+        *LastSector = MBR_MAX_LBA - 1;
+    }
+}
+
+
+/*
+ * Replaces the free space entries of both lists, and their indexes, with
+ * those of the current layout, e.g. after a conversion has moved partitions
+ * between the lists.
+ */
+BOOL
+RebuildFreeSpaceEntries(
+    PDISKENTRY DiskEntry)
+{
+    ListEntry *Heads[2] = { &DiskEntry->PrimaryPartListHead, &DiskEntry->LogicalPartListHead };
+    PPARTENTRY ExtendedEntry = DiskEntry->ExtendedPartition;
+    ListEntry *Entry, *Next;
+    PPARTENTRY PartEntry;
+    ULONGLONG FirstSector, LastSector;
+    int i;
+
+    for (i = 0; i < 2; i++)
+    {
+        for (Entry = Heads[i]->Flink; Entry != Heads[i]; Entry = Next)
+        {
+            Next = Entry->Flink;
+            PartEntry = CONTAINING_RECORD(Entry, PARTENTRY, ListEntry);
+            if (PartEntry->IsPartitioned)
+                continue;
+
+            if (CurrentPartition == PartEntry)
+                CurrentPartition = NULL;
+            RemoveEntryList(Entry);
+            free(PartEntry);
+        }
+    }
+
+    DestroyFreeExtentIndex(&DiskEntry->PrimaryFreeExtents);
+    DestroyFreeExtentIndex(&DiskEntry->LogicalFreeExtents);
+
+    if (ExtendedEntry != NULL &&
+        !AddFreeSpaceEntries(DiskEntry, TRUE, ExtendedEntry->StartSector + 1,
+                             ExtendedEntry->StartSector + ExtendedEntry->SectorCount - 1))
+        return FALSE;
+
+    GetUsableSectors(DiskEntry, &FirstSector, &LastSector);
+
+    return AddFreeSpaceEntries(DiskEntry, FALSE, FirstSector, LastSector);
+}
+
+
+ULONG
+GetPrimaryPartitionCount(
+    PDISKENTRY DiskEntry)
+{
+    ListEntry *Entry;
+    ULONG Count = 0;
+
+    for (Entry = DiskEntry->PrimaryPartListHead.Flink;
+         Entry != &DiskEntry->PrimaryPartListHead;
+         Entry = Entry->Flink)
+    {
+        if (CONTAINING_RECORD(Entry, PARTENTRY, ListEntry)->IsPartitioned)
+            Count++;
+    }
+
+    return Count;
+}
+
+
+/*
+ * Carves a new partition out of the free space entry holding the sector
+ * range. The change stays in memory until WritePartitions.
+ */
+PPARTENTRY
+CreatePartitionEntry(
+    PDISKENTRY DiskEntry,
+    ULONGLONG StartSector,
+    ULONGLONG SectorCount,
+    UCHAR PartitionType)
+{
+    ListEntry *Heads[2] = { &DiskEntry->PrimaryPartListHead, &DiskEntry->LogicalPartListHead };
+    ListEntry *Entry;
+    PPARTENTRY FreeEntry = NULL, PartEntry, TailEntry = NULL;
+    ULONGLONG FreeEnd, End = StartSector + SectorCount;
+    BOOL LogicalPartition, Dirty;
+    int i;
+
+    if (DiskEntry->PartitionStyle == PARTITION_STYLE_RAW)
+    {
+        printf("The disk has no partition table; convert it to MBR or GPT first.\n");
+        return NULL;
+    }
+
+    for (i = 0; i < 2 && FreeEntry == NULL && SectorCount != 0; i++)
+    {
+        for (Entry = Heads[i]->Flink; Entry != Heads[i]; Entry = Entry->Flink)
+        {
+            PartEntry = CONTAINING_RECORD(Entry, PARTENTRY, ListEntry);
+            if (!PartEntry->IsPartitioned &&
+                PartEntry->StartSector <= StartSector &&
+                End <= PartEntry->StartSector + PartEntry->SectorCount)
+            {
+                FreeEntry = PartEntry;
+                break;
+            }
+        }
+    }
+
+    if (FreeEntry == NULL)
+    {
+        printf("There is not enough free space at the requested offset.\n");
+        return NULL;
+    }
+
+    LogicalPartition = FreeEntry->LogicalPartition;
+
+    if (IsContainerPartition(PartitionType) &&
+        (LogicalPartition || DiskEntry->PartitionStyle != PARTITION_STYLE_MBR ||
+         DiskEntry->ExtendedPartition != NULL))
+    {
+        printf("An MBR disk can have one extended partition, outside of which there are no logical drives.\n");
+        return NULL;
+    }
+
+    if (DiskEntry->PartitionStyle == PARTITION_STYLE_MBR)
+    {
+        if (!LogicalPartition && GetPrimaryPartitionCount(DiskEntry) >= 4)
+        {
+            printf("The partition table has no free entry left.\n");
+            return NULL;
+        }
+
+        if (End > MBR_MAX_LBA)
+        {
+            printf("The partition would end beyond the 2^32 sector limit of MBR.\n");
+            return NULL;
+        }
+    }
+
+    FreeEnd = FreeEntry->StartSector + FreeEntry->SectorCount;
+
+    PartEntry = AllocatePartEntry(DiskEntry, StartSector, SectorCount, LogicalPartition);
+    if (PartEntry != NULL && End < FreeEnd)
+        TailEntry = AllocatePartEntry(DiskEntry, End, FreeEnd - End, LogicalPartition);
+    if (PartEntry == NULL || (End < FreeEnd && TailEntry == NULL) ||
+        !RemoveFreeExtent(LogicalPartition ? &DiskEntry->LogicalFreeExtents : &DiskEntry->PrimaryFreeExtents,
+                          StartSector, SectorCount))
+    {
+        printf("Out of memory.\n");
+        free(PartEntry);
+        free(TailEntry);
+        return NULL;
+    }
+
+    /* The free entry keeps what is left in front, the tail entry what is left behind */
+    if (StartSector > FreeEntry->StartSector)
+    {
+        FreeEntry->SectorCount = StartSector - FreeEntry->StartSector;
+    }
+    else
+    {
+        RemoveEntryList(&FreeEntry->ListEntry);
+        free(FreeEntry);
+    }
+
+    PartEntry->PartitionType = PartitionType;
+    PartEntry->IsPartitioned = TRUE;
+    PartEntry->New = TRUE;
+    InsertPartitionEntry(PartEntry);
+
+    if (TailEntry != NULL)
+        InsertPartitionEntry(TailEntry);
+
+    if (DiskEntry->PartitionStyle == PARTITION_STYLE_GPT)
+    {
+        GptTypeFromMbrType(PartitionType, &PartEntry->PartitionTypeGuid);
+        GptCreateGuid(&PartEntry->PartitionGuid);
+    }
+
+    /* Without its free space the extended partition would be useless; take it back out */
+    if (IsContainerPartition(PartitionType))
+    {
+        DiskEntry->ExtendedPartition = PartEntry;
+        if (!AddFreeSpaceEntries(DiskEntry, TRUE, StartSector + 1, End - 1))
+        {
+            Dirty = DiskEntry->Dirty;
+            DeletePartitionEntry(PartEntry);
+            DiskEntry->Dirty = Dirty;
+            printf("Out of memory.\n");
+            return NULL;
+        }
+    }
+
+    DiskEntry->Dirty = TRUE;
+
+    return PartEntry;
+}
+
+
+/*
+ * Turns a partition back into free space, merged with the free space on
+ * either side. The change stays in memory until WritePartitions.
+ */
+BOOL
+DeletePartitionEntry(
+    PPARTENTRY PartEntry)
+{
+    PDISKENTRY DiskEntry = PartEntry->DiskEntry;
+    ListEntry *Entry;
+    PPARTENTRY PrevEntry, NextEntry;
+    PVOLENTRY VolumeEntry;
+
+    if (!PartEntry->IsPartitioned)
+        return FALSE;
+
+    if (IsContainerPartition(PartEntry->PartitionType))
+    {
+        for (Entry = DiskEntry->LogicalPartListHead.Flink;
+             Entry != &DiskEntry->LogicalPartListHead;
+             Entry = Entry->Flink)
+        {
+            if (CONTAINING_RECORD(Entry, PARTENTRY, ListEntry)->IsPartitioned)
+            {
+                printf("The extended partition still holds logical drives.\n");
+                return FALSE;
+            }
+        }
+
+        /* Only free space is left in there */
+        while (!IsListEmpty(&DiskEntry->LogicalPartListHead))
+        {
+            Entry = DiskEntry->LogicalPartListHead.Flink;
+            RemoveEntryList(Entry);
+            free(CONTAINING_RECORD(Entry, PARTENTRY, ListEntry));
+        }
+
+        DestroyFreeExtentIndex(&DiskEntry->LogicalFreeExtents);
+        DiskEntry->ExtendedPartition = NULL;
+    }
+
+    VolumeEntry = GetVolumeFromPartition(PartEntry);
+    if (VolumeEntry != NULL)
+        RemoveVolume(VolumeEntry);
+
+    if (CurrentPartition == PartEntry)
+        CurrentPartition = NULL;
+
+    PartEntry->IsPartitioned = FALSE;
+    PartEntry->New = FALSE;
+    PartEntry->BootIndicator = FALSE;
+    PartEntry->PartitionType = PARTITION_ENTRY_UNUSED;
+    PartEntry->PartitionIndex = 0;
+    PartEntry->PartitionNumber = 0;
+    PartEntry->OnDiskPartitionNumber = 0;
+    PartEntry->FormatState = Unformatted;
+    PartEntry->FileSystemName[0] = '\0';
+    PartEntry->VolumeLabel[0] = '\0';
+    memset(&PartEntry->PartitionTypeGuid, 0, sizeof(GUID));
+    memset(&PartEntry->PartitionGuid, 0, sizeof(GUID));
+
+    PrevEntry = GetPrevUnpartitionedEntry(PartEntry);
+    if (PrevEntry != NULL)
+    {
+        PrevEntry->SectorCount = PartEntry->StartSector + PartEntry->SectorCount - PrevEntry->StartSector;
+        RemoveEntryList(&PartEntry->ListEntry);
+        free(PartEntry);
+        PartEntry = PrevEntry;
+    }
+
+    NextEntry = GetNextUnpartitionedEntry(PartEntry);
+    if (NextEntry != NULL)
+    {
+        PartEntry->SectorCount = NextEntry->StartSector + NextEntry->SectorCount - PartEntry->StartSector;
+        RemoveEntryList(&NextEntry->ListEntry);
+        free(NextEntry);
+    }
+
+    DiskEntry->Dirty = TRUE;
+
+    /* The merged entry overlaps the extents of its neighbours, which absorb it */
+    return InsertFreeExtent(PartEntry->LogicalPartition ? &DiskEntry->LogicalFreeExtents
+                                                        : &DiskEntry->PrimaryFreeExtents,
+                            PartEntry->StartSector, PartEntry->SectorCount);
+}
+
+
+/*
+ * Returns the first sector a partition cannot grow into: the start of the
+ * next partition (less the EBR sector in front of a logical drive), or the
+ * end of the space the table can describe. The sectors in between may be
+ * more than the free space entry behind it, which only covers whole
+ * alignment units.
+ */
+ULONGLONG
+GetPartitionGrowLimit(
+    PPARTENTRY PartEntry)
+{
+    PDISKENTRY DiskEntry = PartEntry->DiskEntry;
+    PPARTENTRY ExtendedEntry = DiskEntry->ExtendedPartition;
+    PPARTENTRY NextEntry;
+    ListEntry *ListHead, *Entry;
+    ULONGLONG FirstSector, LastSector;
+
+    ListHead = PartEntry->LogicalPartition ? &DiskEntry->LogicalPartListHead
+                                           : &DiskEntry->PrimaryPartListHead;
+
+    for (Entry = PartEntry->ListEntry.Flink; Entry != ListHead; Entry = Entry->Flink)
+    {
+        NextEntry = CONTAINING_RECORD(Entry, PARTENTRY, ListEntry);
+        if (NextEntry->IsPartitioned)
+            return PartEntry->LogicalPartition ? NextEntry->StartSector - 1 : NextEntry->StartSector;
+    }
+
+    if (PartEntry->LogicalPartition)
+        return ExtendedEntry->StartSector + ExtendedEntry->SectorCount;
+
+    GetUsableSectors(DiskEntry, &FirstSector, &LastSector);
+
+    return LastSector + 1;
+}
+
+
+/*
+ * Returns the sectors [First, End) a partition can be moved within: its own
+ * and those of the free space directly in front of and behind it.
+ */
+void
+GetPartitionMoveRange(
+    PPARTENTRY PartEntry,
+    ULONGLONG *First,
+    ULONGLONG *End)
+{
+    PPARTENTRY PrevEntry = GetPrevUnpartitionedEntry(PartEntry);
+    PPARTENTRY NextEntry = GetNextUnpartitionedEntry(PartEntry);
+
+    *First = (PrevEntry != NULL) ? PrevEntry->StartSector : PartEntry->StartSector;
+    *End = (NextEntry != NULL) ? NextEntry->StartSector + NextEntry->SectorCount
+                               : PartEntry->StartSector + PartEntry->SectorCount;
+}
+
+
+/*
+ * Moves a partition to NewStartSector within its move range and turns what
+ * is left on either side into free space. Only the lists change; the data
+ * is moved by RelocatePartition and the table by WritePartitions.
+ */
+BOOL
+MovePartitionEntry(
+    PPARTENTRY PartEntry,
+    ULONGLONG NewStartSector)
+{
+    PDISKENTRY DiskEntry = PartEntry->DiskEntry;
+    PPARTENTRY PrevEntry = GetPrevUnpartitionedEntry(PartEntry);
+    PPARTENTRY NextEntry = GetNextUnpartitionedEntry(PartEntry);
+    PFREE_EXTENT_INDEX Index;
+    ULONGLONG First, End, NewEnd = NewStartSector + PartEntry->SectorCount;
+
+    GetPartitionMoveRange(PartEntry, &First, &End);
+    if (NewStartSector < First || NewEnd > End)
+        return FALSE;
+
+    if (PrevEntry == NULL && NewStartSector > First)
+    {
+        PrevEntry = AllocatePartEntry(DiskEntry, First, 0, PartEntry->LogicalPartition);
+        if (PrevEntry == NULL)
+            return FALSE;
+        InsertTailList(&PartEntry->ListEntry, &PrevEntry->ListEntry);
+    }
+
+    if (NextEntry == NULL && NewEnd < End)
+    {
+        NextEntry = AllocatePartEntry(DiskEntry, End, 0, PartEntry->LogicalPartition);
+        if (NextEntry == NULL)
+            return FALSE;
+        InsertTailList(PartEntry->ListEntry.Flink, &NextEntry->ListEntry);
+    }
+
+    /* Free the old location first: the two may overlap */
+    Index = PartEntry->LogicalPartition ? &DiskEntry->LogicalFreeExtents : &DiskEntry->PrimaryFreeExtents;
+    if (!InsertFreeExtent(Index, PartEntry->StartSector, PartEntry->SectorCount) ||
+        !RemoveFreeExtent(Index, NewStartSector, PartEntry->SectorCount))
+        return FALSE;
+
+    PartEntry->StartSector = NewStartSector;
+    DiskEntry->Dirty = TRUE;
+
+    if (PrevEntry != NULL)
+    {
+        PrevEntry->SectorCount = NewStartSector - PrevEntry->StartSector;
+        if (PrevEntry->SectorCount == 0)
+        {
+            RemoveEntryList(&PrevEntry->ListEntry);
+            free(PrevEntry);
+        }
+    }
+
+    if (NextEntry != NULL)
+    {
+        NextEntry->StartSector = NewEnd;
+        NextEntry->SectorCount = End - NewEnd;
+        if (NextEntry->SectorCount == 0)
+        {
+            RemoveEntryList(&NextEntry->ListEntry);
+            free(NextEntry);
+        }
+    }
+
+    return TRUE;
+}
+
+
+static
+PVOLENTRY
+CreatePartitionVolume(
+    PPARTENTRY PartEntry,
+    ULONG VolumeNumber,
+    BOOL Removable)
+{
+    PDISKENTRY DiskEntry = PartEntry->DiskEntry;
+    PVOLENTRY VolumeEntry;
+
+    VolumeEntry = calloc(1, sizeof(VOLENTRY));
+    if (VolumeEntry == NULL)
+        return NULL;
+
+    VolumeEntry->pExtents = malloc(sizeof(VOLUME_DISK_EXTENTS));
+    if (VolumeEntry->pExtents == NULL)
+    {
+        free(VolumeEntry);
+        return NULL;
+    }
+
+    VolumeEntry->VolumeNumber = VolumeNumber;
+    GetPartitionDeviceName(PartEntry, VolumeEntry->DeviceName, sizeof(VolumeEntry->DeviceName));
+    if (!GetPartitionMountPoint(PartEntry, VolumeEntry->VolumeName, sizeof(VolumeEntry->VolumeName)))
+        VolumeEntry->VolumeName[0] = '\0';
+
+    if (PartEntry->FileSystemName[0] != '\0')
+        VolumeEntry->pszFilesystem = strdup(PartEntry->FileSystemName);
+    if (PartEntry->VolumeLabel[0] != '\0')
+        VolumeEntry->pszLabel = strdup(PartEntry->VolumeLabel);
+
+    VolumeEntry->VolumeType = Removable ? VOLUME_TYPE_REMOVABLE : VOLUME_TYPE_PARTITION;
+    VolumeEntry->Size = PartEntry->SectorCount * DiskEntry->BytesPerSector;
+
+    VolumeEntry->pExtents->NumberOfDiskExtents = 1;
+    VolumeEntry->pExtents->Extents[0].DiskNumber = DiskEntry->DiskNumber;
+    VolumeEntry->pExtents->Extents[0].StartingOffset = PartEntry->StartSector * DiskEntry->BytesPerSector;
+    VolumeEntry->pExtents->Extents[0].ExtentLength = VolumeEntry->Size;
+
+    return VolumeEntry;
+}
+
+
+/*
+ * One volume for every data partition, numbered in disk order, then one for
+ * every dm and md device at the top of a stack
+ */
+NTSTATUS
+CreateVolumeList(void)
+{
+    ListEntry *DiskListEntry, *Entry;
+    ListEntry *Heads[2];
+    PDISKENTRY DiskEntry;
+    PPARTENTRY PartEntry;
+    PVOLENTRY VolumeEntry;
+    char Path[MAX_PATH];
+    ULONG VolumeNumber = 0;
+    BOOL Removable;
+    int i;
+
+    for (DiskListEntry = DiskListHead.Flink; DiskListEntry != &DiskListHead; DiskListEntry = DiskListEntry->Flink)
+    {
+        DiskEntry = CONTAINING_RECORD(DiskListEntry, DISKENTRY, ListEntry);
+
+        snprintf(Path, sizeof(Path), "/sys/block/%s/removable", DiskEntry->DeviceName + 5);
+        Removable = (ReadSysfsNumber(Path) != 0);
+
+        Heads[0] = &DiskEntry->PrimaryPartListHead;
+        Heads[1] = &DiskEntry->LogicalPartListHead;
+
+        for (i = 0; i < 2; i++)
+        {
+            for (Entry = Heads[i]->Flink; Entry != Heads[i]; Entry = Entry->Flink)
+            {
+                PartEntry = CONTAINING_RECORD(Entry, PARTENTRY, ListEntry);
+                if (!PartEntry->IsPartitioned || IsContainerPartition(PartEntry->PartitionType))
+                    continue;
+
+                VolumeEntry = CreatePartitionVolume(PartEntry, VolumeNumber, Removable);
+                if (VolumeEntry == NULL)
+                {
+                    printf("Out of memory.\n");
+                    return -1;
+                }
+
+                InsertTailList(&VolumeListHead, &VolumeEntry->ListEntry);
+                VolumeNumber++;
+            }
+        }
+    }
+
+    if (!AddStackedVolumes(&VolumeNumber) || !BuildVolumeIndex())
+    {
+        printf("Out of memory.\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+
+void
+DestroyVolumeList(void)
+{
+    DestroyVolumeIndex();
+
+    while (!IsListEmpty(&VolumeListHead))
+        RemoveVolume(CONTAINING_RECORD(VolumeListHead.Flink, VOLENTRY, ListEntry));
+
+    CurrentVolume = NULL;
+}
+
+
+/* The volume made of exactly this partition, if there is one */
+PVOLENTRY
+GetVolumeFromPartition(
+    PPARTENTRY PartEntry)
+{
+    PDISKENTRY DiskEntry;
+    PDISK_EXTENT Extent;
+    PVOLUME_LINK Links;
+    ULONG Count, i;
+
+    if (PartEntry == NULL || !PartEntry->IsPartitioned)
+        return NULL;
+
+    DiskEntry = PartEntry->DiskEntry;
+
+    Count = GetPartitionVolumes(PartEntry, &Links);
+    for (i = 0; i < Count; i++)
+    {
+        if (Links[i].VolumeEntry->pExtents->NumberOfDiskExtents != 1)
+            continue;
+
+        Extent = &Links[i].VolumeEntry->pExtents->Extents[0];
+        if (Extent->StartingOffset == PartEntry->StartSector * DiskEntry->BytesPerSector &&
+            Extent->ExtentLength == PartEntry->SectorCount * DiskEntry->BytesPerSector)
+            return Links[i].VolumeEntry;
+    }
+
+    return NULL;
+}
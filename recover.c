@@ -6,17 +6,723 @@
  * PROGRAMMERS:     h
  */
 
-#include <stdio.h>
-#include <stdlib.h>
-#include <stdbool.h>
+#define _GNU_SOURCE
+#include "diskpart.h"
 
-int recover_main(int argc, char **argv)
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/aio_abi.h>
+
+/* Every signature we match lies within one 512-byte step, so chunks need no overlap */
+#define SCAN_CHUNK_SIZE     (16 * 1024 * 1024)
+#define SCAN_STEP           512
+#define SCAN_ALIGNMENT      4096
+
+/* Magic words as they appear in memory when loaded little-endian */
+#define MAGIC_XFS           0x42534658ULL           /* "XFSB" */
+#define MAGIC_LUKS          0xBEBA534B554CULL       /* "LUKS\xba\xbe" */
+#define MAGIC_GPT           0x5452415020494645ULL   /* "EFI PART" */
+#define MAGIC_LVM           0x454E4F4C4542414CULL   /* "LABELONE" */
+#define MAGIC_BTRFS         0x4D5F53665248425FULL   /* "_BHRfS_M" */
+#define MAGIC_NTFS          0x202020205346544EULL   /* "NTFS    " */
+#define MAGIC_FAT12         0x2020203231544146ULL   /* "FAT12   " */
+#define MAGIC_FAT16         0x2020203631544146ULL   /* "FAT16   " */
+#define MAGIC_FAT32         0x2020203233544146ULL   /* "FAT32   " */
+
+#define SCORE_TABLE         100
+#define SCORE_SUPERBLOCK    50
+#define SCORE_EBR           30
+#define SCORE_WEAK          10
+#define SCORE_ALIGNED       10
+#define SCORE_CONFIRMED     25
+
+typedef enum _CANDIDATE_SOURCE {
+    SourceFileSystem,
+    SourceEbr,
+    SourceGpt
+} CANDIDATE_SOURCE;
+
+/* Byte offsets and sizes; Size 0 means "up to the next candidate" */
+typedef struct _CANDIDATE {
+    ULONGLONG Start;
+    ULONGLONG Size;
+    const char *Type;
+    UCHAR MbrType;
+    CANDIDATE_SOURCE Source;
+    ULONG Table;                /* GPT table index for SourceGpt */
+    int Score;
+} CANDIDATE, *PCANDIDATE;
+
+typedef struct _SCAN_STATE {
+    PDISKENTRY DiskEntry;
+    int fd;
+    ULONGLONG DiskSize;
+    PCANDIDATE Candidates;
+    ULONG Count;
+    ULONG Allocated;
+    GUID *Tables;               /* Disk GUIDs of the GPTs seen so far */
+    ULONG TableCount;
+} SCAN_STATE, *PSCAN_STATE;
+
+/* FUNCTIONS ******************************************************************/
+
+static
+PCANDIDATE
+AddCandidate(
+    PSCAN_STATE State,
+    ULONGLONG Start,
+    ULONGLONG Size,
+    const char *Type,
+    UCHAR MbrType,
+    CANDIDATE_SOURCE Source,
+    int Score)
+{
+    PCANDIDATE Candidate;
+    PCANDIDATE NewArray;
+
+    if (Start >= State->DiskSize)
+        return NULL;
+
+    if (Size != 0 && Start + Size > State->DiskSize)
+        Size = State->DiskSize - Start;
+
+    if (State->Count == State->Allocated)
+    {
+        NewArray = realloc(State->Candidates,
+                           (State->Allocated ? State->Allocated * 2 : 64) * sizeof(CANDIDATE));
+        if (NewArray == NULL)
+            return NULL;
+        State->Candidates = NewArray;
+        State->Allocated = State->Allocated ? State->Allocated * 2 : 64;
+    }
+
+    if ((Start % (1024 * 1024)) == 0)
+        Score += SCORE_ALIGNED;
+
+    Candidate = &State->Candidates[State->Count++];
+    Candidate->Start = Start;
+    Candidate->Size = Size;
+    Candidate->Type = Type;
+    Candidate->MbrType = MbrType;
+    Candidate->Source = Source;
+    Candidate->Table = 0;
+    Candidate->Score = Score;
+
+    return Candidate;
+}
+
+
+/*
+ * A GPT header at disk byte Position. The entry array is read from the disk
+ * and verified; every used entry becomes a candidate of its own table.
+ */
+static
+void
+CheckGptHeader(
+    PSCAN_STATE State,
+    ULONGLONG Position,
+    const UCHAR *Sector)
+{
+    ULONG BytesPerSector = State->DiskEntry->BytesPerSector;
+    const EFI_PARTITION_HEADER *Header = (const EFI_PARTITION_HEADER *)Sector;
+    UCHAR Copy[EFI_PT_HEADER_SIZE];
+    UCHAR *Entries;
+    ULONGLONG Base, ArraySize, ReadSize, First, Last, MyLba;
+    ULONG EntrySize, EntryCount;
+    PCANDIDATE Candidate;
+    GUID *NewTables;
+    GUID DiskGuid;
+    ULONG i;
+
+    if ((Position % BytesPerSector) != 0 || GptHeaderGetHeaderSize(Header) != EFI_PT_HEADER_SIZE)
+        return;
+
+    memcpy(Copy, Sector, sizeof(Copy));
+    GptHeaderSetHeaderCRC32((PEFI_PARTITION_HEADER)Copy, 0);
+    if (GptCrc32(Copy, sizeof(Copy)) != GptHeaderGetHeaderCRC32(Header))
+        return;
+
+    EntrySize = GptHeaderGetSizeOfPartitionEntry(Header);
+    EntryCount = GptHeaderGetNumberOfEntries(Header);
+    MyLba = GptHeaderGetMyLBA(Header);
+    if (EntrySize < EFI_PT_ENTRY_SIZE || EntryCount == 0 ||
+        EntryCount > 4096 || MyLba * BytesPerSector > Position)
+        return;
+
+    /* Primary and backup describe the same table */
+    GptHeaderGetDiskGUID(Header, &DiskGuid);
+    for (i = 0; i < State->TableCount; i++)
+    {
+        if (memcmp(&State->Tables[i], &DiskGuid, sizeof(GUID)) == 0)
+            return;
+    }
+
+    /* Where the disk this header belongs to starts, normally 0 */
+    Base = Position - MyLba * BytesPerSector;
+    ArraySize = (ULONGLONG)EntryCount * EntrySize;
+    ReadSize = (ArraySize + BytesPerSector - 1) / BytesPerSector * BytesPerSector;
+
+    /* The disk may be open with O_DIRECT */
+    if (posix_memalign((void **)&Entries, SCAN_ALIGNMENT, ReadSize) != 0)
+        return;
+
+    if (pread(State->fd, Entries, ReadSize,
+              Base + GptHeaderGetPartitionEntryLBA(Header) * BytesPerSector) != (ssize_t)ReadSize ||
+        GptCrc32(Entries, ArraySize) != GptHeaderGetPartitionEntryCRC32(Header))
+    {
+        free(Entries);
+        return;
+    }
+
+    NewTables = realloc(State->Tables, (State->TableCount + 1) * sizeof(GUID));
+    if (NewTables == NULL)
+    {
+        free(Entries);
+        return;
+    }
+    State->Tables = NewTables;
+    State->Tables[State->TableCount++] = DiskGuid;
+
+    for (i = 0; i < EntryCount; i++)
+    {
+        const EFI_PARTITION_ENTRY *Entry = (const EFI_PARTITION_ENTRY *)(Entries + (size_t)i * EntrySize);
+        GUID TypeGuid;
+
+        if (!GptEntryIsUsed(Entry))
+            continue;
+
+        First = GptEntryGetStartingLBA(Entry);
+        Last = GptEntryGetEndingLBA(Entry);
+        if (Last < First)
+            continue;
+
+        GptEntryGetPartitionType(Entry, &TypeGuid);
+
+        Candidate = AddCandidate(State, Base + First * BytesPerSector,
+                                 (Last - First + 1) * BytesPerSector,
+                                 "GPT entry", MbrTypeFromGptType(&TypeGuid),
+                                 SourceGpt, SCORE_TABLE);
+        if (Candidate != NULL)
+            Candidate->Table = State->TableCount;
+    }
+
+    free(Entries);
+}
+
+
+/*
+ * An extended boot record: boot signature, a data entry close behind it and
+ * either nothing or a link to the next EBR in the second slot.
+ */
+static
+void
+CheckEbr(
+    PSCAN_STATE State,
+    ULONGLONG Position,
+    const UCHAR *Sector)
+{
+    ULONG BytesPerSector = State->DiskEntry->BytesPerSector;
+    const MASTER_BOOT_RECORD *Ebr = (const MASTER_BOOT_RECORD *)Sector;
+    const MBR_PARTITION_ENTRY *Entry0 = &Ebr->PartitionTable[0];
+    const MBR_PARTITION_ENTRY *Entry1 = &Ebr->PartitionTable[1];
+    ULONG Start = MbrEntryGetStartingLba(Entry0);
+    ULONG Count = MbrEntryGetSectorCount(Entry0);
+    const UCHAR *p;
+
+    if ((Position % BytesPerSector) != 0 || Position == 0)
+        return;
+
+    if ((Entry0->BootIndicator & 0x7F) != 0 || Entry0->PartitionType == 0 ||
+        IsContainerPartition(Entry0->PartitionType) ||
+        Start == 0 || Start > 4096 || Count == 0)
+        return;
+
+    if (Entry1->PartitionType != 0 && !IsContainerPartition(Entry1->PartitionType))
+        return;
+
+    /* The last two slots of an EBR are always empty */
+    for (p = (const UCHAR *)&Ebr->PartitionTable[2]; p < Ebr->MasterBootRecordMagic; p++)
+    {
+        if (*p != 0)
+            return;
+    }
+
+    AddCandidate(State, Position + (ULONGLONG)Start * BytesPerSector,
+                 (ULONGLONG)Count * BytesPerSector,
+                 "EBR entry", Entry0->PartitionType, SourceEbr, SCORE_EBR);
+}
+
+
+/*
+ * Checks one 512-byte aligned position of the buffer against all known
+ * signatures. The common case, no match, costs a few word loads and
+ * compares; only hits are parsed further.
+ */
+static
+void
+CheckPosition(
+    PSCAN_STATE State,
+    ULONGLONG Position,
+    const UCHAR *p)
 {
-    // TODO: Implement interactive partition recovery logic here
+    const XFS_SUPER_BLOCK *Xfs = (const XFS_SUPER_BLOCK *)p;
+    const LVM_LABEL_HEADER *Label = (const LVM_LABEL_HEADER *)p;
+    const BTRFS_SUPER_BLOCK *Btrfs = (const BTRFS_SUPER_BLOCK *)p;
+    const EXT_SUPER_BLOCK *Ext = (const EXT_SUPER_BLOCK *)p;
+    const NTFS_BOOT_SECTOR *Ntfs = (const NTFS_BOOT_SECTOR *)p;
+    const FAT_BOOT_SECTOR *Fat = (const FAT_BOOT_SECTOR *)p;
+    const FAT32_BOOT_SECTOR *Fat32 = (const FAT32_BOOT_SECTOR *)p;
+    ULONGLONG Word0 = LoadLe64(p);
+    ULONGLONG Size, Start, Fat32Type;
+    ULONG BlockSize, LogBlockSize;
+
+    if ((Word0 & 0xFFFFFFFFULL) == MAGIC_XFS)
+    {
+        BlockSize = XfsGetBlockSize(Xfs);
+        if (BlockSize >= 512 && BlockSize <= 65536 && (BlockSize & (BlockSize - 1)) == 0)
+            AddCandidate(State, Position, XfsGetDataBlocks(Xfs) * BlockSize, "xfs", 0x83, SourceFileSystem, SCORE_SUPERBLOCK);
+    }
+    else if ((Word0 & 0xFFFFFFFFFFFFULL) == MAGIC_LUKS)
+    {
+        AddCandidate(State, Position, 0, "LUKS", 0x83, SourceFileSystem, SCORE_SUPERBLOCK);
+    }
+    else if (Word0 == MAGIC_GPT)
+    {
+        CheckGptHeader(State, Position, p);
+    }
+    else if (Word0 == MAGIC_LVM && memcmp(Label->Type, "LVM2 001", 8) == 0 &&
+             LvmGetSectorXl(Label) < 4 && LvmGetSectorXl(Label) * 512 <= Position &&
+             LvmGetOffsetXl(Label) + sizeof(LVM_PV_HEADER) <= SCAN_STEP)
+    {
+        Start = Position - LvmGetSectorXl(Label) * 512;
+        AddCandidate(State, Start, LvmGetDeviceSize((const LVM_PV_HEADER *)(p + LvmGetOffsetXl(Label))),
+                     "LVM2 PV", 0x8E, SourceFileSystem, SCORE_SUPERBLOCK);
+    }
+
+    /* btrfs: magic 0x40 into a superblock whose own offset is at 0x30 */
+    if (BtrfsGetMagic(Btrfs) == MAGIC_BTRFS && BtrfsGetByteNr(Btrfs) == BTRFS_SUPER_BLOCK_OFFSET &&
+        Position >= BTRFS_SUPER_BLOCK_OFFSET)
+        AddCandidate(State, Position - BTRFS_SUPER_BLOCK_OFFSET, BtrfsGetTotalBytes(Btrfs),
+                     "btrfs", 0x83, SourceFileSystem, SCORE_SUPERBLOCK);
+
+    /*
+     * ext2/3/4: primary superblock (group 0) 1024 bytes into the filesystem.
+     * The high half of the block count lies outside this step and is ignored.
+     */
+    LogBlockSize = ExtSuperGetLogBlockSize(Ext);
+    if (ExtSuperGetMagic(Ext) == EXT4_SUPER_MAGIC && ExtSuperGetBlockGroupNr(Ext) == 0 && LogBlockSize <= 6 &&
+        ExtSuperGetRevLevel(Ext) <= 1 && ExtSuperGetBlocksCountLo(Ext) != 0 && Position >= EXT_SUPER_BLOCK_OFFSET)
+    {
+        Size = (ULONGLONG)ExtSuperGetBlocksCountLo(Ext) * (1024ULL << LogBlockSize);
+        AddCandidate(State, Position - EXT_SUPER_BLOCK_OFFSET, Size, "ext", 0x83, SourceFileSystem,
+                     ExtSuperGetBlocksPerGroup(Ext) != 0 ? SCORE_SUPERBLOCK : SCORE_WEAK);
+    }
+
+    if (FatGetSignature(Fat) != MBR_SIGNATURE)
+        return;
+
+    Fat32Type = LoadLe64(Fat32->FileSystemType);
+    if (LoadLe64(Ntfs->OemId) == MAGIC_NTFS)
+    {
+        Size = (NtfsGetTotalSectors(Ntfs) + 1) * NtfsGetBytesPerSector(Ntfs);
+        AddCandidate(State, Position, Size, "ntfs", 0x07, SourceFileSystem, SCORE_SUPERBLOCK);
+    }
+    else if (LoadLe64(Fat->FileSystemType) == MAGIC_FAT12 || LoadLe64(Fat->FileSystemType) == MAGIC_FAT16 ||
+             Fat32Type == MAGIC_FAT32)
+    {
+        Size = FatGetTotalSectors16(Fat) ? FatGetTotalSectors16(Fat) : FatGetTotalSectors32(Fat);
+        AddCandidate(State, Position, Size * FatGetBytesPerSector(Fat),
+                     Fat32Type == MAGIC_FAT32 ? "fat32" : "fat",
+                     Fat32Type == MAGIC_FAT32 ? 0x0C : 0x0E,
+                     SourceFileSystem, SCORE_SUPERBLOCK);
+    }
+    else
+    {
+        CheckEbr(State, Position, p);
+    }
+}
+
+
+static
+void
+ScanBuffer(
+    PSCAN_STATE State,
+    ULONGLONG Offset,
+    const UCHAR *Buffer,
+    size_t Length)
+{
+    size_t i;
+
+    for (i = 0; i < Length; i += SCAN_STEP)
+        CheckPosition(State, Offset + i, Buffer + i);
+}
+
+
+/*
+ * Reads the whole disk in large sequential chunks. While one chunk is being
+ * scanned the read of the next one is already in flight.
+ */
+static
+BOOL
+ScanDisk(
+    PSCAN_STATE State)
+{
+    aio_context_t Context = 0;
+    struct iocb Iocb;
+    struct iocb *Iocbs[1] = { &Iocb };
+    struct io_event Event;
+    UCHAR *Buffer[2] = { NULL, NULL };
+    ULONGLONG Offset, NextOffset;
+    size_t Length;
+    BOOL UseAio, Success = FALSE;
+    int Slot = 0;
+    ssize_t Result;
+
+    Buffer[0] = AcquireIoBuffer(SCAN_CHUNK_SIZE);
+    Buffer[1] = AcquireIoBuffer(SCAN_CHUNK_SIZE);
+    if (Buffer[0] == NULL || Buffer[1] == NULL)
+        goto done;
+
+    UseAio = (syscall(__NR_io_setup, 1, &Context) == 0);
+
+    for (Offset = 0; Offset < State->DiskSize; Offset = NextOffset)
+    {
+        NextOffset = Offset + SCAN_CHUNK_SIZE;
+        Length = SCAN_CHUNK_SIZE;
+        if (Offset + Length > State->DiskSize)
+            Length = State->DiskSize - Offset;
+
+        if (Offset == 0 || !UseAio)
+        {
+            Result = pread(State->fd, Buffer[Slot], Length, Offset);
+        }
+        else
+        {
+            while (syscall(__NR_io_getevents, Context, 1L, 1L, &Event, NULL) < 0)
+            {
+                if (errno != EINTR)
+                    goto done;
+            }
+            Result = (ssize_t)Event.res;
+        }
+
+        if (Result != (ssize_t)Length)
+        {
+            fprintf(stderr, "Read error at offset %llu\n", (unsigned long long)Offset);
+            goto done;
+        }
+
+        /* Start reading the next chunk into the other buffer */
+        if (UseAio && NextOffset < State->DiskSize)
+        {
+            memset(&Iocb, 0, sizeof(Iocb));
+            Iocb.aio_lio_opcode = IOCB_CMD_PREAD;
+            Iocb.aio_fildes = State->fd;
+            Iocb.aio_buf = (uint64_t)(uintptr_t)Buffer[Slot ^ 1];
+            Iocb.aio_nbytes = (NextOffset + SCAN_CHUNK_SIZE > State->DiskSize)
+                                  ? State->DiskSize - NextOffset
+                                  : SCAN_CHUNK_SIZE;
+            Iocb.aio_offset = (int64_t)NextOffset;
+
+            if (syscall(__NR_io_submit, Context, 1L, Iocbs) != 1)
+                UseAio = FALSE;
+        }
+
+        ScanBuffer(State, Offset, Buffer[Slot], Length);
+
+        if (UseAio)
+            Slot ^= 1;
+    }
+
+    Success = TRUE;
+
+done:
+    if (Context != 0)
+        syscall(__NR_io_destroy, Context);
+    ReleaseIoBuffer(Buffer[1]);
+    ReleaseIoBuffer(Buffer[0]);
+
+    return Success;
+}
+
+
+static
+int
+CompareByScore(
+    const void *A,
+    const void *B)
+{
+    const CANDIDATE *First = A, *Second = B;
+
+    if (First->Score != Second->Score)
+        return Second->Score - First->Score;
+
+    return (First->Start < Second->Start) ? -1 : (First->Start > Second->Start);
+}
+
+
+static
+int
+CompareByStart(
+    const void *A,
+    const void *B)
+{
+    const PARTENTRY *First = A, *Second = B;
+
+    return (First->StartSector < Second->StartSector) ? -1 : (First->StartSector > Second->StartSector);
+}
+
+
+/*
+ * Builds a layout from the candidates that pass Filter: greedily by score,
+ * skipping anything that overlaps what was already taken. Partitions whose
+ * start is confirmed by a filesystem signature score extra.
+ */
+static
+int
+BuildLayout(
+    PSCAN_STATE State,
+    CANDIDATE_SOURCE Source,
+    ULONG Table,
+    PPARTENTRY Layout,
+    int MaxCount,
+    int *Score)
+{
+    ULONG BytesPerSector = State->DiskEntry->BytesPerSector;
+    PCANDIDATE Candidate;
+    ULONGLONG Start, End, Next;
+    int Count = 0, i, j;
+
+    *Score = 0;
+
+    for (i = 0; i < (int)State->Count && Count < MaxCount; i++)
+    {
+        Candidate = &State->Candidates[i];
+
+        if (Source == SourceGpt)
+        {
+            if (Candidate->Source != SourceGpt || Candidate->Table != Table)
+                continue;
+        }
+        else if (Candidate->Source == SourceGpt)
+        {
+            continue;
+        }
+
+        Start = Candidate->Start / BytesPerSector;
+        End = Start + (Candidate->Size + BytesPerSector - 1) / BytesPerSector;
+
+        /* Unknown size: up to the next candidate that starts behind it */
+        if (Candidate->Size == 0)
+        {
+            End = State->DiskSize / BytesPerSector;
+            for (j = 0; j < (int)State->Count; j++)
+            {
+                Next = State->Candidates[j].Start / BytesPerSector;
+                if (Next > Start && Next < End)
+                    End = Next;
+            }
+        }
+
+        for (j = 0; j < Count; j++)
+        {
+            if (Start < Layout[j].StartSector + Layout[j].SectorCount &&
+                Layout[j].StartSector < End)
+                break;
+        }
+        if (j < Count)
+            continue;
+
+        memset(&Layout[Count], 0, sizeof(PARTENTRY));
+        Layout[Count].DiskEntry = State->DiskEntry;
+        Layout[Count].StartSector = Start;
+        Layout[Count].SectorCount = End - Start;
+        Layout[Count].PartitionType = Candidate->MbrType;
+        Layout[Count].IsPartitioned = TRUE;
+        snprintf(Layout[Count].FileSystemName, sizeof(Layout[Count].FileSystemName), "%s",
+                 Candidate->Source == SourceFileSystem ? Candidate->Type : "");
+        *Score += Candidate->Score;
+
+        if (Candidate->Source != SourceFileSystem)
+        {
+            for (j = 0; j < (int)State->Count; j++)
+            {
+                if (State->Candidates[j].Source == SourceFileSystem &&
+                    State->Candidates[j].Start == Candidate->Start)
+                {
+                    snprintf(Layout[Count].FileSystemName, sizeof(Layout[Count].FileSystemName),
+                             "%s", State->Candidates[j].Type);
+                    *Score += SCORE_CONFIRMED;
+                    break;
+                }
+            }
+        }
+
+        Count++;
+    }
+
+    qsort(Layout, Count, sizeof(PARTENTRY), CompareByStart);
+    for (i = 0; i < Count; i++)
+        Layout[i].PartitionNumber = i + 1;
+
+    return Count;
+}
+
+
+static
+void
+PrintLayout(
+    int Rank,
+    int Score,
+    const char *Origin,
+    PPARTENTRY Layout,
+    int Count,
+    ULONG BytesPerSector)
+{
+    int i;
+
+    printf("\nLayout %d (score %d, %s):\n", Rank, Score, Origin);
+    printf("  ###  Fs        Id    Start LBA        Size\n");
+    printf("  ---  --------  ----  ---------------  ----------\n");
+
+    for (i = 0; i < Count; i++)
+    {
+        printf("  %3lu  %-8s  0x%02X  %15llu  %7llu MB\n",
+               (unsigned long)Layout[i].PartitionNumber,
+               Layout[i].FileSystemName[0] ? Layout[i].FileSystemName : "?",
+               Layout[i].PartitionType,
+               (unsigned long long)Layout[i].StartSector,
+               (unsigned long long)(Layout[i].SectorCount * BytesPerSector / 1048576ULL));
+    }
+}
+
+
+static
+BOOL
+RecoverScan(
+    PDISKENTRY DiskEntry)
+{
+    SCAN_STATE State;
+    PPARTENTRY *Layouts = NULL;
+    int *Counts = NULL, *Scores = NULL, *Order = NULL;
+    int LayoutCount, MaxPartitions, i, j, Temp;
+    BOOL Success = FALSE;
+
+    memset(&State, 0, sizeof(State));
+    State.DiskEntry = DiskEntry;
+    State.DiskSize = DiskEntry->SectorCount * DiskEntry->BytesPerSector;
+
+    State.fd = OpenDiskDevice(DiskEntry, O_RDONLY | O_DIRECT);
+    if (State.fd < 0 && errno == EINVAL)
+        State.fd = OpenDiskDevice(DiskEntry, O_RDONLY);
+    if (State.fd < 0)
+        return FALSE;
+
+    printf("Scanning %s (%llu MB)...\n", DiskEntry->DeviceName,
+           (unsigned long long)(State.DiskSize / 1048576ULL));
+
+    if (!ScanDisk(&State))
+        goto done;
+
+    if (State.Count == 0)
+    {
+        printf("\nNo partition signatures were found.\n\n");
+        Success = TRUE;
+        goto done;
+    }
+
+    qsort(State.Candidates, State.Count, sizeof(CANDIDATE), CompareByScore);
+
+    /* One layout per GPT found, plus one from the loose signatures */
+    LayoutCount = State.TableCount + 1;
+    MaxPartitions = State.Count;
+    Layouts = calloc(LayoutCount, sizeof(PPARTENTRY));
+    Counts = calloc(LayoutCount, sizeof(int));
+    Scores = calloc(LayoutCount, sizeof(int));
+    Order = calloc(LayoutCount, sizeof(int));
+    if (Layouts == NULL || Counts == NULL || Scores == NULL || Order == NULL)
+        goto done;
+
+    for (i = 0; i < LayoutCount; i++)
+    {
+        Layouts[i] = calloc(MaxPartitions, sizeof(PARTENTRY));
+        if (Layouts[i] == NULL)
+            goto done;
+
+        if (i < (int)State.TableCount)
+            Counts[i] = BuildLayout(&State, SourceGpt, i + 1, Layouts[i], MaxPartitions, &Scores[i]);
+        else
+            Counts[i] = BuildLayout(&State, SourceFileSystem, 0, Layouts[i], MaxPartitions, &Scores[i]);
+
+        Order[i] = i;
+    }
+
+    for (i = 1; i < LayoutCount; i++)
+    {
+        for (j = i; j > 0 && Scores[Order[j]] > Scores[Order[j - 1]]; j--)
+        {
+            Temp = Order[j];
+            Order[j] = Order[j - 1];
+            Order[j - 1] = Temp;
+        }
+    }
+
+    printf("\nFound %lu signatures.\n", (unsigned long)State.Count);
+
+    for (i = 0; i < LayoutCount; i++)
+    {
+        j = Order[i];
+        if (Counts[j] == 0)
+            continue;
+
+        PrintLayout(i + 1, Scores[j],
+                    (j < (int)State.TableCount) ? "from a GPT" : "from filesystem signatures and EBRs",
+                    Layouts[j], Counts[j], DiskEntry->BytesPerSector);
+    }
+
+    printf("\n");
+    Success = TRUE;
+
+done:
+    if (Layouts != NULL)
+    {
+        for (i = 0; i < (int)State.TableCount + 1; i++)
+            free(Layouts[i]);
+    }
+    free(Order);
+    free(Scores);
+    free(Counts);
+    free(Layouts);
+    free(State.Tables);
+    free(State.Candidates);
+    close(State.fd);
+
+    return Success;
+}
+
+
+BOOL
+recover_main(
+    int argc,
+    char **argv)
+{
+    if (CurrentDisk == NULL)
+    {
+        printf("No disk selected.\n");
+        CommandFailed = TRUE;
+        return TRUE;
+    }
+
+    if (argc < 2 || strcasecmp(argv[1], "scan") != 0)
+    {
+        printf("Usage: recover scan\n");
+        return TRUE;
+    }
 
-    printf("Partition recovery module stub - no operations performed.\n");
-    (void)argc;  // Avoid unused parameter warning
-    (void)argv;
+    if (!RecoverScan(CurrentDisk))
+        printf("\nDiskPart failed to scan the selected disk.\n\n");
 
-    return 0; // 0 = success in Linux/Unix conventions
+    return TRUE;
 }
@@ -0,0 +1,365 @@
+/*
+ * PROJECT:         ReactOS DiskPart (Linux port)
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * FILE:            base/system/diskpart/relocate.c
+ * PURPOSE:         Moves partition data to a new offset on the same disk.
+ */
+
+#define _GNU_SOURCE
+#include "diskpart.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/aio_abi.h>
+
+#define RELOCATE_CHUNK_SIZE (8 * 1024 * 1024)
+
+/*
+ * Two buffers: while chunk N is written from one, chunk N+1 is read into the
+ * other. Reads always run ahead of writes on the side of the copy that has
+ * not been overwritten yet, so the pipeline is safe for overlapping ranges.
+ */
+typedef struct _RELOCATE_CONTEXT {
+    PDISKENTRY DiskEntry;
+    int fd;
+    aio_context_t AioContext;
+    BOOL UseAio;
+    UCHAR *Buffer[2];
+    ULONGLONG SourceLba;
+    ULONGLONG TargetLba;
+    ULONGLONG SectorCount;
+    ULONG ChunkSectors;
+    ULONGLONG ChunkCount;
+    BOOL Backwards;
+    const UCHAR *Bitmap;
+    ULONG SectorsPerBit;
+} RELOCATE_CONTEXT, *PRELOCATE_CONTEXT;
+
+/* FUNCTIONS ******************************************************************/
+
+static
+BOOL
+RangeIsAllocated(
+    PRELOCATE_CONTEXT Context,
+    ULONGLONG Start,
+    ULONGLONG Count)
+{
+    ULONGLONG Bit, LastBit;
+
+    if (Context->Bitmap == NULL)
+        return TRUE;
+
+    Bit = Start / Context->SectorsPerBit;
+    LastBit = (Start + Count - 1) / Context->SectorsPerBit;
+
+    /* Whole bytes first, the bitmaps are mostly empty or mostly full */
+    while (Bit <= LastBit)
+    {
+        if ((Bit & 7) == 0 && Bit + 7 <= LastBit)
+        {
+            if (Context->Bitmap[Bit >> 3] != 0)
+                return TRUE;
+            Bit += 8;
+            continue;
+        }
+
+        if (Context->Bitmap[Bit >> 3] & (1 << (Bit & 7)))
+            return TRUE;
+        Bit++;
+    }
+
+    return FALSE;
+}
+
+
+/*
+ * Returns the next chunk that holds allocated data, in copy order, or
+ * ChunkCount when there is none left.
+ */
+static
+ULONGLONG
+NextChunk(
+    PRELOCATE_CONTEXT Context,
+    ULONGLONG Step)
+{
+    ULONGLONG Chunk, Start, Count;
+
+    for (; Step < Context->ChunkCount; Step++)
+    {
+        Chunk = Context->Backwards ? (Context->ChunkCount - 1 - Step) : Step;
+        Start = Chunk * Context->ChunkSectors;
+        Count = Context->SectorCount - Start;
+        if (Count > Context->ChunkSectors)
+            Count = Context->ChunkSectors;
+
+        if (RangeIsAllocated(Context, Start, Count))
+            return Step;
+    }
+
+    return Context->ChunkCount;
+}
+
+
+static
+void
+PrepareIo(
+    PRELOCATE_CONTEXT Context,
+    struct iocb *Iocb,
+    ULONGLONG Step,
+    int Slot,
+    BOOL Write)
+{
+    ULONGLONG Chunk, Start, Count;
+    ULONG BytesPerSector = Context->DiskEntry->BytesPerSector;
+
+    Chunk = Context->Backwards ? (Context->ChunkCount - 1 - Step) : Step;
+    Start = Chunk * Context->ChunkSectors;
+    Count = Context->SectorCount - Start;
+    if (Count > Context->ChunkSectors)
+        Count = Context->ChunkSectors;
+
+    memset(Iocb, 0, sizeof(*Iocb));
+    Iocb->aio_data = Step;
+    Iocb->aio_lio_opcode = Write ? IOCB_CMD_PWRITE : IOCB_CMD_PREAD;
+    Iocb->aio_fildes = Context->fd;
+    Iocb->aio_buf = (uint64_t)(uintptr_t)Context->Buffer[Slot];
+    Iocb->aio_nbytes = Count * BytesPerSector;
+    Iocb->aio_offset = (int64_t)(((Write ? Context->TargetLba : Context->SourceLba) + Start) * BytesPerSector);
+}
+
+
+/*
+ * Submits the given requests and waits for all of them. Falls back to plain
+ * pread/pwrite when the kernel has no native AIO.
+ */
+static
+BOOL
+RunIo(
+    PRELOCATE_CONTEXT Context,
+    struct iocb **Iocbs,
+    int Count)
+{
+    struct io_event Events[2];
+    ssize_t Result;
+    int Done = 0, i;
+
+    if (!Context->UseAio)
+    {
+        for (i = 0; i < Count; i++)
+        {
+            void *Buffer = (void *)(uintptr_t)Iocbs[i]->aio_buf;
+
+            if (Iocbs[i]->aio_lio_opcode == IOCB_CMD_PWRITE)
+                Result = pwrite(Context->fd, Buffer, Iocbs[i]->aio_nbytes, Iocbs[i]->aio_offset);
+            else
+                Result = pread(Context->fd, Buffer, Iocbs[i]->aio_nbytes, Iocbs[i]->aio_offset);
+
+            if (Result != (ssize_t)Iocbs[i]->aio_nbytes)
+            {
+                fprintf(stderr, "I/O error at offset %llu: %s\n",
+                        (unsigned long long)Iocbs[i]->aio_offset,
+                        Result < 0 ? strerror(errno) : "short transfer");
+                return FALSE;
+            }
+        }
+        return TRUE;
+    }
+
+    if (syscall(__NR_io_submit, Context->AioContext, (long)Count, Iocbs) != Count)
+    {
+        fprintf(stderr, "io_submit failed: %s\n", strerror(errno));
+        return FALSE;
+    }
+
+    while (Done < Count)
+    {
+        Result = syscall(__NR_io_getevents, Context->AioContext, 1L, (long)(Count - Done), Events, NULL);
+        if (Result < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "io_getevents failed: %s\n", strerror(errno));
+            return FALSE;
+        }
+
+        for (i = 0; i < Result; i++)
+        {
+            struct iocb *Iocb = (struct iocb *)(uintptr_t)Events[i].obj;
+
+            if (Events[i].res != (int64_t)Iocb->aio_nbytes)
+            {
+                fprintf(stderr, "I/O error at offset %llu: %s\n",
+                        (unsigned long long)Iocb->aio_offset,
+                        (Events[i].res < 0) ? strerror((int)-Events[i].res) : "short transfer");
+                return FALSE;
+            }
+        }
+
+        Done += Result;
+    }
+
+    return TRUE;
+}
+
+
+/*
+ * Copies SectorCount sectors from SourceLba to TargetLba on the same disk.
+ * The ranges may overlap. If Bitmap is given, bit N set means that sectors
+ * [N * SectorsPerBit, (N + 1) * SectorsPerBit) of the source hold data; chunks
+ * without any set bit are neither read nor written.
+ */
+BOOL
+RelocateSectors(
+    PDISKENTRY DiskEntry,
+    ULONGLONG SourceLba,
+    ULONGLONG TargetLba,
+    ULONGLONG SectorCount,
+    const UCHAR *Bitmap,
+    ULONG SectorsPerBit)
+{
+    RELOCATE_CONTEXT Context;
+    struct iocb ReadIocb, WriteIocb;
+    struct iocb *Iocbs[2];
+    ULONGLONG Step, NextStep, Copied = 0;
+    int Slot = 0, Count;
+    BOOL Success = FALSE;
+
+    if (SourceLba == TargetLba || SectorCount == 0)
+        return TRUE;
+
+    if (TargetLba + SectorCount > DiskEntry->SectorCount ||
+        SourceLba + SectorCount > DiskEntry->SectorCount)
+    {
+        printf("The relocation range lies beyond the end of the disk.\n");
+        return FALSE;
+    }
+
+    memset(&Context, 0, sizeof(Context));
+    Context.DiskEntry = DiskEntry;
+    Context.SourceLba = SourceLba;
+    Context.TargetLba = TargetLba;
+    Context.SectorCount = SectorCount;
+    Context.ChunkSectors = RELOCATE_CHUNK_SIZE / DiskEntry->BytesPerSector;
+    Context.ChunkCount = (SectorCount + Context.ChunkSectors - 1) / Context.ChunkSectors;
+    Context.Backwards = (TargetLba > SourceLba) && (TargetLba < SourceLba + SectorCount);
+    Context.Bitmap = Bitmap;
+    Context.SectorsPerBit = (SectorsPerBit != 0) ? SectorsPerBit : 1;
+
+    /* O_DIRECT keeps the copy out of the page cache; not every device takes it */
+    Context.fd = OpenDiskDevice(DiskEntry, O_RDWR | O_DIRECT);
+    if (Context.fd < 0 && errno == EINVAL)
+        Context.fd = OpenDiskDevice(DiskEntry, O_RDWR);
+    if (Context.fd < 0)
+        return FALSE;
+
+    Context.UseAio = (syscall(__NR_io_setup, 2, &Context.AioContext) == 0);
+
+    Context.Buffer[0] = AcquireIoBuffer(RELOCATE_CHUNK_SIZE);
+    Context.Buffer[1] = AcquireIoBuffer(RELOCATE_CHUNK_SIZE);
+    if (Context.Buffer[0] == NULL || Context.Buffer[1] == NULL)
+    {
+        printf("Out of memory.\n");
+        goto done;
+    }
+
+    Step = NextChunk(&Context, 0);
+    if (Step < Context.ChunkCount)
+    {
+        PrepareIo(&Context, &ReadIocb, Step, Slot, FALSE);
+        Iocbs[0] = &ReadIocb;
+        if (!RunIo(&Context, Iocbs, 1))
+            goto done;
+    }
+
+    while (Step < Context.ChunkCount)
+    {
+        /* Write what was just read and read the next chunk into the other slot */
+        PrepareIo(&Context, &WriteIocb, Step, Slot, TRUE);
+        Iocbs[0] = &WriteIocb;
+        Count = 1;
+
+        NextStep = NextChunk(&Context, Step + 1);
+        if (NextStep < Context.ChunkCount)
+        {
+            PrepareIo(&Context, &ReadIocb, NextStep, Slot ^ 1, FALSE);
+            Iocbs[Count++] = &ReadIocb;
+        }
+
+        if (!RunIo(&Context, Iocbs, Count))
+            goto done;
+
+        Copied += WriteIocb.aio_nbytes;
+        Step = NextStep;
+        Slot ^= 1;
+    }
+
+    if (fsync(Context.fd) < 0)
+    {
+        fprintf(stderr, "Failed to flush %s: %s\n", DiskEntry->DeviceName, strerror(errno));
+        goto done;
+    }
+
+    DPRINT("Relocated %llu bytes, skipped %llu bytes\n", Copied,
+           SectorCount * DiskEntry->BytesPerSector - Copied);
+    (void)Copied;
+
+    Success = TRUE;
+
+done:
+    if (Context.UseAio)
+        syscall(__NR_io_destroy, Context.AioContext);
+    ReleaseIoBuffer(Context.Buffer[1]);
+    ReleaseIoBuffer(Context.Buffer[0]);
+    close(Context.fd);
+
+    return Success;
+}
+
+
+/*
+ * Moves the data of a partition so that it starts at NewStartSector, which
+ * must lie in the partition's move range, and updates the partition list.
+ * The caller writes the new partition table.
+ */
+BOOL
+RelocatePartition(
+    PPARTENTRY PartEntry,
+    ULONGLONG NewStartSector,
+    const UCHAR *Bitmap,
+    ULONG SectorsPerBit)
+{
+    PDISKENTRY DiskEntry = PartEntry->DiskEntry;
+    PPARTENTRY PrevEntry;
+    ULONGLONG First, End;
+
+    GetPartitionMoveRange(PartEntry, &First, &End);
+    if (NewStartSector < First || NewStartSector + PartEntry->SectorCount > End)
+    {
+        printf("The new location does not fit in the free space around the partition (sectors %llu-%llu).\n",
+               (unsigned long long)First, (unsigned long long)(End - 1));
+        return FALSE;
+    }
+
+    /* A logical drive behind another one needs the sector in front of it for its EBR */
+    PrevEntry = GetPrevUnpartitionedEntry(PartEntry);
+    if (PartEntry->LogicalPartition && PrevEntry != NULL &&
+        PrevEntry->ListEntry.Blink != &DiskEntry->LogicalPartListHead &&
+        NewStartSector == First)
+    {
+        printf("The logical drive needs a free sector in front of it for its EBR.\n");
+        return FALSE;
+    }
+
+    if (!RelocateSectors(DiskEntry, PartEntry->StartSector, NewStartSector,
+                         PartEntry->SectorCount, Bitmap, SectorsPerBit))
+        return FALSE;
+
+    if (!MovePartitionEntry(PartEntry, NewStartSector))
+    {
+        printf("Out of memory.\n");
+        return FALSE;
+    }
+
+    return TRUE;
+}
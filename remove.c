@@ -18,5 +18,5 @@ int remove_main(int argc, char **argv)
     (void)argc;  // Silence unused parameter warnings
     (void)argv;
 
-    return 0; // Success
+    return 1; // Success, keep interpreting
 }
@@ -6,14 +6,416 @@
  * PROGRAMMERS:     YL
  */
 
-#include <stdio.h>
+#include "diskpart.h"
 
-int repair_main(int argc, char **argv)
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+
+#define MAX_ENTRY_ARRAY_SIZE (1024 * 1024)
+
+/* One copy of the GPT: its header sector and the entry array it points to */
+typedef struct _GPT_COPY {
+    ULONGLONG HeaderLba;
+    UCHAR *Header;
+    UCHAR *Entries;
+    ULONG EntrySectors;
+    BOOL Valid;
+} GPT_COPY, *PGPT_COPY;
+
+/* FUNCTIONS ******************************************************************/
+
+static
+ULONG
+HeaderCrc(
+    const UCHAR *Sector)
+{
+    const EFI_PARTITION_HEADER *Header = (const EFI_PARTITION_HEADER *)Sector;
+    UCHAR Copy[512];
+
+    memcpy(Copy, Sector, GptHeaderGetHeaderSize(Header));
+    GptHeaderSetHeaderCRC32((PEFI_PARTITION_HEADER)Copy, 0);
+
+    return GptCrc32(Copy, GptHeaderGetHeaderSize(Header));
+}
+
+
+/* Reads the header at Lba and its entry array; Valid is set if both CRCs match */
+static
+void
+ReadGptCopy(
+    int fd,
+    PDISKENTRY DiskEntry,
+    ULONGLONG Lba,
+    PGPT_COPY Copy)
+{
+    ULONG BytesPerSector = DiskEntry->BytesPerSector;
+    PEFI_PARTITION_HEADER Header;
+    ULONG HeaderSize, EntrySize, EntryCount;
+    size_t ArraySize;
+
+    Copy->HeaderLba = Lba;
+    Copy->Valid = FALSE;
+
+    Copy->Header = calloc(1, BytesPerSector);
+    if (Copy->Header == NULL || !ReadDiskSectors(fd, DiskEntry, Lba, 1, Copy->Header))
+        return;
+
+    Header = (PEFI_PARTITION_HEADER)Copy->Header;
+    HeaderSize = GptHeaderGetHeaderSize(Header);
+    if (GptHeaderGetSignature(Header) != EFI_PT_SIGNATURE ||
+        HeaderSize < EFI_PT_HEADER_SIZE || HeaderSize > BytesPerSector ||
+        HeaderSize > 512 || GptHeaderGetMyLBA(Header) != Lba ||
+        HeaderCrc(Copy->Header) != GptHeaderGetHeaderCRC32(Header))
+        return;
+
+    EntrySize = GptHeaderGetSizeOfPartitionEntry(Header);
+    EntryCount = GptHeaderGetNumberOfEntries(Header);
+    if (EntrySize < EFI_PT_ENTRY_SIZE || (EntrySize % 8) != 0 ||
+        (ULONGLONG)EntryCount * EntrySize > MAX_ENTRY_ARRAY_SIZE)
+        return;
+
+    ArraySize = (size_t)EntryCount * EntrySize;
+    Copy->EntrySectors = (ULONG)((ArraySize + BytesPerSector - 1) / BytesPerSector);
+
+    Copy->Entries = calloc(Copy->EntrySectors, BytesPerSector);
+    if (Copy->Entries == NULL ||
+        !ReadDiskSectors(fd, DiskEntry, GptHeaderGetPartitionEntryLBA(Header),
+                         Copy->EntrySectors, Copy->Entries))
+        return;
+
+    Copy->Valid = (GptCrc32(Copy->Entries, ArraySize) == GptHeaderGetPartitionEntryCRC32(Header));
+}
+
+
+static
+void
+FreeGptCopy(
+    PGPT_COPY Copy)
+{
+    free(Copy->Entries);
+    free(Copy->Header);
+    Copy->Entries = NULL;
+    Copy->Header = NULL;
+}
+
+
+/*
+ * Writes Buffer to Count sectors at Lba, skipping every sector that already
+ * holds the same data. Returns the number of sectors written, or -1.
+ */
+static
+int
+WriteChangedSectors(
+    int fd,
+    PDISKENTRY DiskEntry,
+    ULONGLONG Lba,
+    ULONG Count,
+    const UCHAR *Buffer)
+{
+    ULONG BytesPerSector = DiskEntry->BytesPerSector;
+    UCHAR *OnDisk;
+    ULONG i, Run;
+    int Written = 0;
+
+    OnDisk = malloc((size_t)Count * BytesPerSector);
+    if (OnDisk == NULL || !ReadDiskSectors(fd, DiskEntry, Lba, Count, OnDisk))
+    {
+        free(OnDisk);
+        return -1;
+    }
+
+    for (i = 0; i < Count; i += Run)
+    {
+        /* Coalesce neighbouring changed sectors into one write */
+        for (Run = 0; i + Run < Count; Run++)
+        {
+            if (memcmp(OnDisk + (size_t)(i + Run) * BytesPerSector,
+                       Buffer + (size_t)(i + Run) * BytesPerSector, BytesPerSector) == 0)
+                break;
+        }
+
+        if (Run == 0)
+        {
+            Run = 1;
+            continue;
+        }
+
+        if (!WriteDiskSectors(fd, DiskEntry, Lba + i, Run, Buffer + (size_t)i * BytesPerSector))
+        {
+            free(OnDisk);
+            return -1;
+        }
+        Written += Run;
+    }
+
+    free(OnDisk);
+
+    return Written;
+}
+
+
+static
+ULONGLONG
+GetDeviceSectorCount(
+    int fd,
+    PDISKENTRY DiskEntry)
+{
+    unsigned long long Size;
+    struct stat StatBuffer;
+
+    /* The LUN may have grown since the disk list was built */
+    if (ioctl(fd, BLKGETSIZE64, &Size) == 0)
+        return Size / DiskEntry->BytesPerSector;
+
+    if (fstat(fd, &StatBuffer) == 0 && S_ISREG(StatBuffer.st_mode))
+        return (ULONGLONG)StatBuffer.st_size / DiskEntry->BytesPerSector;
+
+    return DiskEntry->SectorCount;
+}
+
+
+/* Returns the last LBA used by any partition of the entry array */
+static
+ULONGLONG
+GetLastUsedLba(
+    PGPT_COPY Copy)
+{
+    PEFI_PARTITION_HEADER Header = (PEFI_PARTITION_HEADER)Copy->Header;
+    PEFI_PARTITION_ENTRY Entry;
+    ULONG EntrySize = GptHeaderGetSizeOfPartitionEntry(Header);
+    ULONG EntryCount = GptHeaderGetNumberOfEntries(Header);
+    ULONGLONG LastLba = 0;
+    ULONG i;
+
+    for (i = 0; i < EntryCount; i++)
+    {
+        Entry = (PEFI_PARTITION_ENTRY)(Copy->Entries + (size_t)i * EntrySize);
+        if (GptEntryIsUsed(Entry) && GptEntryGetEndingLBA(Entry) > LastLba)
+            LastLba = GptEntryGetEndingLBA(Entry);
+    }
+
+    return LastLba;
+}
+
+
+/* Makes the protective MBR cover the whole disk again after a resize */
+static
+int
+RepairProtectiveMbr(
+    int fd,
+    PDISKENTRY DiskEntry,
+    ULONGLONG LastLba)
 {
-    (void)argc;
-    (void)argv;
+    PMASTER_BOOT_RECORD Mbr;
+    ULONG Expected = (LastLba > 0xFFFFFFFFULL) ? 0xFFFFFFFF : (ULONG)LastLba;
+    UCHAR *Sector;
+    int Written = 0, i;
+
+    Sector = malloc(DiskEntry->BytesPerSector);
+    if (Sector == NULL || !ReadDiskSectors(fd, DiskEntry, 0, 1, Sector))
+    {
+        free(Sector);
+        return -1;
+    }
+
+    Mbr = (PMASTER_BOOT_RECORD)Sector;
+    if (MbrGetMasterBootRecordMagic(Mbr) == MBR_SIGNATURE)
+    {
+        for (i = 0; i < 4; i++)
+        {
+            if (Mbr->PartitionTable[i].PartitionType == PARTITION_GPT &&
+                MbrEntryGetStartingLba(&Mbr->PartitionTable[i]) == 1 &&
+                MbrEntryGetSectorCount(&Mbr->PartitionTable[i]) != Expected)
+            {
+                MbrEntrySetSectorCount(&Mbr->PartitionTable[i], Expected);
+                Written = WriteChangedSectors(fd, DiskEntry, 0, 1, Sector);
+                break;
+            }
+        }
+    }
+
+    free(Sector);
+
+    return Written;
+}
+
+
+/*
+ * Rebuilds both GPT copies from whichever one is intact, placing the backup
+ * at the current end of the disk. Sectors that already hold the right data
+ * are not rewritten, so a healthy GPT costs only the reads.
+ */
+static
+BOOL
+RepairGpt(
+    PDISKENTRY DiskEntry)
+{
+    ULONG BytesPerSector = DiskEntry->BytesPerSector;
+    GPT_COPY Primary, Backup, Stale;
+    PGPT_COPY Good;
+    PEFI_PARTITION_HEADER GoodHeader, Header;
+    ULONGLONG LastLba, BackupEntryLba, OldAlternate = 0;
+    UCHAR *Buffer = NULL;
+    int Written = 0, Result;
+    BOOL Success = FALSE;
+    int fd;
+
+    memset(&Primary, 0, sizeof(Primary));
+    memset(&Backup, 0, sizeof(Backup));
+    memset(&Stale, 0, sizeof(Stale));
+
+    fd = OpenDiskDevice(DiskEntry, O_RDWR);
+    if (fd < 0)
+        return FALSE;
+
+    LastLba = GetDeviceSectorCount(fd, DiskEntry) - 1;
+
+    ReadGptCopy(fd, DiskEntry, 1, &Primary);
+    ReadGptCopy(fd, DiskEntry, LastLba, &Backup);
+
+    /* After a LUN grow the backup is still where the old end of the disk was */
+    if (Primary.Valid)
+    {
+        OldAlternate = GptHeaderGetAlternateLBA((PEFI_PARTITION_HEADER)Primary.Header);
+        if (OldAlternate != LastLba && OldAlternate > 1 && OldAlternate < LastLba)
+            ReadGptCopy(fd, DiskEntry, OldAlternate, &Stale);
+    }
+
+    printf("Primary GPT: %s\n", Primary.Valid ? "intact" : "damaged");
+    printf("Backup GPT:  %s\n", Backup.Valid ? "intact" :
+                                (Stale.Valid ? "intact, but not at the end of the disk" : "damaged"));
+
+    Good = Primary.Valid ? &Primary : (Backup.Valid ? &Backup : NULL);
+    if (Good == NULL)
+    {
+        printf("\nNeither copy of the GPT is intact. Use \"recover scan\" to look for partitions.\n\n");
+        goto done;
+    }
+
+    GoodHeader = (PEFI_PARTITION_HEADER)Good->Header;
+    BackupEntryLba = LastLba - Good->EntrySectors;
+
+    if (GetLastUsedLba(Good) >= BackupEntryLba ||
+        GptHeaderGetFirstUsableLBA(GoodHeader) < 2 + Good->EntrySectors)
+    {
+        printf("\nThe partitions do not fit on the disk; the GPT cannot be repaired in place.\n\n");
+        goto done;
+    }
+
+    Buffer = calloc(Good->EntrySectors + 1, BytesPerSector);
+    if (Buffer == NULL)
+        goto done;
+
+    /* Backup: entry array directly in front of the header in the last LBA */
+    memcpy(Buffer, Good->Entries, (size_t)Good->EntrySectors * BytesPerSector);
+    Header = (PEFI_PARTITION_HEADER)(Buffer + (size_t)Good->EntrySectors * BytesPerSector);
+    memcpy(Header, GoodHeader, GptHeaderGetHeaderSize(GoodHeader));
+    GptHeaderSetMyLBA(Header, LastLba);
+    GptHeaderSetAlternateLBA(Header, 1);
+    GptHeaderSetLastUsableLBA(Header, BackupEntryLba - 1);
+    GptHeaderSetPartitionEntryLBA(Header, BackupEntryLba);
+    GptHeaderSetHeaderCRC32(Header, HeaderCrc((UCHAR *)Header));
+
+    Result = WriteChangedSectors(fd, DiskEntry, BackupEntryLba, Good->EntrySectors + 1, Buffer);
+    if (Result < 0)
+        goto done;
+    Written += Result;
+
+    /* Primary: header in LBA 1, entry array right behind it */
+    memcpy(Buffer, Good->Entries, (size_t)Good->EntrySectors * BytesPerSector);
+    memset(Header, 0, BytesPerSector);
+    memcpy(Header, GoodHeader, GptHeaderGetHeaderSize(GoodHeader));
+    GptHeaderSetMyLBA(Header, 1);
+    GptHeaderSetAlternateLBA(Header, LastLba);
+    GptHeaderSetLastUsableLBA(Header, BackupEntryLba - 1);
+    GptHeaderSetPartitionEntryLBA(Header, 2);
+    GptHeaderSetHeaderCRC32(Header, HeaderCrc((UCHAR *)Header));
+
+    Result = WriteChangedSectors(fd, DiskEntry, 2, Good->EntrySectors, Buffer);
+    if (Result < 0)
+        goto done;
+    Written += Result;
+
+    Result = WriteChangedSectors(fd, DiskEntry, 1, 1, (UCHAR *)Header);
+    if (Result < 0)
+        goto done;
+    Written += Result;
+
+    /* Don't leave a second, outdated backup header in the grown area */
+    if (Stale.Valid && OldAlternate > GetLastUsedLba(Good))
+    {
+        memset(Buffer, 0, BytesPerSector);
+        Result = WriteChangedSectors(fd, DiskEntry, OldAlternate, 1, Buffer);
+        if (Result < 0)
+            goto done;
+        Written += Result;
+    }
+
+    Result = RepairProtectiveMbr(fd, DiskEntry, LastLba);
+    if (Result < 0)
+        goto done;
+    Written += Result;
+
+    if (Written > 0 && fsync(fd) != 0)
+    {
+        perror("fsync");
+        goto done;
+    }
+
+    DiskEntry->SectorCount = LastLba + 1;
+    if (Written > 0)
+        RememberPartitionTable(DiskEntry);
+
+    if (Written == 0)
+        printf("\nThe GPT is intact; nothing was written.\n\n");
+    else
+        printf("\nDiskPart repaired the GPT (%d sectors written).\n\n", Written);
+
+    Success = TRUE;
+
+done:
+    free(Buffer);
+    FreeGptCopy(&Stale);
+    FreeGptCopy(&Backup);
+    FreeGptCopy(&Primary);
+    close(fd);
+
+    return Success;
+}
+
+
+BOOL
+repair_main(
+    int argc,
+    char **argv)
+{
+    if (CurrentDisk == NULL)
+    {
+        printf("No disk selected.\n");
+        CommandFailed = TRUE;
+        return TRUE;
+    }
+
+    if (argc < 2 || strcasecmp(argv[1], "gpt") != 0)
+    {
+        printf("Usage: repair gpt\n");
+        return TRUE;
+    }
+
+    if (!LockDisk(CurrentDisk, TRUE))
+    {
+        printf("DiskPart failed to repair the GPT.\n\n");
+        return TRUE;
+    }
+
+    if (!RepairGpt(CurrentDisk))
+        printf("DiskPart failed to repair the GPT.\n\n");
 
-    printf("\nTODO: Implement partition repair functionality later.\n");
+    UnlockDisk(CurrentDisk);
 
-    return 0; // Success
+    return TRUE;
 }
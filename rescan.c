@@ -6,15 +6,12 @@
  * PROGRAMMERS:     Radiump
  */
 
-#include <stdio.h>
+#include "diskpart.h"
 
-// Declare functions you would have implemented for managing partitions/volumes
-void DestroyVolumeList(void);
-void DestroyPartitionList(void);
-void CreatePartitionList(void);
-void CreateVolumeList(void);
-
-int rescan_main(int argc, char **argv)
+BOOL
+rescan_main(
+    int argc,
+    char **argv)
 {
     (void)argc;
     (void)argv;
@@ -28,5 +25,5 @@ int rescan_main(int argc, char **argv)
 
     printf("Rescan finished.\n");
 
-    return 0; // Success
+    return TRUE;
 }
@@ -8,9 +8,12 @@
 
 #include "diskpart.h"
 
-BOOL retain_main(int argc, wchar_t **argv)
+BOOL retain_main(int argc, char **argv)
 {
     // TODO: Implement retain command for Linux disk management
     // For now, just return TRUE to indicate success.
-    return 1;  // TRUE in Linux code (usually 1)
+    (void)argc;
+    (void)argv;
+
+    return TRUE;
 }
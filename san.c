@@ -8,9 +8,12 @@
 
 #include "diskpart.h"
 
-BOOL san_main(int argc, wchar_t **argv)
+BOOL san_main(int argc, char **argv)
 {
     // TODO: Implement SAN command for Linux disk management
     // Currently a stub, returns TRUE to indicate success.
-    return 1;  // TRUE
+    (void)argc;
+    (void)argv;
+
+    return TRUE;
 }
@@ -6,61 +6,19 @@
  * PROGRAMMERS:     Adapted by Radiump for Linux
  */
 
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <errno.h>
-#include <ctype.h>
+#include "diskpart.h"
 
-// Example structs for disks, partitions, and volumes
-typedef struct DiskEntry {
-    int DiskNumber;
-    struct DiskEntry* next;
-    struct PartitionEntry* primaryPartitions;
-    struct PartitionEntry* logicalPartitions;
-} DiskEntry;
-
-typedef struct PartitionEntry {
-    int PartitionType;
-    int PartitionNumber;
-    struct PartitionEntry* next;
-} PartitionEntry;
-
-typedef struct VolumeEntry {
-    int VolumeNumber;
-    struct VolumeEntry* next;
-} VolumeEntry;
-
-// Globals simulating current selection and lists
-DiskEntry* DiskListHead = NULL;
-DiskEntry* CurrentDisk = NULL;
-
-PartitionEntry* CurrentPartition = NULL;
-
-VolumeEntry* VolumeListHead = NULL;
-VolumeEntry* CurrentVolume = NULL;
-
-// Utility: check if string is decimal number
-int IsDecString(const char* str)
-{
-    if (!str || *str == '\0')
-        return 0;
-    while (*str)
-    {
-        if (!isdigit((unsigned char)*str))
-            return 0;
-        str++;
-    }
-    return 1;
-}
+#include <stdarg.h>
+#include <strings.h>
 
 // Print functions (simulate ConResPrintf)
-void PrintError(const char* msg)
+static void PrintError(const char* msg)
 {
     fprintf(stderr, "%s\n", msg);
+    CommandFailed = TRUE;
 }
 
-void PrintInfo(const char* fmt, ...)
+static void PrintInfo(const char* fmt, ...)
 {
     va_list args;
     va_start(args, fmt);
@@ -71,15 +29,16 @@ void PrintInfo(const char* fmt, ...)
 
 /* FUNCTIONS */
 
-int SelectDisk(int argc, char* argv[])
+BOOL SelectDisk(int argc, char* argv[])
 {
-    DiskEntry* entry;
-    int ulValue;
+    ListEntry* entry;
+    PDISKENTRY DiskEntry;
+    unsigned long ulValue;
 
     if (argc > 3)
     {
         PrintError("Invalid number of arguments.");
-        return 1;
+        return TRUE;
     }
 
     if (argc == 2)
@@ -87,21 +46,21 @@ int SelectDisk(int argc, char* argv[])
         if (CurrentDisk == NULL)
             PrintInfo("No disk is currently selected.");
         else
-            PrintInfo("Disk %d is currently selected.", CurrentDisk->DiskNumber);
-        return 0;
+            PrintInfo("Disk %lu is currently selected.", (unsigned long)CurrentDisk->DiskNumber);
+        return TRUE;
     }
 
     if (strcasecmp(argv[2], "system") == 0)
     {
-        if (DiskListHead == NULL)
+        if (IsListEmpty(&DiskListHead))
         {
             PrintError("No disks found.");
-            return 1;
+            return TRUE;
         }
-        CurrentDisk = DiskListHead;
+        CurrentDisk = CONTAINING_RECORD(DiskListHead.Flink, DISKENTRY, ListEntry);
         CurrentPartition = NULL;
-        PrintInfo("Disk %d selected.", CurrentDisk->DiskNumber);
-        return 0;
+        PrintInfo("Disk %lu selected.", (unsigned long)CurrentDisk->DiskNumber);
+        return TRUE;
     }
     else if (strcasecmp(argv[2], "next") == 0)
     {
@@ -109,70 +68,74 @@ int SelectDisk(int argc, char* argv[])
         {
             CurrentPartition = NULL;
             PrintError("Disk enumeration has not been started.");
-            return 1;
+            return TRUE;
         }
 
-        if (CurrentDisk->next == NULL)
+        if (CurrentDisk->ListEntry.Flink == &DiskListHead)
         {
             CurrentDisk = NULL;
             CurrentPartition = NULL;
             PrintError("Disk enumeration finished.");
-            return 1;
+            return TRUE;
         }
 
-        CurrentDisk = CurrentDisk->next;
+        CurrentDisk = CONTAINING_RECORD(CurrentDisk->ListEntry.Flink, DISKENTRY, ListEntry);
         CurrentPartition = NULL;
-        PrintInfo("Disk %d selected.", CurrentDisk->DiskNumber);
-        return 0;
+        PrintInfo("Disk %lu selected.", (unsigned long)CurrentDisk->DiskNumber);
+        return TRUE;
     }
     else if (IsDecString(argv[2]))
     {
-        ulValue = strtol(argv[2], NULL, 10);
-        if (ulValue == 0 && errno == ERANGE)
+        errno = 0;
+        ulValue = strtoul(argv[2], NULL, 10);
+        if (errno == ERANGE)
         {
             PrintError("Invalid disk number.");
-            return 1;
+            return TRUE;
         }
 
-        entry = DiskListHead;
-        while (entry != NULL)
+        for (entry = DiskListHead.Flink; entry != &DiskListHead; entry = entry->Flink)
         {
-            if (entry->DiskNumber == ulValue)
+            DiskEntry = CONTAINING_RECORD(entry, DISKENTRY, ListEntry);
+            if (DiskEntry->DiskNumber == ulValue)
             {
-                CurrentDisk = entry;
+                CurrentDisk = DiskEntry;
                 CurrentPartition = NULL;
-                PrintInfo("Disk %d selected.", CurrentDisk->DiskNumber);
-                return 0;
+                PrintInfo("Disk %lu selected.", (unsigned long)CurrentDisk->DiskNumber);
+                return TRUE;
             }
-            entry = entry->next;
         }
     }
     else
     {
         PrintError("Invalid argument.");
-        return 1;
+        return TRUE;
     }
 
     PrintError("Disk not found.");
-    return 1;
+    return TRUE;
 }
 
-int SelectPartition(int argc, char* argv[])
+BOOL SelectPartition(int argc, char* argv[])
 {
-    PartitionEntry* entry;
-    int ulValue;
-    int partNumber = 1;
+    ListEntry* Heads[2];
+    ListEntry* entry;
+    PPARTENTRY PartEntry;
+    unsigned long ulValue;
+    unsigned long partNumber = 1;
+    int i;
 
     if (argc > 3)
     {
         PrintError("Invalid number of arguments.");
-        return 1;
+        return TRUE;
     }
 
     if (CurrentDisk == NULL)
     {
         PrintInfo("No disk selected.");
-        return 1;
+        CommandFailed = TRUE;
+        return TRUE;
     }
 
     if (argc == 2)
@@ -180,70 +143,60 @@ int SelectPartition(int argc, char* argv[])
         if (CurrentPartition == NULL)
             PrintInfo("No partition is currently selected.");
         else
-            PrintInfo("Partition %d is currently selected.", CurrentPartition->PartitionNumber);
-        return 0;
+            PrintInfo("Partition %lu is currently selected.", (unsigned long)CurrentPartition->PartitionNumber);
+        return TRUE;
     }
 
     if (!IsDecString(argv[2]))
     {
         PrintError("Invalid argument: partition number must be numeric.");
-        return 1;
+        return TRUE;
     }
 
-    ulValue = strtol(argv[2], NULL, 10);
-    if (ulValue == 0 && errno == ERANGE)
+    errno = 0;
+    ulValue = strtoul(argv[2], NULL, 10);
+    if (errno == ERANGE)
     {
         PrintError("Invalid partition number.");
-        return 1;
+        return TRUE;
     }
 
-    // Search primary partitions
-    entry = CurrentDisk->primaryPartitions;
-    while (entry != NULL)
-    {
-        if (entry->PartitionType != 0)
-        {
-            if (partNumber == ulValue)
-            {
-                CurrentPartition = entry;
-                PrintInfo("Partition %d selected.", partNumber);
-                return 0;
-            }
-            partNumber++;
-        }
-        entry = entry->next;
-    }
+    // Primary partitions first, then logical ones, as list partition numbers them
+    Heads[0] = &CurrentDisk->PrimaryPartListHead;
+    Heads[1] = &CurrentDisk->LogicalPartListHead;
 
-    // Search logical partitions
-    entry = CurrentDisk->logicalPartitions;
-    while (entry != NULL)
+    for (i = 0; i < 2; i++)
     {
-        if (entry->PartitionType != 0)
+        for (entry = Heads[i]->Flink; entry != Heads[i]; entry = entry->Flink)
         {
+            PartEntry = CONTAINING_RECORD(entry, PARTENTRY, ListEntry);
+            if (!PartEntry->IsPartitioned)
+                continue;
+
             if (partNumber == ulValue)
             {
-                CurrentPartition = entry;
-                PrintInfo("Partition %d selected.", partNumber);
-                return 0;
+                CurrentPartition = PartEntry;
+                PrintInfo("Partition %lu selected.", partNumber);
+                return TRUE;
             }
             partNumber++;
         }
-        entry = entry->next;
     }
 
     PrintError("Partition not found.");
-    return 1;
+    return TRUE;
 }
 
-int SelectVolume(int argc, char* argv[])
+BOOL SelectVolume(int argc, char* argv[])
 {
-    VolumeEntry* entry;
-    int ulValue;
+    ListEntry* entry;
+    PVOLENTRY VolumeEntry;
+    unsigned long ulValue;
 
     if (argc > 3)
     {
         PrintError("Invalid number of arguments.");
-        return 1;
+        return TRUE;
     }
 
     if (argc == 2)
@@ -251,35 +204,35 @@ int SelectVolume(int argc, char* argv[])
         if (CurrentVolume == NULL)
             PrintInfo("No volume is currently selected.");
         else
-            PrintInfo("Volume %d is currently selected.", CurrentVolume->VolumeNumber);
-        return 0;
+            PrintInfo("Volume %lu is currently selected.", (unsigned long)CurrentVolume->VolumeNumber);
+        return TRUE;
     }
 
     if (!IsDecString(argv[2]))
     {
         PrintError("Invalid argument: volume number must be numeric.");
-        return 1;
+        return TRUE;
     }
 
-    ulValue = strtol(argv[2], NULL, 10);
-    if (ulValue == 0 && errno == ERANGE)
+    errno = 0;
+    ulValue = strtoul(argv[2], NULL, 10);
+    if (errno == ERANGE)
     {
         PrintError("Invalid volume number.");
-        return 1;
+        return TRUE;
     }
 
-    entry = VolumeListHead;
-    while (entry != NULL)
+    for (entry = VolumeListHead.Flink; entry != &VolumeListHead; entry = entry->Flink)
     {
-        if (entry->VolumeNumber == ulValue)
+        VolumeEntry = CONTAINING_RECORD(entry, VOLENTRY, ListEntry);
+        if (VolumeEntry->VolumeNumber == ulValue)
         {
-            CurrentVolume = entry;
-            PrintInfo("Volume %d selected.", CurrentVolume->VolumeNumber);
-            return 0;
+            CurrentVolume = VolumeEntry;
+            PrintInfo("Volume %lu selected.", (unsigned long)CurrentVolume->VolumeNumber);
+            return TRUE;
         }
-        entry = entry->next;
     }
 
     PrintError("Volume not found.");
-    return 1;
+    return TRUE;
 }
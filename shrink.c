@@ -6,12 +6,85 @@
  * PROGRAMMERS:     Adapted by Mathieux Fontaine for Linux
  */
 
-#include <stdio.h>
+#include "diskpart.h"
 
-int shrink_main(int argc, char* argv[])
+#include <strings.h>
+
+/* FUNCTIONS ******************************************************************/
+
+/*
+ * Returns the number of bytes the selected partition can give up, based on
+ * the last allocated block of its filesystem.
+ */
+static
+BOOL
+QueryMaxShrink(
+    PPARTENTRY PartEntry,
+    ULONGLONG *MaxBytes)
+{
+    const char *FileSystemName = NULL;
+    ULONGLONG UsedSectors;
+
+    if (!QueryFileSystemUsedSectors(PartEntry, &UsedSectors, &FileSystemName))
+        return FALSE;
+
+    if (UsedSectors > PartEntry->SectorCount)
+        UsedSectors = PartEntry->SectorCount;
+
+    *MaxBytes = (PartEntry->SectorCount - UsedSectors) * PartEntry->DiskEntry->BytesPerSector;
+
+    DPRINT("%s: %llu of %llu sectors in use\n", FileSystemName, UsedSectors, PartEntry->SectorCount);
+    return TRUE;
+}
+
+
+BOOL
+shrink_main(
+    int argc,
+    char **argv)
 {
-    // TODO: Implement partition shrinking logic here
+    ULONGLONG MaxBytes;
+    BOOL bQueryMax = FALSE;
+    int i;
+
+    if (CurrentDisk == NULL)
+    {
+        printf("No disk selected.\n");
+        CommandFailed = TRUE;
+        return TRUE;
+    }
+
+    if (CurrentPartition == NULL || !CurrentPartition->IsPartitioned)
+    {
+        printf("No partition selected.\n");
+        CommandFailed = TRUE;
+        return TRUE;
+    }
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcasecmp(argv[i], "querymax") == 0)
+            bQueryMax = TRUE;
+        else if (strcasecmp(argv[i], "noerr") != 0 && strcasecmp(argv[i], "nowait") != 0)
+            DPRINT("Ignoring argument %s\n", argv[i]);
+    }
+
+    if (!QueryMaxShrink(CurrentPartition, &MaxBytes))
+    {
+        printf("\nDiskPart could not determine how far the filesystem can shrink.\n");
+        printf("The filesystem is not supported or is damaged.\n\n");
+        return TRUE;
+    }
+
+    if (bQueryMax)
+    {
+        printf("\nThe maximum number of reclaimable bytes is: %llu MB\n\n",
+               (unsigned long long)(MaxBytes / 1048576ULL));
+        return TRUE;
+    }
+
+    printf("\nShrinking the filesystem itself is not supported yet.\n");
+    printf("Use SHRINK QUERYMAX to see how much space can be reclaimed.\n\n");
 
-    printf("Shrink command not yet implemented.\n");
-    return 0;
+    return TRUE;
 }
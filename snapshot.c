@@ -0,0 +1,90 @@
+/*
+ * PROJECT:         ReactOS DiskPart (Linux port)
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * FILE:            base/system/diskpart/snapshot.c
+ * PURPOSE:         Manages all the partitions of the OS in an interactive way.
+ */
+
+#include "diskpart.h"
+
+#include <strings.h>
+
+/* FUNCTIONS ******************************************************************/
+
+/* snapshot vdisk [file=<path>] target=<path> [noerr] */
+BOOL
+snapshot_main(
+    int argc,
+    char **argv)
+{
+    VDISKENTRY VDiskEntry;
+    char *pszSuffix = NULL;
+    char *pszFile = NULL;
+    char *pszTarget = NULL;
+    const char *FileName;
+    BOOL bCloned;
+    int i;
+
+    if (argc < 2 || strcasecmp(argv[1], "vdisk") != 0)
+    {
+        printf("Usage: snapshot vdisk [file=<path>] target=<path>\n");
+        return TRUE;
+    }
+
+    for (i = 2; i < argc; i++)
+    {
+        if (HasPrefix(argv[i], "file=", &pszSuffix))
+        {
+            free(pszFile);
+            pszFile = DuplicateQuotedString(pszSuffix);
+        }
+        else if (HasPrefix(argv[i], "target=", &pszSuffix))
+        {
+            free(pszTarget);
+            pszTarget = DuplicateQuotedString(pszSuffix);
+        }
+        else if (strcasecmp(argv[i], "noerr") != 0)
+        {
+            printf("Invalid argument: %s\n", argv[i]);
+            goto done;
+        }
+    }
+
+    FileName = pszFile ? pszFile : CurrentVirtualDisk;
+    if (FileName[0] == '\0')
+    {
+        printf("No virtual disk selected.\n");
+        goto done;
+    }
+
+    if (pszTarget == NULL)
+    {
+        printf("Usage: snapshot vdisk [file=<path>] target=<path>\n");
+        goto done;
+    }
+
+    /* Writes through the loop device would tear the snapshot */
+    if (FindAttachedVirtualDisk(FileName, &VDiskEntry) && !VDiskEntry.ReadOnly)
+    {
+        printf("\nThe virtual disk is attached read-write as %s.\n", VDiskEntry.DeviceName);
+        printf("Detach it or attach it read-only before taking a snapshot.\n\n");
+        goto done;
+    }
+
+    if (!SnapshotVirtualDisk(FileName, pszTarget, &bCloned))
+    {
+        printf("\nDiskPart failed to create the snapshot.\n\n");
+        goto done;
+    }
+
+    if (bCloned)
+        printf("\nDiskPart created the snapshot %s; it shares all blocks with the image.\n\n", pszTarget);
+    else
+        printf("\nDiskPart created the snapshot %s as a sparse copy.\n\n", pszTarget);
+
+done:
+    free(pszTarget);
+    free(pszFile);
+
+    return TRUE;
+}
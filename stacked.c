@@ -0,0 +1,1133 @@
+/*
+ * PROJECT:         ReactOS DiskPart (Linux port)
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * FILE:            base/system/diskpart/stacked.c
+ * PURPOSE:         Volumes on device-mapper and md devices, resolved through
+ *                  the device stack to the disk extents under them.
+ */
+
+#include "diskpart.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/sysmacros.h>
+#include <linux/dm-ioctl.h>
+
+/*
+ * One pass over /sys/class/block builds a node for every block device:
+ * the disks of the disk list, partitions with their offset on the device
+ * holding them, and the dm and md devices stacked on top. The mappings of
+ * a dm device come from its whole table, fetched with one DM_TABLE_STATUS,
+ * as sysfs only has the slaves; md members and their data offsets are in
+ * sysfs. A dm or md device without holders is a volume, and its extents
+ * are found by following the mappings down until they reach disks.
+ *
+ * Where a mapping is not linear, such as a mirror leg, a thin pool or an
+ * md member, any range of the upper device is taken to use all of the
+ * lower one.
+ */
+
+#define DM_TABLE_BUFFER_SIZE    (16 * 1024)
+#define DM_TABLE_BUFFER_MAX     (1024 * 1024)
+
+/* Deeper than any real stack; guards against loops in what sysfs shows */
+#define MAX_STACK_DEPTH         16
+
+/* An LVM uuid is "LVM-", the VG and the LV uuid; internal layers add a suffix */
+#define LVM_UUID_LENGTH         68
+
+typedef enum _BLOCK_NODE_KIND {
+    BLOCK_NODE_OTHER,
+    BLOCK_NODE_DISK,
+    BLOCK_NODE_PARTITION,
+    BLOCK_NODE_DM,
+    BLOCK_NODE_MD
+} BLOCK_NODE_KIND;
+
+typedef enum _SEGMENT_KIND {
+    SEGMENT_LINEAR,
+    SEGMENT_STRIPED,
+    SEGMENT_WHOLE
+} SEGMENT_KIND;
+
+/*
+ * Sectors [Start, Start + Length) of a dm or md device, mapped onto
+ * Device from Offset on. All units are 512-byte sectors.
+ */
+typedef struct _DEVICE_SEGMENT {
+    SEGMENT_KIND Kind;
+    ULONGLONG Start;
+    ULONGLONG Length;
+    dev_t Device;
+    ULONGLONG Offset;
+    ULONGLONG DeviceLength;     /* Whole: the range used on Device */
+    ULONG Stripes;              /* Striped: the device is one of these */
+    ULONG ChunkSize;
+} DEVICE_SEGMENT, *PDEVICE_SEGMENT;
+
+typedef struct _BLOCK_NODE {
+    dev_t Device;
+    BLOCK_NODE_KIND Kind;
+    char Name[32];
+    ULONGLONG Size;
+    PDISKENTRY DiskEntry;       /* Disk */
+    dev_t Parent;               /* Partition: the device holding it */
+    ULONGLONG Start;            /* Partition: where on Parent */
+    ULONG FirstSegment;         /* dm and md */
+    ULONG SegmentCount;
+    VOLUME_TYPE VolumeType;
+    BOOL HasHolders;
+    BOOL Hidden;                /* LVM internal layers */
+    BOOL Multipath;             /* dm: its slaves are paths to one LUN */
+} BLOCK_NODE, *PBLOCK_NODE;
+
+typedef struct _MOUNT_ENTRY {
+    dev_t Device;
+    ULONG Line;
+    char *MountPoint;
+} MOUNT_ENTRY, *PMOUNT_ENTRY;
+
+typedef struct _STACK_SCAN {
+    PBLOCK_NODE Nodes;
+    ULONG NodeCount;
+    ULONG NodesAllocated;
+    PDEVICE_SEGMENT Segments;
+    ULONG SegmentCount;
+    ULONG SegmentsAllocated;
+    PDISK_EXTENT Extents;
+    ULONG ExtentCount;
+    ULONG ExtentsAllocated;
+    PDISKENTRY *Disks;          /* By device name */
+    ULONG DiskCount;
+    PMOUNT_ENTRY Mounts;        /* By device */
+    ULONG MountCount;
+} STACK_SCAN, *PSTACK_SCAN;
+
+/* FUNCTIONS ******************************************************************/
+
+/* Makes room for one more element in a growing array */
+static
+BOOL
+GrowArray(
+    void **Array,
+    ULONG Count,
+    ULONG *Allocated,
+    size_t ElementSize)
+{
+    void *NewArray;
+    ULONG NewAllocated;
+
+    if (Count < *Allocated)
+        return TRUE;
+
+    NewAllocated = *Allocated ? *Allocated * 2 : 64;
+    NewArray = realloc(*Array, NewAllocated * ElementSize);
+    if (NewArray == NULL)
+        return FALSE;
+
+    *Array = NewArray;
+    *Allocated = NewAllocated;
+
+    return TRUE;
+}
+
+
+static
+int
+CompareDiskName(
+    const void *Left,
+    const void *Right)
+{
+    return strcmp((*(PDISKENTRY const *)Left)->DeviceName, (*(PDISKENTRY const *)Right)->DeviceName);
+}
+
+
+static
+int
+CompareNodeDevice(
+    const void *Left,
+    const void *Right)
+{
+    dev_t A = ((const BLOCK_NODE *)Left)->Device;
+    dev_t B = ((const BLOCK_NODE *)Right)->Device;
+
+    return (A > B) - (A < B);
+}
+
+
+static
+int
+CompareMountDevice(
+    const void *Left,
+    const void *Right)
+{
+    const MOUNT_ENTRY *A = Left;
+    const MOUNT_ENTRY *B = Right;
+
+    if (A->Device != B->Device)
+        return (A->Device > B->Device) ? 1 : -1;
+
+    return (A->Line > B->Line) - (A->Line < B->Line);
+}
+
+
+static
+int
+CompareExtent(
+    const void *Left,
+    const void *Right)
+{
+    const DISK_EXTENT *A = Left;
+    const DISK_EXTENT *B = Right;
+
+    if (A->DiskNumber != B->DiskNumber)
+        return (A->DiskNumber > B->DiskNumber) ? 1 : -1;
+
+    return (A->StartingOffset > B->StartingOffset) - (A->StartingOffset < B->StartingOffset);
+}
+
+
+static
+PDISKENTRY
+FindDiskByName(
+    PSTACK_SCAN Scan,
+    const char *Name)
+{
+    DISKENTRY Key;
+    PDISKENTRY KeyPointer = &Key;
+    PDISKENTRY *Found;
+
+    snprintf(Key.DeviceName, sizeof(Key.DeviceName), "/dev/%s", Name);
+
+    Found = bsearch(&KeyPointer, Scan->Disks, Scan->DiskCount, sizeof(PDISKENTRY), CompareDiskName);
+
+    return Found ? *Found : NULL;
+}
+
+
+static
+PBLOCK_NODE
+FindNode(
+    PSTACK_SCAN Scan,
+    dev_t Device)
+{
+    BLOCK_NODE Key;
+
+    Key.Device = Device;
+
+    return bsearch(&Key, Scan->Nodes, Scan->NodeCount, sizeof(BLOCK_NODE), CompareNodeDevice);
+}
+
+
+/* Reads a "major:minor" file such as /sys/class/block/sda/dev */
+static
+BOOL
+ReadDeviceNumber(
+    const char *Path,
+    dev_t *Device)
+{
+    char Buffer[32];
+    unsigned int Major, Minor;
+
+    if (!ReadSysfsString(Path, Buffer, sizeof(Buffer)) ||
+        sscanf(Buffer, "%u:%u", &Major, &Minor) != 2)
+        return FALSE;
+
+    *Device = makedev(Major, Minor);
+    return TRUE;
+}
+
+
+/* The device a sysfs link such as md/dev-sdb1/block points to */
+static
+BOOL
+ReadLinkedDevice(
+    const char *LinkPath,
+    dev_t *Device)
+{
+    char Target[MAX_PATH];
+    char Path[MAX_PATH * 2];
+    const char *Name;
+    ssize_t Length;
+
+    Length = readlink(LinkPath, Target, sizeof(Target) - 1);
+    if (Length <= 0)
+        return FALSE;
+    Target[Length] = '\0';
+
+    Name = strrchr(Target, '/');
+    Name = Name ? Name + 1 : Target;
+
+    snprintf(Path, sizeof(Path), "/sys/class/block/%s/dev", Name);
+    return ReadDeviceNumber(Path, Device);
+}
+
+
+static
+BOOL
+HasDirectoryEntries(
+    const char *Path)
+{
+    struct dirent *Entry;
+    BOOL Found = FALSE;
+    DIR *Directory;
+
+    Directory = opendir(Path);
+    if (Directory == NULL)
+        return FALSE;
+
+    while (!Found && (Entry = readdir(Directory)) != NULL)
+        Found = (Entry->d_name[0] != '.');
+
+    closedir(Directory);
+    return Found;
+}
+
+
+/* Fills the node of one entry of /sys/class/block */
+static
+BOOL
+ReadBlockNode(
+    PSTACK_SCAN Scan,
+    const char *Name,
+    PBLOCK_NODE Node)
+{
+    char Directory[MAX_PATH];
+    char Path[MAX_PATH * 2];
+    char Uuid[DM_UUID_LEN];
+    char Link[MAX_PATH];
+    char *Parent;
+    ssize_t Length;
+
+    memset(Node, 0, sizeof(*Node));
+    snprintf(Node->Name, sizeof(Node->Name), "%s", Name);
+    snprintf(Directory, sizeof(Directory), "/sys/class/block/%s", Name);
+
+    snprintf(Path, sizeof(Path), "%s/dev", Directory);
+    if (!ReadDeviceNumber(Path, &Node->Device))
+        return FALSE;
+
+    snprintf(Path, sizeof(Path), "%s/size", Directory);
+    Node->Size = ReadSysfsNumber(Path);
+
+    snprintf(Path, sizeof(Path), "%s/partition", Directory);
+    if (access(Path, F_OK) == 0)
+    {
+        Node->Kind = BLOCK_NODE_PARTITION;
+
+        snprintf(Path, sizeof(Path), "%s/start", Directory);
+        Node->Start = ReadSysfsNumber(Path);
+
+        /* .../block/sda/sda1: the directory above is the device holding it */
+        Length = readlink(Directory, Link, sizeof(Link) - 1);
+        if (Length <= 0)
+            return FALSE;
+        Link[Length] = '\0';
+
+        Parent = strrchr(Link, '/');
+        if (Parent == NULL)
+            return FALSE;
+        *Parent = '\0';
+        Parent = strrchr(Link, '/');
+        Parent = Parent ? Parent + 1 : Link;
+
+        snprintf(Path, sizeof(Path), "/sys/class/block/%s/dev", Parent);
+        return ReadDeviceNumber(Path, &Node->Parent);
+    }
+
+    if (strncmp(Name, "dm-", 3) == 0)
+    {
+        Node->Kind = BLOCK_NODE_DM;
+
+        snprintf(Path, sizeof(Path), "%s/dm/uuid", Directory);
+        if (ReadSysfsString(Path, Uuid, sizeof(Uuid)))
+        {
+            /* A map without holders is a volume, a file system right on the LUN */
+            Node->Multipath = (strncmp(Uuid, "mpath-", 6) == 0);
+            Node->Hidden = (strncmp(Uuid, "LVM-", 4) == 0 && strlen(Uuid) > LVM_UUID_LENGTH);
+        }
+    }
+    else
+    {
+        snprintf(Path, sizeof(Path), "%s/md", Directory);
+        if (access(Path, F_OK) == 0)
+        {
+            Node->Kind = BLOCK_NODE_MD;
+        }
+        else
+        {
+            Node->DiskEntry = FindDiskByName(Scan, Name);
+            Node->Kind = Node->DiskEntry ? BLOCK_NODE_DISK : BLOCK_NODE_OTHER;
+            return TRUE;
+        }
+    }
+
+    snprintf(Path, sizeof(Path), "%s/holders", Directory);
+    Node->HasHolders = HasDirectoryEntries(Path);
+    Node->VolumeType = VOLUME_TYPE_SIMPLE;
+
+    return TRUE;
+}
+
+
+static
+BOOL
+ScanBlockNodes(
+    PSTACK_SCAN Scan)
+{
+    struct dirent *Entry;
+    DIR *Directory;
+
+    Directory = opendir("/sys/class/block");
+    if (Directory == NULL)
+        return TRUE;
+
+    while ((Entry = readdir(Directory)) != NULL)
+    {
+        if (Entry->d_name[0] == '.')
+            continue;
+
+        if (!GrowArray((void **)&Scan->Nodes, Scan->NodeCount, &Scan->NodesAllocated, sizeof(BLOCK_NODE)))
+        {
+            closedir(Directory);
+            return FALSE;
+        }
+
+        if (ReadBlockNode(Scan, Entry->d_name, &Scan->Nodes[Scan->NodeCount]))
+            Scan->NodeCount++;
+    }
+
+    closedir(Directory);
+
+    qsort(Scan->Nodes, Scan->NodeCount, sizeof(BLOCK_NODE), CompareNodeDevice);
+    return TRUE;
+}
+
+
+static
+PDEVICE_SEGMENT
+AddSegment(
+    PSTACK_SCAN Scan,
+    PBLOCK_NODE Node,
+    SEGMENT_KIND Kind,
+    ULONGLONG Start,
+    ULONGLONG Length,
+    dev_t Device,
+    ULONGLONG Offset)
+{
+    PDEVICE_SEGMENT Segment;
+
+    if (!GrowArray((void **)&Scan->Segments, Scan->SegmentCount, &Scan->SegmentsAllocated,
+                   sizeof(DEVICE_SEGMENT)))
+        return NULL;
+
+    if (Node->SegmentCount == 0)
+        Node->FirstSegment = Scan->SegmentCount;
+
+    Segment = &Scan->Segments[Scan->SegmentCount++];
+    memset(Segment, 0, sizeof(*Segment));
+    Segment->Kind = Kind;
+    Segment->Start = Start;
+    Segment->Length = Length;
+    Segment->Device = Device;
+    Segment->Offset = Offset;
+    Node->SegmentCount++;
+
+    return Segment;
+}
+
+
+/* A mapping onto all of Device, or onto its first DeviceLength sectors from Offset */
+static
+BOOL
+AddWholeSegment(
+    PSTACK_SCAN Scan,
+    PBLOCK_NODE Node,
+    ULONGLONG Start,
+    ULONGLONG Length,
+    dev_t Device,
+    ULONGLONG Offset,
+    ULONGLONG DeviceLength)
+{
+    PDEVICE_SEGMENT Segment;
+    PBLOCK_NODE Lower;
+
+    if (DeviceLength == 0)
+    {
+        Lower = FindNode(Scan, Device);
+        if (Lower == NULL || Lower->Size <= Offset)
+            return TRUE;
+        DeviceLength = Lower->Size - Offset;
+    }
+
+    Segment = AddSegment(Scan, Node, SEGMENT_WHOLE, Start, Length, Device, Offset);
+    if (Segment == NULL)
+        return FALSE;
+
+    Segment->DeviceLength = DeviceLength;
+    return TRUE;
+}
+
+
+static
+BOOL
+ParseDeviceToken(
+    const char *Token,
+    dev_t *Device)
+{
+    unsigned int Major, Minor;
+    int Used;
+
+    if (sscanf(Token, "%u:%u%n", &Major, &Minor, &Used) != 2 || Token[Used] != '\0')
+        return FALSE;
+
+    *Device = makedev(Major, Minor);
+    return TRUE;
+}
+
+
+/* Turns one target of a dm table into segments */
+static
+BOOL
+AddTargetSegments(
+    PSTACK_SCAN Scan,
+    PBLOCK_NODE Node,
+    const struct dm_target_spec *Target,
+    char *Parameters)
+{
+    char *Tokens[256];
+    char *Context = NULL;
+    char *Token;
+    PDEVICE_SEGMENT Segment;
+    ULONG TokenCount = 0, Stripes, i;
+    dev_t Device;
+
+    for (Token = strtok_r(Parameters, " ", &Context);
+         Token != NULL && TokenCount < ARRAYSIZE(Tokens);
+         Token = strtok_r(NULL, " ", &Context))
+        Tokens[TokenCount++] = Token;
+
+    /* linear <dev> <offset> */
+    if (strcmp(Target->target_type, "linear") == 0 && TokenCount >= 2 &&
+        ParseDeviceToken(Tokens[0], &Device))
+    {
+        return AddSegment(Scan, Node, SEGMENT_LINEAR, Target->sector_start, Target->length,
+                          Device, strtoull(Tokens[1], NULL, 10)) != NULL;
+    }
+
+    /* crypt <cipher> <key> <iv offset> <dev> <offset> ... */
+    if (strcmp(Target->target_type, "crypt") == 0 && TokenCount >= 5 &&
+        ParseDeviceToken(Tokens[3], &Device))
+    {
+        return AddSegment(Scan, Node, SEGMENT_LINEAR, Target->sector_start, Target->length,
+                          Device, strtoull(Tokens[4], NULL, 10)) != NULL;
+    }
+
+    /* striped <stripes> <chunk size> [<dev> <offset>]... */
+    if (strcmp(Target->target_type, "striped") == 0 && TokenCount >= 2)
+    {
+        Stripes = strtoul(Tokens[0], NULL, 10);
+        if (Stripes > 0 && TokenCount >= 2 + 2 * Stripes)
+        {
+            Node->VolumeType = VOLUME_TYPE_STRIPE;
+
+            for (i = 0; i < Stripes; i++)
+            {
+                if (!ParseDeviceToken(Tokens[2 + 2 * i], &Device))
+                    continue;
+
+                Segment = AddSegment(Scan, Node, SEGMENT_STRIPED, Target->sector_start, Target->length,
+                                     Device, strtoull(Tokens[3 + 2 * i], NULL, 10));
+                if (Segment == NULL)
+                    return FALSE;
+
+                Segment->Stripes = Stripes;
+                Segment->ChunkSize = strtoul(Tokens[1], NULL, 10);
+            }
+            return TRUE;
+        }
+    }
+
+    /*
+     * multipath: every path is the same LUN, sector for sector, and each
+     * path is a disk of its own; the first one stands for the LUN, so the
+     * map does not span all of them.
+     */
+    if (strcmp(Target->target_type, "multipath") == 0)
+    {
+        for (i = 0; i < TokenCount; i++)
+        {
+            if (ParseDeviceToken(Tokens[i], &Device))
+                return AddSegment(Scan, Node, SEGMENT_LINEAR, Target->sector_start, Target->length,
+                                  Device, Target->sector_start) != NULL;
+        }
+        return TRUE;
+    }
+
+    if (strcmp(Target->target_type, "mirror") == 0)
+    {
+        Node->VolumeType = VOLUME_TYPE_MIRROR;
+    }
+    else if (strcmp(Target->target_type, "raid") == 0 && TokenCount > 0)
+    {
+        if (strncmp(Tokens[0], "raid0", 5) == 0)
+            Node->VolumeType = VOLUME_TYPE_STRIPE;
+        else if (strncmp(Tokens[0], "raid1", 5) == 0)
+            Node->VolumeType = VOLUME_TYPE_MIRROR;
+        else
+            Node->VolumeType = VOLUME_TYPE_RAID5;
+    }
+
+    /* Everything else, from mirror legs to thin pools: every device it names, whole */
+    for (i = 0; i < TokenCount; i++)
+    {
+        if (ParseDeviceToken(Tokens[i], &Device) &&
+            !AddWholeSegment(Scan, Node, Target->sector_start, Target->length, Device, 0, 0))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+/* Without the table, e.g. without access to the control node: the slaves, whole */
+static
+BOOL
+LoadSlaveSegments(
+    PSTACK_SCAN Scan,
+    PBLOCK_NODE Node)
+{
+    char Path[MAX_PATH];
+    char Link[MAX_PATH + 300];
+    struct dirent *Entry;
+    DIR *Directory;
+    dev_t Device;
+    BOOL Success = TRUE;
+
+    snprintf(Path, sizeof(Path), "/sys/class/block/%s/slaves", Node->Name);
+    Directory = opendir(Path);
+    if (Directory == NULL)
+        return TRUE;
+
+    while (Success && (Entry = readdir(Directory)) != NULL)
+    {
+        if (Entry->d_name[0] == '.')
+            continue;
+
+        snprintf(Link, sizeof(Link), "/sys/class/block/%s/dev", Entry->d_name);
+        if (ReadDeviceNumber(Link, &Device))
+        {
+            Success = AddWholeSegment(Scan, Node, 0, Node->Size, Device, 0, 0);
+
+            /* One path of a multipath map, as with the table */
+            if (Node->Multipath)
+                break;
+        }
+    }
+
+    closedir(Directory);
+    return Success;
+}
+
+
+/* The whole table of a dm device, all targets in one DM_TABLE_STATUS */
+static
+BOOL
+LoadDmSegments(
+    PSTACK_SCAN Scan,
+    PBLOCK_NODE Node,
+    int Control,
+    char **Buffer,
+    size_t *BufferSize)
+{
+    struct dm_ioctl *Header;
+    struct dm_target_spec *Target;
+    char *NewBuffer;
+    size_t Next = 0;
+    ULONG i;
+
+    if (Control < 0)
+        return LoadSlaveSegments(Scan, Node);
+
+    for (;;)
+    {
+        Header = (struct dm_ioctl *)*Buffer;
+        memset(Header, 0, sizeof(*Header));
+        Header->version[0] = DM_VERSION_MAJOR;
+        Header->data_size = (__u32)*BufferSize;
+        Header->data_start = sizeof(struct dm_ioctl);
+        Header->flags = DM_STATUS_TABLE_FLAG;
+        Header->dev = (__u64)Node->Device;
+
+        if (ioctl(Control, DM_TABLE_STATUS, Header) < 0)
+            return LoadSlaveSegments(Scan, Node);
+
+        if (!(Header->flags & DM_BUFFER_FULL_FLAG))
+            break;
+
+        if (*BufferSize >= DM_TABLE_BUFFER_MAX)
+            return LoadSlaveSegments(Scan, Node);
+
+        NewBuffer = realloc(*Buffer, *BufferSize * 2);
+        if (NewBuffer == NULL)
+            return FALSE;
+        *Buffer = NewBuffer;
+        *BufferSize *= 2;
+    }
+
+    for (i = 0; i < Header->target_count; i++)
+    {
+        Target = (struct dm_target_spec *)(*Buffer + Header->data_start + Next);
+        if ((char *)(Target + 1) > *Buffer + Header->data_size)
+            break;
+
+        if (!AddTargetSegments(Scan, Node, Target, (char *)(Target + 1)))
+            return FALSE;
+
+        Next = Target->next;
+        if (Next == 0)
+            break;
+    }
+
+    return TRUE;
+}
+
+
+/* Every member holds its share from its data offset on */
+static
+BOOL
+LoadMdSegments(
+    PSTACK_SCAN Scan,
+    PBLOCK_NODE Node)
+{
+    char Path[MAX_PATH];
+    char Member[MAX_PATH + 300];
+    char Level[32];
+    struct dirent *Entry;
+    DIR *Directory;
+    ULONGLONG Offset, Size;
+    dev_t Device;
+    BOOL Success = TRUE;
+
+    snprintf(Path, sizeof(Path), "/sys/class/block/%s/md/level", Node->Name);
+    if (ReadSysfsString(Path, Level, sizeof(Level)))
+    {
+        if (strcmp(Level, "raid0") == 0)
+            Node->VolumeType = VOLUME_TYPE_STRIPE;
+        else if (strcmp(Level, "raid1") == 0 || strcmp(Level, "raid10") == 0)
+            Node->VolumeType = VOLUME_TYPE_MIRROR;
+        else if (strncmp(Level, "raid", 4) == 0)
+            Node->VolumeType = VOLUME_TYPE_RAID5;
+        else if (strcmp(Level, "linear") == 0)
+            Node->VolumeType = VOLUME_TYPE_SPANNED;
+    }
+
+    snprintf(Path, sizeof(Path), "/sys/class/block/%s/md", Node->Name);
+    Directory = opendir(Path);
+    if (Directory == NULL)
+        return TRUE;
+
+    while (Success && (Entry = readdir(Directory)) != NULL)
+    {
+        if (strncmp(Entry->d_name, "dev-", 4) != 0)
+            continue;
+
+        snprintf(Member, sizeof(Member), "%s/%s/block", Path, Entry->d_name);
+        if (!ReadLinkedDevice(Member, &Device))
+            continue;
+
+        /* The offset is in sectors, the size in KiB */
+        snprintf(Member, sizeof(Member), "%s/%s/offset", Path, Entry->d_name);
+        Offset = ReadSysfsNumber(Member);
+        snprintf(Member, sizeof(Member), "%s/%s/size", Path, Entry->d_name);
+        Size = ReadSysfsNumber(Member) * 2;
+
+        Success = AddWholeSegment(Scan, Node, 0, Node->Size, Device, Offset, Size);
+    }
+
+    closedir(Directory);
+    return Success;
+}
+
+
+static
+BOOL
+LoadSegments(
+    PSTACK_SCAN Scan)
+{
+    char *Buffer;
+    size_t BufferSize = DM_TABLE_BUFFER_SIZE;
+    BOOL Success = TRUE;
+    ULONG i;
+    int Control;
+
+    Buffer = malloc(BufferSize);
+    if (Buffer == NULL)
+        return FALSE;
+
+    Control = open("/dev/" DM_DIR "/" DM_CONTROL_NODE, O_RDWR | O_CLOEXEC);
+
+    for (i = 0; Success && i < Scan->NodeCount; i++)
+    {
+        if (Scan->Nodes[i].Kind == BLOCK_NODE_DM)
+            Success = LoadDmSegments(Scan, &Scan->Nodes[i], Control, &Buffer, &BufferSize);
+        else if (Scan->Nodes[i].Kind == BLOCK_NODE_MD)
+            Success = LoadMdSegments(Scan, &Scan->Nodes[i]);
+    }
+
+    if (Control >= 0)
+        close(Control);
+    free(Buffer);
+
+    return Success;
+}
+
+
+static
+BOOL
+AddExtent(
+    PSTACK_SCAN Scan,
+    PDISKENTRY DiskEntry,
+    ULONGLONG Start,
+    ULONGLONG Length)
+{
+    PDISK_EXTENT Extent;
+
+    if (!GrowArray((void **)&Scan->Extents, Scan->ExtentCount, &Scan->ExtentsAllocated, sizeof(DISK_EXTENT)))
+        return FALSE;
+
+    Extent = &Scan->Extents[Scan->ExtentCount++];
+    Extent->DiskNumber = DiskEntry->DiskNumber;
+    Extent->StartingOffset = Start * 512;
+    Extent->ExtentLength = Length * 512;
+
+    return TRUE;
+}
+
+
+/* Follows sectors [Start, Start + Length) of Device down to the disks */
+static
+BOOL
+ResolveRange(
+    PSTACK_SCAN Scan,
+    dev_t Device,
+    ULONGLONG Start,
+    ULONGLONG Length,
+    ULONG Depth)
+{
+    PBLOCK_NODE Node;
+    PDEVICE_SEGMENT Segment;
+    ULONGLONG Low, High, Row, First, Last;
+    ULONG i;
+
+    Node = FindNode(Scan, Device);
+    if (Node == NULL || Length == 0 || Depth > MAX_STACK_DEPTH)
+        return TRUE;
+
+    switch (Node->Kind)
+    {
+        case BLOCK_NODE_DISK:
+            return AddExtent(Scan, Node->DiskEntry, Start, Length);
+
+        case BLOCK_NODE_PARTITION:
+            return ResolveRange(Scan, Node->Parent, Node->Start + Start, Length, Depth + 1);
+
+        case BLOCK_NODE_DM:
+        case BLOCK_NODE_MD:
+            break;
+
+        default:
+            return TRUE;
+    }
+
+    for (i = 0; i < Node->SegmentCount; i++)
+    {
+        Segment = &Scan->Segments[Node->FirstSegment + i];
+
+        Low = (Start > Segment->Start) ? Start : Segment->Start;
+        High = (Start + Length < Segment->Start + Segment->Length) ? Start + Length
+                                                                   : Segment->Start + Segment->Length;
+        if (Low >= High)
+            continue;
+
+        switch (Segment->Kind)
+        {
+            case SEGMENT_LINEAR:
+                if (!ResolveRange(Scan, Segment->Device, Segment->Offset + (Low - Segment->Start),
+                                  High - Low, Depth + 1))
+                    return FALSE;
+                break;
+
+            case SEGMENT_STRIPED:
+                /* The rows of chunks the range touches, on this stripe */
+                Row = (ULONGLONG)Segment->ChunkSize * Segment->Stripes;
+                if (Row == 0)
+                    break;
+                First = (Low - Segment->Start) / Row * Segment->ChunkSize;
+                Last = (High - Segment->Start + Row - 1) / Row * Segment->ChunkSize;
+                if (Last > Segment->Length / Segment->Stripes)
+                    Last = Segment->Length / Segment->Stripes;
+                if (First < Last &&
+                    !ResolveRange(Scan, Segment->Device, Segment->Offset + First, Last - First, Depth + 1))
+                    return FALSE;
+                break;
+
+            case SEGMENT_WHOLE:
+                if (!ResolveRange(Scan, Segment->Device, Segment->Offset, Segment->DeviceLength, Depth + 1))
+                    return FALSE;
+                break;
+        }
+    }
+
+    return TRUE;
+}
+
+
+/*
+ * Sorts the extents found for a volume and joins those that touch, such as
+ * the adjacent targets of a linear map.
+ */
+static
+PVOLUME_DISK_EXTENTS
+CollectExtents(
+    PSTACK_SCAN Scan)
+{
+    PVOLUME_DISK_EXTENTS Extents;
+    PDISK_EXTENT Last, Extent;
+    ULONG Count = 0, i;
+
+    qsort(Scan->Extents, Scan->ExtentCount, sizeof(DISK_EXTENT), CompareExtent);
+
+    Extents = malloc(sizeof(VOLUME_DISK_EXTENTS) +
+                     (Scan->ExtentCount ? Scan->ExtentCount - 1 : 0) * sizeof(DISK_EXTENT));
+    if (Extents == NULL)
+        return NULL;
+
+    for (i = 0; i < Scan->ExtentCount; i++)
+    {
+        Extent = &Scan->Extents[i];
+        Last = Count ? &Extents->Extents[Count - 1] : NULL;
+
+        if (Last != NULL && Last->DiskNumber == Extent->DiskNumber &&
+            Extent->StartingOffset <= Last->StartingOffset + Last->ExtentLength)
+        {
+            if (Extent->StartingOffset + Extent->ExtentLength > Last->StartingOffset + Last->ExtentLength)
+                Last->ExtentLength = Extent->StartingOffset + Extent->ExtentLength - Last->StartingOffset;
+            continue;
+        }
+
+        Extents->Extents[Count++] = *Extent;
+    }
+
+    Extents->NumberOfDiskExtents = Count;
+    return Extents;
+}
+
+
+/* All of /proc/self/mountinfo at once, as there may be thousands of volumes */
+static
+BOOL
+LoadMounts(
+    PSTACK_SCAN Scan)
+{
+    char Path[PATH_MAX];
+    char *Line = NULL;
+    size_t LineSize = 0;
+    dev_t Device;
+    ULONG Allocated = 0;
+    FILE *MountInfo;
+
+    MountInfo = fopen("/proc/self/mountinfo", "r");
+    if (MountInfo == NULL)
+        return TRUE;
+
+    while (getline(&Line, &LineSize, MountInfo) > 0)
+    {
+        if (!ParseMountInfoLine(Line, &Device, Path, sizeof(Path)))
+            continue;
+
+        if (!GrowArray((void **)&Scan->Mounts, Scan->MountCount, &Allocated, sizeof(MOUNT_ENTRY)))
+            break;
+
+        Scan->Mounts[Scan->MountCount].Device = Device;
+        Scan->Mounts[Scan->MountCount].Line = Scan->MountCount;
+        Scan->Mounts[Scan->MountCount].MountPoint = strdup(Path);
+        if (Scan->Mounts[Scan->MountCount].MountPoint == NULL)
+            break;
+        Scan->MountCount++;
+    }
+
+    free(Line);
+    fclose(MountInfo);
+
+    /* Ties go by line, so that the first mount of a device is the one found */
+    qsort(Scan->Mounts, Scan->MountCount, sizeof(MOUNT_ENTRY), CompareMountDevice);
+    return TRUE;
+}
+
+
+static
+const char *
+FindMountPoint(
+    PSTACK_SCAN Scan,
+    dev_t Device)
+{
+    ULONG Low = 0, High = Scan->MountCount, Middle;
+
+    while (Low < High)
+    {
+        Middle = Low + (High - Low) / 2;
+        if (Scan->Mounts[Middle].Device < Device)
+            Low = Middle + 1;
+        else
+            High = Middle;
+    }
+
+    if (Low < Scan->MountCount && Scan->Mounts[Low].Device == Device)
+        return Scan->Mounts[Low].MountPoint;
+
+    return NULL;
+}
+
+
+static
+PVOLENTRY
+CreateStackedVolume(
+    PSTACK_SCAN Scan,
+    PBLOCK_NODE Node,
+    ULONG VolumeNumber)
+{
+    PVOLENTRY VolumeEntry;
+    const char *MountPoint;
+    char Path[MAX_PATH];
+    char Name[DM_NAME_LEN];
+    ULONG i;
+
+    Scan->ExtentCount = 0;
+    if (!ResolveRange(Scan, Node->Device, 0, Node->Size, 0))
+        return NULL;
+
+    VolumeEntry = calloc(1, sizeof(VOLENTRY));
+    if (VolumeEntry == NULL)
+        return NULL;
+
+    VolumeEntry->pExtents = CollectExtents(Scan);
+    if (VolumeEntry->pExtents == NULL)
+    {
+        free(VolumeEntry);
+        return NULL;
+    }
+
+    VolumeEntry->VolumeNumber = VolumeNumber;
+    VolumeEntry->Size = Node->Size * 512;
+
+    snprintf(Path, sizeof(Path), "/sys/class/block/%s/dm/name", Node->Name);
+    if (Node->Kind == BLOCK_NODE_DM && ReadSysfsString(Path, Name, sizeof(Name)))
+        snprintf(VolumeEntry->DeviceName, sizeof(VolumeEntry->DeviceName), "/dev/" DM_DIR "/%s", Name);
+    else
+        snprintf(VolumeEntry->DeviceName, sizeof(VolumeEntry->DeviceName), "/dev/%s", Node->Name);
+
+    MountPoint = FindMountPoint(Scan, Node->Device);
+    if (MountPoint != NULL)
+        snprintf(VolumeEntry->VolumeName, sizeof(VolumeEntry->VolumeName), "%s", MountPoint);
+
+    VolumeEntry->VolumeType = Node->VolumeType;
+    if (VolumeEntry->VolumeType == VOLUME_TYPE_SIMPLE)
+    {
+        for (i = 1; i < VolumeEntry->pExtents->NumberOfDiskExtents; i++)
+        {
+            if (VolumeEntry->pExtents->Extents[i].DiskNumber != VolumeEntry->pExtents->Extents[0].DiskNumber)
+            {
+                VolumeEntry->VolumeType = VOLUME_TYPE_SPANNED;
+                break;
+            }
+        }
+    }
+
+    return VolumeEntry;
+}
+
+
+static
+void
+FreeStackScan(
+    PSTACK_SCAN Scan)
+{
+    ULONG i;
+
+    for (i = 0; i < Scan->MountCount; i++)
+        free(Scan->Mounts[i].MountPoint);
+
+    free(Scan->Mounts);
+    free(Scan->Disks);
+    free(Scan->Nodes);
+    free(Scan->Segments);
+    free(Scan->Extents);
+}
+
+
+/*
+ * Adds a volume for every dm and md device at the top of a stack, numbered
+ * on from VolumeNumber. Fails only when out of memory.
+ */
+BOOL
+AddStackedVolumes(
+    ULONG *VolumeNumber)
+{
+    STACK_SCAN Scan;
+    PVOLENTRY *Volumes = NULL;
+    PVOLENTRY VolumeEntry;
+    PBLOCK_NODE Node;
+    ListEntry *Entry;
+    ULONG Count = 0, Allocated = 0, i;
+    BOOL Success = FALSE;
+
+    memset(&Scan, 0, sizeof(Scan));
+
+    for (Entry = DiskListHead.Flink; Entry != &DiskListHead; Entry = Entry->Flink)
+        Scan.DiskCount++;
+
+    Scan.Disks = malloc(Scan.DiskCount * sizeof(PDISKENTRY) + 1);
+    if (Scan.Disks == NULL)
+        goto done;
+
+    i = 0;
+    for (Entry = DiskListHead.Flink; Entry != &DiskListHead; Entry = Entry->Flink)
+        Scan.Disks[i++] = CONTAINING_RECORD(Entry, DISKENTRY, ListEntry);
+    qsort(Scan.Disks, Scan.DiskCount, sizeof(PDISKENTRY), CompareDiskName);
+
+    if (!ScanBlockNodes(&Scan) || !LoadSegments(&Scan) || !LoadMounts(&Scan))
+        goto done;
+
+    for (i = 0; i < Scan.NodeCount; i++)
+    {
+        Node = &Scan.Nodes[i];
+        if ((Node->Kind != BLOCK_NODE_DM && Node->Kind != BLOCK_NODE_MD) ||
+            Node->HasHolders || Node->Hidden || Node->Size == 0)
+            continue;
+
+        if (!GrowArray((void **)&Volumes, Count, &Allocated, sizeof(PVOLENTRY)))
+            goto done;
+
+        VolumeEntry = CreateStackedVolume(&Scan, Node, *VolumeNumber);
+        if (VolumeEntry == NULL)
+            goto done;
+
+        InsertTailList(&VolumeListHead, &VolumeEntry->ListEntry);
+        Volumes[Count++] = VolumeEntry;
+        (*VolumeNumber)++;
+    }
+
+    /* One batch of superblock reads for all of them */
+    ProbeVolumeFileSystems(Volumes, Count);
+    Success = TRUE;
+
+done:
+    free(Volumes);
+    FreeStackScan(&Scan);
+
+    return Success;
+}
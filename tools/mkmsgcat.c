@@ -0,0 +1,675 @@
+/*
+ * PROJECT:         ReactOS DiskPart (Linux port)
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * FILE:            base/system/diskpart/tools/mkmsgcat.c
+ * PURPOSE:         Build tool: compiles diskpart_msg.mc and the lang/<name>.rc
+ *                  string tables into the binary catalog read by msgcat.c,
+ *                  and writes the MSG_* symbols of the .mc file to a header.
+ *
+ * Usage: mkmsgcat <resource.h> <messages.mc> <out.cat> <out.h> <lang.rc>...
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../msgcat.h"
+
+#define MAX_LANGUAGES 32
+#define MAX_DEFINES   1024
+
+typedef struct _TEXT {
+    uint32_t Id;
+    char *Text;
+} TEXT;
+
+typedef struct _LANGUAGE {
+    char Name[MSGCAT_NAME_SIZE];
+    TEXT *Texts;
+    size_t Count;
+    size_t Allocated;
+} LANGUAGE;
+
+typedef struct _DEFINE {
+    char *Name;
+    long Value;
+} DEFINE;
+
+/* mc language IDs of diskpart_msg.mc, named like the lang/<name>.rc files */
+static const struct {
+    unsigned int LangId;
+    const char *Name;
+} LanguageIds[] = {
+    { 0x409, "en-US" }, { 0x407, "de-DE" }, { 0x410, "it-IT" },
+    { 0x415, "pl-PL" }, { 0x816, "pt-PT" }, { 0x418, "ro-RO" },
+    { 0x419, "ru-RU" }, { 0x41C, "sq-AL" }, { 0x41F, "tr-TR" },
+    { 0x804, "zh-CN" }, { 0x404, "zh-TW" },
+};
+
+static LANGUAGE Languages[MAX_LANGUAGES];
+static size_t LanguageCount;
+
+static DEFINE Defines[MAX_DEFINES];
+static size_t DefineCount;
+
+static const char *CurrentFile;
+static int CurrentLine;
+
+/* FUNCTIONS ******************************************************************/
+
+static void
+Fail(const char *Format, ...)
+{
+    va_list Args;
+
+    if (CurrentFile != NULL)
+        fprintf(stderr, "%s:%d: ", CurrentFile, CurrentLine);
+
+    va_start(Args, Format);
+    vfprintf(stderr, Format, Args);
+    va_end(Args);
+    fputc('\n', stderr);
+
+    exit(1);
+}
+
+
+static void *
+CheckedAlloc(void *Old, size_t Size)
+{
+    void *New = realloc(Old, Size);
+
+    if (New == NULL)
+        Fail("out of memory");
+
+    return New;
+}
+
+
+static char *
+ReadWholeFile(const char *FileName)
+{
+    FILE *File;
+    char *Data;
+    long Size;
+
+    File = fopen(FileName, "rb");
+    if (File == NULL)
+        Fail("cannot open %s", FileName);
+
+    fseek(File, 0, SEEK_END);
+    Size = ftell(File);
+    fseek(File, 0, SEEK_SET);
+
+    Data = CheckedAlloc(NULL, (size_t)Size + 1);
+    if (fread(Data, 1, (size_t)Size, File) != (size_t)Size)
+        Fail("cannot read %s", FileName);
+    Data[Size] = '\0';
+
+    fclose(File);
+
+    return Data;
+}
+
+
+static LANGUAGE *
+GetLanguage(const char *Name)
+{
+    size_t i;
+
+    for (i = 0; i < LanguageCount; i++)
+    {
+        if (strcmp(Languages[i].Name, Name) == 0)
+            return &Languages[i];
+    }
+
+    if (LanguageCount == MAX_LANGUAGES)
+        Fail("too many languages");
+    if (strlen(Name) >= MSGCAT_NAME_SIZE)
+        Fail("language name too long: %s", Name);
+
+    strcpy(Languages[LanguageCount].Name, Name);
+
+    return &Languages[LanguageCount++];
+}
+
+
+static void
+AddText(LANGUAGE *Language, uint32_t Id, char *Text)
+{
+    size_t i;
+
+    if (Id == MSGCAT_EMPTY_ID)
+        Fail("message ID 0x%x is reserved", Id);
+
+    for (i = 0; i < Language->Count; i++)
+    {
+        if (Language->Texts[i].Id == Id)
+            Fail("duplicate ID %u in language %s", Id, Language->Name);
+    }
+
+    if (Language->Count == Language->Allocated)
+    {
+        Language->Allocated = Language->Allocated ? Language->Allocated * 2 : 64;
+        Language->Texts = CheckedAlloc(Language->Texts, Language->Allocated * sizeof(TEXT));
+    }
+
+    Language->Texts[Language->Count].Id = Id;
+    Language->Texts[Language->Count].Text = Text;
+    Language->Count++;
+}
+
+
+/* resource.h: "#define IDS_NAME value" lines */
+static void
+ReadDefines(const char *FileName)
+{
+    char *Data = ReadWholeFile(FileName);
+    char *Line, *Next;
+    char Name[128];
+    long Value;
+
+    for (Line = Data; Line != NULL; Line = Next)
+    {
+        Next = strchr(Line, '\n');
+        if (Next != NULL)
+            *Next++ = '\0';
+
+        if (sscanf(Line, " #define %127s %li", Name, &Value) != 2)
+            continue;
+
+        if (DefineCount == MAX_DEFINES)
+            Fail("too many defines in %s", FileName);
+
+        Defines[DefineCount].Name = strdup(Name);
+        Defines[DefineCount].Value = Value;
+        DefineCount++;
+    }
+
+    free(Data);
+}
+
+
+static long
+LookupDefine(const char *Name)
+{
+    size_t i;
+
+    for (i = 0; i < DefineCount; i++)
+    {
+        if (strcmp(Defines[i].Name, Name) == 0)
+            return Defines[i].Value;
+    }
+
+    Fail("%s is not defined in resource.h", Name);
+    return 0;
+}
+
+
+/* Text of one .mc message: the lines up to ".", with the mc escapes resolved */
+static char *
+ConvertMcText(const char *Lines, size_t Length)
+{
+    char *Text = CheckedAlloc(NULL, Length + 1);
+    size_t i, j = 0;
+
+    for (i = 0; i < Length; i++)
+    {
+        if (Lines[i] == '\r')
+            continue;
+
+        if (Lines[i] != '%' || i + 1 == Length)
+        {
+            Text[j++] = Lines[i];
+            continue;
+        }
+
+        switch (Lines[++i])
+        {
+            case 'n': Text[j++] = '\n'; break;
+            case 'r': Text[j++] = '\r'; break;
+            case 't': Text[j++] = '\t'; break;
+            case 'b': Text[j++] = ' '; break;
+
+            /* %0 ends the message without its final line break */
+            case '0':
+                Text[j] = '\0';
+                return Text;
+
+            /* %% %. %! and inserts like %1 stay as they are but for the % */
+            default:
+                if (isdigit((unsigned char)Lines[i]))
+                    Text[j++] = '%';
+                Text[j++] = Lines[i];
+                break;
+        }
+    }
+
+    Text[j] = '\0';
+
+    return Text;
+}
+
+
+static void
+ReadMessages(const char *FileName, FILE *Header)
+{
+    char *Data = ReadWholeFile(FileName);
+    char *Line, *Next, *Value;
+    char *TextStart = NULL;
+    char LanguageNames[MAX_LANGUAGES][64];
+    unsigned int LanguageIdsByName[MAX_LANGUAGES];
+    size_t NameCount = 0, i, k;
+    unsigned long MessageId = 0;
+    char Symbol[128] = "";
+    LANGUAGE *Language = NULL;
+    int InLanguageNames = 0;
+    char Name[64];
+    unsigned int LangId;
+
+    CurrentFile = FileName;
+    CurrentLine = 0;
+
+    for (Line = Data; Line != NULL; Line = Next)
+    {
+        CurrentLine++;
+        Next = strchr(Line, '\n');
+        if (Next != NULL)
+            *Next++ = '\0';
+
+        if (TextStart != NULL)
+        {
+            /* Message text runs up to a line holding a single "." */
+            if (strcmp(Line, ".") != 0 && strcmp(Line, ".\r") != 0)
+            {
+                if (Next != NULL)
+                    Line[strlen(Line)] = '\n';
+                continue;
+            }
+
+            AddText(Language, (uint32_t)MessageId, ConvertMcText(TextStart, (size_t)(Line - TextStart)));
+            TextStart = NULL;
+            continue;
+        }
+
+        if (strncmp(Line, "LanguageNames=", 14) == 0)
+        {
+            InLanguageNames = 1;
+            Line += 14;
+        }
+
+        if (InLanguageNames)
+        {
+            /* (English=0x409:MSG00409 */
+            if (sscanf(Line, " (%63[^=]=%x", Name, &LangId) == 2 ||
+                sscanf(Line, " %63[^=]=%x", Name, &LangId) == 2)
+            {
+                if (NameCount == MAX_LANGUAGES)
+                    Fail("too many languages");
+                strcpy(LanguageNames[NameCount], Name);
+                LanguageIdsByName[NameCount] = LangId;
+                NameCount++;
+            }
+            if (strchr(Line, ')') != NULL)
+                InLanguageNames = 0;
+            continue;
+        }
+
+        if (strncmp(Line, "MessageId=", 10) == 0)
+        {
+            /* An empty MessageId= follows the previous message */
+            Value = Line + 10;
+            MessageId = (*Value != '\0' && *Value != '\r') ? strtoul(Value, NULL, 0) : MessageId + 1;
+            Symbol[0] = '\0';
+        }
+        else if (sscanf(Line, "SymbolicName=%127[A-Za-z0-9_]", Symbol) == 1)
+        {
+            fprintf(Header, "#define %-40s %lu\n", Symbol, MessageId);
+        }
+        else if (sscanf(Line, "Language=%63[A-Za-z]", Name) == 1)
+        {
+            for (i = 0; i < NameCount && strcmp(LanguageNames[i], Name) != 0; i++)
+                ;
+            if (i == NameCount)
+                Fail("language %s is not in LanguageNames", Name);
+
+            for (k = 0; k < sizeof(LanguageIds) / sizeof(LanguageIds[0]); k++)
+            {
+                if (LanguageIds[k].LangId == LanguageIdsByName[i])
+                    break;
+            }
+            if (k == sizeof(LanguageIds) / sizeof(LanguageIds[0]))
+                Fail("no locale name for language 0x%x", LanguageIdsByName[i]);
+
+            Language = GetLanguage(LanguageIds[k].Name);
+            TextStart = Next;
+        }
+    }
+
+    if (TextStart != NULL)
+        Fail("message %lu is not terminated", MessageId);
+
+    CurrentFile = NULL;
+}
+
+
+/* Reads a C string literal at *Cursor, with RC's "" for a quote */
+static char *
+ReadStringLiteral(char **Cursor)
+{
+    char *p = *Cursor + 1;
+    size_t Allocated = 256, Length = 0;
+    char *Text = CheckedAlloc(NULL, Allocated);
+    unsigned int Value;
+    int Digits;
+    char c;
+
+    for (;;)
+    {
+        c = *p++;
+
+        if (c == '\0')
+            Fail("unterminated string");
+
+        if (c == '"')
+        {
+            if (*p != '"')
+                break;
+            p++;
+        }
+        else if (c == '\n')
+        {
+            CurrentLine++;
+        }
+        else if (c == '\\')
+        {
+            c = *p++;
+            switch (c)
+            {
+                case 'n': c = '\n'; break;
+                case 'r': c = '\r'; break;
+                case 't': c = '\t'; break;
+                case 'a': c = '\a'; break;
+                case '\\': case '"': case '\'': break;
+
+                /* Line continuation */
+                case '\r':
+                    if (*p == '\n')
+                        p++;
+                    /* fallthrough */
+                case '\n':
+                    CurrentLine++;
+                    continue;
+
+                case 'x':
+                    for (Value = 0, Digits = 0; Digits < 2 && isxdigit((unsigned char)*p); Digits++, p++)
+                        Value = Value * 16 + (isdigit((unsigned char)*p) ? *p - '0' : (tolower((unsigned char)*p) - 'a' + 10));
+                    c = (char)Value;
+                    break;
+
+                default:
+                    if (c >= '0' && c <= '7')
+                    {
+                        for (Value = (unsigned int)(c - '0'), Digits = 1; Digits < 3 && *p >= '0' && *p <= '7'; Digits++, p++)
+                            Value = Value * 8 + (unsigned int)(*p - '0');
+                        c = (char)Value;
+                    }
+                    else
+                    {
+                        Fail("unknown escape \\%c", c);
+                    }
+                    break;
+            }
+        }
+
+        if (Length + 2 > Allocated)
+        {
+            Allocated *= 2;
+            Text = CheckedAlloc(Text, Allocated);
+        }
+        Text[Length++] = c;
+    }
+
+    Text[Length] = '\0';
+    *Cursor = p;
+
+    return Text;
+}
+
+
+/* Skips white space and comments, counting lines */
+static char *
+SkipBlanks(char *p)
+{
+    for (;;)
+    {
+        if (*p == '\n')
+        {
+            CurrentLine++;
+            p++;
+        }
+        else if (isspace((unsigned char)*p) || *p == ',')
+        {
+            p++;
+        }
+        else if (p[0] == '/' && p[1] == '*')
+        {
+            for (p += 2; *p != '\0' && !(p[0] == '*' && p[1] == '/'); p++)
+            {
+                if (*p == '\n')
+                    CurrentLine++;
+            }
+            if (*p != '\0')
+                p += 2;
+        }
+        else if ((p[0] == '/' && p[1] == '/') || p[0] == '#')
+        {
+            while (*p != '\0' && *p != '\n')
+                p++;
+        }
+        else
+        {
+            return p;
+        }
+    }
+}
+
+
+/* lang/<name>.rc: the STRINGTABLE blocks; the language comes from the file name */
+static void
+ReadStringTables(const char *FileName)
+{
+    char *Data = ReadWholeFile(FileName);
+    char *p = Data;
+    char Name[MSGCAT_NAME_SIZE + 8];
+    char Word[128];
+    const char *Base;
+    LANGUAGE *Language;
+    int InTable = 0;
+    size_t Length;
+    long Id;
+
+    Base = strrchr(FileName, '/');
+    Base = (Base != NULL) ? Base + 1 : FileName;
+    Length = strcspn(Base, ".");
+    if (Length >= sizeof(Name))
+        Fail("bad language file name %s", FileName);
+    memcpy(Name, Base, Length);
+    Name[Length] = '\0';
+
+    Language = GetLanguage(Name);
+
+    CurrentFile = FileName;
+    CurrentLine = 1;
+
+    for (;;)
+    {
+        p = SkipBlanks(p);
+        if (*p == '\0')
+            break;
+
+        if (*p == '"')
+        {
+            if (!InTable)
+                Fail("string outside of a STRINGTABLE");
+            Fail("string without an ID");
+        }
+
+        for (Length = 0; (isalnum((unsigned char)*p) || *p == '_') && Length < sizeof(Word) - 1; p++)
+            Word[Length++] = *p;
+        Word[Length] = '\0';
+
+        if (Length == 0)
+            Fail("unexpected '%c'", *p);
+
+        if (strcmp(Word, "STRINGTABLE") == 0)
+        {
+            continue;
+        }
+        else if (strcmp(Word, "BEGIN") == 0)
+        {
+            InTable = 1;
+        }
+        else if (strcmp(Word, "END") == 0)
+        {
+            InTable = 0;
+        }
+        else if (strcmp(Word, "LANGUAGE") == 0)
+        {
+            /* Skip the LANG_ and SUBLANG_ arguments */
+            while (*p != '\0' && *p != '\n')
+                p++;
+        }
+        else if (InTable)
+        {
+            Id = isdigit((unsigned char)Word[0]) ? strtol(Word, NULL, 0) : LookupDefine(Word);
+
+            p = SkipBlanks(p);
+            if (*p != '"')
+                Fail("%s has no string", Word);
+
+            AddText(Language, (uint32_t)Id, ReadStringLiteral(&p));
+        }
+        else
+        {
+            Fail("unexpected %s", Word);
+        }
+    }
+
+    CurrentFile = NULL;
+    free(Data);
+}
+
+
+static void
+WriteCatalog(const char *FileName)
+{
+    MSGCAT_HEADER Header;
+    MSGCAT_LANGUAGE *Table;
+    MSGCAT_SLOT *Slots;
+    size_t SlotCount, TotalSlots = 0, TextSize = 0, Offset, TextOffset;
+    unsigned char *Image;
+    uint32_t Shift, Index;
+    size_t i, j;
+    FILE *File;
+
+    Table = CheckedAlloc(NULL, LanguageCount * sizeof(*Table));
+    memset(Table, 0, LanguageCount * sizeof(*Table));
+
+    /* Slot tables are at most half full, so probe chains stay short */
+    for (i = 0; i < LanguageCount; i++)
+    {
+        for (SlotCount = 2, Shift = 31; SlotCount < Languages[i].Count * 2; SlotCount *= 2, Shift--)
+            ;
+        Table[i].SlotShift = Shift;
+        TotalSlots += SlotCount;
+
+        for (j = 0; j < Languages[i].Count; j++)
+            TextSize += strlen(Languages[i].Texts[j].Text) + 1;
+    }
+
+    Offset = sizeof(Header) + LanguageCount * sizeof(*Table);
+    TextOffset = Offset + TotalSlots * sizeof(MSGCAT_SLOT);
+
+    /* One extra NUL keeps the file NUL-terminated even with no texts */
+    Image = CheckedAlloc(NULL, TextOffset + TextSize + 1);
+    memset(Image, 0, TextOffset + TextSize + 1);
+
+    for (i = 0; i < LanguageCount; i++)
+    {
+        memcpy(Table[i].Name, Languages[i].Name, MSGCAT_NAME_SIZE);
+        Table[i].SlotOffset = (uint32_t)Offset;
+
+        SlotCount = (size_t)1 << (32 - Table[i].SlotShift);
+        Slots = (MSGCAT_SLOT *)(Image + Offset);
+        for (j = 0; j < SlotCount; j++)
+            Slots[j].Id = MSGCAT_EMPTY_ID;
+
+        for (j = 0; j < Languages[i].Count; j++)
+        {
+            Index = MsgCatHash(Languages[i].Texts[j].Id, Table[i].SlotShift);
+            while (Slots[Index].Id != MSGCAT_EMPTY_ID)
+                Index = (Index + 1) & (uint32_t)(SlotCount - 1);
+
+            Slots[Index].Id = Languages[i].Texts[j].Id;
+            Slots[Index].TextOffset = (uint32_t)TextOffset;
+
+            strcpy((char *)Image + TextOffset, Languages[i].Texts[j].Text);
+            TextOffset += strlen(Languages[i].Texts[j].Text) + 1;
+        }
+
+        Offset += SlotCount * sizeof(MSGCAT_SLOT);
+    }
+
+    Header.Magic = MSGCAT_MAGIC;
+    Header.Version = MSGCAT_VERSION;
+    Header.LanguageCount = (uint32_t)LanguageCount;
+    Header.FileSize = (uint32_t)(TextOffset + 1);
+
+    memcpy(Image, &Header, sizeof(Header));
+    memcpy(Image + sizeof(Header), Table, LanguageCount * sizeof(*Table));
+
+    File = fopen(FileName, "wb");
+    if (File == NULL || fwrite(Image, 1, Header.FileSize, File) != Header.FileSize || fclose(File) != 0)
+        Fail("cannot write %s", FileName);
+
+    free(Image);
+    free(Table);
+}
+
+
+int
+main(int argc, char **argv)
+{
+    FILE *Header;
+    int i;
+
+    if (argc < 5)
+    {
+        fprintf(stderr, "Usage: %s <resource.h> <messages.mc> <out.cat> <out.h> <lang.rc>...\n", argv[0]);
+        return 1;
+    }
+
+    Header = fopen(argv[4], "w");
+    if (Header == NULL)
+        Fail("cannot write %s", argv[4]);
+
+    fprintf(Header, "/* Generated by mkmsgcat from %s. Do not edit. */\n\n#pragma once\n\n", argv[2]);
+
+    ReadDefines(argv[1]);
+    ReadMessages(argv[2], Header);
+
+    for (i = 5; i < argc; i++)
+        ReadStringTables(argv[i]);
+
+    if (fclose(Header) != 0)
+        Fail("cannot write %s", argv[4]);
+
+    WriteCatalog(argv[3]);
+
+    return 0;
+}
@@ -0,0 +1,298 @@
+/*
+ * PROJECT:         ReactOS DiskPart (Linux port)
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * FILE:            base/system/diskpart/topology.c
+ * PURPOSE:         Block device I/O topology from sysfs and the partition
+ *                  alignment derived from it.
+ */
+
+#include "diskpart.h"
+
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+/* Windows and every current partitioning tool start partitions on 1 MB */
+#define DEFAULT_PARTITION_ALIGNMENT (1024 * 1024)
+
+/* No real stripe is wider; larger optimal I/O sizes are device bugs */
+#define MAX_OPTIMAL_IO_SIZE (16 * 1024 * 1024)
+
+/* FUNCTIONS ******************************************************************/
+
+BOOL
+ReadSysfsString(
+    const char *Path,
+    char *Buffer,
+    size_t Size)
+{
+    FILE *File;
+    size_t Length;
+
+    File = fopen(Path, "r");
+    if (File == NULL)
+        return FALSE;
+
+    if (fgets(Buffer, (int)Size, File) == NULL)
+    {
+        fclose(File);
+        return FALSE;
+    }
+    fclose(File);
+
+    Length = strlen(Buffer);
+    if (Length > 0 && Buffer[Length - 1] == '\n')
+        Buffer[Length - 1] = '\0';
+
+    return TRUE;
+}
+
+
+ULONGLONG
+ReadSysfsNumber(
+    const char *Path)
+{
+    char Buffer[64];
+
+    if (!ReadSysfsString(Path, Buffer, sizeof(Buffer)))
+        return 0;
+
+    return strtoull(Buffer, NULL, 10);
+}
+
+
+/*
+ * Finds the sysfs directory holding the queue limits of a block device node.
+ * A partition has none of its own; its limits are those of the parent disk.
+ */
+static
+BOOL
+GetQueueDirectory(
+    const char *DeviceName,
+    char *Directory,
+    size_t Size)
+{
+    struct stat StatBuffer;
+    char Path[MAX_PATH * 2];
+
+    if (stat(DeviceName, &StatBuffer) < 0 || !S_ISBLK(StatBuffer.st_mode))
+        return FALSE;
+
+    snprintf(Directory, Size, "/sys/dev/block/%u:%u/queue",
+             major(StatBuffer.st_rdev), minor(StatBuffer.st_rdev));
+    snprintf(Path, sizeof(Path), "%s/logical_block_size", Directory);
+    if (access(Path, R_OK) == 0)
+        return TRUE;
+
+    snprintf(Directory, Size, "/sys/dev/block/%u:%u/../queue",
+             major(StatBuffer.st_rdev), minor(StatBuffer.st_rdev));
+    snprintf(Path, sizeof(Path), "%s/logical_block_size", Directory);
+
+    return access(Path, R_OK) == 0;
+}
+
+
+static
+ULONGLONG
+ReadQueueValue(
+    const char *Directory,
+    const char *Name)
+{
+    char Path[MAX_PATH * 2];
+
+    snprintf(Path, sizeof(Path), "%s/%s", Directory, Name);
+
+    return ReadSysfsNumber(Path);
+}
+
+
+static
+ZONE_MODEL
+ReadZoneModel(
+    const char *Directory)
+{
+    char Path[MAX_PATH * 2];
+    char Model[32];
+
+    snprintf(Path, sizeof(Path), "%s/zoned", Directory);
+    if (!ReadSysfsString(Path, Model, sizeof(Model)))
+        return ZONE_MODEL_NONE;
+
+    if (strcmp(Model, "host-managed") == 0)
+        return ZONE_MODEL_HOST_MANAGED;
+    if (strcmp(Model, "host-aware") == 0)
+        return ZONE_MODEL_HOST_AWARE;
+
+    return ZONE_MODEL_NONE;
+}
+
+
+/*
+ * Reads the I/O limits the kernel reports for a block device. Fails for
+ * anything that is not a block device, e.g. an image file.
+ */
+BOOL
+GetDiskTopology(
+    const char *DeviceName,
+    PDISK_TOPOLOGY Topology)
+{
+    char Directory[MAX_PATH];
+    char Path[MAX_PATH * 2];
+
+    memset(Topology, 0, sizeof(*Topology));
+
+    if (!GetQueueDirectory(DeviceName, Directory, sizeof(Directory)))
+        return FALSE;
+
+    Topology->LogicalBlockSize = (ULONG)ReadQueueValue(Directory, "logical_block_size");
+    Topology->PhysicalBlockSize = (ULONG)ReadQueueValue(Directory, "physical_block_size");
+    Topology->MinimumIoSize = (ULONG)ReadQueueValue(Directory, "minimum_io_size");
+    Topology->OptimalIoSize = (ULONG)ReadQueueValue(Directory, "optimal_io_size");
+
+    /* RAID chunk or zone size, in 512-byte units */
+    Topology->ChunkSize = ReadQueueValue(Directory, "chunk_sectors") * 512;
+
+    /* Lives next to queue/, not in it */
+    snprintf(Path, sizeof(Path), "%s/../alignment_offset", Directory);
+    Topology->AlignmentOffset = (ULONG)ReadSysfsNumber(Path);
+
+    /* On a zoned device chunk_sectors is the zone size */
+    Topology->ZoneModel = ReadZoneModel(Directory);
+    if (Topology->ZoneModel != ZONE_MODEL_NONE)
+    {
+        Topology->ZoneSize = Topology->ChunkSize;
+        Topology->ZoneCount = (ULONG)ReadQueueValue(Directory, "nr_zones");
+    }
+
+    if (Topology->LogicalBlockSize == 0)
+        Topology->LogicalBlockSize = 512;
+    if (Topology->PhysicalBlockSize < Topology->LogicalBlockSize)
+        Topology->PhysicalBlockSize = Topology->LogicalBlockSize;
+
+    return TRUE;
+}
+
+
+static
+ULONGLONG
+GreatestCommonDivisor(
+    ULONGLONG a,
+    ULONGLONG b)
+{
+    ULONGLONG Temp;
+
+    while (b != 0)
+    {
+        Temp = a % b;
+        a = b;
+        b = Temp;
+    }
+
+    return a;
+}
+
+
+/* Least common multiple of Grain and Value, ignoring a zero Value */
+static
+ULONGLONG
+CombineAlignment(
+    ULONGLONG Grain,
+    ULONGLONG Value)
+{
+    if (Value == 0)
+        return Grain;
+
+    return Grain / GreatestCommonDivisor(Grain, Value) * Value;
+}
+
+
+/*
+ * Some USB bridges report nonsense as the optimal I/O size, e.g. 0xFFFE00.
+ * Only a power-of-two number of physical blocks, or a whole number of RAID
+ * chunks (a full stripe) when the minimum I/O size is a chunk, is trusted.
+ */
+static
+BOOL
+IsPlausibleOptimalIoSize(
+    const DISK_TOPOLOGY *Topology)
+{
+    ULONG Size = Topology->OptimalIoSize;
+    ULONG Blocks;
+
+    if (Size == 0 || Size > MAX_OPTIMAL_IO_SIZE || Topology->PhysicalBlockSize == 0)
+        return FALSE;
+
+    if (Topology->MinimumIoSize > Topology->PhysicalBlockSize &&
+        (Size % Topology->MinimumIoSize) == 0)
+        return TRUE;
+
+    if ((Size % Topology->PhysicalBlockSize) != 0)
+        return FALSE;
+
+    Blocks = Size / Topology->PhysicalBlockSize;
+
+    return (Blocks & (Blocks - 1)) == 0;
+}
+
+
+/*
+ * The alignment, in bytes, a new partition should start on: 1 MB, widened
+ * to a multiple of the physical block, the minimum and optimal I/O sizes
+ * (RAID chunk and full stripe) and the chunk or zone size. Zoned devices
+ * are aligned to whole zones only.
+ */
+ULONGLONG
+GetPartitionAlignment(
+    const DISK_TOPOLOGY *Topology)
+{
+    ULONGLONG Grain = DEFAULT_PARTITION_ALIGNMENT;
+
+    if (Topology->ZoneModel != ZONE_MODEL_NONE && Topology->ZoneSize != 0)
+        return Topology->ZoneSize;
+
+    Grain = CombineAlignment(Grain, Topology->PhysicalBlockSize);
+    Grain = CombineAlignment(Grain, Topology->MinimumIoSize);
+
+    if (IsPlausibleOptimalIoSize(Topology))
+        Grain = CombineAlignment(Grain, Topology->OptimalIoSize);
+
+    Grain = CombineAlignment(Grain, Topology->ChunkSize);
+
+    return Grain;
+}
+
+
+/*
+ * Rounds a byte offset up to the next aligned partition start. The device
+ * may report that its naturally aligned blocks begin AlignmentOffset bytes
+ * into the disk, so aligned means Offset % Alignment == AlignmentOffset.
+ */
+ULONGLONG
+AlignPartitionStart(
+    const DISK_TOPOLOGY *Topology,
+    ULONGLONG Alignment,
+    ULONGLONG Offset)
+{
+    ULONGLONG Shift = Topology->AlignmentOffset % Alignment;
+
+    if (Offset <= Shift)
+        return Shift;
+
+    return (Offset - Shift + Alignment - 1) / Alignment * Alignment + Shift;
+}
+
+
+/*
+ * Rounds the exclusive end offset of a partition down so that it does not
+ * split a zone. Only zoned devices need it; elsewhere Offset is returned.
+ */
+ULONGLONG
+AlignPartitionEnd(
+    const DISK_TOPOLOGY *Topology,
+    ULONGLONG Offset)
+{
+    if (Topology->ZoneModel == ZONE_MODEL_NONE || Topology->ZoneSize == 0)
+        return Offset;
+
+    return Offset / Topology->ZoneSize * Topology->ZoneSize;
+}
@@ -0,0 +1,157 @@
+/*
+ * PROJECT:         ReactOS DiskPart (Linux port)
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * FILE:            base/system/diskpart/uevent.c
+ * PURPOSE:         Kernel uevents of block devices, read from netlink.
+ */
+
+#include "diskpart.h"
+
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+#define UEVENT_RECEIVE_BUFFER (1024 * 1024)
+
+/* What udev puts in front of the properties it rebroadcasts */
+#define UDEV_MONITOR_MAGIC 0xfeedcafe
+
+typedef struct _UDEV_MONITOR_HEADER {
+    char Prefix[8];             /* "libudev" */
+    unsigned int Magic;         /* Network byte order */
+    unsigned int HeaderSize;
+    unsigned int PropertiesOffset;
+    unsigned int PropertiesLength;
+} UDEV_MONITOR_HEADER;
+
+/* FUNCTIONS ******************************************************************/
+
+/*
+ * Opens a non-blocking socket on a uevent multicast group, the kernel's or
+ * udev's. Returns -1 if it cannot be opened, e.g. without CAP_NET_ADMIN in
+ * a container.
+ */
+int
+OpenUeventSocket(
+    ULONG Group)
+{
+    struct sockaddr_nl Address;
+    int Size = UEVENT_RECEIVE_BUFFER;
+    int fd;
+
+    fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_KOBJECT_UEVENT);
+    if (fd < 0)
+        return -1;
+
+    /* A burst of events (a whole disk of partitions) must not overflow it */
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &Size, sizeof(Size));
+
+    memset(&Address, 0, sizeof(Address));
+    Address.nl_family = AF_NETLINK;
+    Address.nl_groups = Group;
+
+    if (bind(fd, (struct sockaddr *)&Address, sizeof(Address)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+
+/*
+ * Receives one event: "ACTION@DEVPATH" followed by KEY=VALUE strings from
+ * the kernel, or a udev header followed by the same strings from udev. The
+ * strings point into the event's buffer. Returns FALSE when there is
+ * nothing left to read; messages that are neither, or lack an action or
+ * subsystem, are skipped. Only privileged processes can send to these
+ * groups.
+ */
+BOOL
+ReadUevent(
+    int fd,
+    PUEVENT Event)
+{
+    struct sockaddr_nl Address;
+    struct iovec Vector;
+    struct msghdr Message;
+    UDEV_MONITOR_HEADER Header;
+    ssize_t Length;
+    char *Field, *End;
+
+    for (;;)
+    {
+        Vector.iov_base = Event->Buffer;
+        Vector.iov_len = sizeof(Event->Buffer) - 1;
+
+        memset(&Message, 0, sizeof(Message));
+        Message.msg_name = &Address;
+        Message.msg_namelen = sizeof(Address);
+        Message.msg_iov = &Vector;
+        Message.msg_iovlen = 1;
+
+        Length = recvmsg(fd, &Message, 0);
+        if (Length < 0 && errno == EINTR)
+            continue;
+        if (Length <= 0)
+            return FALSE;
+
+        Event->Buffer[Length] = '\0';
+
+        if ((size_t)Length >= sizeof(Header) && memcmp(Event->Buffer, "libudev", 8) == 0)
+        {
+            memcpy(&Header, Event->Buffer, sizeof(Header));
+            if (ntohl(Header.Magic) != UDEV_MONITOR_MAGIC ||
+                Header.PropertiesOffset < sizeof(Header) ||
+                Header.PropertiesOffset > (size_t)Length ||
+                Header.PropertiesLength > (size_t)Length - Header.PropertiesOffset)
+                continue;
+
+            Field = Event->Buffer + Header.PropertiesOffset;
+            End = Field + Header.PropertiesLength;
+            Event->Processed = TRUE;
+        }
+        else
+        {
+            if (Address.nl_pid != 0 || memchr(Event->Buffer, '@', (size_t)Length) == NULL)
+                continue;
+
+            Field = Event->Buffer + strlen(Event->Buffer) + 1;
+            End = Event->Buffer + Length;
+            Event->Processed = FALSE;
+        }
+
+        Event->Action = NULL;
+        Event->DevPath = NULL;
+        Event->Subsystem = NULL;
+        Event->DevName = NULL;
+        Event->DevType = NULL;
+
+        for (; Field < End; Field += strlen(Field) + 1)
+        {
+            if (strncmp(Field, "ACTION=", 7) == 0)
+                Event->Action = Field + 7;
+            else if (strncmp(Field, "DEVPATH=", 8) == 0)
+                Event->DevPath = Field + 8;
+            else if (strncmp(Field, "SUBSYSTEM=", 10) == 0)
+                Event->Subsystem = Field + 10;
+            else if (strncmp(Field, "DEVNAME=", 8) == 0)
+                Event->DevName = Field + 8;
+            else if (strncmp(Field, "DEVTYPE=", 8) == 0)
+                Event->DevType = Field + 8;
+        }
+
+        if (Event->Action != NULL && Event->Subsystem != NULL)
+            return TRUE;
+    }
+}
+
+
+BOOL
+IsBlockUevent(
+    const UEVENT *Event)
+{
+    return (Event->Subsystem != NULL && strcmp(Event->Subsystem, "block") == 0);
+}
@@ -6,90 +6,153 @@
  * PROGRAMMERS:     Adapted by Radiump for Linux
  */
 
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <errno.h>
-#include <ctype.h>
-
-// Dummy structs to simulate ReactOS DiskPart environment
-typedef struct _DISK {
-    unsigned long Signature;
-    int Dirty;
-    // ... other members as needed ...
-} DISK;
-
-DISK *CurrentDisk = NULL;
-
-// Helpers
-int IsHexString(const char *str)
-{
-    while (*str)
-    {
-        if (!isxdigit((unsigned char)*str))
-            return 0;
-        str++;
-    }
-    return 1;
-}
+#include "diskpart.h"
+
+#include <fcntl.h>
+#include <unistd.h>
 
-int HasPrefix(const char *str, const char *prefix, const char **suffix)
+// Reads the disk signature from LBA 0, or writes NewSignature there and
+// leaves the boot code and the partition table as they are
+static int AccessMbrSignature(PDISKENTRY DiskEntry, unsigned long *Signature, const unsigned long *NewSignature)
 {
-    size_t len = strlen(prefix);
-    if (strncmp(str, prefix, len) == 0)
+    PMASTER_BOOT_RECORD Mbr;
+    UCHAR *Sector;
+    int Result = 0;
+    int fd;
+
+    Sector = malloc(DiskEntry->BytesPerSector);
+    if (Sector == NULL)
+        return 0;
+
+    fd = OpenDiskDevice(DiskEntry, (NewSignature != NULL) ? O_RDWR : O_RDONLY);
+    if (fd >= 0 && ReadDiskSectors(fd, DiskEntry, 0, 1, Sector))
     {
-        *suffix = str + len;
-        return 1;
+        Mbr = (PMASTER_BOOT_RECORD)Sector;
+        if (NewSignature == NULL)
+        {
+            *Signature = MbrGetSignature(Mbr);
+            Result = 1;
+        }
+        else
+        {
+            MbrSetSignature(Mbr, (ULONG)*NewSignature);
+            Result = WriteDiskSectors(fd, DiskEntry, 0, 1, Sector) && fsync(fd) == 0;
+        }
     }
-    return 0;
+
+    if (fd >= 0)
+        close(fd);
+    free(Sector);
+
+    return Result;
 }
 
-void UpdateDiskLayout(DISK *disk)
+static void PrintGuid(const GUID *Guid)
 {
-    // TODO: implement actual disk layout update logic
-    printf("[DEBUG] Disk layout updated\n");
+    printf("{%08X-%04X-%04X-%02X%02X-%02X%02X%02X%02X%02X%02X}",
+           (unsigned int)Guid->Data1, Guid->Data2, Guid->Data3,
+           Guid->Data4[0], Guid->Data4[1], Guid->Data4[2], Guid->Data4[3],
+           Guid->Data4[4], Guid->Data4[5], Guid->Data4[6], Guid->Data4[7]);
 }
 
-void WritePartitions(DISK *disk)
+static int ParseGuid(const char *String, GUID *Guid)
 {
-    // TODO: implement actual write partitions logic
-    printf("[DEBUG] Partitions written to disk\n");
+    unsigned int Data1, Data2, Data3, Data4[8];
+    int Length = 0;
+    int i;
+
+    if (*String == '{')
+        String++;
+
+    if (sscanf(String, "%8x-%4x-%4x-%2x%2x-%2x%2x%2x%2x%2x%2x%n",
+               &Data1, &Data2, &Data3, &Data4[0], &Data4[1], &Data4[2], &Data4[3],
+               &Data4[4], &Data4[5], &Data4[6], &Data4[7], &Length) != 11 ||
+        Length != 36 || (String[36] != '\0' && strcmp(&String[36], "}") != 0))
+        return 0;
+
+    Guid->Data1 = Data1;
+    Guid->Data2 = (USHORT)Data2;
+    Guid->Data3 = (USHORT)Data3;
+    for (i = 0; i < 8; i++)
+        Guid->Data4[i] = (UCHAR)Data4[i];
+
+    return 1;
 }
 
 // The adapted UniqueIdDisk function
-int UniqueIdDisk(int argc, char *argv[])
+BOOL UniqueIdDisk(int argc, char *argv[])
 {
-    const char *pszSuffix = NULL;
+    char *pszSuffix = NULL;
     unsigned long ulValue;
+    GUID DiskGuid;
 
     if (CurrentDisk == NULL)
     {
         printf("No disk selected.\n");
-        return 1;
+        CommandFailed = TRUE;
+        return TRUE;
+    }
+
+    if (CurrentDisk->PartitionStyle == PARTITION_STYLE_RAW)
+    {
+        printf("The disk has no partition table.\n");
+        return TRUE;
     }
 
     if (argc == 2)
     {
-        printf("\nDisk ID: %08lx\n\n", CurrentDisk->Signature);
-        return 0;
+        if (CurrentDisk->PartitionStyle == PARTITION_STYLE_GPT)
+        {
+            printf("\nDisk ID: ");
+            PrintGuid(&CurrentDisk->DiskGuid);
+            printf("\n\n");
+        }
+        else if (AccessMbrSignature(CurrentDisk, &ulValue, NULL))
+        {
+            printf("\nDisk ID: %08lx\n\n", ulValue);
+        }
+        else
+        {
+            printf("Failed to read the disk signature.\n");
+        }
+        return TRUE;
     }
 
     if (argc != 3)
     {
         printf("Invalid arguments.\n");
-        return 1;
+        return TRUE;
     }
 
     if (!HasPrefix(argv[2], "ID=", &pszSuffix))
     {
         printf("Invalid arguments.\n");
-        return 1;
+        return TRUE;
+    }
+
+    if (CurrentDisk->PartitionStyle == PARTITION_STYLE_GPT)
+    {
+        if (!ParseGuid(pszSuffix, &DiskGuid) || GptIsNullGuid(&DiskGuid))
+        {
+            printf("Invalid arguments.\n");
+            return TRUE;
+        }
+
+        // Goes into both GPT headers with the next table write
+        CurrentDisk->DiskGuid = DiskGuid;
+        CurrentDisk->Dirty = TRUE;
+
+        UpdateDiskLayout(CurrentDisk);
+        if (!NT_SUCCESS(WritePartitions(CurrentDisk)))
+            printf("Failed to write the new disk ID.\n");
+
+        return TRUE;
     }
 
     if (pszSuffix == NULL || strlen(pszSuffix) != 8 || !IsHexString(pszSuffix))
     {
         printf("Invalid arguments.\n");
-        return 1;
+        return TRUE;
     }
 
     errno = 0;
@@ -97,15 +160,18 @@ int UniqueIdDisk(int argc, char *argv[])
     if ((ulValue == 0) && (errno == ERANGE))
     {
         printf("Invalid arguments.\n");
-        return 1;
+        return TRUE;
     }
 
     printf("New Signature: 0x%08lx\n", ulValue);
-    CurrentDisk->Signature = ulValue;
-    CurrentDisk->Dirty = 1;
 
-    UpdateDiskLayout(CurrentDisk);
-    WritePartitions(CurrentDisk);
+    if (!LockDisk(CurrentDisk, TRUE))
+        return TRUE;
+
+    if (!AccessMbrSignature(CurrentDisk, NULL, &ulValue))
+        printf("Failed to write the new disk ID.\n");
+
+    UnlockDisk(CurrentDisk);
 
-    return 0;
+    return TRUE;
 }
@@ -0,0 +1,711 @@
+/*
+ * PROJECT:         ReactOS DiskPart (Linux port)
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * FILE:            base/system/diskpart/vdisk.c
+ * PURPOSE:         Virtual disks: image files attached through loop devices.
+ */
+
+#define _GNU_SOURCE
+#include "diskpart.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <strings.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <linux/fs.h>
+#include <linux/loop.h>
+
+#define MAX_LOOP_RETRIES 8
+#define VDISK_COPY_CHUNK (8 * 1024 * 1024)
+
+/* The image file that attach and detach work on */
+char CurrentVirtualDisk[MAX_PATH];
+
+/* FUNCTIONS ******************************************************************/
+
+/*
+ * Resolves the image path the way the loop driver reports backing files.
+ * realpath() with a caller buffer assumes PATH_MAX bytes, so let it allocate.
+ */
+static
+BOOL
+ResolveImagePath(
+    const char *FileName,
+    char *Buffer,
+    size_t Size)
+{
+    char *RealName;
+    int Length;
+
+    RealName = realpath(FileName, NULL);
+    if (RealName == NULL)
+        return FALSE;
+
+    Length = snprintf(Buffer, Size, "%s", RealName);
+    free(RealName);
+
+    if (Length < 0 || (size_t)Length >= Size)
+    {
+        errno = ENAMETOOLONG;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+/*
+ * Logical block size of the device holding the image. For a partition the
+ * queue limits live in the parent disk's directory.
+ */
+static
+ULONG
+GetBackingBlockSize(
+    int fd)
+{
+    struct stat StatBuffer;
+    char Path[MAX_PATH];
+    ULONGLONG BlockSize;
+
+    if (fstat(fd, &StatBuffer) < 0)
+        return 512;
+
+    snprintf(Path, sizeof(Path), "/sys/dev/block/%u:%u/queue/logical_block_size",
+             major(StatBuffer.st_dev), minor(StatBuffer.st_dev));
+    BlockSize = ReadSysfsNumber(Path);
+
+    if (BlockSize == 0)
+    {
+        snprintf(Path, sizeof(Path), "/sys/dev/block/%u:%u/../queue/logical_block_size",
+                 major(StatBuffer.st_dev), minor(StatBuffer.st_dev));
+        BlockSize = ReadSysfsNumber(Path);
+    }
+
+    return BlockSize ? (ULONG)BlockSize : 512;
+}
+
+
+/* Binds FileFd to LoopFd, using the pre-5.8 ioctl sequence if needed */
+static
+BOOL
+ConfigureLoopDevice(
+    int LoopFd,
+    int FileFd,
+    const char *FileName,
+    ULONG BlockSize,
+    ULONG Flags)
+{
+    struct loop_config Config;
+
+    memset(&Config, 0, sizeof(Config));
+    Config.fd = (unsigned int)FileFd;
+    Config.block_size = BlockSize;
+    Config.info.lo_flags = Flags;
+    snprintf((char *)Config.info.lo_file_name, LO_NAME_SIZE, "%s", FileName);
+
+    if (ioctl(LoopFd, LOOP_CONFIGURE, &Config) == 0)
+        return TRUE;
+
+    if (errno != ENOTTY && errno != EINVAL)
+        return FALSE;
+
+    if (ioctl(LoopFd, LOOP_SET_FD, FileFd) < 0)
+        return FALSE;
+
+    if (ioctl(LoopFd, LOOP_SET_STATUS64, &Config.info) < 0 ||
+        ioctl(LoopFd, LOOP_SET_BLOCK_SIZE, (unsigned long)BlockSize) < 0 ||
+        ((Flags & LO_FLAGS_DIRECT_IO) && ioctl(LoopFd, LOOP_SET_DIRECT_IO, 1UL) < 0))
+    {
+        ioctl(LoopFd, LOOP_CLR_FD, 0);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+/*
+ * Attaches the image to a free loop device with direct I/O and the block
+ * size of the device underneath, so that reads and writes bypass the page
+ * cache of the image file. Falls back to buffered I/O where the backing
+ * filesystem has no O_DIRECT support (tmpfs, some FUSE mounts).
+ */
+BOOL
+AttachVirtualDisk(
+    const char *FileName,
+    BOOL ReadOnly,
+    PVDISKENTRY VDiskEntry)
+{
+    char LoopName[MAX_PATH];
+    char RealName[MAX_PATH];
+    ULONG BlockSize, Flags;
+    int ControlFd, LoopFd = -1, FileFd, ProbeFd;
+    int Number = -1, Retry;
+    BOOL DirectIo;
+    BOOL Success = FALSE;
+
+    if (!ResolveImagePath(FileName, RealName, sizeof(RealName)))
+    {
+        fprintf(stderr, "Failed to find %s: %s\n", FileName, strerror(errno));
+        return FALSE;
+    }
+
+    FileFd = open(RealName, (ReadOnly ? O_RDONLY : O_RDWR) | O_CLOEXEC);
+    if (FileFd < 0)
+    {
+        fprintf(stderr, "Failed to open %s: %s\n", RealName, strerror(errno));
+        return FALSE;
+    }
+
+    /* Direct I/O on the loop device needs O_DIRECT support in the image's filesystem */
+    ProbeFd = open(RealName, O_RDONLY | O_DIRECT | O_CLOEXEC);
+    DirectIo = (ProbeFd >= 0);
+    if (ProbeFd >= 0)
+        close(ProbeFd);
+
+    BlockSize = GetBackingBlockSize(FileFd);
+
+    ControlFd = open("/dev/loop-control", O_RDWR | O_CLOEXEC);
+    if (ControlFd < 0)
+    {
+        perror("Failed to open /dev/loop-control");
+        close(FileFd);
+        return FALSE;
+    }
+
+    /* Another process may grab the same free device; just try the next one */
+    for (Retry = 0; Retry < MAX_LOOP_RETRIES && !Success; Retry++)
+    {
+        Number = ioctl(ControlFd, LOOP_CTL_GET_FREE);
+        if (Number < 0)
+        {
+            perror("ioctl LOOP_CTL_GET_FREE");
+            break;
+        }
+
+        snprintf(LoopName, sizeof(LoopName), "/dev/loop%d", Number);
+        LoopFd = open(LoopName, (ReadOnly ? O_RDONLY : O_RDWR) | O_CLOEXEC);
+        if (LoopFd < 0)
+            continue;
+
+        Flags = LO_FLAGS_PARTSCAN | (ReadOnly ? LO_FLAGS_READ_ONLY : 0);
+
+        errno = 0;
+        Success = DirectIo &&
+                  ConfigureLoopDevice(LoopFd, FileFd, RealName, BlockSize, Flags | LO_FLAGS_DIRECT_IO);
+
+        if (!Success && errno != EBUSY)
+        {
+            DirectIo = FALSE;
+            Success = ConfigureLoopDevice(LoopFd, FileFd, RealName, BlockSize, Flags);
+        }
+
+        if (!Success && errno != EBUSY)
+        {
+            fprintf(stderr, "Failed to attach %s to %s: %s\n", RealName, LoopName, strerror(errno));
+            close(LoopFd);
+            break;
+        }
+
+        close(LoopFd);
+    }
+
+    close(ControlFd);
+    close(FileFd);
+
+    if (!Success)
+        return FALSE;
+
+    if (VDiskEntry != NULL)
+    {
+        memset(VDiskEntry, 0, sizeof(VDISKENTRY));
+        VDiskEntry->LoopNumber = (ULONG)Number;
+        snprintf(VDiskEntry->DeviceName, sizeof(VDiskEntry->DeviceName), "%s", LoopName);
+        snprintf(VDiskEntry->FileName, sizeof(VDiskEntry->FileName), "%s", RealName);
+        VDiskEntry->BlockSize = BlockSize;
+        VDiskEntry->DirectIo = DirectIo;
+        VDiskEntry->ReadOnly = ReadOnly;
+    }
+
+    return TRUE;
+}
+
+
+/*
+ * Calls Callback for every bound loop device, or only for those backed by
+ * FileName if it is given, until the callback returns FALSE. Only matching
+ * devices have their attributes read. Returns the number of devices passed
+ * to the callback, or -1 if sysfs cannot be read.
+ */
+int
+EnumerateVirtualDisks(
+    const char *FileName,
+    VDISK_CALLBACK Callback,
+    void *Context)
+{
+    struct dirent *DirEntry;
+    char Path[MAX_PATH * 2];
+    VDISKENTRY Entry;
+    DIR *Dir;
+    int Count = 0;
+
+    Dir = opendir("/sys/block");
+    if (Dir == NULL)
+        return -1;
+
+    while ((DirEntry = readdir(Dir)) != NULL)
+    {
+        if (strncmp(DirEntry->d_name, "loop", 4) != 0)
+            continue;
+
+        memset(&Entry, 0, sizeof(Entry));
+
+        /* Only bound devices have a backing file */
+        snprintf(Path, sizeof(Path), "/sys/block/%s/loop/backing_file", DirEntry->d_name);
+        if (!ReadSysfsString(Path, Entry.FileName, sizeof(Entry.FileName)))
+            continue;
+
+        if (FileName != NULL && strcmp(Entry.FileName, FileName) != 0)
+            continue;
+
+        Entry.LoopNumber = (ULONG)strtoul(DirEntry->d_name + 4, NULL, 10);
+        snprintf(Entry.DeviceName, sizeof(Entry.DeviceName), "/dev/loop%lu", (unsigned long)Entry.LoopNumber);
+
+        snprintf(Path, sizeof(Path), "/sys/block/%s/size", DirEntry->d_name);
+        Entry.Size = ReadSysfsNumber(Path) * 512;
+
+        snprintf(Path, sizeof(Path), "/sys/block/%s/queue/logical_block_size", DirEntry->d_name);
+        Entry.BlockSize = (ULONG)ReadSysfsNumber(Path);
+
+        snprintf(Path, sizeof(Path), "/sys/block/%s/loop/dio", DirEntry->d_name);
+        Entry.DirectIo = (ReadSysfsNumber(Path) != 0);
+
+        snprintf(Path, sizeof(Path), "/sys/block/%s/ro", DirEntry->d_name);
+        Entry.ReadOnly = (ReadSysfsNumber(Path) != 0);
+
+        Count++;
+        if (!Callback(Context, &Entry))
+            break;
+    }
+
+    closedir(Dir);
+
+    return Count;
+}
+
+
+/* Keeps the first match and stops */
+static
+BOOL
+CopyVirtualDisk(
+    void *Context,
+    PVDISKENTRY Entry)
+{
+    *(PVDISKENTRY)Context = *Entry;
+    return FALSE;
+}
+
+
+/* Looks up a loop device that the image is attached to */
+BOOL
+FindAttachedVirtualDisk(
+    const char *FileName,
+    PVDISKENTRY VDiskEntry)
+{
+    char RealName[MAX_PATH];
+
+    if (!ResolveImagePath(FileName, RealName, sizeof(RealName)))
+        return FALSE;
+
+    return EnumerateVirtualDisks(RealName, CopyVirtualDisk, VDiskEntry) > 0;
+}
+
+
+static
+BOOL
+DetachLoopDevice(
+    void *Context,
+    PVDISKENTRY Entry)
+{
+    BOOL *Success = Context;
+    int fd;
+
+    fd = open(Entry->DeviceName, O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || ioctl(fd, LOOP_CLR_FD, 0) < 0)
+    {
+        fprintf(stderr, "Failed to detach %s: %s\n", Entry->DeviceName, strerror(errno));
+        *Success = FALSE;
+    }
+
+    if (fd >= 0)
+        close(fd);
+
+    return TRUE;
+}
+
+
+/* Detaches every loop device that is backed by the image */
+BOOL
+DetachVirtualDisk(
+    const char *FileName)
+{
+    char RealName[MAX_PATH];
+    BOOL Success = TRUE;
+
+    if (!ResolveImagePath(FileName, RealName, sizeof(RealName)))
+        snprintf(RealName, sizeof(RealName), "%s", FileName);
+
+    if (EnumerateVirtualDisks(RealName, DetachLoopDevice, &Success) <= 0)
+    {
+        fprintf(stderr, "%s is not attached.\n", RealName);
+        return FALSE;
+    }
+
+    return Success;
+}
+
+
+static
+BOOL
+RefreshLoopCapacity(
+    void *Context,
+    PVDISKENTRY Entry)
+{
+    BOOL *Success = Context;
+    int fd;
+
+    fd = open(Entry->DeviceName, O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || ioctl(fd, LOOP_SET_CAPACITY, 0) < 0)
+    {
+        fprintf(stderr, "Failed to resize %s: %s\n", Entry->DeviceName, strerror(errno));
+        *Success = FALSE;
+    }
+
+    if (fd >= 0)
+        close(fd);
+
+    return TRUE;
+}
+
+
+/*
+ * Grows the image to NewSize bytes. A fully allocated (fixed) image gets
+ * the new blocks allocated too; an expandable one just gets longer. Loop
+ * devices the image is attached to pick up the new size.
+ */
+BOOL
+ExpandVirtualDisk(
+    const char *FileName,
+    ULONGLONG NewSize)
+{
+    char RealName[MAX_PATH];
+    struct stat StatBuffer;
+    BOOL Success = TRUE;
+    int fd, Result;
+
+    if (!ResolveImagePath(FileName, RealName, sizeof(RealName)))
+    {
+        fprintf(stderr, "Failed to find %s: %s\n", FileName, strerror(errno));
+        return FALSE;
+    }
+
+    fd = open(RealName, O_RDWR | O_CLOEXEC);
+    if (fd < 0 || fstat(fd, &StatBuffer) < 0)
+    {
+        fprintf(stderr, "Failed to open %s: %s\n", RealName, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return FALSE;
+    }
+
+    if (NewSize <= (ULONGLONG)StatBuffer.st_size)
+    {
+        fprintf(stderr, "%s is already %llu MB.\n", RealName,
+                (unsigned long long)(StatBuffer.st_size / 1048576));
+        close(fd);
+        return FALSE;
+    }
+
+    if ((ULONGLONG)StatBuffer.st_blocks * 512 >= (ULONGLONG)StatBuffer.st_size)
+        Result = posix_fallocate(fd, StatBuffer.st_size, (off_t)NewSize - StatBuffer.st_size);
+    else
+        Result = (ftruncate(fd, (off_t)NewSize) == 0) ? 0 : errno;
+
+    close(fd);
+
+    if (Result != 0)
+    {
+        fprintf(stderr, "Failed to grow %s: %s\n", RealName, strerror(Result));
+        return FALSE;
+    }
+
+    EnumerateVirtualDisks(RealName, RefreshLoopCapacity, &Success);
+
+    return Success;
+}
+
+
+/* create vdisk file=<path> maximum=<MB> [type=fixed|expandable] [noerr] */
+BOOL
+CreateVirtualDisk(
+    int argc,
+    char **argv)
+{
+    char *pszSuffix = NULL;
+    char *pszFile = NULL;
+    ULONGLONG MaxSize = 0;
+    BOOL bFixed = FALSE;
+    int fd, i, Result;
+
+    for (i = 2; i < argc; i++)
+    {
+        if (HasPrefix(argv[i], "file=", &pszSuffix))
+        {
+            free(pszFile);
+            pszFile = DuplicateQuotedString(pszSuffix);
+        }
+        else if (HasPrefix(argv[i], "maximum=", &pszSuffix))
+        {
+            if (!IsDecString(pszSuffix))
+            {
+                printf("Invalid size: %s\n", pszSuffix);
+                free(pszFile);
+                return TRUE;
+            }
+            MaxSize = strtoull(pszSuffix, NULL, 10);
+        }
+        else if (HasPrefix(argv[i], "type=", &pszSuffix))
+        {
+            if (strcasecmp(pszSuffix, "fixed") == 0)
+                bFixed = TRUE;
+            else if (strcasecmp(pszSuffix, "expandable") != 0)
+            {
+                printf("Invalid type: %s\n", pszSuffix);
+                free(pszFile);
+                return TRUE;
+            }
+        }
+        else if (strcasecmp(argv[i], "noerr") != 0)
+        {
+            printf("Invalid argument: %s\n", argv[i]);
+            free(pszFile);
+            return TRUE;
+        }
+    }
+
+    if (pszFile == NULL || MaxSize == 0)
+    {
+        printf("Usage: create vdisk file=<path> maximum=<MB> [type=fixed|expandable]\n");
+        free(pszFile);
+        return TRUE;
+    }
+
+    fd = open(pszFile, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd < 0)
+    {
+        printf("\nDiskPart failed to create %s: %s\n\n", pszFile, strerror(errno));
+        free(pszFile);
+        return TRUE;
+    }
+
+    /* Expandable images stay sparse; fixed ones get all their blocks now */
+    if (bFixed)
+        Result = posix_fallocate(fd, 0, (off_t)(MaxSize * 1048576ULL));
+    else
+        Result = (ftruncate(fd, (off_t)(MaxSize * 1048576ULL)) == 0) ? 0 : errno;
+
+    close(fd);
+
+    if (Result != 0)
+    {
+        printf("\nDiskPart failed to size %s: %s\n\n", pszFile, strerror(Result));
+        unlink(pszFile);
+        free(pszFile);
+        return TRUE;
+    }
+
+    /* Stored resolved, as the loop devices report their backing file */
+    if (!ResolveImagePath(pszFile, CurrentVirtualDisk, sizeof(CurrentVirtualDisk)))
+        snprintf(CurrentVirtualDisk, sizeof(CurrentVirtualDisk), "%s", pszFile);
+    printf("\nDiskPart successfully created the virtual disk file.\n\n");
+
+    free(pszFile);
+
+    return TRUE;
+}
+
+
+/* select vdisk file=<path> */
+BOOL
+SelectVirtualDisk(
+    int argc,
+    char **argv)
+{
+    char *pszSuffix = NULL;
+    char *pszFile;
+    struct stat StatBuffer;
+
+    if (argc < 3 || !HasPrefix(argv[2], "file=", &pszSuffix))
+    {
+        printf("Usage: select vdisk file=<path>\n");
+        return TRUE;
+    }
+
+    pszFile = DuplicateQuotedString(pszSuffix);
+    if (pszFile == NULL || stat(pszFile, &StatBuffer) < 0 || !S_ISREG(StatBuffer.st_mode))
+    {
+        printf("\nThe virtual disk file could not be found.\n\n");
+        free(pszFile);
+        return TRUE;
+    }
+
+    if (!ResolveImagePath(pszFile, CurrentVirtualDisk, sizeof(CurrentVirtualDisk)))
+        snprintf(CurrentVirtualDisk, sizeof(CurrentVirtualDisk), "%s", pszFile);
+    printf("\nDiskPart successfully selected the virtual disk file.\n\n");
+
+    free(pszFile);
+
+    return TRUE;
+}
+
+
+/*
+ * Copies the data extents of Source into Target, leaving holes as holes.
+ * copy_file_range lets the filesystem share or offload the copy where it
+ * can; pread/pwrite is the last resort.
+ */
+static
+BOOL
+CopySparseFile(
+    int SourceFd,
+    int TargetFd,
+    ULONGLONG Size)
+{
+    ULONGLONG Data, Hole;
+    off_t InOffset, OutOffset;
+    ssize_t Result;
+    size_t Length;
+    UCHAR *Buffer = NULL;
+    BOOL UseCopyRange = TRUE;
+
+    if (ftruncate(TargetFd, (off_t)Size) != 0)
+        return FALSE;
+
+    for (Data = 0; Data < Size; Data = Hole)
+    {
+        Data = (ULONGLONG)lseek(SourceFd, (off_t)Data, SEEK_DATA);
+        if ((off_t)Data < 0)
+            break;      /* ENXIO: only holes left */
+
+        Hole = (ULONGLONG)lseek(SourceFd, (off_t)Data, SEEK_HOLE);
+        if ((off_t)Hole < 0)
+            Hole = Size;
+
+        InOffset = OutOffset = (off_t)Data;
+
+        while ((ULONGLONG)InOffset < Hole)
+        {
+            Length = (Hole - InOffset > VDISK_COPY_CHUNK) ? VDISK_COPY_CHUNK : (size_t)(Hole - InOffset);
+
+            if (UseCopyRange)
+            {
+                Result = copy_file_range(SourceFd, &InOffset, TargetFd, &OutOffset, Length, 0);
+                if (Result > 0)
+                    continue;
+                if (Result < 0 && errno != EXDEV && errno != EINVAL && errno != ENOSYS && errno != EOPNOTSUPP)
+                    break;
+                UseCopyRange = FALSE;
+            }
+
+            if (Buffer == NULL && (Buffer = malloc(VDISK_COPY_CHUNK)) == NULL)
+                break;
+
+            Result = pread(SourceFd, Buffer, Length, InOffset);
+            if (Result <= 0 || pwrite(TargetFd, Buffer, (size_t)Result, OutOffset) != Result)
+                break;
+
+            InOffset += Result;
+            OutOffset += Result;
+        }
+
+        if ((ULONGLONG)InOffset < Hole)
+        {
+            free(Buffer);
+            return FALSE;
+        }
+    }
+
+    free(Buffer);
+
+    return TRUE;
+}
+
+
+/*
+ * Creates Target as a point-in-time copy of the image Source. On
+ * filesystems with reflinks (XFS, btrfs, bcachefs) the copy shares all
+ * blocks with the source and costs neither time nor space until either
+ * side is written; elsewhere only the allocated extents are copied.
+ */
+BOOL
+SnapshotVirtualDisk(
+    const char *Source,
+    const char *Target,
+    BOOL *Cloned)
+{
+    struct stat StatBuffer;
+    int SourceFd, TargetFd;
+    BOOL Success = FALSE;
+
+    *Cloned = FALSE;
+
+    SourceFd = open(Source, O_RDONLY | O_CLOEXEC);
+    if (SourceFd < 0 || fstat(SourceFd, &StatBuffer) < 0 || !S_ISREG(StatBuffer.st_mode))
+    {
+        fprintf(stderr, "Failed to open %s: %s\n", Source, strerror(errno));
+        if (SourceFd >= 0)
+            close(SourceFd);
+        return FALSE;
+    }
+
+    TargetFd = open(Target, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, StatBuffer.st_mode & 0777);
+    if (TargetFd < 0)
+    {
+        fprintf(stderr, "Failed to create %s: %s\n", Target, strerror(errno));
+        close(SourceFd);
+        return FALSE;
+    }
+
+    if (ioctl(TargetFd, FICLONE, SourceFd) == 0)
+    {
+        *Cloned = TRUE;
+        Success = TRUE;
+    }
+    else if (errno == EOPNOTSUPP || errno == EXDEV || errno == EINVAL || errno == ENOTTY)
+    {
+        Success = CopySparseFile(SourceFd, TargetFd, (ULONGLONG)StatBuffer.st_size);
+        if (!Success)
+            fprintf(stderr, "Failed to copy %s: %s\n", Source, strerror(errno));
+    }
+    else
+    {
+        perror("ioctl FICLONE");
+    }
+
+    if (Success && fsync(TargetFd) != 0)
+    {
+        perror("fsync");
+        Success = FALSE;
+    }
+
+    close(TargetFd);
+    close(SourceFd);
+
+    if (!Success)
+        unlink(Target);
+
+    return Success;
+}
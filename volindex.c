@@ -0,0 +1,524 @@
+/*
+ * PROJECT:         ReactOS DiskPart (Linux port)
+ * LICENSE:         GPL - See COPYING in the top level directory
+ * FILE:            base/system/diskpart/volindex.c
+ * PURPOSE:         Index between volumes and the disks and partitions under
+ *                  their extents.
+ */
+
+#include "diskpart.h"
+
+/*
+ * Built with the volume list: every extent of every volume is resolved
+ * once to its disk and to the partitions it overlaps, and the resulting
+ * links are kept in three sorted arrays, so that the volumes of a disk or
+ * partition and the disks of a volume are a binary search and a run of
+ * results away. Links are unique per disk and volume, and per partition
+ * and volume, however many extents a volume has there.
+ */
+
+/* The partitions of one disk, ordered by start */
+typedef struct _DISK_PARTITIONS {
+    PDISKENTRY DiskEntry;
+    PPARTENTRY *Partitions;
+    ULONG Count;
+} DISK_PARTITIONS, *PDISK_PARTITIONS;
+
+/* By disk and volume number */
+static PVOLUME_LINK DiskLinks = NULL;
+static ULONG DiskLinkCount = 0;
+
+/* The same links by volume and disk number */
+static PVOLUME_LINK VolumeLinks = NULL;
+
+/* By disk, partition offset and volume number */
+static PVOLUME_LINK PartitionLinks = NULL;
+static ULONG PartitionLinkCount = 0;
+
+/* FUNCTIONS ******************************************************************/
+
+static
+int
+CompareDiskPartitions(
+    const void *Left,
+    const void *Right)
+{
+    ULONG A = ((const DISK_PARTITIONS *)Left)->DiskEntry->DiskNumber;
+    ULONG B = ((const DISK_PARTITIONS *)Right)->DiskEntry->DiskNumber;
+
+    return (A > B) - (A < B);
+}
+
+
+static
+int
+ComparePartitionStart(
+    const void *Left,
+    const void *Right)
+{
+    ULONGLONG A = (*(PPARTENTRY const *)Left)->StartSector;
+    ULONGLONG B = (*(PPARTENTRY const *)Right)->StartSector;
+
+    return (A > B) - (A < B);
+}
+
+
+static
+int
+CompareByDisk(
+    const void *Left,
+    const void *Right)
+{
+    const VOLUME_LINK *A = Left;
+    const VOLUME_LINK *B = Right;
+
+    if (A->DiskNumber != B->DiskNumber)
+        return (A->DiskNumber > B->DiskNumber) ? 1 : -1;
+
+    return (A->VolumeNumber > B->VolumeNumber) - (A->VolumeNumber < B->VolumeNumber);
+}
+
+
+static
+int
+CompareByVolume(
+    const void *Left,
+    const void *Right)
+{
+    const VOLUME_LINK *A = Left;
+    const VOLUME_LINK *B = Right;
+
+    if (A->VolumeNumber != B->VolumeNumber)
+        return (A->VolumeNumber > B->VolumeNumber) ? 1 : -1;
+
+    return (A->DiskNumber > B->DiskNumber) - (A->DiskNumber < B->DiskNumber);
+}
+
+
+static
+int
+CompareByPartition(
+    const void *Left,
+    const void *Right)
+{
+    const VOLUME_LINK *A = Left;
+    const VOLUME_LINK *B = Right;
+
+    if (A->DiskNumber != B->DiskNumber)
+        return (A->DiskNumber > B->DiskNumber) ? 1 : -1;
+
+    if (A->PartitionOffset != B->PartitionOffset)
+        return (A->PartitionOffset > B->PartitionOffset) ? 1 : -1;
+
+    return (A->VolumeNumber > B->VolumeNumber) - (A->VolumeNumber < B->VolumeNumber);
+}
+
+
+/* Sorts the links and drops the duplicates, returning the new count */
+static
+ULONG
+SortUniqueLinks(
+    PVOLUME_LINK Links,
+    ULONG Count,
+    int (*Compare)(const void *, const void *))
+{
+    ULONG i, Unique = 0;
+
+    if (Count == 0)
+        return 0;
+
+    qsort(Links, Count, sizeof(VOLUME_LINK), Compare);
+
+    for (i = 1; i < Count; i++)
+    {
+        if (Compare(&Links[Unique], &Links[i]) != 0)
+            Links[++Unique] = Links[i];
+    }
+
+    return Unique + 1;
+}
+
+
+/*
+ * The first partition that ends after Offset. Partitions do not overlap, so
+ * their ends are ordered like their starts.
+ */
+static
+ULONG
+FindFirstPartitionEndingAfter(
+    PDISK_PARTITIONS Disk,
+    ULONGLONG Offset)
+{
+    ULONG BytesPerSector = Disk->DiskEntry->BytesPerSector;
+    ULONG Low = 0, High = Disk->Count, Middle;
+    PPARTENTRY PartEntry;
+
+    while (Low < High)
+    {
+        Middle = Low + (High - Low) / 2;
+        PartEntry = Disk->Partitions[Middle];
+        if ((PartEntry->StartSector + PartEntry->SectorCount) * BytesPerSector <= Offset)
+            Low = Middle + 1;
+        else
+            High = Middle;
+    }
+
+    return Low;
+}
+
+
+/*
+ * Lists the data partitions of every disk, sorted so that extents can be
+ * placed with a binary search. Both arrays are freed with the first one.
+ */
+static
+PDISK_PARTITIONS
+CollectDiskPartitions(
+    ULONG *DiskCount)
+{
+    ListEntry *DiskListEntry, *Entry;
+    ListEntry *Heads[2];
+    PDISK_PARTITIONS Disks;
+    PPARTENTRY *Partitions;
+    PDISKENTRY DiskEntry;
+    PPARTENTRY PartEntry;
+    ULONG Count = 0, PartitionCount = 0, Next = 0;
+    ULONG d = 0;
+    int i;
+
+    for (DiskListEntry = DiskListHead.Flink; DiskListEntry != &DiskListHead; DiskListEntry = DiskListEntry->Flink)
+    {
+        DiskEntry = CONTAINING_RECORD(DiskListEntry, DISKENTRY, ListEntry);
+        Count++;
+
+        Heads[0] = &DiskEntry->PrimaryPartListHead;
+        Heads[1] = &DiskEntry->LogicalPartListHead;
+        for (i = 0; i < 2; i++)
+        {
+            for (Entry = Heads[i]->Flink; Entry != Heads[i]; Entry = Entry->Flink)
+                PartitionCount++;
+        }
+    }
+
+    /* One block: the disks, then the partitions they point into */
+    Disks = malloc(Count * sizeof(DISK_PARTITIONS) + PartitionCount * sizeof(PPARTENTRY) + 1);
+    if (Disks == NULL)
+        return NULL;
+    Partitions = (PPARTENTRY *)(Disks + Count);
+
+    for (DiskListEntry = DiskListHead.Flink; DiskListEntry != &DiskListHead; DiskListEntry = DiskListEntry->Flink)
+    {
+        DiskEntry = CONTAINING_RECORD(DiskListEntry, DISKENTRY, ListEntry);
+
+        Disks[d].DiskEntry = DiskEntry;
+        Disks[d].Partitions = &Partitions[Next];
+        Disks[d].Count = 0;
+
+        Heads[0] = &DiskEntry->PrimaryPartListHead;
+        Heads[1] = &DiskEntry->LogicalPartListHead;
+        for (i = 0; i < 2; i++)
+        {
+            for (Entry = Heads[i]->Flink; Entry != Heads[i]; Entry = Entry->Flink)
+            {
+                PartEntry = CONTAINING_RECORD(Entry, PARTENTRY, ListEntry);
+
+                /* Logical drives lie within the container; place extents in them */
+                if (!PartEntry->IsPartitioned || IsContainerPartition(PartEntry->PartitionType))
+                    continue;
+
+                Disks[d].Partitions[Disks[d].Count++] = PartEntry;
+            }
+        }
+
+        qsort(Disks[d].Partitions, Disks[d].Count, sizeof(PPARTENTRY), ComparePartitionStart);
+        Next += Disks[d].Count;
+        d++;
+    }
+
+    qsort(Disks, Count, sizeof(DISK_PARTITIONS), CompareDiskPartitions);
+
+    *DiskCount = Count;
+    return Disks;
+}
+
+
+static
+PDISK_PARTITIONS
+FindDiskPartitions(
+    PDISK_PARTITIONS Disks,
+    ULONG Count,
+    ULONG DiskNumber)
+{
+    ULONG Low = 0, High = Count, Middle;
+
+    while (Low < High)
+    {
+        Middle = Low + (High - Low) / 2;
+        if (Disks[Middle].DiskEntry->DiskNumber == DiskNumber)
+            return &Disks[Middle];
+
+        if (Disks[Middle].DiskEntry->DiskNumber < DiskNumber)
+            Low = Middle + 1;
+        else
+            High = Middle;
+    }
+
+    return NULL;
+}
+
+
+void
+DestroyVolumeIndex(void)
+{
+    free(DiskLinks);
+    free(VolumeLinks);
+    free(PartitionLinks);
+
+    DiskLinks = NULL;
+    VolumeLinks = NULL;
+    PartitionLinks = NULL;
+    DiskLinkCount = 0;
+    PartitionLinkCount = 0;
+}
+
+
+/* Called once the volume list is complete; replaces any previous index */
+BOOL
+BuildVolumeIndex(void)
+{
+    PDISK_PARTITIONS Disks, Disk;
+    PPARTENTRY PartEntry;
+    PVOLENTRY VolumeEntry;
+    PDISK_EXTENT Extent;
+    PVOLUME_LINK NewLinks;
+    ListEntry *Entry;
+    ULONGLONG End;
+    ULONG DiskCount, ExtentCount = 0, LinkCount = 0, PartitionAllocated;
+    ULONG BytesPerSector;
+    ULONG i, j;
+
+    DestroyVolumeIndex();
+
+    for (Entry = VolumeListHead.Flink; Entry != &VolumeListHead; Entry = Entry->Flink)
+    {
+        VolumeEntry = CONTAINING_RECORD(Entry, VOLENTRY, ListEntry);
+        if (VolumeEntry->pExtents != NULL)
+            ExtentCount += VolumeEntry->pExtents->NumberOfDiskExtents;
+    }
+
+    /* Most extents lie in one partition; the partition links grow past that */
+    PartitionAllocated = ExtentCount ? ExtentCount : 1;
+
+    Disks = CollectDiskPartitions(&DiskCount);
+    DiskLinks = malloc(ExtentCount * sizeof(VOLUME_LINK) + 1);
+    PartitionLinks = malloc(PartitionAllocated * sizeof(VOLUME_LINK));
+    if (Disks == NULL || DiskLinks == NULL || PartitionLinks == NULL)
+        goto failed;
+
+    for (Entry = VolumeListHead.Flink; Entry != &VolumeListHead; Entry = Entry->Flink)
+    {
+        VolumeEntry = CONTAINING_RECORD(Entry, VOLENTRY, ListEntry);
+        if (VolumeEntry->pExtents == NULL)
+            continue;
+
+        for (i = 0; i < VolumeEntry->pExtents->NumberOfDiskExtents; i++)
+        {
+            Extent = &VolumeEntry->pExtents->Extents[i];
+
+            /* Extents on devices that are not in the disk list, e.g. a loop device */
+            Disk = FindDiskPartitions(Disks, DiskCount, Extent->DiskNumber);
+            if (Disk == NULL)
+                continue;
+
+            DiskLinks[LinkCount].DiskNumber = Extent->DiskNumber;
+            DiskLinks[LinkCount].VolumeNumber = VolumeEntry->VolumeNumber;
+            DiskLinks[LinkCount].PartitionOffset = VOLUME_LINK_NO_PARTITION;
+            DiskLinks[LinkCount].DiskEntry = Disk->DiskEntry;
+            DiskLinks[LinkCount].VolumeEntry = VolumeEntry;
+
+            LinkCount++;
+
+            /* Every partition holding a byte of the extent, not only its first */
+            BytesPerSector = Disk->DiskEntry->BytesPerSector;
+            End = Extent->StartingOffset + Extent->ExtentLength;
+            for (j = FindFirstPartitionEndingAfter(Disk, Extent->StartingOffset); j < Disk->Count; j++)
+            {
+                PartEntry = Disk->Partitions[j];
+                if (PartEntry->StartSector * BytesPerSector >= End)
+                    break;
+
+                if (PartitionLinkCount == PartitionAllocated)
+                {
+                    NewLinks = realloc(PartitionLinks, PartitionAllocated * 2 * sizeof(VOLUME_LINK));
+                    if (NewLinks == NULL)
+                        goto failed;
+
+                    PartitionLinks = NewLinks;
+                    PartitionAllocated *= 2;
+                }
+
+                PartitionLinks[PartitionLinkCount] = DiskLinks[LinkCount - 1];
+                PartitionLinks[PartitionLinkCount].PartitionOffset = PartEntry->StartSector * BytesPerSector;
+                PartitionLinkCount++;
+            }
+        }
+    }
+
+    free(Disks);
+    Disks = NULL;
+
+    PartitionLinkCount = SortUniqueLinks(PartitionLinks, PartitionLinkCount, CompareByPartition);
+    DiskLinkCount = SortUniqueLinks(DiskLinks, LinkCount, CompareByDisk);
+
+    VolumeLinks = malloc(DiskLinkCount * sizeof(VOLUME_LINK) + 1);
+    if (VolumeLinks == NULL)
+        goto failed;
+
+    memcpy(VolumeLinks, DiskLinks, DiskLinkCount * sizeof(VOLUME_LINK));
+    qsort(VolumeLinks, DiskLinkCount, sizeof(VOLUME_LINK), CompareByVolume);
+
+    return TRUE;
+
+failed:
+    free(Disks);
+    DestroyVolumeIndex();
+    return FALSE;
+}
+
+
+/*
+ * Drops the links of a volume that goes away. Linear, but only the deletion
+ * of a partition or a clean removes volumes between two rescans.
+ */
+void
+RemoveVolumeLinks(
+    PVOLENTRY VolumeEntry)
+{
+    PVOLUME_LINK Arrays[3] = { DiskLinks, VolumeLinks, PartitionLinks };
+    ULONG Counts[3] = { DiskLinkCount, DiskLinkCount, PartitionLinkCount };
+    ULONG i, j, Kept;
+
+    for (i = 0; i < 3; i++)
+    {
+        Kept = 0;
+        for (j = 0; j < Counts[i]; j++)
+        {
+            if (Arrays[i][j].VolumeEntry != VolumeEntry)
+                Arrays[i][Kept++] = Arrays[i][j];
+        }
+        Counts[i] = Kept;
+    }
+
+    DiskLinkCount = Counts[0];
+    PartitionLinkCount = Counts[2];
+}
+
+
+/*
+ * The run of links starting at the first one not ordered before Key,
+ * as long as Match holds.
+ */
+static
+ULONG
+FindLinks(
+    PVOLUME_LINK Links,
+    ULONG Count,
+    const VOLUME_LINK *Key,
+    int (*Compare)(const void *, const void *),
+    BOOL (*Match)(const VOLUME_LINK *, const VOLUME_LINK *),
+    PVOLUME_LINK *First)
+{
+    ULONG Low = 0, High = Count, Middle, End;
+
+    while (Low < High)
+    {
+        Middle = Low + (High - Low) / 2;
+        if (Compare(&Links[Middle], Key) < 0)
+            Low = Middle + 1;
+        else
+            High = Middle;
+    }
+
+    for (End = Low; End < Count && Match(&Links[End], Key); End++)
+        ;
+
+    *First = &Links[Low];
+    return End - Low;
+}
+
+
+static
+BOOL
+SameDisk(
+    const VOLUME_LINK *Link,
+    const VOLUME_LINK *Key)
+{
+    return Link->DiskNumber == Key->DiskNumber;
+}
+
+
+static
+BOOL
+SameVolume(
+    const VOLUME_LINK *Link,
+    const VOLUME_LINK *Key)
+{
+    return Link->VolumeNumber == Key->VolumeNumber;
+}
+
+
+static
+BOOL
+SamePartition(
+    const VOLUME_LINK *Link,
+    const VOLUME_LINK *Key)
+{
+    return Link->DiskNumber == Key->DiskNumber && Link->PartitionOffset == Key->PartitionOffset;
+}
+
+
+/* The volumes with an extent on the disk, by volume number */
+ULONG
+GetDiskVolumes(
+    PDISKENTRY DiskEntry,
+    PVOLUME_LINK *Links)
+{
+    VOLUME_LINK Key = { 0 };
+
+    Key.DiskNumber = DiskEntry->DiskNumber;
+
+    return FindLinks(DiskLinks, DiskLinkCount, &Key, CompareByDisk, SameDisk, Links);
+}
+
+
+/* The volumes with an extent in the partition, by volume number */
+ULONG
+GetPartitionVolumes(
+    PPARTENTRY PartEntry,
+    PVOLUME_LINK *Links)
+{
+    VOLUME_LINK Key = { 0 };
+
+    *Links = PartitionLinks;
+    if (!PartEntry->IsPartitioned)
+        return 0;
+
+    Key.DiskNumber = PartEntry->DiskEntry->DiskNumber;
+    Key.PartitionOffset = PartEntry->StartSector * PartEntry->DiskEntry->BytesPerSector;
+
+    return FindLinks(PartitionLinks, PartitionLinkCount, &Key, CompareByPartition, SamePartition, Links);
+}
+
+
+/* The disks under the extents of the volume, by disk number */
+ULONG
+GetVolumeDisks(
+    PVOLENTRY VolumeEntry,
+    PVOLUME_LINK *Links)
+{
+    VOLUME_LINK Key = { 0 };
+
+    Key.VolumeNumber = VolumeEntry->VolumeNumber;
+
+    return FindLinks(VolumeLinks, DiskLinkCount, &Key, CompareByVolume, SameVolume, Links);
+}